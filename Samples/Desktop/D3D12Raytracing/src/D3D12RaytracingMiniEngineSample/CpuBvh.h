@@ -0,0 +1,305 @@
+#pragma once
+
+#include <d3d12.h>
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "Utility.h"
+
+// Animated meshes (see UpdateAnimatedMeshes) refit their acceleration structures in place, instead of
+// rebuilding them every frame. Refitting keeps the tree topology, so its quality drops as the triangles
+// move away from where they were at build time. Once the SAH cost grows by more than
+// BVH_REBUILD_SAH_RATIO, the acceleration structures are rebuilt instead.
+#define BVH_REFIT 1
+#define BVH_REBUILD_SAH_RATIO 1.3f
+
+#define CPU_BVH_BINS 16
+#define CPU_BVH_MAX_LEAF_SIZE 4
+// cost of visiting a node, relative to testing a primitive
+#define CPU_BVH_TRAVERSAL_COST 1.0f
+
+// The DXR acceleration structures are opaque, so a CPU BVH over the same leaf boxes stands in for them
+// when estimating how much refitting has degraded the tree, and how much traversal work the beams do
+// (AnalyzeSuperTiles, AnalyzeMultiView, AnalyzeBeamAO). Binned SAH build, bottom-up refit.
+class CpuBvh
+{
+public:
+    typedef D3D12_RAYTRACING_AABB AABB;
+
+    void Build(const std::vector<AABB> &prims)
+    {
+        m_nodes.clear();
+        m_primIndices.resize(prims.size());
+        for (uint32_t i = 0; i < uint32_t(prims.size()); i++)
+            m_primIndices[i] = i;
+
+        if (prims.empty())
+            return;
+
+        std::vector<float> centroids(prims.size() * 3);
+        for (size_t i = 0; i < prims.size(); i++)
+        {
+            centroids[i * 3 + 0] = (prims[i].MinX + prims[i].MaxX) * .5f;
+            centroids[i * 3 + 1] = (prims[i].MinY + prims[i].MaxY) * .5f;
+            centroids[i * 3 + 2] = (prims[i].MinZ + prims[i].MaxZ) * .5f;
+        }
+
+        Node root = { EmptyBox(), 0, uint32_t(prims.size()) };
+        m_nodes.push_back(root);
+
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty())
+        {
+            uint32_t n = stack.back();
+            stack.pop_back();
+
+            uint32_t first = m_nodes[n].first;
+            uint32_t count = m_nodes[n].count;
+
+            AABB bounds = EmptyBox();
+            float centroidMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float centroidMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                uint32_t p = m_primIndices[i];
+                Grow(bounds, prims[p]);
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    centroidMin[axis] = std::min(centroidMin[axis], centroids[p * 3 + axis]);
+                    centroidMax[axis] = std::max(centroidMax[axis], centroids[p * 3 + axis]);
+                }
+            }
+            m_nodes[n].bounds = bounds;
+
+            if (count <= CPU_BVH_MAX_LEAF_SIZE)
+                continue;
+
+            int axis = 0;
+            for (int a = 1; a < 3; a++)
+            {
+                if (centroidMax[a] - centroidMin[a] > centroidMax[axis] - centroidMin[axis])
+                    axis = a;
+            }
+            float extent = centroidMax[axis] - centroidMin[axis];
+
+            uint32_t mid;
+            if (extent > 0.0f)
+            {
+                // bin the centroids, and sweep for the cheapest split between bins
+                uint32_t binCount[CPU_BVH_BINS] = {};
+                AABB binBounds[CPU_BVH_BINS];
+                for (int b = 0; b < CPU_BVH_BINS; b++)
+                    binBounds[b] = EmptyBox();
+
+                float binScale = CPU_BVH_BINS / extent;
+                auto binIndex = [&](uint32_t p)
+                {
+                    int b = int((centroids[p * 3 + axis] - centroidMin[axis]) * binScale);
+                    return std::min(b, CPU_BVH_BINS - 1);
+                };
+                for (uint32_t i = first; i < first + count; i++)
+                {
+                    uint32_t p = m_primIndices[i];
+                    int b = binIndex(p);
+                    binCount[b]++;
+                    Grow(binBounds[b], prims[p]);
+                }
+
+                float rightCost[CPU_BVH_BINS];
+                AABB rightBounds = EmptyBox();
+                uint32_t rightCount = 0;
+                for (int b = CPU_BVH_BINS - 1; b > 0; b--)
+                {
+                    Grow(rightBounds, binBounds[b]);
+                    rightCount += binCount[b];
+                    rightCost[b] = rightCount * SurfaceArea(rightBounds);
+                }
+
+                int bestSplit = 1;
+                float bestCost = FLT_MAX;
+                AABB leftBounds = EmptyBox();
+                uint32_t leftCount = 0;
+                for (int b = 1; b < CPU_BVH_BINS; b++)
+                {
+                    Grow(leftBounds, binBounds[b - 1]);
+                    leftCount += binCount[b - 1];
+                    float cost = leftCount * SurfaceArea(leftBounds) + rightCost[b];
+                    if (leftCount > 0 && leftCount < count && cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestSplit = b;
+                    }
+                }
+
+                uint32_t *split = std::partition(
+                    m_primIndices.data() + first, m_primIndices.data() + first + count,
+                    [&](uint32_t p) { return binIndex(p) < bestSplit; });
+                mid = uint32_t(split - m_primIndices.data()) - first;
+            }
+            else
+            {
+                // all of the centroids coincide
+                mid = count / 2;
+            }
+
+            if (mid == 0 || mid == count)
+                mid = count / 2;
+
+            uint32_t left = uint32_t(m_nodes.size());
+            Node leftNode = { EmptyBox(), first, mid };
+            Node rightNode = { EmptyBox(), first + mid, count - mid };
+            m_nodes.push_back(leftNode);
+            m_nodes.push_back(rightNode);
+
+            m_nodes[n].first = left;
+            m_nodes[n].count = 0;
+
+            stack.push_back(left);
+            stack.push_back(left + 1);
+        }
+    }
+
+    // Children always come after their parent, so a reverse walk visits them first.
+    void Refit(const std::vector<AABB> &prims)
+    {
+        ASSERT(prims.size() == m_primIndices.size(), "refit needs the primitives the BVH was built with");
+
+        for (size_t n = m_nodes.size(); n-- > 0;)
+        {
+            Node &node = m_nodes[n];
+            node.bounds = EmptyBox();
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                    Grow(node.bounds, prims[m_primIndices[i]]);
+            }
+            else
+            {
+                Grow(node.bounds, m_nodes[node.first].bounds);
+                Grow(node.bounds, m_nodes[node.first + 1].bounds);
+            }
+        }
+    }
+
+    // expected cost of a ray query, relative to testing a single primitive
+    float SahCost() const
+    {
+        if (m_nodes.empty())
+            return 0.0f;
+
+        double cost = 0.0;
+        for (const Node &node : m_nodes)
+        {
+            if (node.count > 0)
+                cost += node.count * SurfaceArea(node.bounds);
+            else
+                cost += CPU_BVH_TRAVERSAL_COST * SurfaceArea(node.bounds);
+        }
+
+        float rootArea = SurfaceArea(m_nodes[0].bounds);
+        return rootArea > 0.0f ? float(cost / rootArea) : 0.0f;
+    }
+
+    uint32_t NodeCount() const { return uint32_t(m_nodes.size()); }
+
+    // Any hit query (nothing shortens the ray), for estimating traversal work. Counts the nodes visited,
+    // and the primitive boxes the ray hits before tMax, and optionally appends their indices to hitPrims.
+    void RayQuery(const float origin[3], const float dir[3], const std::vector<AABB> &prims,
+        uint32_t &nodeVisits, uint32_t &primHits, std::vector<uint32_t> *hitPrims = nullptr,
+        float tMax = FLT_MAX) const
+    {
+        nodeVisits = 0;
+        primHits = 0;
+        if (m_nodes.empty())
+            return;
+
+        float invDir[3];
+        for (int axis = 0; axis < 3; axis++)
+            invDir[axis] = 1.0f / dir[axis];
+
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty())
+        {
+            const Node &node = m_nodes[stack.back()];
+            stack.pop_back();
+
+            nodeVisits++;
+            if (!RayHitsBox(origin, invDir, tMax, node.bounds))
+                continue;
+
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                {
+                    if (RayHitsBox(origin, invDir, tMax, prims[m_primIndices[i]]))
+                    {
+                        primHits++;
+                        if (hitPrims)
+                            hitPrims->push_back(m_primIndices[i]);
+                    }
+                }
+            }
+            else
+            {
+                stack.push_back(node.first);
+                stack.push_back(node.first + 1);
+            }
+        }
+    }
+
+private:
+    struct Node
+    {
+        AABB bounds;
+        uint32_t first; // leaf: first entry in m_primIndices, internal: left child (the right child follows)
+        uint32_t count; // leaf: primitive count, internal: 0
+    };
+
+    static AABB EmptyBox()
+    {
+        AABB box = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        return box;
+    }
+
+    static void Grow(AABB &box, const AABB &other)
+    {
+        box.MinX = std::min(box.MinX, other.MinX);
+        box.MinY = std::min(box.MinY, other.MinY);
+        box.MinZ = std::min(box.MinZ, other.MinZ);
+        box.MaxX = std::max(box.MaxX, other.MaxX);
+        box.MaxY = std::max(box.MaxY, other.MaxY);
+        box.MaxZ = std::max(box.MaxZ, other.MaxZ);
+    }
+
+    // slab test, for 0 <= t <= rayTMax
+    static bool RayHitsBox(const float origin[3], const float invDir[3], float rayTMax, const AABB &box)
+    {
+        const float boxMin[3] = { box.MinX, box.MinY, box.MinZ };
+        const float boxMax[3] = { box.MaxX, box.MaxY, box.MaxZ };
+
+        float tMin = 0.0f;
+        float tMax = rayTMax;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t0 = (boxMin[axis] - origin[axis]) * invDir[axis];
+            float t1 = (boxMax[axis] - origin[axis]) * invDir[axis];
+            tMin = std::max(tMin, std::min(t0, t1));
+            tMax = std::min(tMax, std::max(t0, t1));
+        }
+        return tMin <= tMax;
+    }
+
+    static float SurfaceArea(const AABB &box)
+    {
+        float dx = box.MaxX - box.MinX;
+        float dy = box.MaxY - box.MinY;
+        float dz = box.MaxZ - box.MinZ;
+        if (dx < 0.0f || dy < 0.0f || dz < 0.0f)
+            return 0.0f;
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_primIndices;
+};
@@ -38,17 +38,30 @@
 #include "ReadbackBuffer.h"
 
 #include <atlbase.h>
+#include <set>
 #include "DXSampleHelper.h"
+#include "CpuBvh.h"
 
 #include "CompiledShaders/ModelViewerVS.h"
 #include "CompiledShaders/ModelViewerPS.h"
+#include "CompiledShaders/BeamsBinScatter.h"
 #include "CompiledShaders/BeamsLib.h"
 #include "CompiledShaders/BeamsShade.h"
 #include "CompiledShaders/BeamsVis.h"
+#include "CompiledShaders/DynamicResolutionUpscale.h"
+#include "CompiledShaders/OpacityBake.h"
 #include "CompiledShaders/RaysLib.h"
+#include "CompiledShaders/TemporalResolve.h"
 
+#include "Shaders/BeamCoverage.h"
+#include "Shaders/OpacityMask.h"
 #include "Shaders/RayCommon.h"
+#include "Shaders/SamplePatterns.h"
 #include "Shaders/Shading.h"
+#include "Shaders/SortNetworks.h"
+
+// needs the opacity mask states
+#include "TileBinner.h"
 
 #include <ShellScalingAPI.h>
 #pragma comment(lib, "Shcore.lib")
@@ -59,7 +72,268 @@ using namespace GameCore;
 using namespace Math;
 using namespace Graphics;
 
+// -reports on the command line: the load time analyses and benchmarks (Analyze*, BenchmarkBvhRefit, ReportTileBinning,
+// the foveation sample counts), which otherwise slow down every start
+static bool s_loadTimeReports = false;
+
 BoolVar freezeCamera("Application/Raytracing/freezeCamera", false);
+#if BVH_REFIT
+BoolVar animateMeshes("Application/Raytracing/animateMeshes", false);
+NumVar animationAmplitude("Application/Raytracing/animationAmplitude", 40.0f, 0.0f, 400.0f, 10.0f);
+#endif
+#if SUPER_TILE
+BoolVar superTiles("Application/Raytracing/superTiles", true);
+#endif
+#if TILE_BINNING
+BoolVar cpuTileBinning("Application/Raytracing/cpuTileBinning", false);
+IntVar cpuTileBinningThreads("Application/Raytracing/cpuTileBinningThreads",
+    int(std::min(std::max(std::thread::hardware_concurrency(), 1u), uint32_t(TILE_SCHEDULER_MAX_THREADS))), 1, TILE_SCHEDULER_MAX_THREADS);
+// off: a static split of the tasks over the threads, in task order
+BoolVar cpuTileBinningStealing("Application/Raytracing/cpuTileBinningStealing", true);
+BoolVar cpuTileBinningPipelined("Application/Raytracing/cpuTileBinningPipelined", false);
+#endif
+#if MULTI_VIEW
+BoolVar multiView("Application/Raytracing/multiView", false);
+NumVar multiViewSeparation("Application/Raytracing/multiViewSeparation", 6.5f, 0.0f, MULTI_VIEW_MAX_SEPARATION, 0.5f);
+#endif
+#if FOVEATION
+IntVar foveaMaxLevel("Application/Raytracing/foveaMaxLevel", 0, 0, FOVEATION_MAX_LEVEL);
+NumVar foveaX("Application/Raytracing/foveaX", 0.5f, 0.0f, 1.0f, 0.05f);
+NumVar foveaY("Application/Raytracing/foveaY", 0.5f, 0.0f, 1.0f, 0.05f);
+NumVar foveaRadius("Application/Raytracing/foveaRadius", 0.15f, 0.0f, 2.0f, 0.05f);
+NumVar foveaFalloff("Application/Raytracing/foveaFalloff", 0.1f, 0.0f, 1.0f, 0.025f);
+
+static float4 FoveaParams()
+{
+    float4 fovea = { float(foveaX), float(foveaY), float(foveaRadius), float(foveaFalloff) };
+    return fovea;
+}
+#endif
+#if ADAPTIVE_SAMPLES
+BoolVar adaptiveSamples("Application/Raytracing/adaptiveSamples", false);
+BoolVar adaptiveSamplesValidate("Application/Raytracing/adaptiveSamplesValidate", false);
+#endif
+#if LENS_DISTORTION
+BoolVar lensDistortion("Application/Raytracing/lensDistortion", false);
+NumVar lensK1("Application/Raytracing/lensK1", 0.22f, LENS_DISTORTION_K1_MIN, LENS_DISTORTION_K1_MAX, 0.02f);
+NumVar lensK2("Application/Raytracing/lensK2", 0.24f, LENS_DISTORTION_K2_MIN, LENS_DISTORTION_K2_MAX, 0.01f);
+
+static float4 LensParams(float k1, float k2, float aspect)
+{
+    float4 lens = { k1, k2, aspect, 1.0f / (1.0f + aspect * aspect) };
+    return lens;
+}
+
+// Largest reach of a distorted tile footprint, over the coefficient ranges, for the AABB enlargement. In the aspect
+// corrected space where the distortion is radial, the footprint's extent along x is at most |dxu/dx| w + |dxu/dy| h,
+// with |dxu/dx| <= max(|g|, |g + 2 r2 g'|) and |dxu/dy| <= r2 |g'|. Those are linear in the coefficients, so the
+// corners of their ranges bound them.
+static void LensStretchBounds(float &stretch, float &shear)
+{
+    const float k1s[2] = { LENS_DISTORTION_K1_MIN, LENS_DISTORTION_K1_MAX };
+    const float k2s[2] = { LENS_DISTORTION_K2_MIN, LENS_DISTORTION_K2_MAX };
+    const int steps = 256;
+
+    float maxStretch = 1.0f;
+    float maxShear = 0.0f;
+    for (float k1 : k1s)
+    {
+        for (float k2 : k2s)
+        {
+            float4 lens = LensParams(k1, k2, 1.0f);
+            for (int i = 0; i <= steps; i++)
+            {
+                float r2 = float(i) / steps;
+                float g = LensScale(r2, lens);
+                float dg = LensScaleDerivative(r2, lens);
+                maxStretch = std::max(maxStretch, std::max(fabsf(g), fabsf(g + 2.0f * r2 * dg)));
+                maxShear = std::max(maxShear, r2 * fabsf(dg));
+            }
+        }
+    }
+
+    // margin for sampling r2
+    stretch = maxStretch * 1.01f - 1.0f;
+    shear = maxShear * 1.01f;
+}
+
+// Extent of the rectilinear view the distorted view looks through, relative to the undistorted one.
+static void LensViewExtent(const float4 &lens, float &extentX, float &extentY)
+{
+    const int steps = 128;
+
+    extentX = 0.0f;
+    extentY = 0.0f;
+    for (int j = 0; j <= steps; j++)
+    {
+        for (int i = 0; i <= steps; i++)
+        {
+            float x = float(i) / steps * 2.0f - 1.0f;
+            float y = float(j) / steps * 2.0f - 1.0f;
+            float g = LensScale(LensRadius2(x, y, lens), lens);
+            extentX = std::max(extentX, fabsf(x * g));
+            extentY = std::max(extentY, fabsf(y * g));
+        }
+    }
+}
+#endif
+
+// Random numbers for the load time reports: xorshift, with a fixed seed so the reports repeat from run to run.
+struct ReportRandom
+{
+    uint32_t state = 0x9e3779b9;
+
+    // uniform in [0, 1)
+    float operator()()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return float(state >> 8) / float(1 << 24);
+    }
+};
+
+#if TEMPORAL_SAMPLES
+BoolVar temporalSamples("Application/Raytracing/temporalSamples", false);
+IntVar temporalMaxHistory("Application/Raytracing/temporalMaxHistory", TEMPORAL_SAMPLES_MAX_HISTORY, 1, TEMPORAL_SAMPLES_MAX_HISTORY);
+NumVar temporalClipGamma("Application/Raytracing/temporalClipGamma", 1.5f, 0.5f, 4.0f, 0.25f);
+
+// CPU reference for TEMPORAL_SAMPLES: the coverage error of edges through a pixel, for a static view accumulated the
+// way TemporalResolve does (a running average, over up to TEMPORAL_SAMPLES_MAX_HISTORY frames), with the fixed
+// pattern against the rotating ones. Each pixel holds one or two random half-planes (an edge or a corner), and its
+// exact coverage comes from clipping the pixel square to them.
+static void AnalyzeTemporalSamples()
+{
+    const uint32_t pixelCount = 16384;
+    const uint32_t frameCounts[] = { 1, 2, 4, 8, 16, 32 };
+    const uint32_t maxFrames = 32;
+
+    ReportRandom random;
+
+    double squaredError[2][maxFrames] = {};
+    double squaredError16x = 0.0;
+    for (uint32_t pixel = 0; pixel < pixelCount; pixel++)
+    {
+        // half-planes a x + b y <= c, through the pixel
+        float planes[2][3];
+        uint32_t planeCount = pixel % 2 + 1;
+        for (uint32_t p = 0; p < planeCount; p++)
+        {
+            float angle = random() * 6.2831853f;
+            planes[p][0] = cosf(angle);
+            planes[p][1] = sinf(angle);
+            planes[p][2] = (random() - .5f) * (fabsf(planes[p][0]) + fabsf(planes[p][1]));
+        }
+        auto inside = [&](float2 s)
+        {
+            for (uint32_t p = 0; p < planeCount; p++)
+            {
+                if (planes[p][0] * s.x + planes[p][1] * s.y > planes[p][2])
+                    return false;
+            }
+            return true;
+        };
+
+        // clip the pixel square, then the shoelace formula
+        std::vector<float2> polygon = { { -.5f, -.5f }, { .5f, -.5f }, { .5f, .5f }, { -.5f, .5f } };
+        for (uint32_t p = 0; p < planeCount; p++)
+        {
+            std::vector<float2> clipped;
+            for (size_t i = 0; i < polygon.size(); i++)
+            {
+                float2 a = polygon[i];
+                float2 b = polygon[(i + 1) % polygon.size()];
+                float da = planes[p][0] * a.x + planes[p][1] * a.y - planes[p][2];
+                float db = planes[p][0] * b.x + planes[p][1] * b.y - planes[p][2];
+                if (da <= 0.0f)
+                    clipped.push_back(a);
+                if ((da < 0.0f) != (db < 0.0f) && da != db)
+                {
+                    float t = da / (da - db);
+                    clipped.push_back({ a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t });
+                }
+            }
+            polygon = clipped;
+        }
+        float coverage = 0.0f;
+        for (size_t i = 0; i < polygon.size(); i++)
+        {
+            float2 a = polygon[i];
+            float2 b = polygon[(i + 1) % polygon.size()];
+            coverage += a.x * b.y - b.x * a.y;
+        }
+        coverage = fabsf(coverage) * .5f;
+
+        for (uint32_t rotating = 0; rotating < 2; rotating++)
+        {
+            float accumulated = 0.0f;
+            for (uint32_t frame = 0; frame < maxFrames; frame++)
+            {
+                uint32_t pattern = rotating ? samplePatternOrder[frame % TEMPORAL_SAMPLE_PATTERNS] : 0;
+                uint32_t covered = 0;
+                for (uint32_t s = 0; s < AA_SAMPLES; s++)
+                    covered += inside(SamplePatternTransform(AA_SAMPLE_OFFSET_TABLE[s], pattern)) ? 1 : 0;
+
+                float count = float(std::min(frame + 1, uint32_t(TEMPORAL_SAMPLES_MAX_HISTORY)));
+                accumulated += (covered / float(AA_SAMPLES) - accumulated) / count;
+                squaredError[rotating][frame] += double(accumulated - coverage) * (accumulated - coverage);
+            }
+        }
+
+        uint32_t covered16x = 0;
+        for (uint32_t s = 0; s < 16; s++)
+            covered16x += inside(sampleOffset16x[s]) ? 1 : 0;
+        squaredError16x += double(covered16x / 16.0f - coverage) * (covered16x / 16.0f - coverage);
+    }
+
+    Utility::Printf("temporal samples: edge coverage rms error, %ux fixed / rotating, after frames", AA_SAMPLES);
+    for (uint32_t frames : frameCounts)
+    {
+        // distinct positions the rotating patterns have visited
+        std::set<std::pair<float, float>> positions;
+        for (uint32_t frame = 0; frame < frames; frame++)
+        {
+            for (uint32_t s = 0; s < AA_SAMPLES; s++)
+            {
+                float2 o = SamplePatternTransform(AA_SAMPLE_OFFSET_TABLE[s], samplePatternOrder[frame % TEMPORAL_SAMPLE_PATTERNS]);
+                positions.insert(std::make_pair(o.x, o.y));
+            }
+        }
+        Utility::Printf(" %u: %.4f / %.4f (%u positions),", frames,
+            sqrt(squaredError[0][frames - 1] / pixelCount), sqrt(squaredError[1][frames - 1] / pixelCount),
+            uint32_t(positions.size()));
+    }
+    Utility::Printf(" 16x fixed: %.4f\n", sqrt(squaredError16x / pixelCount));
+}
+#endif
+#if BEAM_AO
+BoolVar beamAO("Application/Raytracing/beamAO", false);
+#endif
+#if SHADE_CACHE
+BoolVar shadeCache("Application/Raytracing/shadeCache", false);
+IntVar shadeCacheMaxAge("Application/Raytracing/shadeCacheMaxAge", 8, 1, SHADE_CACHE_MAX_AGE);
+#endif
+#if BEAM_VALIDATION
+BoolVar validateBeams("Application/Raytracing/validateBeams", false);
+// -validatebeams on the command line, see DxrMsaaDemo::ValidateBeams
+static bool s_validateBeamsHeadless = false;
+#endif
+#if TILE_STATS
+BoolVar tileStats("Application/Raytracing/tileStats", false);
+
+// black, blue, cyan, green, yellow, red, over 0..1
+static void HeatmapColor(float value, float rgb[3])
+{
+    static const float stops[][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } };
+    const int lastStop = _countof(stops) - 1;
+
+    float x = min(max(value, 0.0f), 1.0f) * lastStop;
+    int i = min(int(x), lastStop - 1);
+    float f = x - i;
+    for (int c = 0; c < 3; c++)
+        rgb[c] = stops[i][c] + (stops[i + 1][c] - stops[i][c]) * f;
+}
+#endif
 namespace EngineProfiling
 {
     extern BoolVar DrawProfiler;
@@ -72,6 +346,12 @@ CComPtr<ID3D12Device5> g_pRaytracingDevice;
 
 ByteAddressBuffer          g_shadeConstantBuffer;
 ByteAddressBuffer          g_dynamicConstantBuffer;
+#if TEMPORAL_SAMPLES
+ByteAddressBuffer          g_temporalConstantBuffer;
+#endif
+#if DYNAMIC_RESOLUTION
+ByteAddressBuffer          g_dynamicResolutionConstantBuffer;
+#endif
 
 D3D12_GPU_DESCRIPTOR_HANDLE g_GpuSceneMaterialSrvs[27];
 D3D12_CPU_DESCRIPTOR_HANDLE g_SceneMeshInfo;
@@ -80,18 +360,158 @@ D3D12_CPU_DESCRIPTOR_HANDLE g_SceneIndices;
 D3D12_GPU_DESCRIPTOR_HANDLE g_OutputUAV;
 D3D12_GPU_DESCRIPTOR_HANDLE g_SceneSrvs;
 
-// we only need a single bottom-level BVH
-constexpr uint32_t bvhBottomCount = 1;
+// leaf AABBs per mesh
+static uint32_t aabbLeafCount(uint32_t triCount)
+{
+    return (triCount + TRIS_PER_AABB - 1) / TRIS_PER_AABB;
+}
+
+// shadow cluster AABBs per mesh, stored after the mesh's leaves
+static uint32_t aabbClusterCount(uint32_t leafCount)
+{
+#if SHADOW_CLUSTER_SIZE > 1
+    return (leafCount + SHADOW_CLUSTER_SIZE - 1) / SHADOW_CLUSTER_SIZE;
+#else
+    return 0;
+#endif
+}
+
+#if SORT_NETWORK
+// Checks the networks in SortNetworks.h against every 0/1 input, which is enough to show they sort any
+// input (the 0-1 principle), and reports their size against the bitonic sort.
+static void ValidateSortNetworks()
+{
+    for (uint32_t n = 2; n <= SORT_NETWORK_MAX; n++)
+    {
+        std::vector<uint32_t> network;
+        for (uint32_t c = 0; c < sortNetworkLength[n]; c++)
+        {
+            uint32_t ce = sortNetworkComparators[sortNetworkFirst[n] + c];
+            if (SORT_CE_B(ce) < n)
+                network.push_back(ce);
+        }
+
+        uint32_t wireDepth[SORT_NETWORK_MAX] = {};
+        uint32_t depth = 0;
+        for (uint32_t ce : network)
+        {
+            uint32_t d = std::max(wireDepth[SORT_CE_A(ce)], wireDepth[SORT_CE_B(ce)]) + 1;
+            wireDepth[SORT_CE_A(ce)] = d;
+            wireDepth[SORT_CE_B(ce)] = d;
+            depth = std::max(depth, d);
+        }
+
+        // bit i holds key i
+        uint32_t failures = 0;
+        for (uint32_t input = 0; input < (1u << n); input++)
+        {
+            uint32_t keys = input;
+            for (uint32_t ce : network)
+            {
+                uint32_t a = SORT_CE_A(ce);
+                uint32_t b = SORT_CE_B(ce);
+                if (((keys >> a) & 1) > ((keys >> b) & 1))
+                    keys ^= (1u << a) | (1u << b);
+            }
+
+            // sorted means all of the zeros, then all of the ones
+            uint32_t ones = 0;
+            for (uint32_t i = 0; i < n; i++)
+                ones += (input >> i) & 1;
+            uint32_t expected = ((1u << n) - 1) & ~((1u << (n - ones)) - 1);
+            if (keys != expected)
+                failures++;
+        }
+
+        uint32_t bitonicLog2 = 0;
+        while ((1u << bitonicLog2) < n)
+            bitonicLog2++;
+        uint32_t bitonicComparators = (1u << bitonicLog2) / 2 * bitonicLog2 * (bitonicLog2 + 1) / 2;
+
+        Utility::Printf("sort network, %u keys: %u comparators, depth %u (bitonic %u)%s\n",
+            n, uint32_t(network.size()), depth, bitonicComparators, failures ? ", FAILED" : "");
+        ASSERT(failures == 0, "sorting network doesn't sort");
+    }
+}
+#endif
 
 struct BVH
 {
     CComPtr<ID3D12Resource> top;
-    CComPtr<ID3D12Resource> bottom;
+    // SCENE_INSTANCES instances per bottom-level BVH, with InstanceMask = 1 << index
+    std::vector<CComPtr<ID3D12Resource>> bottom;
+
+    // build inputs, kept for refits (BVH_REFIT)
+    std::vector<std::vector<D3D12_RAYTRACING_GEOMETRY_DESC>> geoDesc;
+    std::vector<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC> bottomDesc;
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topDesc;
+    ByteAddressBuffer instanceData;
+    ByteAddressBuffer scratch;
+};
+
+// How createAABBs enlarges the AABBs, kept with them so that refits enlarge them the same way.
+struct AABBEnlargement
+{
+    float growRadius; // uniform, for orthographic beams of a bounded width
+#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+    float camPosX, camPosY, camPosZ;
+    float camRightX, camRightY, camRightZ;
+    float camUpX, camUpY, camUpZ;
+    float camForwardX, camForwardY, camForwardZ;
+    float camFoV;
+    float camAspect;
+    uint32_t tilesX, tilesY;
+# if LENS_DISTORTION
+    // how much further a tile's distorted footprint can reach, see LensStretchBounds
+    float lensStretch; // relative to the tile's own extent
+    float lensShear; // relative to the tile's extent along the other axis
+# endif
+#endif
 };
+
+#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+// the camera the beams are enlarged for, the FoV, aspect ratio and tile counts stay as they are
+static void SetEnlargementCamera(AABBEnlargement& enlargement, const Math::Camera& camera)
+{
+    enlargement.camPosX = camera.GetPosition().GetX();
+    enlargement.camPosY = camera.GetPosition().GetY();
+    enlargement.camPosZ = camera.GetPosition().GetZ();
+
+    enlargement.camRightX = camera.GetRightVec().GetX();
+    enlargement.camRightY = camera.GetRightVec().GetY();
+    enlargement.camRightZ = camera.GetRightVec().GetZ();
+
+    enlargement.camUpX = camera.GetUpVec().GetX();
+    enlargement.camUpY = camera.GetUpVec().GetY();
+    enlargement.camUpZ = camera.GetUpVec().GetZ();
+
+    enlargement.camForwardX = camera.GetForwardVec().GetX();
+    enlargement.camForwardY = camera.GetForwardVec().GetY();
+    enlargement.camForwardZ = camera.GetForwardVec().GetZ();
+}
+#endif
+
 BVH g_bvhTriangles;
 BVH g_bvhAABBs_primary;
+#if SUPER_TILE
+BVH g_bvhAABBs_superTile;
+#endif
+#if MULTI_VIEW
+BVH g_bvhAABBs_multiView;
+#endif
+#if LENS_DISTORTION
+BVH g_bvhAABBs_lens;
+#endif
+#if DYNAMIC_RESOLUTION
+BVH g_bvhAABBs_dynamicResolution;
+#endif
 #if SHADOW_MODE == SHADOW_MODE_BEAM
 BVH g_bvhAABBs_shadow;
+#elif SHADOW_MODE == SHADOW_MODE_HARD
+BVH g_bvhAABBs_sun;
+#endif
+#if BEAM_AO
+BVH g_bvhAABBs_ao;
 #endif
 
 CComPtr<ID3D12RootSignature> g_GlobalRaytracingRootSignature;
@@ -100,6 +520,22 @@ CComPtr<ID3D12RootSignature> g_LocalRaytracingRootSignature;
 RootSignature g_BeamPostRootSig;
 ComputePSO g_BeamVisPSO;
 ComputePSO g_BeamShadePSO;
+#if TILE_BINNING
+RootSignature g_BinScatterRootSig;
+ComputePSO g_BinScatterPSO;
+#endif
+
+RootSignature g_OpacityBakeRootSig;
+ComputePSO g_OpacityBakePSO;
+
+#if TEMPORAL_SAMPLES
+RootSignature g_TemporalResolveRootSig;
+ComputePSO g_TemporalResolvePSO;
+#endif
+#if DYNAMIC_RESOLUTION
+RootSignature g_DynamicResolutionUpscaleRootSig;
+ComputePSO g_DynamicResolutionUpscalePSO;
+#endif
 
 enum class RenderMode
 {
@@ -200,6 +636,32 @@ struct RaytracingDispatchRayInputs
 
 RaytracingDispatchRayInputs g_RaytracingInputs_Ray;
 RaytracingDispatchRayInputs g_RaytracingInputs_Beam;
+#if SUPER_TILE
+RaytracingDispatchRayInputs g_RaytracingInputs_BeamSuperTile;
+RaytracingDispatchRayInputs g_RaytracingInputs_BeamRefine;
+#endif
+#if MULTI_VIEW
+RaytracingDispatchRayInputs g_RaytracingInputs_BeamMultiView;
+#endif
+#if SHADOW_MODE == SHADOW_MODE_HARD
+RaytracingDispatchRayInputs g_RaytracingInputs_BeamSunShadow;
+#endif
+#if BEAM_AO
+RaytracingDispatchRayInputs g_RaytracingInputs_BeamAO;
+#endif
+#if DYNAMIC_RESOLUTION
+BoolVar dynamicResolution("Application/Raytracing/dynamicResolution", false);
+NumVar dynamicResolutionTargetMs("Application/Raytracing/dynamicResolutionTargetMs", 8.0f, 1.0f, 100.0f, 0.5f);
+// of the way to the fitted scale, per frame
+NumVar dynamicResolutionRate("Application/Raytracing/dynamicResolutionRate", 0.25f, 0.05f, 1.0f, 0.05f);
+// -dynamicresolutionpath on the command line, see DxrMsaaDemo::UpdateDynamicResolutionPath
+static bool s_dynamicResolutionPathHeadless = false;
+static const uint32_t c_pathSegmentFrames = 240;
+static const uint32_t c_pathWarmupFrames = 30;
+#endif
+#if BEAM_VALIDATION
+RaytracingDispatchRayInputs g_RaytracingInputs_ValidateBeams;
+#endif
 
 struct MaterialRootConstant
 {
@@ -221,33 +683,85 @@ public:
     virtual void RenderScene() override;
     virtual void RenderUI(class GraphicsContext&) override;
     virtual void Raytrace(class GraphicsContext&);
+#if BEAM_VALIDATION || DYNAMIC_RESOLUTION
+    virtual bool IsDone() override;
+#endif
 
     void SetCameraToPredefinedPosition(int cameraPosition);
 
 private:
 
-    void createAABBs(
+    float createAABBs(
         StructuredBuffer& aabbBuffer
         , StructuredBuffer* aabbPayloadBuffer
-#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
-        , float camPosX, float camPosY, float camPosZ
-        , float camRightX, float camRightY, float camRightZ
-        , float camUpX, float camUpY, float camUpZ
-        , float camForwardX, float camForwardY, float camForwardZ
-        , float camFoV
-        , float camAspect
-        , uint32_t tilesX, uint32_t tilesY
-#endif
+        , bool shadowClusters
+        , const AABBEnlargement& enlargement
+        , CommandContext* refitContext = nullptr
+        , std::vector<D3D12_RAYTRACING_AABB>* cpuAABBs = nullptr
+        , std::vector<ShadowAABBPayload>* cpuPayload = nullptr
+        , bool refitAllMeshes = false
     );
-    void createBvh(BVH &bvh, bool useAABBs, StructuredBuffer* aabbBuffer);
+    void createBvh(BVH &bvh, bool useAABBs, StructuredBuffer* aabbBuffers, uint32_t bottomCount, bool shadowClusters, bool allowUpdate);
+#if BVH_REFIT
+    void refitBvh(CommandContext& context, BVH &bvh, bool rebuild);
+    void fitLeafAABBs(uint32_t meshIndex, const uint8_t *positions, uint32_t stride, std::vector<D3D12_RAYTRACING_AABB> &aabbs);
+    void UpdateAnimatedMeshes(CommandContext& context);
+    void BenchmarkBvhRefit();
+#endif
+#if SUPER_TILE || MULTI_VIEW
+    Vector3 CameraTileRayDir(float tileX, float tileY);
+    void TraceCameraRay(const CpuBvh &bvh, const std::vector<D3D12_RAYTRACING_AABB> &aabbs, const Vector3 &origin, const Vector3 &dir,
+        uint32_t &nodeVisits, uint32_t &leafHits, std::vector<uint32_t> *hits = nullptr);
+#endif
+#if SUPER_TILE
+    void AnalyzeSuperTiles(const std::vector<D3D12_RAYTRACING_AABB> &tileAABBs, const std::vector<D3D12_RAYTRACING_AABB> &superTileAABBs);
+#endif
+#if MULTI_VIEW
+    void AnalyzeMultiView(const std::vector<D3D12_RAYTRACING_AABB> &tileAABBs);
+#endif
+#if LENS_DISTORTION
+    void AnalyzeLensDistortion();
+#endif
+#if SHADOW_MODE == SHADOW_MODE_BEAM && SHADOW_CLUSTER_SIZE > 1
+    void AnalyzeShadowClusters(const std::vector<D3D12_RAYTRACING_AABB> *partitionAABBs, const std::vector<ShadowAABBPayload> &payload);
+#endif
+#if BEAM_AO
+    void AnalyzeBeamAO(const std::vector<D3D12_RAYTRACING_AABB> &aoAABBs, const std::vector<ShadowAABBPayload> &aoPayload);
+#endif
+#if TILE_BINNING
+    void writeBinnerTriangles(uint32_t meshIndex);
+    void BinTiles(const Math::Camera& camera, float jitterNormalizedX, float jitterNormalizedY);
+    void ReportTileBinning();
+#endif
 
     void InitializeSceneInfo();
+    void writePositionStream(uint32_t meshIndex);
     void InitializeRaytracingStateObjects();
     void InitializeViews();
+    void BakeOpacityMasks();
 
     void RenderObjects( GraphicsContext& Context, const Matrix4& ViewProjMat);
     void RaytraceDiffuse(GraphicsContext& context, const Math::Camera& camera, ColorBuffer& colorTarget);
     void RaytraceDiffuseBeams(GraphicsContext& context, const Math::Camera& camera, ColorBuffer& colorTarget);
+    const char *TileBeamsOnlyReason();
+    void BeamsFrontEnd(bool &useCpuTileBinning, bool &useMultiView, bool &useSuperTiles);
+#if TEMPORAL_SAMPLES
+    void TemporalResolve(GraphicsContext& context, const Math::Camera& camera, ColorBuffer& colorTarget);
+#endif
+#if BEAM_VALIDATION || DYNAMIC_RESOLUTION
+    void RetargetBeamAABBs(const Math::Camera& camera);
+#endif
+#if BEAM_VALIDATION
+    void ValidateBeams();
+#endif
+#if TILE_STATS
+    void ExportTileStats(uint64_t frame, uint32_t tilesX, uint32_t tilesY, const TileStats *stats);
+#endif
+#if DYNAMIC_RESOLUTION
+    void UpdateDynamicResolution();
+    void UpscaleDynamicResolution(GraphicsContext& context, ColorBuffer& colorTarget);
+    void UpdateDynamicResolutionPath();
+#endif
 
     Camera m_Camera;
     std::auto_ptr<CameraController> m_CameraController;
@@ -261,23 +775,171 @@ private:
     D3D12_CPU_DESCRIPTOR_HANDLE m_DefaultSampler;
 
     Model m_Model;
+    // per mesh, first entry in m_opacityMasks or OPACITY_MASK_NONE
+    std::vector<uint32_t> m_opacityMaskOffset;
+    StructuredBuffer m_opacityMasks;
+    std::vector<uint32_t> m_opacityMasks_cpu;
+    std::vector<RayTraceMeshInfo> m_meshInfo;
+    // de-indexed positions, see POSITION_STREAM
+    std::vector<uint32_t> m_positionStream_cpu;
+    ByteAddressBuffer m_positionStream;
+    // object to world, SCENE_INSTANCES of them
+    std::vector<InstanceTransform> m_instanceTransforms;
+    StructuredBuffer m_instanceTransformBuffer;
     StructuredBuffer m_ModelAABBs_primary;
+    AABBEnlargement m_ModelAABBs_primaryEnlargement;
+#if SUPER_TILE
+    StructuredBuffer m_ModelAABBs_superTile;
+    AABBEnlargement m_ModelAABBs_superTileEnlargement;
+#endif
+#if MULTI_VIEW
+    StructuredBuffer m_ModelAABBs_multiView;
+    AABBEnlargement m_ModelAABBs_multiViewEnlargement;
+#endif
+#if LENS_DISTORTION
+    StructuredBuffer m_ModelAABBs_lens;
+    AABBEnlargement m_ModelAABBs_lensEnlargement;
+#endif
+#if DYNAMIC_RESOLUTION
+    StructuredBuffer m_ModelAABBs_dynamicResolution;
+    AABBEnlargement m_ModelAABBs_dynamicResolutionEnlargement;
+#endif
 #if SHADOW_MODE == SHADOW_MODE_BEAM
-    StructuredBuffer m_ModelAABBs_shadow;
+    StructuredBuffer m_ModelAABBs_shadow[SHADOW_PARTITIONS];
+    AABBEnlargement m_ModelAABBs_shadowEnlargement[SHADOW_PARTITIONS];
     StructuredBuffer m_ModelAABBs_shadow_payload;
+    float m_shadowPartitionInflation[SHADOW_PARTITIONS];
+    float2 m_shadowPartitionOrigin;
+    float2 m_shadowPartitionScale;
+#elif SHADOW_MODE == SHADOW_MODE_HARD
+    StructuredBuffer m_ModelAABBs_sun;
+    AABBEnlargement m_ModelAABBs_sunEnlargement;
+#endif
+#if BEAM_AO
+    StructuredBuffer m_ModelAABBs_ao;
+    AABBEnlargement m_ModelAABBs_aoEnlargement;
+#endif
+
+    // per mesh, deformed every frame by UpdateAnimatedMeshes with BVH_REFIT (the fabric and curtain materials)
+    std::vector<bool> m_meshAnimated;
+#if BVH_REFIT
+    std::vector<uint32_t> m_animatedMeshes;
+    // rest pose positions of the animated meshes' vertices, in m_animatedMeshes order
+    std::vector<std::vector<float>> m_animatedRestPositions;
+    // mirrors the refits of the acceleration structures, per animated mesh
+    std::vector<CpuBvh> m_animatedBvh;
+    std::vector<float> m_animatedBvhBuildSah;
+    float m_animationTime;
+    float m_bvhSahRatio;
+    uint32_t m_bvhRefitCount;
+    uint32_t m_bvhRebuildCount;
 #endif
 
     uint32_t m_tilesX;
     uint32_t m_tilesY;
+    // the grid the beams render this frame, the full m_tilesX x m_tilesY unless scaled by DYNAMIC_RESOLUTION
+    uint32_t m_renderTilesX;
+    uint32_t m_renderTilesY;
     StructuredBuffer m_tileTriCounts;
     StructuredBuffer m_tileTris;
     StructuredBuffer m_tileShadeQuads;
     StructuredBuffer m_tileShadeQuadsCount;
     StructuredBuffer m_counters;
+    StructuredBuffer m_tileBounds;
+#if SUPER_TILE
+    uint32_t m_superTilesX;
+    uint32_t m_superTilesY;
+#endif
+    // candidate lists, see SUPER_TILE
+    StructuredBuffer m_superTileTriCounts;
+    StructuredBuffer m_superTileTris;
+    // nearest sample per pixel, still part of the UAV table without TEMPORAL_SAMPLES
+    ColorBuffer m_screenDepth;
+    // see SHADE_CACHE, a single entry without it
+    StructuredBuffer m_shadeCache;
+    // see TILE_DEPTH_RECORD, still part of the UAV table without it
+    StructuredBuffer m_tileDepthRecords;
+    // see BEAM_VALIDATION, a single entry without it
+    StructuredBuffer m_beamValidationMisses;
+#if BEAM_VALIDATION
+    bool m_validateBeamsPass; // RaytraceDiffuseBeams runs RayGenValidateBeams, for ValidateBeams
+    bool m_validateBeamsDone; // the -validatebeams run has reported
+    ReadbackBuffer m_beamValidationCountersReadback;
+    ReadbackBuffer m_beamValidationMissesReadback;
+#endif
+    // see TILE_STATS, a single entry without it
+    StructuredBuffer m_tileStats;
+#if SHADE_CACHE
+    // cleared when switched on, or when the sun changes
+    bool m_shadeCacheValid;
+    Vector3 m_shadeCacheSunDirection;
+    float m_shadeCacheSunIntensity;
+    // since the last clear, for the hit rate over camera movement
+    uint64_t m_shadeCacheLookupsTotal;
+    uint64_t m_shadeCacheHitsTotal;
+#endif
+#if TEMPORAL_SAMPLES
+    // copy of the frame's color, for TemporalResolve to read while it writes the resolved one
+    ColorBuffer m_temporalColor;
+    // ping-ponged by frame, rgb: color, a: frames accumulated
+    ColorBuffer m_temporalHistory[2];
+    // per history parity, the SRVs (color, depth, previous history) and the UAVs (scene color, next history)
+    D3D12_GPU_DESCRIPTOR_HANDLE m_temporalSrvs[2];
+    D3D12_GPU_DESCRIPTOR_HANDLE m_temporalUavs[2];
+    Matrix4 m_temporalPrevViewProj;
+    bool m_temporalHistoryValid;
+#endif
+#if TILE_BINNING
+    // every instance's triangles in world space, indexed like PRIM_ID_GLOBAL
+    TileBinner m_tileBinner;
+    TileBinner::Stats m_tileBinnerStats;
+    // packed tile lists, see TileBinner::Bin
+    std::vector<uint32_t> m_binnedTris_cpu;
+    ByteAddressBuffer m_binnedTris;
+#endif
 
     enum { countersReadbackCount = 4 };
     ReadbackBuffer m_countersReadback[countersReadbackCount];
     uint64_t m_frameIndex;
+#if TILE_STATS
+    // alongside m_countersReadback, with the frame each holds (~0 for none)
+    ReadbackBuffer m_tileStatsReadback[countersReadbackCount];
+    uint64_t m_tileStatsFrame[countersReadbackCount];
+    // the tile grid each was recorded at
+    uint32_t m_tileStatsTilesX[countersReadbackCount];
+    uint32_t m_tileStatsTilesY[countersReadbackCount];
+#endif
+#if DYNAMIC_RESOLUTION
+    // the beams' GPU time, as a pair of timestamps per m_countersReadback slot
+    CComPtr<ID3D12QueryHeap> m_beamsTimestampHeap;
+    ReadbackBuffer m_beamsTimeReadback[countersReadbackCount];
+    uint64_t m_beamsTimeFrame[countersReadbackCount]; // ~0 for none
+    uint32_t m_beamsTimeTiles[countersReadbackCount]; // tiles rendered
+    uint64_t m_timestampFrequency;
+    float m_beamsMs; // the latest read back
+    float m_dynamicResolutionScale; // per axis, of the full tile grid
+    uint32_t m_minRenderTilesX; // the grid at DYNAMIC_RESOLUTION_MIN_SCALE
+    uint32_t m_minRenderTilesY;
+    // copies of the frame's color and depth, for DynamicResolutionUpscale to read while it writes them
+    ColorBuffer m_upscaleColor;
+    ColorBuffer m_upscaleDepth;
+    D3D12_GPU_DESCRIPTOR_HANDLE m_upscaleSrvs;
+    D3D12_GPU_DESCRIPTOR_HANDLE m_upscaleUavs;
+    // the -dynamicresolutionpath run
+    uint32_t m_pathFrame;
+    uint64_t m_pathStartFrame; // m_frameIndex of the path's first frame
+    bool m_pathDone;
+    Math::Camera m_pathLoadCamera; // the camera the beams' AABBs were enlarged for at load time
+    uint32_t m_pathSamples;
+    uint32_t m_pathWithinTolerance; // within 10% of the target
+    uint32_t m_pathOverTarget;
+    double m_pathMsSum;
+    double m_pathSquaredErrorSum;
+    double m_pathScaleSum;
+    float m_pathMsMax;
+    float m_pathScaleMin;
+    float m_pathScaleMax;
+#endif
 
     DepthBuffer g_SceneDepthBufferMsaa;
     ColorBuffer g_SceneColorBufferMsaa;
@@ -347,6 +1009,26 @@ int wmain(int argc, wchar_t** argv)
         pAdapter = nullptr;
     }
 
+    for (int i = 1; i < argc; i++)
+    {
+        if (_wcsicmp(argv[i], L"-reports") == 0)
+            s_loadTimeReports = true;
+    }
+#if BEAM_VALIDATION
+    for (int i = 1; i < argc; i++)
+    {
+        if (_wcsicmp(argv[i], L"-validatebeams") == 0)
+            s_validateBeamsHeadless = true;
+    }
+#endif
+#if DYNAMIC_RESOLUTION
+    for (int i = 1; i < argc; i++)
+    {
+        if (_wcsicmp(argv[i], L"-dynamicresolutionpath") == 0)
+            s_dynamicResolutionPathHeadless = true;
+    }
+#endif
+
     s_EnableVSync.Decrement();
     TargetResolution = k1080p;
     g_DisplayWidth = 1920;
@@ -438,7 +1120,14 @@ void DxrMsaaDemo::InitializeSceneInfo()
     //
     // Mesh info
     //
-    std::vector<RayTraceMeshInfo>   meshInfoData(m_Model.m_Header.meshCount);
+    std::vector<RayTraceMeshInfo>   &meshInfoData = m_meshInfo;
+    meshInfoData.resize(m_Model.m_Header.meshCount);
+    uint32_t shadowAABBOffset = 0;
+    uint32_t opacityMaskCount = 0;
+    uint32_t triOffset = 0;
+    uint32_t maxMeshTriCount = 0;
+    m_opacityMaskOffset.resize(m_Model.m_Header.meshCount);
+    m_meshAnimated.resize(m_Model.m_Header.meshCount);
     for (UINT i=0; i < m_Model.m_Header.meshCount; ++i)
     {
         meshInfoData[i].triCount = m_Model.m_pMesh[i].indexCount / 3;
@@ -451,8 +1140,88 @@ void DxrMsaaDemo::InitializeSceneInfo()
         meshInfoData[i].attrStride = m_Model.m_pMesh[i].vertexStride;
         meshInfoData[i].materialID = m_Model.m_pMesh[i].materialIndex;
         ASSERT(meshInfoData[i].materialID < 27);
+
+        meshInfoData[i].triOffset = triOffset;
+        triOffset += meshInfoData[i].triCount;
+
+        const Model::BoundingBox &bounds = m_Model.m_pMesh[i].boundingBox;
+        meshInfoData[i].posQuantMin = float3(bounds.min);
+        meshInfoData[i].posQuantScale = float3((bounds.max - bounds.min) * (1.0f / 65535));
+        maxMeshTriCount = max(maxMeshTriCount, meshInfoData[i].triCount);
+
+        // must match the layout written by createAABBs
+        uint32_t leafCount = aabbLeafCount(meshInfoData[i].triCount);
+        meshInfoData[i].shadowAABBOffset = shadowAABBOffset;
+        shadowAABBOffset += leafCount + aabbClusterCount(leafCount);
+
+        // same alpha tested materials as MiniEngine's cutout pass
+        std::string diffusePath = m_Model.m_pMaterial[meshInfoData[i].materialID].texDiffusePath;
+        bool cutout =
+            diffusePath.find("thorn") != std::string::npos ||
+            diffusePath.find("plant") != std::string::npos ||
+            diffusePath.find("chain") != std::string::npos;
+        // the hanging cloth sways, see UpdateAnimatedMeshes
+        m_meshAnimated[i] =
+            diffusePath.find("fabric") != std::string::npos ||
+            diffusePath.find("curtain") != std::string::npos;
+        meshInfoData[i].animated = m_meshAnimated[i] ? 1 : 0;
+        m_opacityMaskOffset[i] = cutout ? opacityMaskCount : OPACITY_MASK_NONE;
+        meshInfoData[i].opacityMaskOffset = m_opacityMaskOffset[i];
+        if (cutout)
+            opacityMaskCount += meshInfoData[i].triCount;
+    }
+
+    // The encoded primitive IDs live in the tile triangle lists and shade quads, and must stay below BAD_TRI_ID.
+#if PRIM_ID_GLOBAL
+    ASSERT(uint64_t(triOffset) * SCENE_INSTANCES < BAD_TRI_ID, "too many triangles for the global primitive ID encoding");
+#else
+    if (maxMeshTriCount > (1u << PRIM_ID_BITS))
+        Utility::Printf("primitive IDs: a mesh has %u triangles, over 2^PRIM_ID_BITS, set PRIM_ID_GLOBAL to 1\n", maxMeshTriCount);
+    ASSERT(maxMeshTriCount <= (1u << PRIM_ID_BITS), "mesh has too many triangles for PRIM_ID_BITS");
+    ASSERT((uint64_t(m_Model.m_Header.meshCount - 1) << PRIM_ID_BITS) + PRIM_ID_MASK < BAD_TRI_ID,
+        "too many meshes for PRIM_ID_BITS");
+#endif
+    // Both encodings are 32 bits, so the tile lists and shade quads are the same size. The global encoding
+    // trades the mesh ID bits for a binary search over the mesh prefix sums on every decode.
+    uint32_t decodeSteps = 0;
+    while ((1u << decodeSteps) < m_Model.m_Header.meshCount)
+        decodeSteps++;
+    Utility::Printf("primitive IDs: %s, %u meshes, %u triangles (largest mesh %u), %u mesh info loads per decode\n",
+        PRIM_ID_GLOBAL ? "global triangle index" : "mesh + triangle bits",
+        m_Model.m_Header.meshCount, triOffset, maxMeshTriCount,
+        PRIM_ID_GLOBAL ? decodeSteps + 1 : 0);
+
+    // Instances are laid out edge to edge, so they don't overlap. They only translate, see SCENE_INSTANCES.
+    Vector3 modelSize = m_Model.m_Header.boundingBox.max - m_Model.m_Header.boundingBox.min;
+    m_instanceTransforms.resize(SCENE_INSTANCES);
+    for (uint32_t i = 0; i < SCENE_INSTANCES; i++)
+    {
+        InstanceTransform &xf = m_instanceTransforms[i];
+        xf.row0 = { 1.0f, 0.0f, 0.0f, float(i % SCENE_INSTANCES_X) * modelSize.GetX() };
+        xf.row1 = { 0.0f, 1.0f, 0.0f, 0.0f };
+        xf.row2 = { 0.0f, 0.0f, 1.0f, float(i / SCENE_INSTANCES_X) * modelSize.GetZ() };
+    }
+    m_instanceTransformBuffer.Create(L"m_instanceTransformBuffer",
+        SCENE_INSTANCES, sizeof(InstanceTransform), m_instanceTransforms.data());
+
+    // de-indexed triangle positions for the visibility passes
+    {
+        uint32_t blockCount = (triOffset + POSITION_STREAM_BLOCK - 1) / POSITION_STREAM_BLOCK;
+        m_positionStream_cpu.assign(blockCount * POSITION_STREAM_BLOCK * POSITION_STREAM_DWORDS, 0);
+        for (uint32_t m = 0; m < m_Model.m_Header.meshCount; m++)
+            writePositionStream(m);
+        m_positionStream.Create(L"m_positionStream", uint32_t(m_positionStream_cpu.size()), sizeof(uint32_t), m_positionStream_cpu.data());
+
+        Utility::Printf("position stream: %.1f MB (%s), %u bytes per triangle fetch, %u through the index buffer\n",
+            m_positionStream_cpu.size() * sizeof(uint32_t) / (1024.0f * 1024.0f),
+            POSITION_STREAM_QUANTIZED ? "16-bit" : "float",
+            TRI_FETCH_BYTES_STREAM, TRI_FETCH_BYTES_INDEXED);
     }
 
+    // keep the buffer (and its descriptor) valid even if nothing is alpha tested
+    m_opacityMasks.Create(L"m_opacityMasks", max(opacityMaskCount, 1u), sizeof(uint32_t), nullptr);
+    m_opacityMasks_cpu.assign(opacityMaskCount, OPACITY_MASK_ALL_OPAQUE);
+
     g_hitShaderMeshInfoBuffer.Create(L"RayTraceMeshInfo",
         (UINT)meshInfoData.size(),
         sizeof(meshInfoData[0]),
@@ -462,6 +1231,50 @@ void DxrMsaaDemo::InitializeSceneInfo()
     g_SceneMeshInfo = g_hitShaderMeshInfoBuffer.GetSRV();
 }
 
+// Copies one mesh's triangles from the vertex data into m_positionStream_cpu, see POSITION_STREAM.
+void DxrMsaaDemo::writePositionStream(uint32_t meshIndex)
+{
+    const Model::Mesh &mesh = m_Model.m_pMesh[meshIndex];
+    const RayTraceMeshInfo &info = m_meshInfo[meshIndex];
+    const uint16_t *indexData = (const uint16_t*)(m_Model.m_pIndexData + mesh.indexDataByteOffset);
+    const uint8_t *positions = m_Model.m_pVertexData + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
+
+    for (uint32_t t = 0; t < info.triCount; t++)
+    {
+        uint32_t triIndex = info.triOffset + t;
+        uint32_t *block = &m_positionStream_cpu[triIndex / POSITION_STREAM_BLOCK * POSITION_STREAM_BLOCK * POSITION_STREAM_DWORDS];
+        uint32_t lane = triIndex % POSITION_STREAM_BLOCK;
+
+        uint32_t components[9];
+        for (uint32_t v = 0; v < 3; v++)
+        {
+            const float *p = (const float*)(positions + indexData[t * 3 + v] * mesh.vertexStride);
+#if POSITION_STREAM_QUANTIZED
+            // animated meshes can sway out of their rest bounds, those vertices get clamped
+            const float quantMin[3] = { info.posQuantMin.x, info.posQuantMin.y, info.posQuantMin.z };
+            const float quantScale[3] = { info.posQuantScale.x, info.posQuantScale.y, info.posQuantScale.z };
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                float q = quantScale[c] > 0.0f ? (p[c] - quantMin[c]) / quantScale[c] + .5f : 0.0f;
+                components[v * 3 + c] = uint32_t(std::min(std::max(q, 0.0f), 65535.0f));
+            }
+#else
+            memcpy(&components[v * 3], p, 3 * sizeof(float));
+#endif
+        }
+
+        for (uint32_t d = 0; d < POSITION_STREAM_DWORDS; d++)
+        {
+#if POSITION_STREAM_QUANTIZED
+            uint32_t dword = components[d * 2] | (d * 2 + 1 < 9 ? components[d * 2 + 1] << 16 : 0);
+#else
+            uint32_t dword = components[d];
+#endif
+            block[d * POSITION_STREAM_BLOCK + lane] = dword;
+        }
+    }
+}
+
 void DxrMsaaDemo::InitializeViews()
 {
     {
@@ -486,7 +1299,77 @@ void DxrMsaaDemo::InitializeViews()
 
         g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
         Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_counters.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_tileBounds.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_superTileTriCounts.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_superTileTris.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_screenDepth.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_shadeCache.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_tileDepthRecords.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_beamValidationMisses.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(uavHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, uavHandle, m_tileStats.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+    }
+
+#if TEMPORAL_SAMPLES
+    for (uint32_t parity = 0; parity < 2; parity++)
+    {
+        D3D12_CPU_DESCRIPTOR_HANDLE handle;
+        UINT descriptorIndex;
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, descriptorIndex);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, m_temporalColor.GetSRV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+        m_temporalSrvs[parity] = g_pRaytracingDescriptorHeap->GetGpuHandle(descriptorIndex);
+
+        UINT unused;
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, m_screenDepth.GetSRV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, m_temporalHistory[parity ^ 1].GetSRV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, descriptorIndex);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, g_SceneColorBuffer.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+        m_temporalUavs[parity] = g_pRaytracingDescriptorHeap->GetGpuHandle(descriptorIndex);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, m_temporalHistory[parity].GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+    }
+#endif
+
+#if DYNAMIC_RESOLUTION
+    {
+        D3D12_CPU_DESCRIPTOR_HANDLE handle;
+        UINT descriptorIndex;
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, descriptorIndex);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, m_upscaleColor.GetSRV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+        m_upscaleSrvs = g_pRaytracingDescriptorHeap->GetGpuHandle(descriptorIndex);
+
+        UINT unused;
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, m_upscaleDepth.GetSRV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, descriptorIndex);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, g_SceneColorBuffer.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+        m_upscaleUavs = g_pRaytracingDescriptorHeap->GetGpuHandle(descriptorIndex);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(handle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, handle, m_screenDepth.GetUAV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
     }
+#endif
 
     {
         D3D12_CPU_DESCRIPTOR_HANDLE srvHandle;
@@ -501,6 +1384,15 @@ void DxrMsaaDemo::InitializeViews()
 
         g_pRaytracingDescriptorHeap->AllocateBufferSrv(*const_cast<ID3D12Resource*>(m_Model.m_VertexBuffer.GetResource()));
 
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(srvHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, srvHandle, m_opacityMasks.GetSRV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(srvHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, srvHandle, m_instanceTransformBuffer.GetSRV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+        g_pRaytracingDescriptorHeap->AllocateDescriptor(srvHandle, unused);
+        Graphics::g_Device->CopyDescriptorsSimple(1, srvHandle, m_positionStream.GetSRV(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
         for (UINT i = 0; i < m_Model.m_Header.materialCount; i++)
         {
             UINT slot;
@@ -514,15 +1406,86 @@ void DxrMsaaDemo::InitializeViews()
     }
 }
 
-D3D12_STATE_SUBOBJECT CreateDxilLibrary(LPCWSTR entrypoint, const void *pShaderByteCode, SIZE_T bytecodeLength, D3D12_DXIL_LIBRARY_DESC &dxilLibDesc, D3D12_EXPORT_DESC &exportDesc)
+void DxrMsaaDemo::BakeOpacityMasks()
 {
-    exportDesc = { entrypoint, nullptr, D3D12_EXPORT_FLAG_NONE };
-    D3D12_STATE_SUBOBJECT dxilLibSubObject = {};
-    dxilLibDesc.DXILLibrary.pShaderBytecode = pShaderByteCode;
-    dxilLibDesc.DXILLibrary.BytecodeLength = bytecodeLength;
-    dxilLibDesc.NumExports = 1;
-    dxilLibDesc.pExports = &exportDesc;
-    dxilLibSubObject.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
+    if (m_opacityMasks_cpu.empty())
+        return;
+
+    SamplerDesc DefaultSamplerDesc;
+    DefaultSamplerDesc.MaxAnisotropy = 8;
+
+    g_OpacityBakeRootSig.Reset(4, 1);
+    g_OpacityBakeRootSig[0].InitAsConstants(3, 1);
+    g_OpacityBakeRootSig[1].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 3);
+    g_OpacityBakeRootSig[2].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 100, UINT_MAX);
+    g_OpacityBakeRootSig[3].InitAsBufferUAV(0);
+    g_OpacityBakeRootSig.InitStaticSampler(0, DefaultSamplerDesc);
+    g_OpacityBakeRootSig.Finalize(L"g_OpacityBakeRootSig");
+
+    g_OpacityBakePSO.SetRootSignature(g_OpacityBakeRootSig);
+    g_OpacityBakePSO.SetComputeShader(g_pOpacityBake, sizeof(g_pOpacityBake));
+    g_OpacityBakePSO.Finalize();
+
+    ReadbackBuffer readback;
+    readback.Create(L"Opacity Mask Readback", m_opacityMasks.GetElementCount(), sizeof(uint32_t));
+
+    ComputeContext& context = ComputeContext::Begin(L"Bake Opacity Masks");
+    context.TransitionResource(m_opacityMasks, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, true);
+
+    ID3D12GraphicsCommandList* pCommandList = context.GetCommandList();
+    ID3D12DescriptorHeap* pDescriptorHeaps[] = { &g_pRaytracingDescriptorHeap->GetDescriptorHeap() };
+    pCommandList->SetDescriptorHeaps(_countof(pDescriptorHeaps), pDescriptorHeaps);
+
+    pCommandList->SetComputeRootSignature(g_OpacityBakeRootSig.GetSignature());
+    pCommandList->SetComputeRootDescriptorTable(1, g_SceneSrvs);
+    pCommandList->SetComputeRootDescriptorTable(2, g_GpuSceneMaterialSrvs[0]);
+    pCommandList->SetComputeRootUnorderedAccessView(3, m_opacityMasks.GetGpuVirtualAddress());
+    pCommandList->SetPipelineState(g_OpacityBakePSO.GetPipelineStateObject());
+
+    uint32_t cutoutMeshCount = 0;
+    for (uint32_t m = 0; m < m_Model.m_Header.meshCount; m++)
+    {
+        if (m_opacityMaskOffset[m] == OPACITY_MASK_NONE)
+            continue;
+
+        uint32_t triCount = m_Model.m_pMesh[m].indexCount / 3;
+        pCommandList->SetComputeRoot32BitConstant(0, m, 0);
+        pCommandList->Dispatch((triCount + 63) / 64, 1, 1);
+        cutoutMeshCount++;
+    }
+
+    context.CopyBuffer(readback, m_opacityMasks);
+    context.TransitionResource(m_opacityMasks, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, true);
+    context.Finish(true);
+
+    // the shadow AABB coverage masks are built on the CPU, and skip transparent micro-triangles
+    const uint32_t *masks = (const uint32_t*)readback.Map();
+    memcpy(m_opacityMasks_cpu.data(), masks, m_opacityMasks_cpu.size() * sizeof(uint32_t));
+    readback.Unmap();
+
+    uint32_t stateCounts[4] = {};
+    for (uint32_t mask : m_opacityMasks_cpu)
+    {
+        for (uint32_t microTri = 0; microTri < OPACITY_MICRO_TRIS; microTri++)
+            stateCounts[OpacityMaskState(mask, microTri)]++;
+    }
+    uint32_t microTriCount = uint32_t(m_opacityMasks_cpu.size()) * OPACITY_MICRO_TRIS;
+    Utility::Printf("opacity masks: %u meshes, %u tris, %.1f%% opaque, %.1f%% transparent, %.1f%% unknown\n",
+        cutoutMeshCount, uint32_t(m_opacityMasks_cpu.size()),
+        100.0f * stateCounts[OPACITY_STATE_OPAQUE] / microTriCount,
+        100.0f * stateCounts[OPACITY_STATE_TRANSPARENT] / microTriCount,
+        100.0f * stateCounts[OPACITY_STATE_UNKNOWN] / microTriCount);
+}
+
+D3D12_STATE_SUBOBJECT CreateDxilLibrary(LPCWSTR entrypoint, const void *pShaderByteCode, SIZE_T bytecodeLength, D3D12_DXIL_LIBRARY_DESC &dxilLibDesc, D3D12_EXPORT_DESC &exportDesc)
+{
+    exportDesc = { entrypoint, nullptr, D3D12_EXPORT_FLAG_NONE };
+    D3D12_STATE_SUBOBJECT dxilLibSubObject = {};
+    dxilLibDesc.DXILLibrary.pShaderBytecode = pShaderByteCode;
+    dxilLibDesc.DXILLibrary.BytecodeLength = bytecodeLength;
+    dxilLibDesc.NumExports = 1;
+    dxilLibDesc.pExports = &exportDesc;
+    dxilLibSubObject.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
     dxilLibSubObject.pDesc = &dxilLibDesc;
     return dxilLibSubObject;
 }
@@ -579,13 +1542,13 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
 
     D3D12_DESCRIPTOR_RANGE1 sceneBuffersDescriptorRange = {};
     sceneBuffersDescriptorRange.BaseShaderRegister = 1;
-    sceneBuffersDescriptorRange.NumDescriptors = 3;
+    sceneBuffersDescriptorRange.NumDescriptors = 6;
     sceneBuffersDescriptorRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
     sceneBuffersDescriptorRange.Flags = D3D12_DESCRIPTOR_RANGE_FLAG_NONE;
 
     D3D12_DESCRIPTOR_RANGE1 uavDescriptorRange = {};
     uavDescriptorRange.BaseShaderRegister = 2;
-    uavDescriptorRange.NumDescriptors = 6;
+    uavDescriptorRange.NumDescriptors = 14;
     uavDescriptorRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
     uavDescriptorRange.Flags = D3D12_DESCRIPTOR_RANGE_FLAG_NONE;
 
@@ -633,6 +1596,32 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
     exportName_HitGroup[HIT_GROUP_SHADOW] =     L"HitGroupShadow";
 
     LPCWSTR exportName_RayGen = L"RayGen";
+#if SUPER_TILE
+    LPCWSTR exportName_RayGenRefine = L"RayGenRefine";
+    LPCWSTR exportName_RayGenSuperTile = L"RayGenSuperTile";
+    LPCWSTR exportName_IntersectionSuperTile = L"IntersectionSuperTile";
+    LPCWSTR exportName_AnyHitSuperTile = L"AnyHitSuperTile";
+#endif
+#if MULTI_VIEW
+    LPCWSTR exportName_RayGenMultiView = L"RayGenMultiView";
+    LPCWSTR exportName_IntersectionMultiView = L"IntersectionMultiView";
+    LPCWSTR exportName_AnyHitMultiView = L"AnyHitMultiView";
+#endif
+#if SHADOW_MODE == SHADOW_MODE_HARD
+    LPCWSTR exportName_RayGenSunShadow = L"RayGenSunShadow";
+    LPCWSTR exportName_IntersectionSunShadow = L"IntersectionSunShadow";
+    LPCWSTR exportName_AnyHitSunShadow = L"AnyHitSunShadow";
+    LPCWSTR exportName_MissSunShadow = L"MissSunShadow";
+#endif
+#if BEAM_AO
+    LPCWSTR exportName_RayGenBeamAO = L"RayGenBeamAO";
+    LPCWSTR exportName_IntersectionBeamAO = L"IntersectionBeamAO";
+    LPCWSTR exportName_AnyHitBeamAO = L"AnyHitBeamAO";
+    LPCWSTR exportName_MissBeamAO = L"MissBeamAO";
+#endif
+#if BEAM_VALIDATION
+    LPCWSTR exportName_RayGenValidateBeams = L"RayGenValidateBeams";
+#endif
 
     LPCWSTR exportName_Intersection[HIT_GROUP_COUNT];
     exportName_Intersection[HIT_GROUP_PRIMARY] = L"IntersectionPrimary";
@@ -705,12 +1694,17 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
         {
             { exportName_RayGen,                            nullptr, D3D12_EXPORT_FLAG_NONE },
             { exportName_Hit[HIT_GROUP_PRIMARY],            nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_AnyHit[HIT_GROUP_PRIMARY],         nullptr, D3D12_EXPORT_FLAG_NONE },
             { exportName_Miss[HIT_GROUP_PRIMARY],           nullptr, D3D12_EXPORT_FLAG_NONE },
+#if BEAM_VALIDATION
+            { exportName_RayGenValidateBeams,               nullptr, D3D12_EXPORT_FLAG_NONE },
+#endif
 #if SHADOW_MODE == SHADOW_MODE_BEAM
             { exportName_Intersection[HIT_GROUP_SHADOW],    nullptr, D3D12_EXPORT_FLAG_NONE },
             { exportName_AnyHit[HIT_GROUP_SHADOW],          nullptr, D3D12_EXPORT_FLAG_NONE },
 #else
             { exportName_Hit[HIT_GROUP_SHADOW],             nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_AnyHit[HIT_GROUP_SHADOW],          nullptr, D3D12_EXPORT_FLAG_NONE },
 #endif
         };
         D3D12_DXIL_LIBRARY_DESC dxilLibDesc =
@@ -727,6 +1721,8 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
         hitGroupDesc[HIT_GROUP_PRIMARY].HitGroupExport = exportName_HitGroup[HIT_GROUP_PRIMARY];
         hitGroupDesc[HIT_GROUP_PRIMARY].Type = D3D12_HIT_GROUP_TYPE_TRIANGLES;
         hitGroupDesc[HIT_GROUP_PRIMARY].ClosestHitShaderImport = exportName_Hit[HIT_GROUP_PRIMARY];
+        // only runs for alpha tested (non-opaque) geometry
+        hitGroupDesc[HIT_GROUP_PRIMARY].AnyHitShaderImport = exportName_AnyHit[HIT_GROUP_PRIMARY];
 
 #if SHADOW_MODE == SHADOW_MODE_BEAM
         hitGroupDesc[HIT_GROUP_SHADOW].HitGroupExport = exportName_HitGroup[HIT_GROUP_SHADOW];
@@ -737,6 +1733,7 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
         hitGroupDesc[HIT_GROUP_SHADOW].HitGroupExport = exportName_HitGroup[HIT_GROUP_SHADOW];
         hitGroupDesc[HIT_GROUP_SHADOW].Type = D3D12_HIT_GROUP_TYPE_TRIANGLES;
         hitGroupDesc[HIT_GROUP_SHADOW].ClosestHitShaderImport = exportName_Hit[HIT_GROUP_SHADOW];
+        hitGroupDesc[HIT_GROUP_SHADOW].AnyHitShaderImport = exportName_AnyHit[HIT_GROUP_SHADOW];
 #endif
 
         D3D12_STATE_SUBOBJECT stateSubobjects[] =
@@ -782,8 +1779,27 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
             exportName_RayGen,
             missShaderSymbols, _countof(missShaderSymbols));
 
+        LPCWSTR stackRayGen = exportName_RayGen;
+#if BEAM_VALIDATION
+        // same state object and tables, different ray gen
+        g_RaytracingInputs_ValidateBeams = RaytracingDispatchRayInputs(
+            *g_pRaytracingDevice,
+            pDiffusePSO,
+            pHitShaderTable.data(),
+            shaderRecordSizeInBytes,
+            (UINT)pHitShaderTable.size(),
+            exportName_RayGenValidateBeams,
+            missShaderSymbols, _countof(missShaderSymbols));
+
+        // the ray gens share the state object's stack size, and RayGenValidateBeams keeps its list bits across TraceRay
+        CComPtr<ID3D12StateObjectProperties> stateObjectProperties;
+        ThrowIfFailed(pDiffusePSO->QueryInterface(IID_PPV_ARGS(&stateObjectProperties)));
+        if (stateObjectProperties->GetShaderStackSize(exportName_RayGenValidateBeams) > stateObjectProperties->GetShaderStackSize(exportName_RayGen))
+            stackRayGen = exportName_RayGenValidateBeams;
+#endif
+
         SetPipelineStateStackSize(
-            exportName_RayGen,
+            stackRayGen,
             hitShaderSymbols, _countof(hitShaderSymbols),
             missShaderSymbols, _countof(missShaderSymbols),
             pipelineConfig.MaxTraceRecursionDepth,
@@ -797,7 +1813,13 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
 
         D3D12_RAYTRACING_SHADER_CONFIG shaderConfig;
         shaderConfig.MaxAttributeSizeInBytes = sizeof(BeamHitAttribs);
+#if BEAM_AO
+        shaderConfig.MaxPayloadSizeInBytes = UINT(std::max(sizeof(BeamPayload), sizeof(BeamAOPayload)));
+#elif SHADOW_MODE == SHADOW_MODE_HARD
+        shaderConfig.MaxPayloadSizeInBytes = UINT(std::max(sizeof(BeamPayload), sizeof(SunShadowBeamPayload)));
+#else
         shaderConfig.MaxPayloadSizeInBytes = sizeof(BeamPayload);
+#endif
 
         D3D12_EXPORT_DESC exportDesc[] =
         {
@@ -805,6 +1827,21 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
             { exportName_Intersection[HIT_GROUP_PRIMARY],   nullptr, D3D12_EXPORT_FLAG_NONE },
             { exportName_AnyHit[HIT_GROUP_PRIMARY],         nullptr, D3D12_EXPORT_FLAG_NONE },
             { exportName_Miss[HIT_GROUP_PRIMARY],           nullptr, D3D12_EXPORT_FLAG_NONE },
+#if SUPER_TILE
+            { exportName_RayGenRefine,                      nullptr, D3D12_EXPORT_FLAG_NONE },
+#endif
+#if SHADOW_MODE == SHADOW_MODE_HARD
+            { exportName_RayGenSunShadow,                   nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_IntersectionSunShadow,             nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_AnyHitSunShadow,                   nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_MissSunShadow,                     nullptr, D3D12_EXPORT_FLAG_NONE },
+#endif
+#if BEAM_AO
+            { exportName_RayGenBeamAO,                      nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_IntersectionBeamAO,                nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_AnyHitBeamAO,                      nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_MissBeamAO,                        nullptr, D3D12_EXPORT_FLAG_NONE },
+#endif
         };
         D3D12_DXIL_LIBRARY_DESC dxilLibDesc =
         {
@@ -822,10 +1859,24 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
         hitGroupDesc[HIT_GROUP_PRIMARY].AnyHitShaderImport = exportName_AnyHit[HIT_GROUP_PRIMARY];
         hitGroupDesc[HIT_GROUP_PRIMARY].IntersectionShaderImport = exportName_Intersection[HIT_GROUP_PRIMARY];
 
+#if SHADOW_MODE == SHADOW_MODE_HARD
+        // sun shadow beams are launched per tile between quad visibility and shading
+        hitGroupDesc[HIT_GROUP_SHADOW].HitGroupExport = exportName_HitGroup[HIT_GROUP_SHADOW];
+        hitGroupDesc[HIT_GROUP_SHADOW].Type = D3D12_HIT_GROUP_TYPE_PROCEDURAL_PRIMITIVE;
+        hitGroupDesc[HIT_GROUP_SHADOW].AnyHitShaderImport = exportName_AnyHitSunShadow;
+        hitGroupDesc[HIT_GROUP_SHADOW].IntersectionShaderImport = exportName_IntersectionSunShadow;
+#elif BEAM_AO
+        // ambient occlusion beams are launched per tile between quad visibility and shading
+        hitGroupDesc[HIT_GROUP_SHADOW].HitGroupExport = exportName_HitGroup[HIT_GROUP_SHADOW];
+        hitGroupDesc[HIT_GROUP_SHADOW].Type = D3D12_HIT_GROUP_TYPE_PROCEDURAL_PRIMITIVE;
+        hitGroupDesc[HIT_GROUP_SHADOW].AnyHitShaderImport = exportName_AnyHitBeamAO;
+        hitGroupDesc[HIT_GROUP_SHADOW].IntersectionShaderImport = exportName_IntersectionBeamAO;
+#else
         // TODO... beam emulation would require shooting rays from the final shading compute shader, not from the
         // ray launch state object.
         hitGroupDesc[HIT_GROUP_SHADOW] = hitGroupDesc[HIT_GROUP_PRIMARY];
         hitGroupDesc[HIT_GROUP_SHADOW].HitGroupExport = exportName_HitGroup[HIT_GROUP_SHADOW];
+#endif
 
         D3D12_STATE_SUBOBJECT stateSubobjects[] =
         {
@@ -875,6 +1926,187 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
             missShaderSymbols, _countof(missShaderSymbols),
             pipelineConfig.MaxTraceRecursionDepth,
             g_RaytracingInputs_Beam.m_pPSO);
+
+#if SHADOW_MODE == SHADOW_MODE_HARD
+        // same state object and hit table, with a miss table of its own for the sun shadow payload
+        LPCWSTR sunShadowMissShaderSymbols[] =
+        {
+            exportName_MissSunShadow,
+        };
+        g_RaytracingInputs_BeamSunShadow = RaytracingDispatchRayInputs(
+            *g_pRaytracingDevice,
+            pBeamsPSO,
+            pHitShaderTable.data(),
+            shaderRecordSizeInBytes,
+            (UINT)pHitShaderTable.size(),
+            exportName_RayGenSunShadow,
+            sunShadowMissShaderSymbols, _countof(sunShadowMissShaderSymbols));
+#endif
+
+#if BEAM_AO
+        // same state object and hit table, with a miss table of its own for the AO payload
+        LPCWSTR beamAOMissShaderSymbols[] =
+        {
+            exportName_MissBeamAO,
+        };
+        g_RaytracingInputs_BeamAO = RaytracingDispatchRayInputs(
+            *g_pRaytracingDevice,
+            pBeamsPSO,
+            pHitShaderTable.data(),
+            shaderRecordSizeInBytes,
+            (UINT)pHitShaderTable.size(),
+            exportName_RayGenBeamAO,
+            beamAOMissShaderSymbols, _countof(beamAOMissShaderSymbols));
+#endif
+
+#if SUPER_TILE
+        // tiles refining their super-tile's candidate list, also the same state object
+        g_RaytracingInputs_BeamRefine = RaytracingDispatchRayInputs(
+            *g_pRaytracingDevice,
+            pBeamsPSO,
+            pHitShaderTable.data(),
+            shaderRecordSizeInBytes,
+            (UINT)pHitShaderTable.size(),
+            exportName_RayGenRefine,
+            missShaderSymbols, _countof(missShaderSymbols));
+
+        // Super-tile beams need a state object of their own, where the primary hit group gathers into the
+        // candidate lists. Nothing traces the shadow hit group.
+        D3D12_EXPORT_DESC superTileExportDesc[] =
+        {
+            { exportName_RayGenSuperTile,                   nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_IntersectionSuperTile,             nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_AnyHitSuperTile,                   nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_Miss[HIT_GROUP_PRIMARY],           nullptr, D3D12_EXPORT_FLAG_NONE },
+        };
+        D3D12_DXIL_LIBRARY_DESC superTileLibDesc =
+        {
+            { // DXILLibrary
+                g_pBeamsLib,
+                sizeof(g_pBeamsLib)
+            },
+            _countof(superTileExportDesc), // NumExports
+            superTileExportDesc // pExports
+        };
+
+        D3D12_HIT_GROUP_DESC superTileHitGroupDesc[HIT_GROUP_COUNT] = {};
+        superTileHitGroupDesc[HIT_GROUP_PRIMARY].HitGroupExport = exportName_HitGroup[HIT_GROUP_PRIMARY];
+        superTileHitGroupDesc[HIT_GROUP_PRIMARY].Type = D3D12_HIT_GROUP_TYPE_PROCEDURAL_PRIMITIVE;
+        superTileHitGroupDesc[HIT_GROUP_PRIMARY].AnyHitShaderImport = exportName_AnyHitSuperTile;
+        superTileHitGroupDesc[HIT_GROUP_PRIMARY].IntersectionShaderImport = exportName_IntersectionSuperTile;
+        superTileHitGroupDesc[HIT_GROUP_SHADOW] = superTileHitGroupDesc[HIT_GROUP_PRIMARY];
+        superTileHitGroupDesc[HIT_GROUP_SHADOW].HitGroupExport = exportName_HitGroup[HIT_GROUP_SHADOW];
+
+        D3D12_STATE_SUBOBJECT superTileSubobjects[] =
+        {
+            { D3D12_STATE_SUBOBJECT_TYPE_NODE_MASK, &nodeMask },
+            { D3D12_STATE_SUBOBJECT_TYPE_GLOBAL_ROOT_SIGNATURE, &g_GlobalRaytracingRootSignature.p },
+            { D3D12_STATE_SUBOBJECT_TYPE_RAYTRACING_PIPELINE_CONFIG, &pipelineConfig },
+            { D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY, &superTileLibDesc },
+            { D3D12_STATE_SUBOBJECT_TYPE_RAYTRACING_SHADER_CONFIG, &shaderConfig },
+            { D3D12_STATE_SUBOBJECT_TYPE_HIT_GROUP, superTileHitGroupDesc + 0 },
+# if HIT_GROUP_COUNT > 1
+            { D3D12_STATE_SUBOBJECT_TYPE_HIT_GROUP, superTileHitGroupDesc + 1 },
+# endif
+            { D3D12_STATE_SUBOBJECT_TYPE_LOCAL_ROOT_SIGNATURE, &g_LocalRaytracingRootSignature.p },
+        };
+        D3D12_STATE_OBJECT_DESC superTileStateObjectDesc =
+        {
+            D3D12_STATE_OBJECT_TYPE_RAYTRACING_PIPELINE,
+            _countof(superTileSubobjects),
+            superTileSubobjects
+        };
+
+        CComPtr<ID3D12StateObject> pSuperTilePSO;
+        g_pRaytracingDevice->CreateStateObject(&superTileStateObjectDesc, IID_PPV_ARGS(&pSuperTilePSO));
+        GetShaderTable(m_Model, pSuperTilePSO, pHitShaderTable.data());
+        g_RaytracingInputs_BeamSuperTile = RaytracingDispatchRayInputs(
+            *g_pRaytracingDevice,
+            pSuperTilePSO,
+            pHitShaderTable.data(),
+            shaderRecordSizeInBytes,
+            (UINT)pHitShaderTable.size(),
+            exportName_RayGenSuperTile,
+            missShaderSymbols, _countof(missShaderSymbols));
+
+        SetPipelineStateStackSize(
+            exportName_RayGenSuperTile,
+            hitShaderSymbols, _countof(hitShaderSymbols),
+            missShaderSymbols, _countof(missShaderSymbols),
+            pipelineConfig.MaxTraceRecursionDepth,
+            g_RaytracingInputs_BeamSuperTile.m_pPSO);
+#endif
+
+#if MULTI_VIEW
+        // Multi-view beams also need a state object of their own, the primary hit group tests and appends
+        // for every view, and reports which views it hit in larger attributes.
+        D3D12_RAYTRACING_SHADER_CONFIG multiViewShaderConfig = shaderConfig;
+        multiViewShaderConfig.MaxAttributeSizeInBytes = sizeof(MultiViewHitAttribs);
+
+        D3D12_EXPORT_DESC multiViewExportDesc[] =
+        {
+            { exportName_RayGenMultiView,                   nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_IntersectionMultiView,             nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_AnyHitMultiView,                   nullptr, D3D12_EXPORT_FLAG_NONE },
+            { exportName_Miss[HIT_GROUP_PRIMARY],           nullptr, D3D12_EXPORT_FLAG_NONE },
+        };
+        D3D12_DXIL_LIBRARY_DESC multiViewLibDesc =
+        {
+            { // DXILLibrary
+                g_pBeamsLib,
+                sizeof(g_pBeamsLib)
+            },
+            _countof(multiViewExportDesc), // NumExports
+            multiViewExportDesc // pExports
+        };
+
+        D3D12_HIT_GROUP_DESC multiViewHitGroupDesc[HIT_GROUP_COUNT] = {};
+        multiViewHitGroupDesc[HIT_GROUP_PRIMARY].HitGroupExport = exportName_HitGroup[HIT_GROUP_PRIMARY];
+        multiViewHitGroupDesc[HIT_GROUP_PRIMARY].Type = D3D12_HIT_GROUP_TYPE_PROCEDURAL_PRIMITIVE;
+        multiViewHitGroupDesc[HIT_GROUP_PRIMARY].AnyHitShaderImport = exportName_AnyHitMultiView;
+        multiViewHitGroupDesc[HIT_GROUP_PRIMARY].IntersectionShaderImport = exportName_IntersectionMultiView;
+        multiViewHitGroupDesc[HIT_GROUP_SHADOW] = multiViewHitGroupDesc[HIT_GROUP_PRIMARY];
+        multiViewHitGroupDesc[HIT_GROUP_SHADOW].HitGroupExport = exportName_HitGroup[HIT_GROUP_SHADOW];
+
+        D3D12_STATE_SUBOBJECT multiViewSubobjects[] =
+        {
+            { D3D12_STATE_SUBOBJECT_TYPE_NODE_MASK, &nodeMask },
+            { D3D12_STATE_SUBOBJECT_TYPE_GLOBAL_ROOT_SIGNATURE, &g_GlobalRaytracingRootSignature.p },
+            { D3D12_STATE_SUBOBJECT_TYPE_RAYTRACING_PIPELINE_CONFIG, &pipelineConfig },
+            { D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY, &multiViewLibDesc },
+            { D3D12_STATE_SUBOBJECT_TYPE_RAYTRACING_SHADER_CONFIG, &multiViewShaderConfig },
+            { D3D12_STATE_SUBOBJECT_TYPE_HIT_GROUP, multiViewHitGroupDesc + 0 },
+# if HIT_GROUP_COUNT > 1
+            { D3D12_STATE_SUBOBJECT_TYPE_HIT_GROUP, multiViewHitGroupDesc + 1 },
+# endif
+            { D3D12_STATE_SUBOBJECT_TYPE_LOCAL_ROOT_SIGNATURE, &g_LocalRaytracingRootSignature.p },
+        };
+        D3D12_STATE_OBJECT_DESC multiViewStateObjectDesc =
+        {
+            D3D12_STATE_OBJECT_TYPE_RAYTRACING_PIPELINE,
+            _countof(multiViewSubobjects),
+            multiViewSubobjects
+        };
+
+        CComPtr<ID3D12StateObject> pMultiViewPSO;
+        g_pRaytracingDevice->CreateStateObject(&multiViewStateObjectDesc, IID_PPV_ARGS(&pMultiViewPSO));
+        GetShaderTable(m_Model, pMultiViewPSO, pHitShaderTable.data());
+        g_RaytracingInputs_BeamMultiView = RaytracingDispatchRayInputs(
+            *g_pRaytracingDevice,
+            pMultiViewPSO,
+            pHitShaderTable.data(),
+            shaderRecordSizeInBytes,
+            (UINT)pHitShaderTable.size(),
+            exportName_RayGenMultiView,
+            missShaderSymbols, _countof(missShaderSymbols));
+
+        SetPipelineStateStackSize(
+            exportName_RayGenMultiView,
+            hitShaderSymbols, _countof(hitShaderSymbols),
+            missShaderSymbols, _countof(missShaderSymbols),
+            pipelineConfig.MaxTraceRecursionDepth,
+            g_RaytracingInputs_BeamMultiView.m_pPSO);
+#endif
     }
 
     // beam post processing shaders
@@ -885,8 +2117,8 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
         g_BeamPostRootSig.Reset(5, 1);
         g_BeamPostRootSig[0].InitAsConstantBuffer(0);
         g_BeamPostRootSig[1].InitAsConstantBuffer(1);
-        g_BeamPostRootSig[2].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 6);
-        g_BeamPostRootSig[3].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 3);
+        g_BeamPostRootSig[2].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 14);
+        g_BeamPostRootSig[3].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 6);
         g_BeamPostRootSig[4].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 100, UINT_MAX);
         g_BeamPostRootSig.InitStaticSampler(0, DefaultSamplerDesc);
         g_BeamPostRootSig.Finalize(L"g_BeamPostRootSig");
@@ -899,45 +2131,203 @@ void DxrMsaaDemo::InitializeRaytracingStateObjects()
         g_BeamShadePSO.SetComputeShader(g_pBeamsShade, sizeof(g_pBeamsShade));
         g_BeamShadePSO.Finalize();
     }
+
+#if TILE_BINNING
+    // copies the CPU binned tile lists into the beam tile lists
+    {
+        g_BinScatterRootSig.Reset(3, 0);
+        g_BinScatterRootSig[0].InitAsConstantBuffer(1);
+        g_BinScatterRootSig[1].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 14);
+        g_BinScatterRootSig[2].InitAsBufferSRV(7);
+        g_BinScatterRootSig.Finalize(L"g_BinScatterRootSig");
+
+        g_BinScatterPSO.SetRootSignature(g_BinScatterRootSig);
+        g_BinScatterPSO.SetComputeShader(g_pBeamsBinScatter, sizeof(g_pBeamsBinScatter));
+        g_BinScatterPSO.Finalize();
+    }
+#endif
+
+#if TEMPORAL_SAMPLES
+    // accumulates the rotating sample patterns
+    {
+        SamplerDesc LinearClampSamplerDesc;
+        LinearClampSamplerDesc.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+        LinearClampSamplerDesc.SetTextureAddressMode(D3D12_TEXTURE_ADDRESS_MODE_CLAMP);
+
+        g_TemporalResolveRootSig.Reset(4, 1);
+        g_TemporalResolveRootSig[0].InitAsConstantBuffer(0);
+        g_TemporalResolveRootSig[1].InitAsConstantBuffer(1);
+        g_TemporalResolveRootSig[2].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 30, 3);
+        g_TemporalResolveRootSig[3].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 20, 2);
+        g_TemporalResolveRootSig.InitStaticSampler(0, LinearClampSamplerDesc);
+        g_TemporalResolveRootSig.Finalize(L"g_TemporalResolveRootSig");
+
+        g_TemporalResolvePSO.SetRootSignature(g_TemporalResolveRootSig);
+        g_TemporalResolvePSO.SetComputeShader(g_pTemporalResolve, sizeof(g_pTemporalResolve));
+        g_TemporalResolvePSO.Finalize();
+    }
+#endif
+
+#if DYNAMIC_RESOLUTION
+    // fills the frame from the scaled beams
+    {
+        SamplerDesc LinearClampSamplerDesc;
+        LinearClampSamplerDesc.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+        LinearClampSamplerDesc.SetTextureAddressMode(D3D12_TEXTURE_ADDRESS_MODE_CLAMP);
+
+        g_DynamicResolutionUpscaleRootSig.Reset(3, 1);
+        g_DynamicResolutionUpscaleRootSig[0].InitAsConstantBuffer(0);
+        g_DynamicResolutionUpscaleRootSig[1].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 30, 2);
+        g_DynamicResolutionUpscaleRootSig[2].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 20, 2);
+        g_DynamicResolutionUpscaleRootSig.InitStaticSampler(0, LinearClampSamplerDesc);
+        g_DynamicResolutionUpscaleRootSig.Finalize(L"g_DynamicResolutionUpscaleRootSig");
+
+        g_DynamicResolutionUpscalePSO.SetRootSignature(g_DynamicResolutionUpscaleRootSig);
+        g_DynamicResolutionUpscalePSO.SetComputeShader(g_pDynamicResolutionUpscale, sizeof(g_pDynamicResolutionUpscale));
+        g_DynamicResolutionUpscalePSO.Finalize();
+    }
+#endif
 }
 
-void DxrMsaaDemo::createAABBs(
+// Returns the surface area of the (enlarged) AABBs relative to the tightly fit AABBs.
+// With a refitContext, only the animated meshes' AABBs are refit (all of them with refitAllMeshes), and written into
+// the existing buffers. cpuAABBs receives a copy of the AABBs that were written, and cpuPayload their coverage masks.
+float DxrMsaaDemo::createAABBs(
     StructuredBuffer& aabbBuffer
     , StructuredBuffer* aabbPayloadBuffer
-#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
-    , float camPosX, float camPosY, float camPosZ
-    , float camRightX, float camRightY, float camRightZ
-    , float camUpX, float camUpY, float camUpZ
-    , float camForwardX, float camForwardY, float camForwardZ
-    , float camFoV
-    , float camAspect
-    , uint32_t tilesX, uint32_t tilesY
-#endif
+    , bool shadowClusters
+    , const AABBEnlargement& enlargement
+    , CommandContext* refitContext
+    , std::vector<D3D12_RAYTRACING_AABB>* cpuAABBs
+    , std::vector<ShadowAABBPayload>* cpuPayload
+    , bool refitAllMeshes
 )
 {
+    float growRadius = enlargement.growRadius;
 #if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+    float camPosX = enlargement.camPosX, camPosY = enlargement.camPosY, camPosZ = enlargement.camPosZ;
+    float camRightX = enlargement.camRightX, camRightY = enlargement.camRightY, camRightZ = enlargement.camRightZ;
+    float camUpX = enlargement.camUpX, camUpY = enlargement.camUpY, camUpZ = enlargement.camUpZ;
+    float camForwardX = enlargement.camForwardX, camForwardY = enlargement.camForwardY, camForwardZ = enlargement.camForwardZ;
+    float camFoV = enlargement.camFoV;
+    float camAspect = enlargement.camAspect;
+    uint32_t tilesX = enlargement.tilesX, tilesY = enlargement.tilesY;
+
     // TODO: if not requesting a fully conservative beam query, the tile size should be inset
     // to the bounding box of the actual samples... in the case of 1x (no AA), it would be
     // inset to the pixel centers of the outer corner pixels of the beam tile. This will give a tighter
     // fit and allow fewer triangles through.
     float tileSizeXAt1 = tanf(camFoV * .5f) * camAspect / tilesX;
     float tileSizeYAt1 = tanf(camFoV * .5f) / tilesY;
+# if LENS_DISTORTION
+    float lensTileSizeXAt1 = tileSizeXAt1 * (1.0f + enlargement.lensStretch) + tileSizeYAt1 * enlargement.lensShear;
+    float lensTileSizeYAt1 = tileSizeYAt1 * (1.0f + enlargement.lensStretch) + tileSizeXAt1 * enlargement.lensShear;
+    tileSizeXAt1 = lensTileSizeXAt1;
+    tileSizeYAt1 = lensTileSizeYAt1;
+# endif
+
+    // The AABBs are in object space, and shared by all of the instances (see SCENE_INSTANCES).
+    // The instances only translate, and the enlargement only grows with distance along the camera's
+    // forward axis, so the instance furthest along it decides the enlargement for all of them.
+    float instanceForwardMax = -FLT_MAX;
+    for (const InstanceTransform &xf : m_instanceTransforms)
+    {
+        float instanceForward = xf.row0.w * camForwardX + xf.row1.w * camForwardY + xf.row2.w * camForwardZ;
+        instanceForwardMax = max(instanceForwardMax, instanceForward);
+    }
+
+    auto enlargeAABB = [&](D3D12_RAYTRACING_AABB &aabb)
+    {
+        float aabbPPointX = camForwardX < 0 ? aabb.MinX : aabb.MaxX;
+        float aabbPPointY = camForwardY < 0 ? aabb.MinY : aabb.MaxY;
+        float aabbPPointZ = camForwardZ < 0 ? aabb.MinZ : aabb.MaxZ;
+
+        float dx = aabbPPointX - camPosX;
+        float dy = aabbPPointY - camPosY;
+        float dz = aabbPPointZ - camPosZ;
+
+        float d = dx * camForwardX + dy * camForwardY + dz * camForwardZ + instanceForwardMax;
+
+        if (d < 0)
+            d = 0;
+
+        float expansionScreenX = tileSizeXAt1 * d;
+        float expansionScreenY = tileSizeYAt1 * d;
+
+        float expansionX = fabsf(camRightX) * expansionScreenX + fabsf(camUpX) * expansionScreenY;
+        float expansionY = fabsf(camRightY) * expansionScreenX + fabsf(camUpY) * expansionScreenY;
+        float expansionZ = fabsf(camRightZ) * expansionScreenX + fabsf(camUpZ) * expansionScreenY;
+
+        aabb.MinX -= expansionX;
+        aabb.MinY -= expansionY;
+        aabb.MinZ -= expansionZ;
+
+        aabb.MaxX += expansionX;
+        aabb.MaxY += expansionY;
+        aabb.MaxZ += expansionZ;
+    };
 #endif
 
     uint32_t meshCount = m_Model.m_Header.meshCount;
     std::vector<D3D12_RAYTRACING_AABB> aabbs;
     std::vector<ShadowAABBPayload> aabbPayload;
+    double surfaceAreaFit = 0.0;
+    double surfaceAreaEnlarged = 0.0;
+    auto surfaceArea = [](const D3D12_RAYTRACING_AABB &aabb)
+    {
+        double dx = aabb.MaxX - aabb.MinX;
+        double dy = aabb.MaxY - aabb.MinY;
+        double dz = aabb.MaxZ - aabb.MinZ;
+        return 2.0 * (dx * dy + dy * dz + dz * dx);
+    };
+    // uniform enlargement, for orthographic beams of a bounded width
+    auto growAABB = [=](D3D12_RAYTRACING_AABB &aabb)
+    {
+        aabb.MinX -= growRadius;
+        aabb.MinY -= growRadius;
+        aabb.MinZ -= growRadius;
+
+        aabb.MaxX += growRadius;
+        aabb.MaxY += growRadius;
+        aabb.MaxZ += growRadius;
+    };
+    if (refitContext)
+    {
+        refitContext->TransitionResource(aabbBuffer, D3D12_RESOURCE_STATE_COPY_DEST);
+        if (aabbPayloadBuffer)
+            refitContext->TransitionResource(*aabbPayloadBuffer, D3D12_RESOURCE_STATE_COPY_DEST);
+        refitContext->FlushResourceBarriers();
+    }
+
+    // first AABB of the current mesh
+    uint32_t meshAABBOffset = 0;
     for (uint32_t m = 0; m < m_Model.m_Header.meshCount; m++)
     {
         const Model::Mesh &mesh = m_Model.m_pMesh[m];
 
         uint32_t triCount = mesh.indexCount / 3;
+        uint32_t leafCount = aabbLeafCount(triCount);
+        uint32_t clusterCount = shadowClusters ? aabbClusterCount(leafCount) : 0;
+
+        uint32_t meshAABBBegin = meshAABBOffset;
+        meshAABBOffset += leafCount + clusterCount;
+        if (refitContext && !refitAllMeshes && !m_meshAnimated[m])
+            continue;
+        size_t meshAABBFirst = aabbs.size();
 
         const uint16_t *indexData = (const uint16_t*)(m_Model.m_pIndexData + mesh.indexDataByteOffset);
         const uint8_t *vertexData = (const uint8_t*)(m_Model.m_pVertexData
             + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset);
+        uint32_t opacityMaskOffset = m_opacityMaskOffset[m];
+
+        auto fetchTri = [&](uint32_t t, const float *v[3])
+        {
+            v[0] = (const float*)(vertexData + mesh.vertexStride * indexData[t * 3 + 0]);
+            v[1] = (const float*)(vertexData + mesh.vertexStride * indexData[t * 3 + 1]);
+            v[2] = (const float*)(vertexData + mesh.vertexStride * indexData[t * 3 + 2]);
+        };
 
-        for (uint32_t a = 0; a < (triCount + TRIS_PER_AABB - 1) / TRIS_PER_AABB; a++)
+        auto fitAABB = [&](uint32_t triBegin, uint32_t triEnd)
         {
             D3D12_RAYTRACING_AABB aabb =
             {
@@ -945,20 +2335,10 @@ void DxrMsaaDemo::createAABBs(
                 -FLT_MAX, -FLT_MAX, -FLT_MAX,
             };
 
-            for (uint32_t t = a * TRIS_PER_AABB; t < (a + 1) * TRIS_PER_AABB; t++)
+            for (uint32_t t = triBegin; t < triEnd; t++)
             {
-                uint32_t i[3] =
-                {
-                    indexData[t * 3 + 0],
-                    indexData[t * 3 + 1],
-                    indexData[t * 3 + 2],
-                };
-                const float *v[3] =
-                {
-                    (const float*)(vertexData + mesh.vertexStride * i[0]),
-                    (const float*)(vertexData + mesh.vertexStride * i[1]),
-                    (const float*)(vertexData + mesh.vertexStride * i[2]),
-                };
+                const float *v[3];
+                fetchTri(t, v);
 
                 aabb.MinX = min(aabb.MinX, min(v[0][0], min(v[1][0], v[2][0])));
                 aabb.MinY = min(aabb.MinY, min(v[0][1], min(v[1][1], v[2][1])));
@@ -968,6 +2348,25 @@ void DxrMsaaDemo::createAABBs(
                 aabb.MaxZ = max(aabb.MaxZ, max(v[0][2], max(v[1][2], v[2][2])));
             }
 
+#if POSITION_STREAM && POSITION_STREAM_QUANTIZED
+            // the visibility passes see the quantized positions, which are up to half a step off
+            float3 quantHalfStep = m_meshInfo[m].posQuantScale * float3(.5f, .5f, .5f);
+            aabb.MinX -= quantHalfStep.x;
+            aabb.MinY -= quantHalfStep.y;
+            aabb.MinZ -= quantHalfStep.z;
+            aabb.MaxX += quantHalfStep.x;
+            aabb.MaxY += quantHalfStep.y;
+            aabb.MaxZ += quantHalfStep.z;
+#endif
+
+            return aabb;
+        };
+
+        // Rasterize the triangles into a SHADOW_COVERAGE_DIM x SHADOW_COVERAGE_DIM coverage mask over
+        // the box, once per major axis. Covered cells are unioned, so triangles which overlap in projection
+        // don't get counted twice (this matters for clusters).
+        auto calculatePayload = [&](const D3D12_RAYTRACING_AABB &aabb, uint32_t triBegin, uint32_t triEnd)
+        {
             ShadowAABBPayload payload;
             // use the un-expanded AABB
             payload.min = float3(
@@ -978,173 +2377,273 @@ void DxrMsaaDemo::createAABBs(
                 aabb.MaxX,
                 aabb.MaxY,
                 aabb.MaxZ);
-            payload.opacity = float3(0, 0, 0);
-            for (uint32_t t = a * TRIS_PER_AABB; t < (a + 1) * TRIS_PER_AABB; t++)
+            payload.cluster = SHADOW_CLUSTER_NONE;
+
+            uint64_t coverageX = 0;
+            uint64_t coverageY = 0;
+            uint64_t coverageZ = 0;
+            for (uint32_t t = triBegin; t < triEnd; t++)
             {
-                uint32_t i[3] =
-                {
-                    indexData[t * 3 + 0],
-                    indexData[t * 3 + 1],
-                    indexData[t * 3 + 2],
-                };
-                const float *v[3] =
-                {
-                    (const float*)(vertexData + mesh.vertexStride * i[0]),
-                    (const float*)(vertexData + mesh.vertexStride * i[1]),
-                    (const float*)(vertexData + mesh.vertexStride * i[2]),
-                };
+                const float *v[3];
+                fetchTri(t, v);
 
-                // We know the triangles are inside the AABB, because the AABB was fit against the triangles.
-                // So, we can skip clipping and assume the triangle is contained by the AABB.
-                auto calculateOpacity = [](
+                // transparent parts of alpha tested triangles don't cast shadows
+                uint32_t opacityMask = opacityMaskOffset == OPACITY_MASK_NONE ?
+                    OPACITY_MASK_ALL_OPAQUE : m_opacityMasks_cpu[opacityMaskOffset + t];
+                if (opacityMask == OPACITY_MASK_ALL_TRANSPARENT)
+                    continue;
+
+                auto rasterizeCoverage = [opacityMask](
                     float minA, float minB, float maxA, float maxB,
                     float v0A, float v0B,
                     float v1A, float v1B,
                     float v2A, float v2B)
                 {
-                    // We know the triangles are inside the AABB, because the AABB was fit against the triangles.
-                    // So, we can skip clipping and assume the triangle is contained by the AABB.
-                    float e0A = v1A - v0A;
-                    float e0B = v1B - v0B;
-                    float e1A = v2A - v0A;
-                    float e1B = v2B - v0B;
-                    float areaTri = .5f * fabsf(e0A * e1B - e0B * e1A);
+                    uint64_t coverage = 0;
 
-                    float areaBox = (maxA - minA) * (maxB - minB);
+                    float sizeA = maxA - minA;
+                    float sizeB = maxB - minB;
+                    if (sizeA <= 0.0f || sizeB <= 0.0f)
+                        return coverage; // flat box, the beam can't overlap its projection
 
-                    float areaPercent = areaTri / areaBox;
-                    return areaPercent;
+                    float area2 = (v1A - v0A) * (v2B - v0B) - (v1B - v0B) * (v2A - v0A);
+                    if (area2 == 0.0f)
+                        return coverage; // edge-on
+                    float winding = area2 > 0.0f ? 1.0f : -1.0f;
+                    float ooArea2 = 1.0f / (area2 * winding);
+
+                    // We know the triangles are inside the AABB, because the AABB was fit against the triangles.
+                    // So, we can skip clipping and just test the cell centers.
+                    for (uint32_t b = 0; b < SHADOW_COVERAGE_DIM; b++)
+                    {
+                        float pB = minB + (b + .5f) * sizeB / SHADOW_COVERAGE_DIM;
+                        for (uint32_t a = 0; a < SHADOW_COVERAGE_DIM; a++)
+                        {
+                            float pA = minA + (a + .5f) * sizeA / SHADOW_COVERAGE_DIM;
+
+                            float w0 = winding * ((v1A - pA) * (v2B - pB) - (v1B - pB) * (v2A - pA));
+                            float w1 = winding * ((v2A - pA) * (v0B - pB) - (v2B - pB) * (v0A - pA));
+                            float w2 = winding * ((v0A - pA) * (v1B - pB) - (v0B - pB) * (v1A - pA));
+
+                            if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f)
+                            {
+                                // unknown micro-triangles count as covered
+                                uint32_t microTri = OpacityMicroTriIndex(w1 * ooArea2, w2 * ooArea2);
+                                if (OpacityMaskState(opacityMask, microTri) != OPACITY_STATE_TRANSPARENT)
+                                    coverage |= uint64_t(1) << (b * SHADOW_COVERAGE_DIM + a);
+                            }
+                        }
+                    }
+                    return coverage;
                 };
 
-                payload.opacity.x += calculateOpacity(
+                coverageX |= rasterizeCoverage(
                     aabb.MinY, aabb.MinZ, aabb.MaxY, aabb.MaxZ,
                     v[0][1], v[0][2],
                     v[1][1], v[1][2],
                     v[2][1], v[2][2]);
 
-                payload.opacity.y += calculateOpacity(
+                coverageY |= rasterizeCoverage(
                     aabb.MinX, aabb.MinZ, aabb.MaxX, aabb.MaxZ,
                     v[0][0], v[0][2],
                     v[1][0], v[1][2],
                     v[2][0], v[2][2]);
 
-                payload.opacity.z += calculateOpacity(
+                coverageZ |= rasterizeCoverage(
                     aabb.MinX, aabb.MinY, aabb.MaxX, aabb.MaxY,
                     v[0][0], v[0][1],
                     v[1][0], v[1][1],
                     v[2][0], v[2][1]);
             }
-            payload.opacity.x = min(1.0f, payload.opacity.x);
-            payload.opacity.y = min(1.0f, payload.opacity.y);
-            payload.opacity.z = min(1.0f, payload.opacity.z);
+            payload.coverageX = uint2(uint32_t(coverageX), uint32_t(coverageX >> 32));
+            payload.coverageY = uint2(uint32_t(coverageY), uint32_t(coverageY >> 32));
+            payload.coverageZ = uint2(uint32_t(coverageZ), uint32_t(coverageZ >> 32));
 
-#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
-            float aabbPPointX = camForwardX < 0 ? aabb.MinX : aabb.MaxX;
-            float aabbPPointY = camForwardY < 0 ? aabb.MinY : aabb.MaxY;
-            float aabbPPointZ = camForwardZ < 0 ? aabb.MinZ : aabb.MaxZ;
+            return payload;
+        };
+
+        // leaves come first, followed by the clusters that group them
+        uint32_t clusterBase = meshAABBBegin + leafCount;
+
+        for (uint32_t a = 0; a < leafCount; a++)
+        {
+            uint32_t triBegin = a * TRIS_PER_AABB;
+            uint32_t triEnd = (a + 1) * TRIS_PER_AABB;
+
+            D3D12_RAYTRACING_AABB aabb = fitAABB(triBegin, triEnd);
 
-            float dx = aabbPPointX - camPosX;
-            float dy = aabbPPointY - camPosY;
-            float dz = aabbPPointZ - camPosZ;
+            ShadowAABBPayload payload = calculatePayload(aabb, triBegin, triEnd);
+            if (clusterCount > 0)
+                payload.cluster = clusterBase + a / SHADOW_CLUSTER_SIZE;
 
-            float d = dx * camForwardX + dy * camForwardY + dz * camForwardZ;
+            surfaceAreaFit += surfaceArea(aabb);
+#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+            enlargeAABB(aabb);
+#endif
+            growAABB(aabb);
+            surfaceAreaEnlarged += surfaceArea(aabb);
 
-            if (d < 0)
-                d = 0;
+            aabbs.push_back(aabb);
+            aabbPayload.push_back(payload);
+        }
 
-            float expansionScreenX = tileSizeXAt1 * d;
-            float expansionScreenY = tileSizeYAt1 * d;
+        for (uint32_t c = 0; c < clusterCount; c++)
+        {
+            uint32_t triBegin = c * SHADOW_CLUSTER_SIZE * TRIS_PER_AABB;
+            uint32_t triEnd = min((c + 1) * SHADOW_CLUSTER_SIZE * TRIS_PER_AABB, triCount);
 
-            float expansionX = fabsf(camRightX) * expansionScreenX + fabsf(camUpX) * expansionScreenY;
-            float expansionY = fabsf(camRightY) * expansionScreenX + fabsf(camUpY) * expansionScreenY;
-            float expansionZ = fabsf(camRightZ) * expansionScreenX + fabsf(camUpZ) * expansionScreenY;
+            D3D12_RAYTRACING_AABB aabb = fitAABB(triBegin, triEnd);
 
-            aabb.MinX -= expansionX;
-            aabb.MinY -= expansionY;
-            aabb.MinZ -= expansionZ;
+            ShadowAABBPayload payload = calculatePayload(aabb, triBegin, triEnd);
 
-            aabb.MaxX += expansionX;
-            aabb.MaxY += expansionY;
-            aabb.MaxZ += expansionZ;
+            surfaceAreaFit += surfaceArea(aabb);
+#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+            enlargeAABB(aabb);
 #endif
+            growAABB(aabb);
+            surfaceAreaEnlarged += surfaceArea(aabb);
 
             aabbs.push_back(aabb);
             aabbPayload.push_back(payload);
         }
+
+        if (refitContext)
+        {
+            size_t meshAABBCount = aabbs.size() - meshAABBFirst;
+            refitContext->WriteBuffer(aabbBuffer, meshAABBBegin * sizeof(D3D12_RAYTRACING_AABB),
+                &aabbs[meshAABBFirst], meshAABBCount * sizeof(D3D12_RAYTRACING_AABB));
+            if (aabbPayloadBuffer)
+            {
+                refitContext->WriteBuffer(*aabbPayloadBuffer, meshAABBBegin * sizeof(ShadowAABBPayload),
+                    &aabbPayload[meshAABBFirst], meshAABBCount * sizeof(ShadowAABBPayload));
+            }
+        }
+    }
+
+    if (refitContext)
+    {
+        refitContext->TransitionResource(aabbBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+        if (aabbPayloadBuffer)
+            refitContext->TransitionResource(*aabbPayloadBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    }
+    else
+    {
+        aabbBuffer.Create(L"AABBs", uint32_t(aabbs.size()), sizeof(D3D12_RAYTRACING_AABB), aabbs.data());
+
+        if (aabbPayloadBuffer)
+            aabbPayloadBuffer->Create(L"AABBs Payload", uint32_t(aabbPayload.size()), sizeof(ShadowAABBPayload), aabbPayload.data());
     }
 
-    aabbBuffer.Create(L"AABBs", uint32_t(aabbs.size()), sizeof(D3D12_RAYTRACING_AABB), aabbs.data());
+    if (cpuAABBs)
+        cpuAABBs->swap(aabbs);
+    if (cpuPayload)
+        cpuPayload->swap(aabbPayload);
 
-    if (aabbPayloadBuffer)
-        aabbPayloadBuffer->Create(L"AABBs Payload", uint32_t(aabbPayload.size()), sizeof(ShadowAABBPayload), aabbPayload.data());
+    return surfaceAreaFit > 0.0 ? float(surfaceAreaEnlarged / surfaceAreaFit) : 1.0f;
 }
 
-void DxrMsaaDemo::createBvh(BVH &bvh, bool useAABBs, StructuredBuffer* aabbBuffer)
+void DxrMsaaDemo::createBvh(BVH &bvh, bool useAABBs, StructuredBuffer* aabbBuffers, uint32_t bottomCount, bool shadowClusters, bool allowUpdate)
 {
     uint32_t meshCount = m_Model.m_Header.meshCount;
 
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topDesc = {};
+    ASSERT(bottomCount <= 8, "instance masks are used to select bottom-level BVHs");
+    bvh.bottom.resize(bottomCount);
+    uint32_t instanceCount = bottomCount * SCENE_INSTANCES;
+
+    // updatable structures are larger and can trace slower, so only the ones refitBvh updates get the flag
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+    if (allowUpdate)
+        buildFlags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC &topDesc = bvh.topDesc;
+    topDesc = {};
     topDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
-    topDesc.Inputs.NumDescs = bvhBottomCount;
-    topDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+    topDesc.Inputs.NumDescs = instanceCount;
+    topDesc.Inputs.Flags = buildFlags;
     topDesc.Inputs.pGeometryDescs = nullptr;
     topDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO topPrebuildInfo;
     g_pRaytracingDevice->GetRaytracingAccelerationStructurePrebuildInfo(&topDesc.Inputs, &topPrebuildInfo);
 
-    uint32_t aabbTotal = 0;
-    std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geoDesc(meshCount);
-    for (uint32_t m = 0; m < meshCount; m++)
+    // refits reuse the scratch buffer
+    uint64_t scratchBufferSizeNeeded = std::max(topPrebuildInfo.ScratchDataSizeInBytes, topPrebuildInfo.UpdateScratchDataSizeInBytes);
+
+    std::vector<std::vector<D3D12_RAYTRACING_GEOMETRY_DESC>> &geoDesc = bvh.geoDesc;
+    std::vector<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC> &bottomDesc = bvh.bottomDesc;
+    geoDesc.assign(bottomCount, std::vector<D3D12_RAYTRACING_GEOMETRY_DESC>());
+    bottomDesc.assign(bottomCount, D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC());
+    std::vector<D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO> bottomPrebuildInfo(bottomCount);
+    for (uint32_t b = 0; b < bottomCount; b++)
     {
-        const Model::Mesh &mesh = m_Model.m_pMesh[m];
+        geoDesc[b].resize(meshCount);
 
-        if (!useAABBs)
+        uint32_t aabbTotal = 0;
+        for (uint32_t m = 0; m < meshCount; m++)
         {
-            geoDesc[m].Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-            geoDesc[m].Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
-            geoDesc[m].Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-            geoDesc[m].Triangles.VertexCount = mesh.vertexCount;
-            geoDesc[m].Triangles.VertexBuffer.StartAddress = m_Model.m_VertexBuffer.GetGpuVirtualAddress()
-                + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
-            geoDesc[m].Triangles.IndexBuffer = m_Model.m_IndexBuffer.GetGpuVirtualAddress() + mesh.indexDataByteOffset;
-            geoDesc[m].Triangles.VertexBuffer.StrideInBytes = mesh.vertexStride;
-            geoDesc[m].Triangles.IndexCount = mesh.indexCount;
-            geoDesc[m].Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
-            geoDesc[m].Triangles.Transform3x4 = 0;
+            const Model::Mesh &mesh = m_Model.m_pMesh[m];
+
+            if (!useAABBs)
+            {
+                geoDesc[b][m].Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+                // alpha tested meshes go through the any hit shaders
+                geoDesc[b][m].Flags = m_opacityMaskOffset[m] == OPACITY_MASK_NONE ?
+                    D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE : D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION;
+                geoDesc[b][m].Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+                geoDesc[b][m].Triangles.VertexCount = mesh.vertexCount;
+                geoDesc[b][m].Triangles.VertexBuffer.StartAddress = m_Model.m_VertexBuffer.GetGpuVirtualAddress()
+                    + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
+                geoDesc[b][m].Triangles.IndexBuffer = m_Model.m_IndexBuffer.GetGpuVirtualAddress() + mesh.indexDataByteOffset;
+                geoDesc[b][m].Triangles.VertexBuffer.StrideInBytes = mesh.vertexStride;
+                geoDesc[b][m].Triangles.IndexCount = mesh.indexCount;
+                geoDesc[b][m].Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
+                geoDesc[b][m].Triangles.Transform3x4 = 0;
+            }
+            else
+            {
+                StructuredBuffer &aabbBuffer = aabbBuffers[b];
+                uint32_t stride = aabbBuffer.GetElementSize();
+                uint32_t triCount = mesh.indexCount / 3;
+                uint32_t aabbCount = aabbLeafCount(triCount);
+                if (shadowClusters)
+                    aabbCount += aabbClusterCount(aabbCount);
+
+                geoDesc[b][m].Type = D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS;
+                geoDesc[b][m].Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION;
+                geoDesc[b][m].AABBs.AABBCount = aabbCount;
+                geoDesc[b][m].AABBs.AABBs.StartAddress = aabbBuffer.GetGpuVirtualAddress() + aabbTotal * stride;
+                geoDesc[b][m].AABBs.AABBs.StrideInBytes = stride;
+
+                aabbTotal += aabbCount;
+            }
         }
-        else
+        if (useAABBs)
         {
-            uint32_t stride = aabbBuffer->GetElementSize();
-            uint32_t triCount = mesh.indexCount / 3;
-            uint32_t aabbCount = (triCount + TRIS_PER_AABB - 1) / TRIS_PER_AABB;
+            ASSERT(aabbTotal == aabbBuffers[b].GetElementCount());
+        }
 
-            geoDesc[m].Type = D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS;
-            geoDesc[m].Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION;
-            geoDesc[m].AABBs.AABBCount = aabbCount;
-            geoDesc[m].AABBs.AABBs.StartAddress = aabbBuffer->GetGpuVirtualAddress() + aabbTotal * stride;
-            geoDesc[m].AABBs.AABBs.StrideInBytes = stride;
+        bottomDesc[b].Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+        bottomDesc[b].Inputs.NumDescs = uint32_t(geoDesc[b].size());
+        bottomDesc[b].Inputs.pGeometryDescs = geoDesc[b].data();
+        bottomDesc[b].Inputs.Flags = buildFlags;
+        bottomDesc[b].Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
 
-            aabbTotal += aabbCount;
-        }
+        g_pRaytracingDevice->GetRaytracingAccelerationStructurePrebuildInfo(&bottomDesc[b].Inputs, &bottomPrebuildInfo[b]);
+
+        scratchBufferSizeNeeded = std::max(scratchBufferSizeNeeded, bottomPrebuildInfo[b].ScratchDataSizeInBytes);
+        scratchBufferSizeNeeded = std::max(scratchBufferSizeNeeded, bottomPrebuildInfo[b].UpdateScratchDataSizeInBytes);
     }
-    if (useAABBs)
-    {
-        ASSERT(aabbTotal == aabbBuffer->GetElementCount());
-    }
-
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC bottomDesc = {};
-    bottomDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-    bottomDesc.Inputs.NumDescs = uint32_t(geoDesc.size());
-    bottomDesc.Inputs.pGeometryDescs = geoDesc.data();
-    bottomDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
-    bottomDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-
-    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO bottomPrebuildInfo;
-    g_pRaytracingDevice->GetRaytracingAccelerationStructurePrebuildInfo(&bottomDesc.Inputs, &bottomPrebuildInfo);
 
-    uint64_t scratchBufferSizeNeeded = std::max(bottomPrebuildInfo.ScratchDataSizeInBytes, topPrebuildInfo.ScratchDataSizeInBytes);
-
-    ByteAddressBuffer scratchBuffer;
+    // the instances share the bottom-level BVHs, instead of each getting a copy
+    uint64_t bottomSize = 0;
+    for (uint32_t b = 0; b < bottomCount; b++)
+        bottomSize += bottomPrebuildInfo[b].ResultDataMaxSizeInBytes;
+    Utility::Printf("%s BVH: %u instances, bottom level %.1f MB (%.1f MB unshared), top level %.1f KB\n",
+        useAABBs ? "AABB" : "triangle", instanceCount,
+        bottomSize / (1024.0f * 1024.0f),
+        float(bottomSize) * SCENE_INSTANCES / (1024.0f * 1024.0f),
+        topPrebuildInfo.ResultDataMaxSizeInBytes / 1024.0f);
+
+    ByteAddressBuffer &scratchBuffer = bvh.scratch;
     scratchBuffer.Create(L"Acceleration Structure Scratch Buffer", (uint32_t)scratchBufferSizeNeeded, 1);
 
     D3D12_HEAP_PROPERTIES defaultHeapDesc = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
@@ -1159,31 +2658,38 @@ void DxrMsaaDemo::createBvh(BVH &bvh, bool useAABBs, StructuredBuffer* aabbBuffe
     topDesc.DestAccelerationStructureData = bvh.top->GetGPUVirtualAddress();
     topDesc.ScratchAccelerationStructureData = scratchBuffer.GetGpuVirtualAddress();
 
-    D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
-    auto bottomLevelDesc = CD3DX12_RESOURCE_DESC::Buffer(bottomPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
-    g_Device->CreateCommittedResource(
-        &defaultHeapDesc,
-        D3D12_HEAP_FLAG_NONE, 
-        &bottomLevelDesc, 
-        D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
-        nullptr, 
-        IID_PPV_ARGS(&bvh.bottom));
-    bottomDesc.DestAccelerationStructureData = bvh.bottom->GetGPUVirtualAddress();
-    bottomDesc.ScratchAccelerationStructureData = scratchBuffer.GetGpuVirtualAddress();
-
-    // Identity matrix
-    ZeroMemory(instanceDesc.Transform, sizeof(instanceDesc.Transform));
-    instanceDesc.Transform[0][0] = 1.0f;
-    instanceDesc.Transform[1][1] = 1.0f;
-    instanceDesc.Transform[2][2] = 1.0f;
-    instanceDesc.AccelerationStructure = bvh.bottom->GetGPUVirtualAddress();
-    instanceDesc.Flags = 0;
-    instanceDesc.InstanceID = 0;
-    instanceDesc.InstanceMask = 1;
-    instanceDesc.InstanceContributionToHitGroupIndex = 0;
-
-    ByteAddressBuffer instanceDataBuffer;
-    instanceDataBuffer.Create(L"Instance Data Buffer", bvhBottomCount, sizeof(D3D12_RAYTRACING_INSTANCE_DESC), &instanceDesc);
+    std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDesc(instanceCount);
+    for (uint32_t b = 0; b < bottomCount; b++)
+    {
+        auto bottomLevelDesc = CD3DX12_RESOURCE_DESC::Buffer(bottomPrebuildInfo[b].ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+        g_Device->CreateCommittedResource(
+            &defaultHeapDesc,
+            D3D12_HEAP_FLAG_NONE, 
+            &bottomLevelDesc, 
+            D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+            nullptr, 
+            IID_PPV_ARGS(&bvh.bottom[b]));
+        bottomDesc[b].DestAccelerationStructureData = bvh.bottom[b]->GetGPUVirtualAddress();
+        bottomDesc[b].ScratchAccelerationStructureData = scratchBuffer.GetGpuVirtualAddress();
+
+        // grouped by bottom-level BVH, SCENE_INSTANCES each
+        for (uint32_t i = 0; i < SCENE_INSTANCES; i++)
+        {
+            D3D12_RAYTRACING_INSTANCE_DESC &desc = instanceDesc[b * SCENE_INSTANCES + i];
+            static_assert(sizeof(desc.Transform) == sizeof(InstanceTransform), "same 3x4 layout");
+            memcpy(desc.Transform, &m_instanceTransforms[i], sizeof(desc.Transform));
+            desc.AccelerationStructure = bvh.bottom[b]->GetGPUVirtualAddress();
+            desc.Flags = 0;
+            // the shaders use this to find the instance transform, and for the primitive ID
+            desc.InstanceID = i;
+            // one bit per bottom-level BVH, so rays can pick which one to trace
+            desc.InstanceMask = 1 << b;
+            desc.InstanceContributionToHitGroupIndex = 0;
+        }
+    }
+
+    ByteAddressBuffer &instanceDataBuffer = bvh.instanceData;
+    instanceDataBuffer.Create(L"Instance Data Buffer", instanceCount, sizeof(D3D12_RAYTRACING_INSTANCE_DESC), instanceDesc.data());
     topDesc.Inputs.InstanceDescs = instanceDataBuffer.GetGpuVirtualAddress();
     topDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
 
@@ -1198,9 +2704,13 @@ void DxrMsaaDemo::createBvh(BVH &bvh, bool useAABBs, StructuredBuffer* aabbBuffe
         ID3D12DescriptorHeap *descriptorHeaps[] = { &g_pRaytracingDescriptorHeap->GetDescriptorHeap() };
         pRaytracingCommandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
+        // the builds share a scratch buffer, so they need to be serialized
         auto uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
-        pRaytracingCommandList->BuildRaytracingAccelerationStructure(&bottomDesc, 0, nullptr);
-        pCommandList->ResourceBarrier(1, &uavBarrier);
+        for (uint32_t b = 0; b < bottomCount; b++)
+        {
+            pRaytracingCommandList->BuildRaytracingAccelerationStructure(&bottomDesc[b], 0, nullptr);
+            pCommandList->ResourceBarrier(1, &uavBarrier);
+        }
 
         pRaytracingCommandList->BuildRaytracingAccelerationStructure(&topDesc, 0, nullptr);
 
@@ -1208,6 +2718,1089 @@ void DxrMsaaDemo::createBvh(BVH &bvh, bool useAABBs, StructuredBuffer* aabbBuffe
     }
 }
 
+#if BVH_REFIT
+// Sways the vertices of a hanging mesh, pinned along its top edge. The rest pose is 3 floats per vertex.
+static void swayPositions(const float *rest, uint32_t vertexCount, float time, float amplitude, uint8_t *positions, uint32_t stride)
+{
+    float top = -FLT_MAX;
+    float bottom = FLT_MAX;
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        top = max(top, rest[v * 3 + 1]);
+        bottom = min(bottom, rest[v * 3 + 1]);
+    }
+    float ooHeight = top > bottom ? 1.0f / (top - bottom) : 0.0f;
+
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        float x = rest[v * 3 + 0];
+        float y = rest[v * 3 + 1];
+        float z = rest[v * 3 + 2];
+
+        float weight = (top - y) * ooHeight;
+        float phase = time * 2.0f + y * .02f;
+
+        float *p = (float*)(positions + v * stride);
+        p[0] = x + amplitude * weight * sinf(phase);
+        p[1] = y;
+        p[2] = z + amplitude * weight * cosf(phase * .7f);
+    }
+}
+
+// Tight (un-enlarged) leaf AABBs of one mesh, the same leaves createAABBs writes.
+void DxrMsaaDemo::fitLeafAABBs(uint32_t meshIndex, const uint8_t *positions, uint32_t stride, std::vector<D3D12_RAYTRACING_AABB> &aabbs)
+{
+    const Model::Mesh &mesh = m_Model.m_pMesh[meshIndex];
+    const uint16_t *indexData = (const uint16_t*)(m_Model.m_pIndexData + mesh.indexDataByteOffset);
+
+    uint32_t triCount = mesh.indexCount / 3;
+    uint32_t leafCount = aabbLeafCount(triCount);
+    aabbs.resize(leafCount);
+    for (uint32_t a = 0; a < leafCount; a++)
+    {
+        D3D12_RAYTRACING_AABB &aabb = aabbs[a];
+        aabb = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        uint32_t triEnd = min((a + 1) * TRIS_PER_AABB, triCount);
+        for (uint32_t i = a * TRIS_PER_AABB * 3; i < triEnd * 3; i++)
+        {
+            const float *v = (const float*)(positions + stride * indexData[i]);
+            aabb.MinX = min(aabb.MinX, v[0]);
+            aabb.MinY = min(aabb.MinY, v[1]);
+            aabb.MinZ = min(aabb.MinZ, v[2]);
+            aabb.MaxX = max(aabb.MaxX, v[0]);
+            aabb.MaxY = max(aabb.MaxY, v[1]);
+            aabb.MaxZ = max(aabb.MaxZ, v[2]);
+        }
+    }
+}
+
+// Updates the acceleration structures in place after their inputs (vertices or AABBs) have moved.
+// The topology stays the same, so a refit is much cheaper than a build, but the tree degrades as
+// things move. With rebuild set, everything is built from scratch instead, which doesn't need the
+// structures to have been built with ALLOW_UPDATE.
+void DxrMsaaDemo::refitBvh(CommandContext& context, BVH &bvh, bool rebuild)
+{
+    ASSERT(rebuild || (bvh.topDesc.Inputs.Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE),
+        "refitting an acceleration structure built without allowUpdate");
+    context.FlushResourceBarriers();
+
+    ID3D12GraphicsCommandList *pCommandList = context.GetCommandList();
+    CComPtr<ID3D12GraphicsCommandList4> pRaytracingCommandList;
+    pCommandList->QueryInterface(IID_PPV_ARGS(&pRaytracingCommandList));
+
+    // the builds share a scratch buffer, so they need to be serialized
+    auto uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
+    for (D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc : bvh.bottomDesc)
+    {
+        if (!rebuild)
+        {
+            desc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+            desc.SourceAccelerationStructureData = desc.DestAccelerationStructureData;
+        }
+        pRaytracingCommandList->BuildRaytracingAccelerationStructure(&desc, 0, nullptr);
+        pCommandList->ResourceBarrier(1, &uavBarrier);
+    }
+
+    // the instances don't move, so the top level only needs refitting, unless it wasn't built for it
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = bvh.topDesc;
+    if (!rebuild)
+    {
+        desc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+        desc.SourceAccelerationStructureData = desc.DestAccelerationStructureData;
+    }
+    pRaytracingCommandList->BuildRaytracingAccelerationStructure(&desc, 0, nullptr);
+    pCommandList->ResourceBarrier(1, &uavBarrier);
+}
+
+// Moves the animated meshes, and brings the AABBs and acceleration structures up to date. The AABBs
+// are enlarged the same way they were at startup, so beams stay conservative against the moved triangles.
+void DxrMsaaDemo::UpdateAnimatedMeshes(CommandContext& context)
+{
+    if (!animateMeshes || m_animatedMeshes.empty())
+        return;
+
+    ScopedTimer _prof(L"Update Animated Meshes", context);
+
+    context.TransitionResource(m_Model.m_VertexBuffer, D3D12_RESOURCE_STATE_COPY_DEST);
+    context.TransitionResource(m_positionStream, D3D12_RESOURCE_STATE_COPY_DEST, true);
+    float maxSahRatio = 0.0f;
+    std::vector<std::vector<D3D12_RAYTRACING_AABB>> leafAABBs(m_animatedMeshes.size());
+    for (uint32_t k = 0; k < uint32_t(m_animatedMeshes.size()); k++)
+    {
+        const Model::Mesh &mesh = m_Model.m_pMesh[m_animatedMeshes[k]];
+        uint8_t *vertexData = m_Model.m_pVertexData + mesh.vertexDataByteOffset;
+
+        swayPositions(m_animatedRestPositions[k].data(), mesh.vertexCount, m_animationTime, animationAmplitude,
+            vertexData + mesh.attrib[Model::attrib_position].offset, mesh.vertexStride);
+        // normals and tangents keep their rest pose
+        context.WriteBuffer(m_Model.m_VertexBuffer, mesh.vertexDataByteOffset, vertexData, mesh.vertexCount * mesh.vertexStride);
+
+        // the whole blocks holding the mesh's triangles
+        writePositionStream(m_animatedMeshes[k]);
+#if TILE_BINNING
+        writeBinnerTriangles(m_animatedMeshes[k]);
+#endif
+        const RayTraceMeshInfo &info = m_meshInfo[m_animatedMeshes[k]];
+        uint32_t blockBegin = info.triOffset / POSITION_STREAM_BLOCK;
+        uint32_t blockEnd = (info.triOffset + info.triCount + POSITION_STREAM_BLOCK - 1) / POSITION_STREAM_BLOCK;
+        size_t blockDwords = POSITION_STREAM_BLOCK * POSITION_STREAM_DWORDS;
+        context.WriteBuffer(m_positionStream, blockBegin * blockDwords * sizeof(uint32_t),
+            &m_positionStream_cpu[blockBegin * blockDwords], (blockEnd - blockBegin) * blockDwords * sizeof(uint32_t));
+
+        fitLeafAABBs(m_animatedMeshes[k], vertexData + mesh.attrib[Model::attrib_position].offset, mesh.vertexStride, leafAABBs[k]);
+        m_animatedBvh[k].Refit(leafAABBs[k]);
+        if (m_animatedBvhBuildSah[k] > 0.0f)
+            maxSahRatio = max(maxSahRatio, m_animatedBvh[k].SahCost() / m_animatedBvhBuildSah[k]);
+    }
+    context.TransitionResource(m_Model.m_VertexBuffer, D3D12_RESOURCE_STATE_GENERIC_READ);
+    context.TransitionResource(m_positionStream, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+
+    bool rebuild = maxSahRatio > BVH_REBUILD_SAH_RATIO;
+    if (rebuild)
+    {
+        for (uint32_t k = 0; k < uint32_t(m_animatedMeshes.size()); k++)
+        {
+            m_animatedBvh[k].Build(leafAABBs[k]);
+            m_animatedBvhBuildSah[k] = m_animatedBvh[k].SahCost();
+        }
+        m_bvhRebuildCount++;
+    }
+    else
+    {
+        m_bvhRefitCount++;
+    }
+    m_bvhSahRatio = rebuild ? 1.0f : maxSahRatio;
+
+    createAABBs(m_ModelAABBs_primary, nullptr, false, m_ModelAABBs_primaryEnlargement, &context);
+#if SUPER_TILE
+    createAABBs(m_ModelAABBs_superTile, nullptr, false, m_ModelAABBs_superTileEnlargement, &context);
+#endif
+#if MULTI_VIEW
+    createAABBs(m_ModelAABBs_multiView, nullptr, false, m_ModelAABBs_multiViewEnlargement, &context);
+#endif
+#if LENS_DISTORTION
+    createAABBs(m_ModelAABBs_lens, nullptr, false, m_ModelAABBs_lensEnlargement, &context);
+#endif
+#if DYNAMIC_RESOLUTION
+    createAABBs(m_ModelAABBs_dynamicResolution, nullptr, false, m_ModelAABBs_dynamicResolutionEnlargement, &context);
+#endif
+#if SHADOW_MODE == SHADOW_MODE_BEAM
+    for (uint32_t p = 0; p < SHADOW_PARTITIONS; p++)
+    {
+        createAABBs(m_ModelAABBs_shadow[p], p == 0 ? &m_ModelAABBs_shadow_payload : nullptr, true,
+            m_ModelAABBs_shadowEnlargement[p], &context);
+    }
+#elif SHADOW_MODE == SHADOW_MODE_HARD
+    createAABBs(m_ModelAABBs_sun, nullptr, false, m_ModelAABBs_sunEnlargement, &context);
+#endif
+#if BEAM_AO
+    createAABBs(m_ModelAABBs_ao, nullptr, false, m_ModelAABBs_aoEnlargement, &context);
+#endif
+
+    refitBvh(context, g_bvhTriangles, rebuild);
+    refitBvh(context, g_bvhAABBs_primary, rebuild);
+#if SUPER_TILE
+    refitBvh(context, g_bvhAABBs_superTile, rebuild);
+#endif
+#if MULTI_VIEW
+    refitBvh(context, g_bvhAABBs_multiView, rebuild);
+#endif
+#if LENS_DISTORTION
+    refitBvh(context, g_bvhAABBs_lens, rebuild);
+#endif
+#if DYNAMIC_RESOLUTION
+    refitBvh(context, g_bvhAABBs_dynamicResolution, rebuild);
+#endif
+#if SHADOW_MODE == SHADOW_MODE_BEAM
+    refitBvh(context, g_bvhAABBs_shadow, rebuild);
+#elif SHADOW_MODE == SHADOW_MODE_HARD
+    refitBvh(context, g_bvhAABBs_sun, rebuild);
+#endif
+#if BEAM_AO
+    refitBvh(context, g_bvhAABBs_ao, rebuild);
+#endif
+}
+
+// Load time comparison of refitting against rebuilding, on the CPU BVHs, as the meshes sway further from
+// their rest pose. The largest mesh is included so there's something to measure even without animated meshes.
+void DxrMsaaDemo::BenchmarkBvhRefit()
+{
+    std::vector<uint32_t> meshes = m_animatedMeshes;
+    uint32_t largestMesh = 0;
+    for (uint32_t m = 1; m < m_Model.m_Header.meshCount; m++)
+    {
+        if (m_Model.m_pMesh[m].indexCount > m_Model.m_pMesh[largestMesh].indexCount)
+            largestMesh = m;
+    }
+    if (std::find(meshes.begin(), meshes.end(), largestMesh) == meshes.end())
+        meshes.push_back(largestMesh);
+
+    const float amplitudeScales[] = { .25f, .5f, 1.0f, 2.0f };
+    for (uint32_t m : meshes)
+    {
+        const Model::Mesh &mesh = m_Model.m_pMesh[m];
+        const uint8_t *positions = m_Model.m_pVertexData + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
+
+        std::vector<float> rest(mesh.vertexCount * 3);
+        for (uint32_t v = 0; v < mesh.vertexCount; v++)
+            memcpy(&rest[v * 3], positions + v * mesh.vertexStride, 3 * sizeof(float));
+
+        std::vector<D3D12_RAYTRACING_AABB> leafAABBs;
+        fitLeafAABBs(m, positions, mesh.vertexStride, leafAABBs);
+        CpuBvh restBvh;
+        restBvh.Build(leafAABBs);
+        float restSah = restBvh.SahCost();
+
+        std::vector<float> swayed(mesh.vertexCount * 3);
+        for (float scale : amplitudeScales)
+        {
+            float amplitude = scale * animationAmplitude;
+            swayPositions(rest.data(), mesh.vertexCount, 1.0f, amplitude, (uint8_t*)swayed.data(), 3 * sizeof(float));
+            fitLeafAABBs(m, (const uint8_t*)swayed.data(), 3 * sizeof(float), leafAABBs);
+
+            CpuBvh refitted = restBvh;
+            int64_t refitStart = SystemTime::GetCurrentTick();
+            refitted.Refit(leafAABBs);
+            int64_t refitEnd = SystemTime::GetCurrentTick();
+
+            CpuBvh rebuilt;
+            rebuilt.Build(leafAABBs);
+            int64_t rebuildEnd = SystemTime::GetCurrentTick();
+
+            float refitRatio = restSah > 0.0f ? refitted.SahCost() / restSah : 1.0f;
+            float rebuildRatio = restSah > 0.0f ? rebuilt.SahCost() / restSah : 1.0f;
+            Utility::Printf("bvh refit benchmark: mesh %u (%u tris), sway %.0f: refit %.3f ms (SAH %.2fx), rebuild %.3f ms (SAH %.2fx)%s\n",
+                m, mesh.indexCount / 3, amplitude,
+                SystemTime::TicksToMillisecs(refitEnd - refitStart), refitRatio,
+                SystemTime::TicksToMillisecs(rebuildEnd - refitEnd), rebuildRatio,
+                refitRatio > BVH_REBUILD_SAH_RATIO ? ", would rebuild" : "");
+        }
+    }
+}
+#endif
+
+#if SUPER_TILE || MULTI_VIEW
+// Direction of the camera ray through (tileX, tileY), in tiles, the same projection as GenerateCameraRay without the jitter.
+Vector3 DxrMsaaDemo::CameraTileRayDir(float tileX, float tileY)
+{
+    float tanHalfFoV = tanf(m_Camera.GetFOV() * .5f);
+    float aspect = float(g_SceneColorBuffer.GetWidth()) / g_SceneColorBuffer.GetHeight();
+    return m_Camera.GetForwardVec()
+        + m_Camera.GetRightVec() * (tanHalfFoV * aspect * (tileX / m_tilesX * 2.0f - 1.0f))
+        + m_Camera.GetUpVec() * (tanHalfFoV * (1.0f - tileY / m_tilesY * 2.0f));
+}
+
+// A camera ray through a CpuBvh over leaf AABBs, summed over the instances. The hit leaves, when asked for, are keyed
+// by instance * aabbs.size() + leaf, and sorted.
+void DxrMsaaDemo::TraceCameraRay(const CpuBvh &bvh, const std::vector<D3D12_RAYTRACING_AABB> &aabbs, const Vector3 &origin, const Vector3 &dir,
+    uint32_t &nodeVisits, uint32_t &leafHits, std::vector<uint32_t> *hits)
+{
+    const float rayDir[3] = { dir.GetX(), dir.GetY(), dir.GetZ() };
+
+    nodeVisits = 0;
+    leafHits = 0;
+    if (hits)
+        hits->clear();
+    std::vector<uint32_t> instanceHits;
+    for (uint32_t i = 0; i < uint32_t(m_instanceTransforms.size()); i++)
+    {
+        // the instances only translate
+        const InstanceTransform &xf = m_instanceTransforms[i];
+        const float rayOrigin[3] = { origin.GetX() - xf.row0.w, origin.GetY() - xf.row1.w, origin.GetZ() - xf.row2.w };
+        uint32_t instanceNodeVisits;
+        uint32_t instanceLeafHits;
+        instanceHits.clear();
+        bvh.RayQuery(rayOrigin, rayDir, aabbs, instanceNodeVisits, instanceLeafHits, hits ? &instanceHits : nullptr);
+        nodeVisits += instanceNodeVisits;
+        leafHits += instanceLeafHits;
+        if (hits)
+        {
+            for (uint32_t leaf : instanceHits)
+                hits->push_back(i * uint32_t(aabbs.size()) + leaf);
+        }
+    }
+    if (hits)
+        std::sort(hits->begin(), hits->end());
+}
+#endif
+
+#if SUPER_TILE
+// Load time estimate of where super-tiles pay off, at the starting camera. CPU BVHs over the same enlarged AABBs
+// stand in for the acceleration structures, and a ray through each tile and super-tile counts the nodes it
+// visits and the leaves it hits (intersection shader invocations).
+// Without super-tiles, every tile pays for its own traversal and leaves. With them, the super-tile pays for one
+// traversal, and every tile within it tests all of the super-tile's leaves (an upper bound, the super-tile beam
+// culls some of them first). So super-tiles pay off where the traversal they share outweighs the candidates the
+// tiles don't need, which depends on how many surfaces overlap a tile. The super-tiles are binned by that depth
+// complexity (leaf hits per tile ray).
+void DxrMsaaDemo::AnalyzeSuperTiles(const std::vector<D3D12_RAYTRACING_AABB> &tileAABBs, const std::vector<D3D12_RAYTRACING_AABB> &superTileAABBs)
+{
+    int64_t start = SystemTime::GetCurrentTick();
+
+    CpuBvh tileBvh;
+    tileBvh.Build(tileAABBs);
+    CpuBvh superTileBvh;
+    superTileBvh.Build(superTileAABBs);
+
+    Vector3 camPos = m_Camera.GetPosition();
+
+    // bin 0 is under 1 leaf per tile, bin b covers [2^(b-1), 2^b), and the last bin is open ended
+    const uint32_t binCount = 9;
+    struct CrossoverBin
+    {
+        uint32_t superTiles;
+        uint32_t tiles;
+        double tileCost; // tile beams only
+        double superTileCost; // super-tile beams and refinement
+    };
+    CrossoverBin bins[binCount] = {};
+
+    for (uint32_t sy = 0; sy < m_superTilesY; sy++)
+    {
+        for (uint32_t sx = 0; sx < m_superTilesX; sx++)
+        {
+            uint32_t superTileNodeVisits;
+            uint32_t superTileLeafHits;
+            TraceCameraRay(superTileBvh, superTileAABBs, camPos,
+                CameraTileRayDir((sx + .5f) * SUPER_TILE_DIM_X, (sy + .5f) * SUPER_TILE_DIM_Y),
+                superTileNodeVisits, superTileLeafHits);
+
+            uint32_t tiles = 0;
+            uint64_t tileLeafHits = 0;
+            double tileCost = 0.0;
+            for (uint32_t ty = sy * SUPER_TILE_DIM_Y; ty < std::min((sy + 1) * SUPER_TILE_DIM_Y, m_tilesY); ty++)
+            {
+                for (uint32_t tx = sx * SUPER_TILE_DIM_X; tx < std::min((sx + 1) * SUPER_TILE_DIM_X, m_tilesX); tx++)
+                {
+                    uint32_t nodeVisits;
+                    uint32_t leafHits;
+                    TraceCameraRay(tileBvh, tileAABBs, camPos, CameraTileRayDir(tx + .5f, ty + .5f), nodeVisits, leafHits);
+
+                    tileCost += nodeVisits * SUPER_TILE_NODE_COST + leafHits;
+                    tileLeafHits += leafHits;
+                    tiles++;
+                }
+            }
+
+            double superTileCost = superTileNodeVisits * SUPER_TILE_NODE_COST + superTileLeafHits
+                + double(tiles) * superTileLeafHits;
+
+            float depthComplexity = float(tileLeafHits) / tiles;
+            uint32_t bin = depthComplexity < 1.0f ? 0 : std::min(binCount - 1, uint32_t(log2f(depthComplexity)) + 1);
+            bins[bin].superTiles++;
+            bins[bin].tiles += tiles;
+            bins[bin].tileCost += tileCost;
+            bins[bin].superTileCost += superTileCost;
+        }
+    }
+
+    CrossoverBin total = {};
+    for (uint32_t b = 0; b < binCount; b++)
+    {
+        const CrossoverBin &bin = bins[b];
+        total.superTiles += bin.superTiles;
+        total.tiles += bin.tiles;
+        total.tileCost += bin.tileCost;
+        total.superTileCost += bin.superTileCost;
+        if (bin.superTiles == 0)
+            continue;
+
+        char depthRange[32];
+        if (b == binCount - 1)
+            sprintf_s(depthRange, "%u+", 1 << (b - 1));
+        else
+            sprintf_s(depthRange, "%u-%u", b == 0 ? 0 : 1 << (b - 1), 1 << b);
+        Utility::Printf("super-tile crossover, %s leaves per tile: %u super-tiles, cost per tile %.1f tile beams, %.1f super-tiles (%.2fx)%s\n",
+            depthRange, bin.superTiles, bin.tileCost / bin.tiles, bin.superTileCost / bin.tiles,
+            bin.superTileCost / bin.tileCost, bin.superTileCost < bin.tileCost ? ", pays off" : "");
+    }
+
+    int64_t end = SystemTime::GetCurrentTick();
+    Utility::Printf("super-tile crossover, all: cost per tile %.1f tile beams, %.1f super-tiles (%.2fx), %u tile BVH nodes, %u super-tile BVH nodes, %.0f ms\n",
+        total.tileCost / total.tiles, total.superTileCost / total.tiles, total.superTileCost / total.tileCost,
+        tileBvh.NodeCount(), superTileBvh.NodeCount(), SystemTime::TicksToMillisecs(end - start));
+}
+#endif
+
+#if MULTI_VIEW
+// CPU reference of the multi-view beams, at the starting camera and for a range of view separations. Compares one
+// traversal against the grown AABBs followed by each view's tests, against a traversal per view, and splits the
+// shared candidates per view with the backface test of TriTileSetup. Every leaf a view's own traversal hits must
+// also be a shared candidate, the missed count checks that. Sampled every few tiles.
+void DxrMsaaDemo::AnalyzeMultiView(const std::vector<D3D12_RAYTRACING_AABB> &tileAABBs)
+{
+    int64_t start = SystemTime::GetCurrentTick();
+
+    const uint32_t tileStep = 4;
+    const uint32_t aabbCount = uint32_t(tileAABBs.size());
+
+    // leaf AABB to its mesh and first triangle, in the layout of createAABBs without clusters
+    std::vector<uint32_t> leafMesh;
+    std::vector<uint32_t> leafFirstTri;
+    for (uint32_t m = 0; m < m_Model.m_Header.meshCount; m++)
+    {
+        uint32_t leafCount = aabbLeafCount(m_meshInfo[m].triCount);
+        for (uint32_t a = 0; a < leafCount; a++)
+        {
+            leafMesh.push_back(m);
+            leafFirstTri.push_back(a * TRIS_PER_AABB);
+        }
+    }
+    ASSERT(leafMesh.size() == tileAABBs.size(), "expected the primary leaf AABBs");
+
+    // triangles of the leaf that pass TriTileSetup from origin (object space)
+    auto setupPassCount = [&](uint32_t leaf, const Vector3 &origin)
+    {
+        const Model::Mesh &mesh = m_Model.m_pMesh[leafMesh[leaf]];
+        const uint16_t *indexData = (const uint16_t*)(m_Model.m_pIndexData + mesh.indexDataByteOffset);
+        const uint8_t *positions = m_Model.m_pVertexData + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
+        uint32_t triEnd = std::min(leafFirstTri[leaf] + TRIS_PER_AABB, mesh.indexCount / 3);
+
+        uint32_t passCount = 0;
+        for (uint32_t t = leafFirstTri[leaf]; t < triEnd; t++)
+        {
+            Vector3 v[3];
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                const float *p = (const float*)(positions + indexData[t * 3 + c] * mesh.vertexStride);
+                v[c] = Vector3(p[0], p[1], p[2]);
+            }
+            if (float(Dot(origin - v[0], Cross(v[1] - v[0], v[2] - v[0]))) >= 0.0f)
+                passCount++;
+        }
+        return passCount;
+    };
+
+    CpuBvh tileBvh;
+    tileBvh.Build(tileAABBs);
+
+    Vector3 camPos = m_Camera.GetPosition();
+    Vector3 right = m_Camera.GetRightVec();
+
+    // hits are keyed by instance * aabbCount + leaf, see TraceCameraRay
+    auto instanceOrigin = [&](const Vector3 &origin, uint32_t key)
+    {
+        const InstanceTransform &xf = m_instanceTransforms[key / aabbCount];
+        return origin - Vector3(xf.row0.w, xf.row1.w, xf.row2.w);
+    };
+
+    const float separations[] = { 0.0f, 1.625f, 3.25f, 6.5f, 13.0f, 26.0f, 52.0f };
+    std::vector<D3D12_RAYTRACING_AABB> grownAABBs(tileAABBs.size());
+    std::vector<uint32_t> sharedHits;
+    std::vector<uint32_t> viewHits;
+    for (float separation : separations)
+    {
+        // growAABB, by the furthest a view is from the middle
+        float growRadius = separation * .5f;
+        for (size_t a = 0; a < tileAABBs.size(); a++)
+        {
+            D3D12_RAYTRACING_AABB aabb = tileAABBs[a];
+            aabb.MinX -= growRadius;
+            aabb.MinY -= growRadius;
+            aabb.MinZ -= growRadius;
+            aabb.MaxX += growRadius;
+            aabb.MaxY += growRadius;
+            aabb.MaxZ += growRadius;
+            grownAABBs[a] = aabb;
+        }
+        CpuBvh sharedBvh;
+        sharedBvh.Build(grownAABBs);
+
+        Vector3 viewOrigins[MULTI_VIEW_COUNT];
+        for (uint32_t v = 0; v < MULTI_VIEW_COUNT; v++)
+            viewOrigins[v] = camPos + right * (separation * v / max(MULTI_VIEW_COUNT - 1, 1));
+        Vector3 centerOrigin = camPos + right * (separation * .5f);
+
+        uint32_t tiles = 0;
+        double sharedCost = 0.0;
+        double independentCost = 0.0;
+        uint64_t sharedCandidates = 0; // summed over the views
+        uint64_t independentCandidates = 0;
+        uint32_t missed = 0;
+        for (uint32_t ty = tileStep / 2; ty < m_tilesY; ty += tileStep)
+        {
+            for (uint32_t tx = tileStep / 2; tx < m_tilesX; tx += tileStep)
+            {
+                Vector3 rayDir = CameraTileRayDir(tx + .5f, ty + .5f);
+
+                uint32_t sharedNodeVisits;
+                uint32_t sharedLeafHits;
+                TraceCameraRay(sharedBvh, grownAABBs, centerOrigin, rayDir, sharedNodeVisits, sharedLeafHits, &sharedHits);
+                sharedCost += sharedNodeVisits * CPU_BVH_TRAVERSAL_COST + double(sharedHits.size()) * TRIS_PER_AABB * MULTI_VIEW_COUNT;
+
+                for (uint32_t v = 0; v < MULTI_VIEW_COUNT; v++)
+                {
+                    for (uint32_t key : sharedHits)
+                        sharedCandidates += setupPassCount(key % aabbCount, instanceOrigin(viewOrigins[v], key));
+
+                    uint32_t viewNodeVisits;
+                    uint32_t viewLeafHits;
+                    TraceCameraRay(tileBvh, tileAABBs, viewOrigins[v], rayDir, viewNodeVisits, viewLeafHits, &viewHits);
+                    independentCost += viewNodeVisits * CPU_BVH_TRAVERSAL_COST + double(viewHits.size()) * TRIS_PER_AABB;
+
+                    for (uint32_t key : viewHits)
+                    {
+                        independentCandidates += setupPassCount(key % aabbCount, instanceOrigin(viewOrigins[v], key));
+                        if (!std::binary_search(sharedHits.begin(), sharedHits.end(), key))
+                            missed++;
+                    }
+                }
+                tiles++;
+            }
+        }
+
+        Utility::Printf("multi-view, %u views %.2f apart%s: cost per tile %.1f independent, %.1f shared (%.2fx), candidates per tile and view %.1f independent, %.1f shared, %u missed\n",
+            MULTI_VIEW_COUNT, separation, separation > MULTI_VIEW_MAX_SEPARATION ? " (beyond MULTI_VIEW_MAX_SEPARATION)" : "",
+            independentCost / tiles, sharedCost / tiles, sharedCost / independentCost,
+            float(independentCandidates) / (tiles * MULTI_VIEW_COUNT), float(sharedCandidates) / (tiles * MULTI_VIEW_COUNT), missed);
+    }
+
+    int64_t end = SystemTime::GetCurrentTick();
+    Utility::Printf("multi-view analysis: every %u tiles, %.0f ms\n", tileStep, SystemTime::TicksToMillisecs(end - start));
+}
+#endif
+
+#if LENS_DISTORTION
+// Sample efficiency of tracing through the distorted pixels, against render-then-warp. Render-then-warp renders a
+// rectilinear image covering the distorted view, at the density of the distorted image at its center (where the
+// distortion is the identity), and resamples it. Also reports the area of the tile beams' bounds (as in
+// GenerateTileRectRays) against the distorted tile footprints.
+void DxrMsaaDemo::AnalyzeLensDistortion()
+{
+    uint32_t width = g_SceneColorBuffer.GetWidth();
+    uint32_t height = g_SceneColorBuffer.GetHeight();
+    float aspect = float(width) / height;
+
+    // pincushion, none and barrel, then the current and the largest coefficients, as seen through the rectilinear view
+    const float coefficients[][2] =
+    {
+        { LENS_DISTORTION_K1_MIN, 0.0f },
+        { -0.1f, 0.0f },
+        { 0.0f, 0.0f },
+        { 0.1f, 0.0f },
+        { float(lensK1), float(lensK2) },
+        { LENS_DISTORTION_K1_MAX, LENS_DISTORTION_K2_MAX },
+    };
+    for (const float *k : coefficients)
+    {
+        float4 lens = LensParams(k[0], k[1], aspect);
+        bool distorted = k[0] != 0.0f || k[1] != 0.0f;
+
+        float extentX, extentY;
+        LensViewExtent(lens, extentX, extentY);
+        double warpSamples = double(width * extentX) * double(height * extentY);
+
+        double boundsArea = 0.0;
+        double footprintArea = 0.0;
+        float tileScaleX = 2.0f / m_tilesX;
+        float tileScaleY = 2.0f / m_tilesY;
+        float padX = LENS_DISTORTION_BEAM_PAD * tileScaleX / TILE_DIM_X;
+        float padY = LENS_DISTORTION_BEAM_PAD * tileScaleY / TILE_DIM_Y;
+        for (uint32_t tileY = 0; tileY < m_tilesY; tileY++)
+        {
+            for (uint32_t tileX = 0; tileX < m_tilesX; tileX++)
+            {
+                // y up, as in GenerateTileRectRays
+                float x0 = tileX * tileScaleX - 1.0f;
+                float x1 = x0 + tileScaleX;
+                float y1 = 1.0f - tileY * tileScaleY;
+                float y0 = y1 - tileScaleY;
+
+                float4 bounds = { x0, y0, x1, y1 };
+                if (distorted)
+                    bounds = LensRectBounds(x0 - padX, x1 + padX, y0 - padY, y1 + padY, lens);
+                boundsArea += double(bounds.z - bounds.x) * (bounds.w - bounds.y);
+
+                // the Jacobian's eigenvalues are g and g + 2 r2 g'
+                float r2 = LensRadius2((x0 + x1) * .5f, (y0 + y1) * .5f, lens);
+                float g = LensScale(r2, lens);
+                float radial = g + 2.0f * r2 * LensScaleDerivative(r2, lens);
+                footprintArea += fabs(double(g) * radial) * tileScaleX * tileScaleY;
+            }
+        }
+
+        Utility::Printf("lens distortion, k1 %.2f k2 %.2f: view %.2fx%.2f, render-then-warp %.2fx the samples (%.0fx%.0f), tile beam bounds %.3fx the footprints\n",
+            k[0], k[1], extentX, extentY, warpSamples / (double(width) * height),
+            width * extentX, height * extentY, boundsArea / footprintArea);
+    }
+}
+#endif
+
+#if SHADOW_MODE == SHADOW_MODE_BEAM && SHADOW_CLUSTER_SIZE > 1
+// Shadow beams from random points on the scene's triangles (object space, and the first instance's triangles only),
+// accumulated the way IntersectionShadow and AnyHitShadow do it, with the clusters against the leaves only. One
+// ray toward the area light through a CpuBvh over the receiver's partition of enlarged boxes gives the candidates,
+// which add their coverage nearest first until the beam is opaque (the GPU's anyhit order is up to the traversal).
+// The shadows don't depend on the view, so the points are spread over the model instead of the camera positions.
+void DxrMsaaDemo::AnalyzeShadowClusters(const std::vector<D3D12_RAYTRACING_AABB> *partitionAABBs, const std::vector<ShadowAABBPayload> &payload)
+{
+    int64_t start = SystemTime::GetCurrentTick();
+
+    const uint32_t pointCount = 4096;
+
+    // the triangles that aren't entirely transparent, 9 floats each
+    std::vector<float> triVerts;
+    for (uint32_t m = 0; m < m_Model.m_Header.meshCount; m++)
+    {
+        const Model::Mesh &mesh = m_Model.m_pMesh[m];
+        const uint16_t *indexData = (const uint16_t*)(m_Model.m_pIndexData + mesh.indexDataByteOffset);
+        const uint8_t *positions = m_Model.m_pVertexData + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
+        uint32_t opacityMaskOffset = m_opacityMaskOffset[m];
+
+        for (uint32_t t = 0; t < mesh.indexCount / 3; t++)
+        {
+            if (opacityMaskOffset != OPACITY_MASK_NONE && m_opacityMasks_cpu[opacityMaskOffset + t] == OPACITY_MASK_ALL_TRANSPARENT)
+                continue;
+            for (uint32_t v = 0; v < 3; v++)
+            {
+                const float *p = (const float*)(positions + indexData[t * 3 + v] * mesh.vertexStride);
+                triVerts.insert(triVerts.end(), p, p + 3);
+            }
+        }
+    }
+    uint32_t triCount = uint32_t(triVerts.size() / 9);
+    if (triCount == 0 || payload.empty())
+        return;
+
+    // the leaves name their clusters, everything else is a leaf
+    std::vector<bool> isCluster(payload.size(), false);
+    for (const ShadowAABBPayload &box : payload)
+    {
+        if (box.cluster != SHADOW_CLUSTER_NONE)
+            isCluster[box.cluster] = true;
+    }
+
+    CpuBvh partitionBvhs[SHADOW_PARTITIONS];
+    for (uint32_t p = 0; p < SHADOW_PARTITIONS; p++)
+        partitionBvhs[p].Build(partitionAABBs[p]);
+
+    auto vertex = [&triVerts](uint32_t tri, uint32_t v)
+    {
+        const float *p = &triVerts[tri * 9 + v * 3];
+        return float3(p[0], p[1], p[2]);
+    };
+
+    ReportRandom random;
+
+    std::vector<uint32_t> hitPrims;
+    std::vector<std::pair<float, uint32_t>> hits;
+
+    // opacity of the beam over the candidates in hitPrims
+    auto beamOpacity = [&](float3 origin, float3 dir, float3 beamExtents, bool clusters, uint64_t &anyHits)
+    {
+        hits.clear();
+        for (uint32_t prim : hitPrims)
+        {
+            const ShadowAABBPayload &box = payload[prim];
+            // exactly one of a cluster and its leaves contributes, see IntersectionShadow
+            if (clusters && box.cluster != SHADOW_CLUSTER_NONE && ShadowBeamTakesCluster(origin, beamExtents, payload[box.cluster]))
+                continue;
+            if (isCluster[prim] && !(clusters && ShadowBeamTakesCluster(origin, beamExtents, box)))
+                continue;
+
+            float t = ShadowAABBNearT(box, origin, dir);
+            if (t > 0.0f)
+                hits.push_back(std::make_pair(t, prim));
+        }
+        std::sort(hits.begin(), hits.end());
+
+        float opacity = 0.0f;
+        for (const std::pair<float, uint32_t> &hit : hits)
+        {
+            anyHits++;
+            opacity += ShadowBeamCoverage(payload[hit.second], origin, dir, hit.first, beamExtents);
+            if (opacity >= 1.0f)
+                return 1.0f;
+        }
+        return opacity;
+    };
+
+    uint32_t sampledPoints = 0;
+    double leafSum = 0.0, clusterSum = 0.0, sqDifference = 0.0;
+    float maxDifference = 0.0f;
+    uint32_t differingPoints = 0;
+    uint64_t leafAnyHits = 0, clusterAnyHits = 0;
+    for (uint32_t i = 0; i < pointCount; i++)
+    {
+        uint32_t tri = std::min(uint32_t(random() * triCount), triCount - 1);
+        float3 v0 = vertex(tri, 0);
+        float3 e0 = vertex(tri, 1) - v0;
+        float3 e1 = vertex(tri, 2) - v0;
+
+        float b0 = random();
+        float b1 = random();
+        if (b0 + b1 > 1.0f)
+        {
+            b0 = 1.0f - b0;
+            b1 = 1.0f - b1;
+        }
+        float3 origin = v0 + e0 * b0 + e1 * b1;
+
+        // same beam as the RayGen shaders trace from either face
+        float3 dir = normalize(AREA_LIGHT_CENTER - origin);
+        float3 beamExtents = ShadowBeamExtents(origin);
+
+        // same as ShadowPartition
+        int cellX = int((origin.x - m_shadowPartitionOrigin.x) * m_shadowPartitionScale.x);
+        int cellZ = int((origin.z - m_shadowPartitionOrigin.y) * m_shadowPartitionScale.y);
+        cellX = std::min(std::max(cellX, 0), SHADOW_PARTITIONS_X - 1);
+        cellZ = std::min(std::max(cellZ, 0), SHADOW_PARTITIONS_Z - 1);
+        uint32_t p = cellZ * SHADOW_PARTITIONS_X + cellX;
+
+        const float o[3] = { origin.x, origin.y, origin.z };
+        const float d[3] = { dir.x, dir.y, dir.z };
+        uint32_t nodeVisits, primHits;
+        hitPrims.clear();
+        partitionBvhs[p].RayQuery(o, d, partitionAABBs[p], nodeVisits, primHits, &hitPrims);
+
+        float leaf = beamOpacity(origin, dir, beamExtents, false, leafAnyHits);
+        float clustered = beamOpacity(origin, dir, beamExtents, true, clusterAnyHits);
+
+        sampledPoints++;
+        leafSum += leaf;
+        clusterSum += clustered;
+        float difference = fabsf(clustered - leaf);
+        sqDifference += difference * difference;
+        maxDifference = std::max(maxDifference, difference);
+        differingPoints += difference > .05f ? 1 : 0;
+    }
+
+    double n = sampledPoints;
+    Utility::Printf("shadow clusters: %u points, opacity %.3f clustered vs %.3f leaf-only, RMS difference %.3f, max %.3f, %.1f%% of points off by more than .05\n",
+        sampledPoints, clusterSum / n, leafSum / n, sqrt(sqDifference / n), maxDifference, 100.0 * differingPoints / n);
+    Utility::Printf("shadow clusters: per beam, %.1f box coverages clustered vs %.1f leaf-only, %.0f ms\n",
+        clusterAnyHits / n, leafAnyHits / n, SystemTime::TicksToMillisecs(SystemTime::GetCurrentTick() - start));
+}
+#endif
+
+#if BEAM_AO
+// CPU reference for BEAM_AO, at random points on the scene's triangles (object space, and the first instance's
+// triangles only). The beams are emulated the way RayGenBeamAO traces them: one ray down each cone through a CpuBvh
+// over the grown AO boxes, adding up ShadowBeamCoverage for every box it reaches within BEAM_AO_RADIUS (the GPU
+// stops at full opacity, so its any-hit counts are lower). The reference is many cosine weighted thin rays against
+// the exact triangles, with alpha tested triangles opaque unless they're entirely transparent. Also reports as
+// many thin rays as there are cones, which is the noise the beams replace.
+void DxrMsaaDemo::AnalyzeBeamAO(const std::vector<D3D12_RAYTRACING_AABB> &aoAABBs, const std::vector<ShadowAABBPayload> &aoPayload)
+{
+    int64_t start = SystemTime::GetCurrentTick();
+
+    const uint32_t pointCount = 1024;
+    const uint32_t referenceRays = 256;
+
+    // the opaque triangles, 9 floats each, and their boxes
+    std::vector<float> triVerts;
+    std::vector<D3D12_RAYTRACING_AABB> triAABBs;
+    for (uint32_t m = 0; m < m_Model.m_Header.meshCount; m++)
+    {
+        const Model::Mesh &mesh = m_Model.m_pMesh[m];
+        const uint16_t *indexData = (const uint16_t*)(m_Model.m_pIndexData + mesh.indexDataByteOffset);
+        const uint8_t *positions = m_Model.m_pVertexData + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
+        uint32_t opacityMaskOffset = m_opacityMaskOffset[m];
+
+        for (uint32_t t = 0; t < mesh.indexCount / 3; t++)
+        {
+            if (opacityMaskOffset != OPACITY_MASK_NONE && m_opacityMasks_cpu[opacityMaskOffset + t] == OPACITY_MASK_ALL_TRANSPARENT)
+                continue;
+
+            D3D12_RAYTRACING_AABB box = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (uint32_t v = 0; v < 3; v++)
+            {
+                const float *p = (const float*)(positions + indexData[t * 3 + v] * mesh.vertexStride);
+                triVerts.insert(triVerts.end(), p, p + 3);
+                box.MinX = std::min(box.MinX, p[0]);
+                box.MinY = std::min(box.MinY, p[1]);
+                box.MinZ = std::min(box.MinZ, p[2]);
+                box.MaxX = std::max(box.MaxX, p[0]);
+                box.MaxY = std::max(box.MaxY, p[1]);
+                box.MaxZ = std::max(box.MaxZ, p[2]);
+            }
+            triAABBs.push_back(box);
+        }
+    }
+    uint32_t triCount = uint32_t(triAABBs.size());
+    if (triCount == 0 || aoAABBs.empty())
+        return;
+
+    CpuBvh triBvh;
+    triBvh.Build(triAABBs);
+    CpuBvh aoBvh;
+    aoBvh.Build(aoAABBs);
+
+    auto vertex = [&triVerts](uint32_t tri, uint32_t v)
+    {
+        const float *p = &triVerts[tri * 9 + v * 3];
+        return float3(p[0], p[1], p[2]);
+    };
+
+    ReportRandom random;
+
+    std::vector<uint32_t> hitPrims;
+
+    // does a thin ray hit a triangle within BEAM_AO_RADIUS
+    auto rayOccluded = [&](float3 origin, float3 dir, uint64_t &nodeVisits, uint64_t &triTests)
+    {
+        const float o[3] = { origin.x, origin.y, origin.z };
+        const float d[3] = { dir.x, dir.y, dir.z };
+        uint32_t queryNodeVisits, queryPrimHits;
+        hitPrims.clear();
+        triBvh.RayQuery(o, d, triAABBs, queryNodeVisits, queryPrimHits, &hitPrims, BEAM_AO_RADIUS);
+        nodeVisits += queryNodeVisits;
+        triTests += queryPrimHits;
+
+        for (uint32_t tri : hitPrims)
+        {
+            // Moller-Trumbore, both faces
+            float3 v0 = vertex(tri, 0);
+            float3 e0 = vertex(tri, 1) - v0;
+            float3 e1 = vertex(tri, 2) - v0;
+            float3 pv = cross(dir, e1);
+            float det = dot(e0, pv);
+            if (det == 0.0f)
+                continue;
+            float invDet = 1.0f / det;
+            float3 tv = origin - v0;
+            float u = dot(tv, pv) * invDet;
+            if (u < 0.0f || u > 1.0f)
+                continue;
+            float3 qv = cross(tv, e0);
+            float v = dot(dir, qv) * invDet;
+            if (v < 0.0f || u + v > 1.0f)
+                continue;
+            float t = dot(e1, qv) * invDet;
+            if (t > 0.0f && t <= BEAM_AO_RADIUS)
+                return true;
+        }
+        return false;
+    };
+
+    // occlusion of the BEAM_AO cones, as RayGenBeamAO would see it
+    auto beamOcclusion = [&](float3 origin, float3 normal, uint64_t &nodeVisits, uint64_t &anyHits)
+    {
+        float occlusion = 0.0f;
+        for (uint32_t c = 0; c < BEAM_AO_CONES; c++)
+        {
+            float3 dir = BeamAOConeDir(normal, c);
+            const float o[3] = { origin.x, origin.y, origin.z };
+            const float d[3] = { dir.x, dir.y, dir.z };
+            uint32_t queryNodeVisits, queryPrimHits;
+            hitPrims.clear();
+            aoBvh.RayQuery(o, d, aoAABBs, queryNodeVisits, queryPrimHits, &hitPrims, BEAM_AO_RADIUS);
+            nodeVisits += queryNodeVisits;
+
+            float opacity = 0.0f;
+            for (uint32_t leaf : hitPrims)
+            {
+                float t = ShadowAABBNearT(aoPayload[leaf], origin, dir);
+                if (t <= 0.0f || t > BEAM_AO_RADIUS)
+                    continue;
+                anyHits++;
+                opacity += ShadowBeamCoverage(aoPayload[leaf], origin, dir, t, float3(BEAM_AO_CONE_TAN, BEAM_AO_CONE_TAN, BEAM_AO_CONE_TAN));
+            }
+            occlusion += std::min(opacity, 1.0f);
+        }
+        return occlusion / BEAM_AO_CONES;
+    };
+
+    uint32_t sampledPoints = 0;
+    double referenceSum = 0.0, referenceVariance = 0.0;
+    double beamSum = 0.0, beamSqError = 0.0;
+    double thinSum = 0.0, thinSqError = 0.0;
+    uint64_t referenceNodeVisits = 0, referenceTriTests = 0;
+    uint64_t beamNodeVisits = 0, beamAnyHits = 0;
+    uint64_t thinNodeVisits = 0, thinTriTests = 0;
+    for (uint32_t i = 0; i < pointCount; i++)
+    {
+        uint32_t tri = std::min(uint32_t(random() * triCount), triCount - 1);
+        float3 v0 = vertex(tri, 0);
+        float3 e0 = vertex(tri, 1) - v0;
+        float3 e1 = vertex(tri, 2) - v0;
+        float3 normal = cross(e0, e1);
+        float normalLength = sqrtf(dot(normal, normal));
+        if (normalLength == 0.0f)
+            continue;
+        // either face could be the one in view
+        normal = normal * ((random() < .5f ? 1.0f : -1.0f) / normalLength);
+
+        float b0 = random();
+        float b1 = random();
+        if (b0 + b1 > 1.0f)
+        {
+            b0 = 1.0f - b0;
+            b1 = 1.0f - b1;
+        }
+        float3 origin = v0 + e0 * b0 + e1 * b1 + normal * BEAM_AO_BIAS;
+
+        float3 helper = fabsf(normal.y) < .9f ? float3(0, 1, 0) : float3(1, 0, 0);
+        float3 tangent = normalize(cross(helper, normal));
+        float3 bitangent = cross(normal, tangent);
+        auto cosineDir = [&]()
+        {
+            float phi = 6.2831853f * random();
+            float sinTheta2 = random();
+            float sinTheta = sqrtf(sinTheta2);
+            return tangent * (cosf(phi) * sinTheta) + bitangent * (sinf(phi) * sinTheta) + normal * sqrtf(1.0f - sinTheta2);
+        };
+
+        uint32_t referenceOccluded = 0;
+        for (uint32_t r = 0; r < referenceRays; r++)
+            referenceOccluded += rayOccluded(origin, cosineDir(), referenceNodeVisits, referenceTriTests) ? 1 : 0;
+        float reference = referenceOccluded / float(referenceRays);
+
+        uint32_t thinOccluded = 0;
+        for (uint32_t r = 0; r < BEAM_AO_CONES; r++)
+            thinOccluded += rayOccluded(origin, cosineDir(), thinNodeVisits, thinTriTests) ? 1 : 0;
+        float thin = thinOccluded / float(BEAM_AO_CONES);
+
+        float beam = beamOcclusion(origin, normal, beamNodeVisits, beamAnyHits);
+
+        sampledPoints++;
+        referenceSum += reference;
+        referenceVariance += reference * (1.0f - reference) / referenceRays;
+        beamSum += beam;
+        beamSqError += (beam - reference) * (beam - reference);
+        thinSum += thin;
+        thinSqError += (thin - reference) * (thin - reference);
+    }
+    if (sampledPoints == 0)
+        return;
+
+    double n = sampledPoints;
+    Utility::Printf("ambient occlusion beams: %u points, occlusion %.3f vs %.3f from %u rays (+-%.3f), RMS error %.3f; %u thin rays %.3f, RMS error %.3f\n",
+        sampledPoints, beamSum / n, referenceSum / n, referenceRays, sqrt(referenceVariance / n),
+        sqrt(beamSqError / n), BEAM_AO_CONES, thinSum / n, sqrt(thinSqError / n));
+    Utility::Printf("ambient occlusion beams: per point, beams %.0f nodes + %.1f box coverages, %u thin rays %.0f nodes + %.1f triangle tests, %.0f ms\n",
+        beamNodeVisits / n, beamAnyHits / n, BEAM_AO_CONES, thinNodeVisits / n, thinTriTests / n,
+        SystemTime::TicksToMillisecs(SystemTime::GetCurrentTick() - start));
+}
+#endif
+
+#if TILE_BINNING
+// Every instance of the mesh. These are the positions the beams see, unless POSITION_STREAM_QUANTIZED.
+void DxrMsaaDemo::writeBinnerTriangles(uint32_t meshIndex)
+{
+    const Model::Mesh &mesh = m_Model.m_pMesh[meshIndex];
+    const RayTraceMeshInfo &info = m_meshInfo[meshIndex];
+    const uint16_t *indexData = (const uint16_t*)(m_Model.m_pIndexData + mesh.indexDataByteOffset);
+    const uint8_t *positions = m_Model.m_pVertexData + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
+    uint32_t sceneTriCount = m_meshInfo.back().triOffset + m_meshInfo.back().triCount;
+    uint32_t opacityMaskOffset = m_opacityMaskOffset[meshIndex];
+
+    for (uint32_t i = 0; i < uint32_t(m_instanceTransforms.size()); i++)
+    {
+        const InstanceTransform &xf = m_instanceTransforms[i];
+        for (uint32_t t = 0; t < info.triCount; t++)
+        {
+            float world[3][3];
+            for (uint32_t v = 0; v < 3; v++)
+            {
+                const float *p = (const float*)(positions + indexData[t * 3 + v] * mesh.vertexStride);
+                world[v][0] = xf.row0.x * p[0] + xf.row0.y * p[1] + xf.row0.z * p[2] + xf.row0.w;
+                world[v][1] = xf.row1.x * p[0] + xf.row1.y * p[1] + xf.row1.z * p[2] + xf.row1.w;
+                world[v][2] = xf.row2.x * p[0] + xf.row2.y * p[1] + xf.row2.z * p[2] + xf.row2.w;
+            }
+
+            uint32_t index = i * sceneTriCount + info.triOffset + t;
+#if PRIM_ID_GLOBAL
+            uint32_t id = index;
+#else
+            uint32_t id = (meshIndex << PRIM_ID_BITS) | t;
+#endif
+            uint32_t opacityMask = opacityMaskOffset == OPACITY_MASK_NONE ?
+                OPACITY_MASK_ALL_OPAQUE : m_opacityMasks_cpu[opacityMaskOffset + t];
+            m_tileBinner.SetTriangle(index, world[0], world[1], world[2], id, opacityMask);
+        }
+    }
+}
+
+// same rays as GenerateCameraRay, see RaytraceDiffuseBeams
+void DxrMsaaDemo::BinTiles(const Math::Camera& camera, float jitterNormalizedX, float jitterNormalizedY)
+{
+    TileBinner::Camera binCamera;
+    const Vector3 vectors[4] = { camera.GetPosition(), camera.GetRightVec(), camera.GetUpVec(), camera.GetForwardVec() };
+    float *dests[4] = { binCamera.position, binCamera.right, binCamera.up, binCamera.forward };
+    for (int n = 0; n < 4; n++)
+    {
+        dests[n][0] = vectors[n].GetX();
+        dests[n][1] = vectors[n].GetY();
+        dests[n][2] = vectors[n].GetZ();
+    }
+    binCamera.projScaleX = camera.GetProjMatrix().GetX().GetX();
+    binCamera.projScaleY = camera.GetProjMatrix().GetY().GetY();
+    binCamera.jitterNormalizedX = jitterNormalizedX;
+    binCamera.jitterNormalizedY = jitterNormalizedY;
+
+    m_tileBinner.SetThreading(uint32_t(int(cpuTileBinningThreads)),
+        cpuTileBinningStealing ? TileScheduler::Mode::workStealing : TileScheduler::Mode::staticSplit);
+    m_tileBinner.SetPipelined(cpuTileBinningPipelined);
+    m_tileBinner.Bin(binCamera, m_tilesX, m_tilesY, TILE_MAX_TRIS, m_binnedTris_cpu, m_tileBinnerStats);
+}
+
+// Load time report of the CPU tile binning at the startup camera: its cost, against the thread count and a static
+// split of the tasks, and full screen against pipelined bands.
+void DxrMsaaDemo::ReportTileBinning()
+{
+    // best of a few, from the startup camera
+    float bestMs = FLT_MAX;
+    for (int n = 0; n < 4; n++)
+    {
+        BinTiles(m_Camera, 0.0f, 0.0f);
+        bestMs = std::min(bestMs, m_tileBinnerStats.milliseconds);
+    }
+
+    const TileBinner::Stats &stats = m_tileBinnerStats;
+    uint32_t tileCount = m_tilesX * m_tilesY;
+    Utility::Printf("tile binning: %u tris in, %u backfacing, %u transparent, %u offscreen, %u clipped\n",
+        stats.trisIn, stats.culledBackface, stats.culledTransparent, stats.culledOffscreen, stats.clipped);
+    Utility::Printf("tile binning: %.1f entries per tile, %u occluded in %u occluder tiles, %u overflowing tiles, %.2f ms\n",
+        float(stats.entries) / tileCount, stats.entriesOccluded, stats.occluderTiles, stats.overflowTiles, bestMs);
+
+    // Against the thread count, and a static split (a plain parallel for over the same tasks). Best of a few
+    // again, the first run of each also warms up the task costs that order the work stealing.
+    int32_t savedThreads = cpuTileBinningThreads;
+    bool savedStealing = cpuTileBinningStealing;
+    for (uint32_t threads = 1; threads <= TILE_SCHEDULER_MAX_THREADS; threads *= 2)
+    {
+        TileBinner::Stats best[2];
+        for (int stealing = 0; stealing < 2; stealing++)
+        {
+            cpuTileBinningThreads = int32_t(threads);
+            cpuTileBinningStealing = stealing != 0;
+            best[stealing].milliseconds = FLT_MAX;
+            for (int n = 0; n < 4; n++)
+            {
+                BinTiles(m_Camera, 0.0f, 0.0f);
+                if (m_tileBinnerStats.milliseconds < best[stealing].milliseconds)
+                    best[stealing] = m_tileBinnerStats;
+            }
+        }
+        Utility::Printf("tile binning, %u threads: static split %.2f ms, %.0f%% utilization, work stealing %.2f ms, %.0f%% utilization, %u steals\n",
+            threads, best[0].milliseconds, best[0].utilization * 100.0f,
+            best[1].milliseconds, best[1].utilization * 100.0f, best[1].steals);
+    }
+    cpuTileBinningThreads = savedThreads;
+    cpuTileBinningStealing = savedStealing;
+
+    // full screen against pipelined bands, with the lists live at once against the cache sizes
+    bool savedPipelined = cpuTileBinningPipelined;
+    for (int pipelined = 0; pipelined < 2; pipelined++)
+    {
+        cpuTileBinningPipelined = pipelined != 0;
+        TileBinner::Stats best;
+        best.milliseconds = FLT_MAX;
+        for (int n = 0; n < 4; n++)
+        {
+            BinTiles(m_Camera, 0.0f, 0.0f);
+            if (m_tileBinnerStats.milliseconds < best.milliseconds)
+                best = m_tileBinnerStats;
+        }
+        Utility::Printf("tile binning, %s, %u threads: %.2f ms, %.0f KB of tile lists live at most\n",
+            pipelined ? "pipelined bands" : "full screen", best.threads, best.milliseconds, best.peakListBytes / 1024.0f);
+    }
+    cpuTileBinningPipelined = savedPipelined;
+}
+#endif
+
 void DxrMsaaDemo::Startup()
 {
     m_frameIndex = 0;
@@ -1285,21 +3878,166 @@ m_Model.m_Header.meshCount -= 1;
 
     g_shadeConstantBuffer.Create(L"Hit Constant Buffer", 1, sizeof(ShadeConstants));
     g_dynamicConstantBuffer.Create(L"Dynamic Constant Buffer", 1, sizeof(DynamicCB));
+#if TEMPORAL_SAMPLES
+    g_temporalConstantBuffer.Create(L"Temporal Constant Buffer", 1, sizeof(TemporalCB));
+#endif
+#if DYNAMIC_RESOLUTION
+    g_dynamicResolutionConstantBuffer.Create(L"Dynamic Resolution Constant Buffer", 1, sizeof(DynamicResolutionCB));
+#endif
 
     InitializeSceneInfo();
 
+#if SORT_NETWORK
+    ValidateSortNetworks();
+#endif
+
     // beam buffers
     {
         // we'll just keep it simple for the demo and round down
         m_tilesX = g_SceneColorBuffer.GetWidth() / TILE_DIM_X;
         m_tilesY = g_SceneColorBuffer.GetHeight() / TILE_DIM_Y;
         uint32_t tileCount = m_tilesX * m_tilesY;
+        m_renderTilesX = m_tilesX;
+        m_renderTilesY = m_tilesY;
 
-        m_tileTriCounts.Create(L"m_tileTriCounts", tileCount, sizeof(uint), nullptr);
-        m_tileTris.Create(L"m_tileTris", tileCount, sizeof(TileTri), nullptr);
+#if MULTI_VIEW
+        // a set of tile lists per view, see MULTI_VIEW
+        uint32_t tileListCount = tileCount * MULTI_VIEW_COUNT;
+#else
+        uint32_t tileListCount = tileCount;
+#endif
+        m_tileTriCounts.Create(L"m_tileTriCounts", tileListCount, sizeof(uint), nullptr);
+        m_tileTris.Create(L"m_tileTris", tileListCount, sizeof(TileTri), nullptr);
         m_tileShadeQuads.Create(L"m_tileShadeQuads", tileCount, sizeof(TileShadeQuads), nullptr);
         m_tileShadeQuadsCount.Create(L"m_tileShadeQuadsCount", tileCount, sizeof(uint32_t), nullptr);
         m_counters.Create(L"m_counters", 1, sizeof(Counters), nullptr);
+        m_tileBounds.Create(L"m_tileBounds", tileCount, sizeof(TileBounds), nullptr);
+        m_tileDepthRecords.Create(L"m_tileDepthRecords", tileCount, sizeof(TileDepthRecord), nullptr);
+#if BEAM_VALIDATION
+        m_beamValidationMisses.Create(L"m_beamValidationMisses", BEAM_VALIDATION_MAX_MISSES, sizeof(BeamValidationMiss), nullptr);
+        m_beamValidationCountersReadback.Create(L"m_beamValidationCountersReadback", 1, sizeof(Counters));
+        m_beamValidationMissesReadback.Create(L"m_beamValidationMissesReadback", BEAM_VALIDATION_MAX_MISSES, sizeof(BeamValidationMiss));
+        m_validateBeamsPass = false;
+        m_validateBeamsDone = false;
+#else
+        m_beamValidationMisses.Create(L"m_beamValidationMisses", 1, sizeof(BeamValidationMiss), nullptr);
+#endif
+#if TILE_STATS
+        m_tileStats.Create(L"m_tileStats", tileCount, sizeof(TileStats), nullptr);
+        for (int n = 0; n < countersReadbackCount; n++)
+        {
+            m_tileStatsReadback[n].Create(L"m_tileStatsReadback", tileCount, sizeof(TileStats));
+            m_tileStatsFrame[n] = ~0ull;
+            m_tileStatsTilesX[n] = m_tilesX;
+            m_tileStatsTilesY[n] = m_tilesY;
+        }
+#else
+        m_tileStats.Create(L"m_tileStats", 1, sizeof(TileStats), nullptr);
+#endif
+        m_screenDepth.Create(L"m_screenDepth", g_SceneColorBuffer.GetWidth(), g_SceneColorBuffer.GetHeight(), 1, DXGI_FORMAT_R32_FLOAT);
+#if SHADE_CACHE
+        m_shadeCache.Create(L"m_shadeCache", SHADE_CACHE_ENTRIES, sizeof(ShadeCacheEntry), nullptr);
+        m_shadeCacheValid = false;
+        Utility::Printf("shade cache: %u sets of %u entries, %.1f MB\n",
+            1u << SHADE_CACHE_SETS_LOG2, SHADE_CACHE_WAYS,
+            float(SHADE_CACHE_ENTRIES) * sizeof(ShadeCacheEntry) / (1024.0f * 1024.0f));
+#else
+        m_shadeCache.Create(L"m_shadeCache", 1, sizeof(ShadeCacheEntry), nullptr);
+#endif
+
+#if TEMPORAL_SAMPLES
+        m_temporalColor.Create(L"m_temporalColor", g_SceneColorBuffer.GetWidth(), g_SceneColorBuffer.GetHeight(), 1, g_SceneColorBuffer.GetFormat());
+        for (uint32_t parity = 0; parity < 2; parity++)
+            m_temporalHistory[parity].Create(L"m_temporalHistory", g_SceneColorBuffer.GetWidth(), g_SceneColorBuffer.GetHeight(), 1, DXGI_FORMAT_R16G16B16A16_FLOAT);
+        m_temporalHistoryValid = false;
+
+        if (s_loadTimeReports)
+            AnalyzeTemporalSamples();
+#endif
+
+#if DYNAMIC_RESOLUTION
+        // the tile buffers and the frame buffers stay at the full grid's size, scaled frames use the top left
+        m_upscaleColor.Create(L"m_upscaleColor", g_SceneColorBuffer.GetWidth(), g_SceneColorBuffer.GetHeight(), 1, g_SceneColorBuffer.GetFormat());
+        m_upscaleDepth.Create(L"m_upscaleDepth", g_SceneColorBuffer.GetWidth(), g_SceneColorBuffer.GetHeight(), 1, DXGI_FORMAT_R32_FLOAT);
+
+        D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+        queryHeapDesc.Count = countersReadbackCount * 2;
+        queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+        ASSERT_SUCCEEDED(Graphics::g_Device->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&m_beamsTimestampHeap)));
+        ASSERT_SUCCEEDED(g_CommandManager.GetCommandQueue()->GetTimestampFrequency(&m_timestampFrequency));
+        for (int n = 0; n < countersReadbackCount; n++)
+        {
+            m_beamsTimeReadback[n].Create(L"m_beamsTimeReadback", 2, sizeof(uint64_t));
+            m_beamsTimeFrame[n] = ~0ull;
+        }
+        m_beamsMs = 0.0f;
+
+        m_dynamicResolutionScale = 1.0f;
+        m_minRenderTilesX = std::max(1u, uint32_t(m_tilesX * DYNAMIC_RESOLUTION_MIN_SCALE));
+        m_minRenderTilesY = std::max(1u, uint32_t(m_tilesY * DYNAMIC_RESOLUTION_MIN_SCALE));
+
+        m_pathFrame = 0;
+        m_pathDone = false;
+        m_pathSamples = 0;
+        m_pathWithinTolerance = 0;
+        m_pathOverTarget = 0;
+        m_pathMsSum = 0.0;
+        m_pathSquaredErrorSum = 0.0;
+        m_pathScaleSum = 0.0;
+        m_pathMsMax = 0.0f;
+        m_pathScaleMin = 1.0f;
+        m_pathScaleMax = 0.0f;
+#endif
+
+#if FOVEATION
+        // samples tested by quad visibility at each foveaMaxLevel, with the current fovea (shade quads and
+        // frame cost are on screen, see visSamples)
+        if (s_loadTimeReports)
+        {
+            for (uint32_t maxLevel = 0; maxLevel <= FOVEATION_MAX_LEVEL; maxLevel++)
+            {
+                uint32_t levelTiles[FOVEATION_MAX_LEVEL + 1] = {};
+                uint64_t samples = 0;
+                for (uint32_t tileY = 0; tileY < m_tilesY; tileY++)
+                {
+                    for (uint32_t tileX = 0; tileX < m_tilesX; tileX++)
+                    {
+                        uint32_t level = FoveationLevel(tileX, tileY, m_tilesX, m_tilesY, FoveaParams(), maxLevel);
+                        levelTiles[level]++;
+                        samples += TILE_SIZE * FoveationSampleCount(level);
+                    }
+                }
+
+                Utility::Printf("foveation: max level %u, %.2fM samples (%.1f%%), tiles per level",
+                    maxLevel, samples / 1e6, 100.0 * samples / (uint64_t(tileCount) * TILE_SIZE * AA_SAMPLES));
+                for (uint32_t level = 0; level <= maxLevel; level++)
+                    Utility::Printf(" %u", levelTiles[level]);
+                Utility::Printf("\n");
+            }
+        }
+#endif
+
+#if SUPER_TILE
+        // the super-tiles along the right and bottom edges can be partial
+        m_superTilesX = (m_tilesX + SUPER_TILE_DIM_X - 1) / SUPER_TILE_DIM_X;
+        m_superTilesY = (m_tilesY + SUPER_TILE_DIM_Y - 1) / SUPER_TILE_DIM_Y;
+        uint32_t superTileCount = m_superTilesX * m_superTilesY;
+#else
+        // still part of the UAV table
+        uint32_t superTileCount = 1;
+#endif
+        m_superTileTriCounts.Create(L"m_superTileTriCounts", superTileCount, sizeof(uint32_t), nullptr);
+        m_superTileTris.Create(L"m_superTileTris", superTileCount * SUPER_TILE_MAX_TRIS, sizeof(uint32_t), nullptr);
+
+        // the primitive ID encoding (PRIM_ID_GLOBAL) doesn't change these, IDs are 32 bits either way
+        Utility::Printf("tile buffers: tri lists %.1f MB, shade quads %.1f MB\n",
+            float(tileListCount) * sizeof(TileTri) / (1024.0f * 1024.0f),
+            float(tileCount) * sizeof(TileShadeQuads) / (1024.0f * 1024.0f));
+#if SUPER_TILE
+        Utility::Printf("super-tile buffers: %ux%u super-tiles of %ux%u tiles, candidate lists %.1f MB\n",
+            m_superTilesX, m_superTilesY, SUPER_TILE_DIM_X, SUPER_TILE_DIM_Y,
+            float(superTileCount) * SUPER_TILE_MAX_TRIS * sizeof(uint32_t) / (1024.0f * 1024.0f));
+#endif
 
         for (int n = 0; n < countersReadbackCount; n++)
         {
@@ -1311,94 +4049,289 @@ m_Model.m_Header.meshCount -= 1;
         }
     }
 
+    // the opacity bake needs the scene descriptors, and the shadow AABB coverage needs the baked masks
+    InitializeViews();
+    BakeOpacityMasks();
+
+    // UpdateAnimatedMeshes refits every acceleration structure when a mesh sways, the others are only ever built
+#if BVH_REFIT
+    bool refitAnimated = std::find(m_meshAnimated.begin(), m_meshAnimated.end(), true) != m_meshAnimated.end();
+#else
+    bool refitAnimated = false;
+#endif
+
     // ray vs triangle acceleration structure
-    createBvh(g_bvhTriangles, false, nullptr);
+    createBvh(g_bvhTriangles, false, nullptr, 1, false, refitAnimated);
 
     // acceleration structure for primary beams
     // for EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT, this must come after setting up the camera transform and tile counts
     {
+        AABBEnlargement &enlargement = m_ModelAABBs_primaryEnlargement;
+        enlargement = {};
 #if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
-        float camPosX = m_Camera.GetPosition().GetX();
-        float camPosY = m_Camera.GetPosition().GetY();
-        float camPosZ = m_Camera.GetPosition().GetZ();
+        SetEnlargementCamera(enlargement, m_Camera);
+        enlargement.camFoV = m_Camera.GetFOV();
+        enlargement.camAspect = float(g_SceneColorBuffer.GetWidth()) / g_SceneColorBuffer.GetHeight();
+        enlargement.tilesX = m_tilesX;
+        enlargement.tilesY = m_tilesY;
+#endif
+#if SUPER_TILE || MULTI_VIEW
+        std::vector<D3D12_RAYTRACING_AABB> tileAABBs;
+        createAABBs(m_ModelAABBs_primary, nullptr, false, enlargement, nullptr, &tileAABBs);
+#else
+        createAABBs(m_ModelAABBs_primary, nullptr, false, enlargement);
+#endif
 
-        float camRightX = m_Camera.GetRightVec().GetX();
-        float camRightY = m_Camera.GetRightVec().GetY();
-        float camRightZ = m_Camera.GetRightVec().GetZ();
+        createBvh(g_bvhAABBs_primary, true, &m_ModelAABBs_primary, 1, false, refitAnimated);
 
-        float camUpX = m_Camera.GetUpVec().GetX();
-        float camUpY = m_Camera.GetUpVec().GetY();
-        float camUpZ = m_Camera.GetUpVec().GetZ();
+#if SUPER_TILE
+        // The same enlargement, for super-tile sized beams. Rounding the super-tile count down keeps it
+        // conservative for the partial super-tiles.
+        AABBEnlargement &superTileEnlargement = m_ModelAABBs_superTileEnlargement;
+        superTileEnlargement = enlargement;
+# if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+        superTileEnlargement.tilesX = std::max(1u, m_tilesX / SUPER_TILE_DIM_X);
+        superTileEnlargement.tilesY = std::max(1u, m_tilesY / SUPER_TILE_DIM_Y);
+# endif
+        std::vector<D3D12_RAYTRACING_AABB> superTileAABBs;
+        float inflation = createAABBs(m_ModelAABBs_superTile, nullptr, false, superTileEnlargement, nullptr, &superTileAABBs);
 
-        float camForwardX = m_Camera.GetForwardVec().GetX();
-        float camForwardY = m_Camera.GetForwardVec().GetY();
-        float camForwardZ = m_Camera.GetForwardVec().GetZ();
+        Utility::Printf("super-tile beams: AABB surface area inflation %.3fx\n", inflation);
 
-        float camFoV = m_Camera.GetFOV();
-        float camAspect = float(g_SceneColorBuffer.GetWidth()) / g_SceneColorBuffer.GetHeight();
+        createBvh(g_bvhAABBs_superTile, true, &m_ModelAABBs_superTile, 1, false, refitAnimated);
+
+        if (s_loadTimeReports)
+            AnalyzeSuperTiles(tileAABBs, superTileAABBs);
 #endif
-        createAABBs(
-            m_ModelAABBs_primary
-            , nullptr
-#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
-            , camPosX, camPosY, camPosZ
-            , camRightX, camRightY, camRightZ
-            , camUpX, camUpY, camUpZ
-            , camForwardX, camForwardY, camForwardZ
-            , camFoV
-            , camAspect
-            , m_tilesX, m_tilesY
+
+#if MULTI_VIEW
+        // The same enlargement, grown by the furthest a view can be from the middle of the views.
+        AABBEnlargement &multiViewEnlargement = m_ModelAABBs_multiViewEnlargement;
+        multiViewEnlargement = enlargement;
+        multiViewEnlargement.growRadius += MULTI_VIEW_MAX_SEPARATION * .5f;
+        float multiViewInflation = createAABBs(m_ModelAABBs_multiView, nullptr, false, multiViewEnlargement);
+
+        Utility::Printf("multi-view beams: %u views, AABB surface area inflation %.3fx\n", MULTI_VIEW_COUNT, multiViewInflation);
+
+        createBvh(g_bvhAABBs_multiView, true, &m_ModelAABBs_multiView, 1, false, refitAnimated);
+
+        if (s_loadTimeReports)
+            AnalyzeMultiView(tileAABBs);
 #endif
-        );
 
-        createBvh(g_bvhAABBs_primary, true, &m_ModelAABBs_primary);
+#if LENS_DISTORTION
+        // The same enlargement, for the largest distorted tile footprints the coefficient ranges allow.
+        AABBEnlargement &lensEnlargement = m_ModelAABBs_lensEnlargement;
+        lensEnlargement = enlargement;
+# if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+        LensStretchBounds(lensEnlargement.lensStretch, lensEnlargement.lensShear);
+        Utility::Printf("lens distortion: tile footprints up to %.2fx their extent, plus %.2fx the other axis\n",
+            1.0f + lensEnlargement.lensStretch, lensEnlargement.lensShear);
+# endif
+        float lensInflation = createAABBs(m_ModelAABBs_lens, nullptr, false, lensEnlargement);
+
+        Utility::Printf("lens distortion beams: AABB surface area inflation %.3fx\n", lensInflation);
+
+        createBvh(g_bvhAABBs_lens, true, &m_ModelAABBs_lens, 1, false, refitAnimated);
+
+        if (s_loadTimeReports)
+            AnalyzeLensDistortion();
+#endif
+
+#if DYNAMIC_RESOLUTION
+        // The same enlargement, for the largest tiles of the scaled frames, and the distorted footprints of those.
+        AABBEnlargement &dynamicResolutionEnlargement = m_ModelAABBs_dynamicResolutionEnlargement;
+        dynamicResolutionEnlargement = enlargement;
+# if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+        dynamicResolutionEnlargement.tilesX = m_minRenderTilesX;
+        dynamicResolutionEnlargement.tilesY = m_minRenderTilesY;
+#  if LENS_DISTORTION
+        dynamicResolutionEnlargement.lensStretch = m_ModelAABBs_lensEnlargement.lensStretch;
+        dynamicResolutionEnlargement.lensShear = m_ModelAABBs_lensEnlargement.lensShear;
+#  endif
+# endif
+        float dynamicResolutionInflation = createAABBs(m_ModelAABBs_dynamicResolution, nullptr, false, dynamicResolutionEnlargement);
+
+        Utility::Printf("dynamic resolution beams: down to %ux%u tiles, AABB surface area inflation %.3fx\n",
+            m_minRenderTilesX, m_minRenderTilesY, dynamicResolutionInflation);
+
+        createBvh(g_bvhAABBs_dynamicResolution, true, &m_ModelAABBs_dynamicResolution, 1, false, refitAnimated);
+#endif
+    }
+
+#if TILE_BINNING
+    // CPU front-end for the same tile lists, needs the baked opacity masks
+    {
+        uint32_t sceneTriCount = m_meshInfo.back().triOffset + m_meshInfo.back().triCount;
+        m_tileBinner.Resize(sceneTriCount * uint32_t(m_instanceTransforms.size()));
+        for (uint32_t m = 0; m < m_Model.m_Header.meshCount; m++)
+            writeBinnerTriangles(m);
+
+        // sizes the upload buffer
+        BinTiles(m_Camera, 0.0f, 0.0f);
+        if (s_loadTimeReports)
+            ReportTileBinning();
+
+        m_binnedTris.Create(L"m_binnedTris", uint32_t(m_binnedTris_cpu.size() * 5 / 4), sizeof(uint32_t), nullptr);
     }
+#endif
 
 #if SHADOW_MODE == SHADOW_MODE_BEAM
-    // acceleration structure for shadow beams
+    // acceleration structures for shadow beams
     {
-# if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
         // For the purpose of enlarging AABBs, we need to know an origin point for the beams...
-        // Unlike camera primary rays, there isn't a single point we can use for shadows, so just
-        // pick something in the middle of the floor.
-        float camPosX = 0.0f;
-        float camPosY = 0.0f;
-        float camPosZ = 0.0f;
-
-        float camRightX = -1;
-        float camRightY = 0;
-        float camRightZ = 0;
-
-        float camUpX = 0;
-        float camUpY = 0;
-        float camUpZ = 1;
-
-        float camForwardX = 0;
-        float camForwardY = -1;
-        float camForwardZ = 0;
-
-        float camFoV = 2.0f * atan(AREA_LIGHT_EXTENT.z / (AREA_LIGHT_CENTER.y - camPosY));
-        float camAspect = AREA_LIGHT_EXTENT.x / AREA_LIGHT_EXTENT.z;
+        // Unlike camera primary rays, there isn't a single point we can use for shadows, so split the
+        // floor into a grid of receiver regions, and enlarge a separate set of AABBs from the middle
+        // of each region. Shadow beams trace the set belonging to the region they start in.
+        // The grid covers all of the instances.
+        Vector3 modelMin = m_Model.m_Header.boundingBox.min;
+        Vector3 modelMax = m_Model.m_Header.boundingBox.max;
+        modelMax += Vector3(m_instanceTransforms.back().row0.w, 0.0f, m_instanceTransforms.back().row2.w);
+        float partitionSizeX = (modelMax.GetX() - modelMin.GetX()) / SHADOW_PARTITIONS_X;
+        float partitionSizeZ = (modelMax.GetZ() - modelMin.GetZ()) / SHADOW_PARTITIONS_Z;
+
+        m_shadowPartitionOrigin.x = modelMin.GetX();
+        m_shadowPartitionOrigin.y = modelMin.GetZ();
+        m_shadowPartitionScale.x = 1.0f / partitionSizeX;
+        m_shadowPartitionScale.y = 1.0f / partitionSizeZ;
+
+# if SHADOW_CLUSTER_SIZE > 1
+        std::vector<D3D12_RAYTRACING_AABB> partitionAABBs[SHADOW_PARTITIONS];
+        std::vector<ShadowAABBPayload> shadowPayload;
+# endif
+        for (uint32_t p = 0; p < SHADOW_PARTITIONS; p++)
+        {
+            AABBEnlargement &enlargement = m_ModelAABBs_shadowEnlargement[p];
+            enlargement = {};
+# if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+            enlargement.camPosX = modelMin.GetX() + ((p % SHADOW_PARTITIONS_X) + .5f) * partitionSizeX;
+            enlargement.camPosY = modelMin.GetY();
+            enlargement.camPosZ = modelMin.GetZ() + ((p / SHADOW_PARTITIONS_X) + .5f) * partitionSizeZ;
+
+            enlargement.camRightX = -1;
+            enlargement.camRightY = 0;
+            enlargement.camRightZ = 0;
+
+            enlargement.camUpX = 0;
+            enlargement.camUpY = 0;
+            enlargement.camUpZ = 1;
+
+            // looking up at the area light
+            enlargement.camForwardX = 0;
+            enlargement.camForwardY = 1;
+            enlargement.camForwardZ = 0;
+
+            enlargement.camFoV = 2.0f * atan(AREA_LIGHT_EXTENT.z / (AREA_LIGHT_CENTER.y - enlargement.camPosY));
+            enlargement.camAspect = AREA_LIGHT_EXTENT.x / AREA_LIGHT_EXTENT.z;
+            enlargement.tilesX = 1;
+            enlargement.tilesY = 1;
+# endif
+            // the payload is un-enlarged, so it's shared between partitions
+            m_shadowPartitionInflation[p] = createAABBs(
+                m_ModelAABBs_shadow[p]
+                , p == 0 ? &m_ModelAABBs_shadow_payload : nullptr
+                , true
+                , enlargement
+# if SHADOW_CLUSTER_SIZE > 1
+                , nullptr
+                , &partitionAABBs[p]
+                , p == 0 ? &shadowPayload : nullptr
+# endif
+            );
+
+            Utility::Printf("shadow partition %u: AABB surface area inflation %.3fx\n", p, m_shadowPartitionInflation[p]);
+        }
+
+        createBvh(g_bvhAABBs_shadow, true, m_ModelAABBs_shadow, SHADOW_PARTITIONS, true, refitAnimated);
+
+# if SHADOW_CLUSTER_SIZE > 1
+        if (s_loadTimeReports)
+            AnalyzeShadowClusters(partitionAABBs, shadowPayload);
 # endif
-        createAABBs(
-            m_ModelAABBs_shadow
-            , &m_ModelAABBs_shadow_payload
+    }
+#elif SHADOW_MODE == SHADOW_MODE_HARD
+    // acceleration structure for sun shadow beams
+    {
+        // Sun shadow beams are orthographic, so the enlargement doesn't depend on distance,
+        // and a zero field of view turns off the perspective enlargement.
+        AABBEnlargement &enlargement = m_ModelAABBs_sunEnlargement;
+        enlargement = {};
+        enlargement.growRadius = SUN_SHADOW_BEAM_RADIUS;
 # if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
-            , camPosX, camPosY, camPosZ
-            , camRightX, camRightY, camRightZ
-            , camUpX, camUpY, camUpZ
-            , camForwardX, camForwardY, camForwardZ
-            , camFoV
-            , camAspect
-            , 1, 1
+        enlargement.camAspect = 1.0f;
+        enlargement.tilesX = 1;
+        enlargement.tilesY = 1;
 # endif
-        );
+        float inflation = createAABBs(m_ModelAABBs_sun, nullptr, false, enlargement);
+
+        Utility::Printf("sun shadow beams: AABB surface area inflation %.3fx\n", inflation);
 
-        createBvh(g_bvhAABBs_shadow, true, &m_ModelAABBs_shadow);
+        createBvh(g_bvhAABBs_sun, true, &m_ModelAABBs_sun, 1, false, refitAnimated);
     }
 #endif
 
-    InitializeViews();
+#if BEAM_AO
+    // acceleration structure for ambient occlusion beams
+    {
+        // Every direction is possible, so the enlargement is uniform: the beams' half width at BEAM_AO_RADIUS.
+        // Leaves only, with the same per mesh layout as the shadow payload's leaves.
+        AABBEnlargement &enlargement = m_ModelAABBs_aoEnlargement;
+        enlargement = {};
+        enlargement.growRadius = BEAM_AO_RADIUS * BEAM_AO_CONE_TAN;
+# if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+        enlargement.camAspect = 1.0f;
+        enlargement.tilesX = 1;
+        enlargement.tilesY = 1;
+# endif
+        std::vector<D3D12_RAYTRACING_AABB> aoAABBs;
+        std::vector<ShadowAABBPayload> aoPayload;
+        float inflation = createAABBs(m_ModelAABBs_ao, nullptr, false, enlargement, nullptr, &aoAABBs, &aoPayload);
+
+        Utility::Printf("ambient occlusion beams: AABB surface area inflation %.3fx\n", inflation);
+
+        createBvh(g_bvhAABBs_ao, true, &m_ModelAABBs_ao, 1, false, refitAnimated);
+
+        if (s_loadTimeReports)
+            AnalyzeBeamAO(aoAABBs, aoPayload);
+    }
+#endif
+
+#if BVH_REFIT
+    // rest poses and CPU BVHs of the animated meshes
+    m_animationTime = 0.0f;
+    m_bvhSahRatio = 1.0f;
+    m_bvhRefitCount = 0;
+    m_bvhRebuildCount = 0;
+    uint32_t animatedTriCount = 0;
+    for (uint32_t m = 0; m < m_Model.m_Header.meshCount; m++)
+    {
+        if (!m_meshAnimated[m])
+            continue;
+
+        const Model::Mesh &mesh = m_Model.m_pMesh[m];
+        const uint8_t *positions = m_Model.m_pVertexData + mesh.vertexDataByteOffset + mesh.attrib[Model::attrib_position].offset;
+
+        std::vector<float> rest(mesh.vertexCount * 3);
+        for (uint32_t v = 0; v < mesh.vertexCount; v++)
+            memcpy(&rest[v * 3], positions + v * mesh.vertexStride, 3 * sizeof(float));
+
+        std::vector<D3D12_RAYTRACING_AABB> leafAABBs;
+        fitLeafAABBs(m, positions, mesh.vertexStride, leafAABBs);
+        CpuBvh bvh;
+        bvh.Build(leafAABBs);
+
+        m_animatedMeshes.push_back(m);
+        m_animatedRestPositions.push_back(rest);
+        m_animatedBvh.push_back(bvh);
+        m_animatedBvhBuildSah.push_back(bvh.SahCost());
+        animatedTriCount += mesh.indexCount / 3;
+    }
+    Utility::Printf("animated meshes: %u, %u tris\n", uint32_t(m_animatedMeshes.size()), animatedTriCount);
+
+    if (s_loadTimeReports)
+        BenchmarkBvhRefit();
+#endif
+
     InitializeRaytracingStateObjects();
     
     m_CameraPosArrayCurrentPosition = 0;
@@ -1459,6 +4392,14 @@ void DxrMsaaDemo::Update( float deltaT )
 {
     ScopedTimer _prof(L"Update State");
 
+#if BEAM_VALIDATION
+    if (s_validateBeamsHeadless && !m_validateBeamsDone)
+    {
+        ValidateBeams();
+        m_validateBeamsDone = true;
+    }
+#endif
+
     if (GameInput::IsFirstPressed(GameInput::kLShoulder))
         DebugZoom.Decrement();
     else if (GameInput::IsFirstPressed(GameInput::kRShoulder))
@@ -1472,6 +4413,11 @@ void DxrMsaaDemo::Update( float deltaT )
         freezeCamera = !freezeCamera;
     }
 
+#if BVH_REFIT
+    if (animateMeshes)
+        m_animationTime += deltaT;
+#endif
+
     /*if (GameInput::IsFirstPressed(GameInput::kKey_left))
     {
         m_CameraPosArrayCurrentPosition = (m_CameraPosArrayCurrentPosition + c_NumCameraPositions - 1) % c_NumCameraPositions;
@@ -1483,6 +4429,11 @@ void DxrMsaaDemo::Update( float deltaT )
         SetCameraToPredefinedPosition(m_CameraPosArrayCurrentPosition);
     }*/
 
+#if DYNAMIC_RESOLUTION
+    if (s_dynamicResolutionPathHeadless && !m_pathDone)
+        UpdateDynamicResolutionPath();
+    else
+#endif
     if (!freezeCamera) 
     {
         m_CameraController->Update(deltaT);
@@ -1524,26 +4475,30 @@ void DxrMsaaDemo::RenderObjects(GraphicsContext& gfxContext, const Matrix4& View
         Matrix4 modelToProjection;
         XMFLOAT3 viewerPos;
     } vsConstants;
-    vsConstants.modelToProjection = ViewProjMat;
     XMStoreFloat3(&vsConstants.viewerPos, m_Camera.GetPosition());
 
-    gfxContext.SetDynamicConstantBufferView(0, sizeof(vsConstants), &vsConstants);
-
     uint32_t VertexStride = m_Model.m_VertexStride;
 
-    for (uint32_t meshIndex = 0; meshIndex < m_Model.m_Header.meshCount; meshIndex++)
+    for (const InstanceTransform &xf : m_instanceTransforms)
     {
-        const Model::Mesh& mesh = m_Model.m_pMesh[meshIndex];
+        // instances only translate, see SCENE_INSTANCES
+        vsConstants.modelToProjection = ViewProjMat * Matrix4(AffineTransform::MakeTranslation(Vector3(xf.row0.w, xf.row1.w, xf.row2.w)));
+        gfxContext.SetDynamicConstantBufferView(0, sizeof(vsConstants), &vsConstants);
 
-        uint32_t indexCount = mesh.indexCount;
-        uint32_t startIndex = mesh.indexDataByteOffset / sizeof(uint16_t);
-        uint32_t baseVertex = mesh.vertexDataByteOffset / VertexStride;
+        for (uint32_t meshIndex = 0; meshIndex < m_Model.m_Header.meshCount; meshIndex++)
+        {
+            const Model::Mesh& mesh = m_Model.m_pMesh[meshIndex];
 
-        uint32_t materialIndex = mesh.materialIndex;
-        gfxContext.SetDynamicDescriptors(2, 0, 6, m_Model.GetSRVs(materialIndex));
-        gfxContext.SetConstants(3, baseVertex, materialIndex);
+            uint32_t indexCount = mesh.indexCount;
+            uint32_t startIndex = mesh.indexDataByteOffset / sizeof(uint16_t);
+            uint32_t baseVertex = mesh.vertexDataByteOffset / VertexStride;
 
-        gfxContext.DrawIndexed(indexCount, startIndex, baseVertex);
+            uint32_t materialIndex = mesh.materialIndex;
+            gfxContext.SetDynamicDescriptors(2, 0, 6, m_Model.GetSRVs(materialIndex));
+            gfxContext.SetConstants(3, baseVertex, materialIndex);
+
+            gfxContext.DrawIndexed(indexCount, startIndex, baseVertex);
+        }
     }
 }
 
@@ -1570,12 +4525,20 @@ void DxrMsaaDemo::RenderScene()
 
     ParticleEffects::Update(gfxContext.GetComputeContext(), Graphics::GetFrameTime());
 
+#if BVH_REFIT
+    UpdateAnimatedMeshes(gfxContext);
+#endif
+
     uint32_t FrameIndex = TemporalEffects::GetFrameIndexMod2();
 
     ShadeConstants shadeConstants = {};
     shadeConstants.sunDirection = m_SunDirection;
     shadeConstants.sunColor = Vector3(1.0f, 1.0f, 1.0f) * m_SunLightIntensity;
     shadeConstants.ambientColor = Vector3(1.0f, 1.0f, 1.0f) * m_AmbientIntensity;
+#if SHADOW_MODE == SHADOW_MODE_BEAM
+    shadeConstants.shadowPartitionOrigin = m_shadowPartitionOrigin;
+    shadeConstants.shadowPartitionScale = m_shadowPartitionScale;
+#endif
 
     // Set the default state for command lists
     auto& pfnSetupGraphicsState = [&](void)
@@ -1654,17 +4617,25 @@ void DxrMsaaDemo::RaytraceDiffuse(
     TemporalEffects::GetJitterOffset(jitterX, jitterY);
     inputs.jitterNormalizedX = jitterX / g_SceneColorBuffer.GetWidth() * 2.0f;
     inputs.jitterNormalizedY = jitterY / g_SceneColorBuffer.GetHeight() * 2.0f;
+#if TEMPORAL_SAMPLES
+    inputs.samplePattern = temporalSamples ? samplePatternOrder[m_frameIndex % TEMPORAL_SAMPLE_PATTERNS] : 0;
+#endif
     context.WriteBuffer(g_dynamicConstantBuffer, 0, &inputs, sizeof(inputs));
 
     ShadeConstants shadeConstants = {};
     shadeConstants.sunDirection = m_SunDirection;
     shadeConstants.sunColor = Vector3(1.0f, 1.0f, 1.0f) * m_SunLightIntensity;
     shadeConstants.ambientColor = Vector3(1.0f, 1.0f, 1.0f) * m_AmbientIntensity;
+#if SHADOW_MODE == SHADOW_MODE_BEAM
+    shadeConstants.shadowPartitionOrigin = m_shadowPartitionOrigin;
+    shadeConstants.shadowPartitionScale = m_shadowPartitionScale;
+#endif
     context.WriteBuffer(g_shadeConstantBuffer, 0, &shadeConstants, sizeof(shadeConstants));
 
     context.TransitionResource(g_dynamicConstantBuffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
     context.TransitionResource(g_shadeConstantBuffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
     context.TransitionResource(colorTarget, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_screenDepth, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
     context.FlushResourceBarriers();
 
     ID3D12GraphicsCommandList * pCommandList = context.GetCommandList();
@@ -1692,6 +4663,40 @@ void DxrMsaaDemo::RaytraceDiffuse(
     pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
 }
 
+// The setting that limits the beams to the tile beams, or null. Only the tile beams have AABBs enlarged for the
+// distorted footprints and the scaled tiles, and the CPU binning bins the full grid onto the rectilinear view.
+const char *DxrMsaaDemo::TileBeamsOnlyReason()
+{
+#if LENS_DISTORTION
+    if (lensDistortion)
+        return "lens distortion";
+#endif
+#if DYNAMIC_RESOLUTION
+    if (dynamicResolution)
+        return "dynamic resolution";
+#endif
+    return nullptr;
+}
+
+// The tile list front end the beams run, from the settings, which stay as they are while TileBeamsOnlyReason rules
+// them out.
+void DxrMsaaDemo::BeamsFrontEnd(bool &useCpuTileBinning, bool &useMultiView, bool &useSuperTiles)
+{
+    bool available = TileBeamsOnlyReason() == nullptr;
+    useCpuTileBinning = false;
+    useMultiView = false;
+    useSuperTiles = false;
+#if TILE_BINNING
+    useCpuTileBinning = available && cpuTileBinning;
+#endif
+#if MULTI_VIEW
+    useMultiView = available && multiView;
+#endif
+#if SUPER_TILE
+    useSuperTiles = available && superTiles;
+#endif
+}
+
 void DxrMsaaDemo::RaytraceDiffuseBeams(
     GraphicsContext& context,
     const Math::Camera& camera,
@@ -1699,6 +4704,9 @@ void DxrMsaaDemo::RaytraceDiffuseBeams(
 {
     ScopedTimer _p0(L"RaytraceDiffuseBeams", context);
 
+    bool useCpuTileBinning, useMultiView, useSuperTiles;
+    BeamsFrontEnd(useCpuTileBinning, useMultiView, useSuperTiles);
+
     // Prepare constants
     DynamicCB inputs = {};
     Matrix4 viewToWorld = 
@@ -1710,25 +4718,126 @@ void DxrMsaaDemo::RaytraceDiffuseBeams(
     TemporalEffects::GetJitterOffset(jitterX, jitterY);
     inputs.jitterNormalizedX = jitterX / g_SceneColorBuffer.GetWidth() * 2.0f;
     inputs.jitterNormalizedY = jitterY / g_SceneColorBuffer.GetHeight() * 2.0f;
-    inputs.tilesX = m_tilesX;
-    inputs.tilesY = m_tilesY;
+#if DYNAMIC_RESOLUTION
+    // in the scaled frame's pixels
+    inputs.jitterNormalizedX *= float(m_tilesX) / m_renderTilesX;
+    inputs.jitterNormalizedY *= float(m_tilesY) / m_renderTilesY;
+#endif
+    inputs.tilesX = m_renderTilesX;
+    inputs.tilesY = m_renderTilesY;
+#if FOVEATION
+    inputs.foveaMaxLevel = uint32_t(int(foveaMaxLevel));
+    inputs.fovea = FoveaParams();
+#endif
+#if ADAPTIVE_SAMPLES
+    inputs.adaptiveSamples = !adaptiveSamples ? ADAPTIVE_SAMPLES_OFF :
+        adaptiveSamplesValidate ? ADAPTIVE_SAMPLES_VALIDATE : ADAPTIVE_SAMPLES_ON;
+#endif
+#if LENS_DISTORTION
+    inputs.lens = LensParams(
+        lensDistortion ? float(lensK1) : 0.0f, lensDistortion ? float(lensK2) : 0.0f,
+        float(g_SceneColorBuffer.GetWidth()) / g_SceneColorBuffer.GetHeight());
+#endif
+#if TEMPORAL_SAMPLES
+    inputs.samplePattern = temporalSamples ? samplePatternOrder[m_frameIndex % TEMPORAL_SAMPLE_PATTERNS] : 0;
+#endif
+#if MULTI_VIEW
+    // evenly spaced along the camera's right axis, starting at the camera
+    for (uint32_t v = 0; v < MULTI_VIEW_COUNT; v++)
+    {
+        Vector3 offset = camera.GetRightVec() * (float(multiViewSeparation) * v / max(MULTI_VIEW_COUNT - 1, 1));
+        inputs.multiViewOffsets[v] = { offset.GetX(), offset.GetY(), offset.GetZ(), 0.0f };
+    }
+#endif
+#if SHADE_CACHE
+    // the cached sun light is only good for the sun it was shaded with
+    bool clearShadeCache = false;
+    if (shadeCache)
+    {
+        if (!m_shadeCacheValid ||
+            m_SunDirection.GetX() != m_shadeCacheSunDirection.GetX() ||
+            m_SunDirection.GetY() != m_shadeCacheSunDirection.GetY() ||
+            m_SunDirection.GetZ() != m_shadeCacheSunDirection.GetZ() ||
+            float(m_SunLightIntensity) != m_shadeCacheSunIntensity)
+        {
+            clearShadeCache = true;
+            m_shadeCacheValid = true;
+            m_shadeCacheSunDirection = m_SunDirection;
+            m_shadeCacheSunIntensity = float(m_SunLightIntensity);
+            m_shadeCacheLookupsTotal = 0;
+            m_shadeCacheHitsTotal = 0;
+        }
+        inputs.shadeCacheFrame = uint32_t(m_frameIndex);
+        inputs.shadeCacheMaxAge = uint32_t(int(shadeCacheMaxAge));
+        inputs.animateMeshes = animateMeshes && !m_animatedMeshes.empty() ? 1 : 0;
+    }
+    else
+    {
+        m_shadeCacheValid = false;
+    }
+#endif
+#if TILE_STATS
+    inputs.tileStats = tileStats ? 1 : 0;
+#endif
     context.WriteBuffer(g_dynamicConstantBuffer, 0, &inputs, sizeof(inputs));
 
     ShadeConstants shadeConstants = {};
     shadeConstants.sunDirection = m_SunDirection;
     shadeConstants.sunColor = Vector3(1.0f, 1.0f, 1.0f) * m_SunLightIntensity;
     shadeConstants.ambientColor = Vector3(1.0f, 1.0f, 1.0f) * m_AmbientIntensity;
+#if SHADOW_MODE == SHADOW_MODE_BEAM
+    shadeConstants.shadowPartitionOrigin = m_shadowPartitionOrigin;
+    shadeConstants.shadowPartitionScale = m_shadowPartitionScale;
+#endif
     context.WriteBuffer(g_shadeConstantBuffer, 0, &shadeConstants, sizeof(shadeConstants));
 
     context.TransitionResource(g_dynamicConstantBuffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
     context.TransitionResource(g_shadeConstantBuffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
     context.TransitionResource(colorTarget, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_screenDepth, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
     context.TransitionResource(m_tileTriCounts, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
     context.TransitionResource(m_tileTris, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
     context.TransitionResource(m_tileShadeQuads, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
     context.TransitionResource(m_tileShadeQuadsCount, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_tileBounds, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_shadeCache, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_tileDepthRecords, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_beamValidationMisses, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_tileStats, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 
     context.ClearUAV(m_tileTriCounts);
+#if TILE_STATS
+    if (tileStats)
+        context.ClearUAV(m_tileStats);
+#endif
+#if SHADE_CACHE
+    if (clearShadeCache)
+        context.ClearUAV(m_shadeCache);
+#endif
+#if TILE_BINNING
+    if (useCpuTileBinning)
+    {
+        // binned against the live camera, where the beams' AABB enlargement is fixed at load time
+        {
+            ScopedTimer _p0(L"CPU Tile Binning", context);
+            BinTiles(camera, inputs.jitterNormalizedX, inputs.jitterNormalizedY);
+        }
+        if (m_binnedTris_cpu.size() > m_binnedTris.GetElementCount())
+        {
+            // the frames in flight may still be reading it
+            g_CommandManager.IdleGPU();
+            m_binnedTris.Create(L"m_binnedTris", uint32_t(m_binnedTris_cpu.size() * 5 / 4), sizeof(uint32_t), nullptr);
+        }
+        context.TransitionResource(m_binnedTris, D3D12_RESOURCE_STATE_COPY_DEST, true);
+        context.WriteBuffer(m_binnedTris, 0, m_binnedTris_cpu.data(), m_binnedTris_cpu.size() * sizeof(uint32_t));
+        context.TransitionResource(m_binnedTris, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    }
+#endif
+#if SUPER_TILE
+    context.TransitionResource(m_superTileTriCounts, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_superTileTris, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.ClearUAV(m_superTileTriCounts);
+#endif
 
     ID3D12GraphicsCommandList* pCommandList = context.GetCommandList();
     CComPtr<ID3D12GraphicsCommandList4> pRaytracingCommandList;
@@ -1746,16 +4855,89 @@ void DxrMsaaDemo::RaytraceDiffuseBeams(
 #if SHADOW_MODE == SHADOW_MODE_BEAM
     pRaytracingCommandList->SetComputeRootShaderResourceView(7, g_bvhAABBs_shadow.top->GetGPUVirtualAddress());
     pRaytracingCommandList->SetComputeRootShaderResourceView(8, m_ModelAABBs_shadow_payload.GetGpuVirtualAddress());
+#elif SHADOW_MODE == SHADOW_MODE_HARD
+    pRaytracingCommandList->SetComputeRootShaderResourceView(7, g_bvhAABBs_sun.top->GetGPUVirtualAddress());
 #else
     pRaytracingCommandList->SetComputeRootShaderResourceView(7, g_bvhTriangles.top->GetGPUVirtualAddress());
 #endif
 
-    D3D12_DISPATCH_RAYS_DESC dispatchRaysDesc = g_RaytracingInputs_Beam.GetDispatchRayDesc(
-        m_tilesX, m_tilesY);
-    pRaytracingCommandList->SetPipelineState1(g_RaytracingInputs_Beam.m_pPSO);
+    D3D12_DISPATCH_RAYS_DESC dispatchRaysDesc;
+#if TILE_BINNING
+    if (useCpuTileBinning)
     {
-        ScopedTimer _p0(L"Beam Trace", context);
-        pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
+        pCommandList->SetComputeRootSignature(g_BinScatterRootSig.GetSignature());
+        pCommandList->SetComputeRootConstantBufferView(0, g_dynamicConstantBuffer.GetGpuVirtualAddress());
+        pCommandList->SetComputeRootDescriptorTable(1, g_OutputUAV);
+        pCommandList->SetComputeRootShaderResourceView(2, m_binnedTris.GetGpuVirtualAddress());
+        pCommandList->SetPipelineState(g_BinScatterPSO.GetPipelineStateObject());
+        {
+            ScopedTimer _p0(L"Bin Scatter", context);
+            pCommandList->Dispatch(m_renderTilesX, m_renderTilesY, 1);
+        }
+    }
+    else
+#endif
+#if MULTI_VIEW
+    if (useMultiView)
+    {
+        // one beam per tile for all of the views, against the AABBs grown for their separation
+        pRaytracingCommandList->SetComputeRootShaderResourceView(6, g_bvhAABBs_multiView.top->GetGPUVirtualAddress());
+        dispatchRaysDesc = g_RaytracingInputs_BeamMultiView.GetDispatchRayDesc(
+            m_renderTilesX, m_renderTilesY);
+        pRaytracingCommandList->SetPipelineState1(g_RaytracingInputs_BeamMultiView.m_pPSO);
+        {
+            ScopedTimer _p0(L"Multi-View Beam Trace", context);
+            pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
+        }
+    }
+    else
+#endif
+#if SUPER_TILE
+    if (useSuperTiles)
+    {
+        // super-tile beams gather the candidate lists, against the AABBs enlarged for their size
+        pRaytracingCommandList->SetComputeRootShaderResourceView(6, g_bvhAABBs_superTile.top->GetGPUVirtualAddress());
+        dispatchRaysDesc = g_RaytracingInputs_BeamSuperTile.GetDispatchRayDesc(
+            m_superTilesX, m_superTilesY);
+        pRaytracingCommandList->SetPipelineState1(g_RaytracingInputs_BeamSuperTile.m_pPSO);
+        {
+            ScopedTimer _p0(L"Super-Tile Beam Trace", context);
+            pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
+        }
+
+        context.InsertUAVBarrier(m_superTileTriCounts);
+        context.InsertUAVBarrier(m_superTileTris);
+        context.FlushResourceBarriers();
+
+        // the tiles refine the candidates into their own lists, and trace the tile AABBs if their super-tile overflowed
+        pRaytracingCommandList->SetComputeRootShaderResourceView(6, g_bvhAABBs_primary.top->GetGPUVirtualAddress());
+        dispatchRaysDesc = g_RaytracingInputs_BeamRefine.GetDispatchRayDesc(
+            m_renderTilesX, m_renderTilesY);
+        pRaytracingCommandList->SetPipelineState1(g_RaytracingInputs_BeamRefine.m_pPSO);
+        {
+            ScopedTimer _p0(L"Beam Refine", context);
+            pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
+        }
+    }
+    else
+#endif
+    {
+#if LENS_DISTORTION
+        if (lensDistortion)
+            pRaytracingCommandList->SetComputeRootShaderResourceView(6, g_bvhAABBs_lens.top->GetGPUVirtualAddress());
+#endif
+#if DYNAMIC_RESOLUTION
+        // also enlarged for the lens distortion
+        if (m_renderTilesX != m_tilesX || m_renderTilesY != m_tilesY)
+            pRaytracingCommandList->SetComputeRootShaderResourceView(6, g_bvhAABBs_dynamicResolution.top->GetGPUVirtualAddress());
+#endif
+        dispatchRaysDesc = g_RaytracingInputs_Beam.GetDispatchRayDesc(
+            m_renderTilesX, m_renderTilesY);
+        pRaytracingCommandList->SetPipelineState1(g_RaytracingInputs_Beam.m_pPSO);
+        {
+            ScopedTimer _p0(L"Beam Trace", context);
+            pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
+        }
     }
 
 // TODO: beam tracing probably isn't fully utilizing the GPU, ideally we'd run these next two shaders in parallel with it
@@ -1764,6 +4946,37 @@ void DxrMsaaDemo::RaytraceDiffuseBeams(
     context.InsertUAVBarrier(m_tileTris);
     context.FlushResourceBarriers();
 
+#if BEAM_VALIDATION
+    if (validateBeams || m_validateBeamsPass)
+    {
+        // exact rays for every sample, against the triangles with the rays renderer's bindings (the CPU tile binning
+        // switched root signatures)
+        pCommandList->SetComputeRootSignature(g_GlobalRaytracingRootSignature);
+        pCommandList->SetComputeRootDescriptorTable(0, g_SceneSrvs);
+        pCommandList->SetComputeRootConstantBufferView(1, g_shadeConstantBuffer.GetGpuVirtualAddress());
+        pCommandList->SetComputeRootConstantBufferView(2, g_dynamicConstantBuffer.GetGpuVirtualAddress());
+        pCommandList->SetComputeRootDescriptorTable(3, g_OutputUAV);
+        pRaytracingCommandList->SetComputeRootShaderResourceView(6, g_bvhTriangles.top->GetGPUVirtualAddress());
+# if SHADOW_MODE == SHADOW_MODE_BEAM
+        pRaytracingCommandList->SetComputeRootShaderResourceView(7, g_bvhAABBs_shadow.top->GetGPUVirtualAddress());
+        pRaytracingCommandList->SetComputeRootShaderResourceView(8, m_ModelAABBs_shadow_payload.GetGpuVirtualAddress());
+# else
+        pRaytracingCommandList->SetComputeRootShaderResourceView(7, g_bvhTriangles.top->GetGPUVirtualAddress());
+# endif
+
+        dispatchRaysDesc = g_RaytracingInputs_ValidateBeams.GetDispatchRayDesc(
+            m_renderTilesX, m_renderTilesY);
+        pRaytracingCommandList->SetPipelineState1(g_RaytracingInputs_ValidateBeams.m_pPSO);
+        {
+            ScopedTimer _p0(L"Validate Beams", context);
+            pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
+        }
+
+        context.InsertUAVBarrier(m_beamValidationMisses);
+        context.FlushResourceBarriers();
+    }
+#endif
+
     pRaytracingCommandList->SetComputeRootSignature(g_BeamPostRootSig.GetSignature());
     pRaytracingCommandList->SetComputeRootConstantBufferView(0, g_shadeConstantBuffer.GetGpuVirtualAddress());
     pRaytracingCommandList->SetComputeRootConstantBufferView(1, g_dynamicConstantBuffer.GetGpuVirtualAddress());
@@ -1775,20 +4988,504 @@ void DxrMsaaDemo::RaytraceDiffuseBeams(
     pRaytracingCommandList->SetPipelineState(g_BeamVisPSO.GetPipelineStateObject());
     {
         ScopedTimer _p0(L"Quad Vis", context);
-        pRaytracingCommandList->Dispatch(m_tilesX, m_tilesY, 1);
+        pRaytracingCommandList->Dispatch(m_renderTilesX, m_renderTilesY, 1);
     }
 
     context.InsertUAVBarrier(m_tileShadeQuads);
     context.InsertUAVBarrier(m_tileShadeQuadsCount);
+#if SHADOW_MODE == SHADOW_MODE_HARD
+    context.InsertUAVBarrier(m_tileBounds);
+    context.FlushResourceBarriers();
+
+    // sun shadow beams, gathering each tile's occluders into its (now unused) tri list
+    pCommandList->SetComputeRootSignature(g_GlobalRaytracingRootSignature);
+    pCommandList->SetComputeRootDescriptorTable(0, g_SceneSrvs);
+    pCommandList->SetComputeRootConstantBufferView(1, g_shadeConstantBuffer.GetGpuVirtualAddress());
+    pCommandList->SetComputeRootConstantBufferView(2, g_dynamicConstantBuffer.GetGpuVirtualAddress());
+    pCommandList->SetComputeRootDescriptorTable(3, g_OutputUAV);
+    pRaytracingCommandList->SetComputeRootShaderResourceView(6, g_bvhAABBs_primary.top->GetGPUVirtualAddress());
+    pRaytracingCommandList->SetComputeRootShaderResourceView(7, g_bvhAABBs_sun.top->GetGPUVirtualAddress());
+
+    dispatchRaysDesc = g_RaytracingInputs_BeamSunShadow.GetDispatchRayDesc(
+        m_renderTilesX, m_renderTilesY);
+    pRaytracingCommandList->SetPipelineState1(g_RaytracingInputs_BeamSunShadow.m_pPSO);
+    {
+        ScopedTimer _p0(L"Sun Shadow Beams", context);
+        pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
+    }
+
+    context.InsertUAVBarrier(m_tileTriCounts);
+    context.InsertUAVBarrier(m_tileTris);
+    context.FlushResourceBarriers();
+
+    pRaytracingCommandList->SetComputeRootSignature(g_BeamPostRootSig.GetSignature());
+    pRaytracingCommandList->SetComputeRootConstantBufferView(0, g_shadeConstantBuffer.GetGpuVirtualAddress());
+    pRaytracingCommandList->SetComputeRootConstantBufferView(1, g_dynamicConstantBuffer.GetGpuVirtualAddress());
+    pRaytracingCommandList->SetComputeRootDescriptorTable(2, g_OutputUAV);
+    pRaytracingCommandList->SetComputeRootDescriptorTable(3, g_SceneSrvs);
+    pRaytracingCommandList->SetComputeRootDescriptorTable(4, g_GpuSceneMaterialSrvs[0]);
+#else
     context.FlushResourceBarriers();
+#endif
+
+#if BEAM_AO
+    if (beamAO)
+    {
+        // ambient occlusion beams, writing into the shade quads
+        pCommandList->SetComputeRootSignature(g_GlobalRaytracingRootSignature);
+        pCommandList->SetComputeRootDescriptorTable(0, g_SceneSrvs);
+        pCommandList->SetComputeRootConstantBufferView(1, g_shadeConstantBuffer.GetGpuVirtualAddress());
+        pCommandList->SetComputeRootConstantBufferView(2, g_dynamicConstantBuffer.GetGpuVirtualAddress());
+        pCommandList->SetComputeRootDescriptorTable(3, g_OutputUAV);
+        pRaytracingCommandList->SetComputeRootShaderResourceView(6, g_bvhAABBs_primary.top->GetGPUVirtualAddress());
+        pRaytracingCommandList->SetComputeRootShaderResourceView(7, g_bvhAABBs_ao.top->GetGPUVirtualAddress());
+        pRaytracingCommandList->SetComputeRootShaderResourceView(8, m_ModelAABBs_shadow_payload.GetGpuVirtualAddress());
+
+        dispatchRaysDesc = g_RaytracingInputs_BeamAO.GetDispatchRayDesc(
+            m_renderTilesX, m_renderTilesY);
+        pRaytracingCommandList->SetPipelineState1(g_RaytracingInputs_BeamAO.m_pPSO);
+        {
+            ScopedTimer _p0(L"AO Beams", context);
+            pRaytracingCommandList->DispatchRays(&dispatchRaysDesc);
+        }
+
+        context.InsertUAVBarrier(m_tileShadeQuads);
+        context.FlushResourceBarriers();
+
+        pRaytracingCommandList->SetComputeRootSignature(g_BeamPostRootSig.GetSignature());
+        pRaytracingCommandList->SetComputeRootConstantBufferView(0, g_shadeConstantBuffer.GetGpuVirtualAddress());
+        pRaytracingCommandList->SetComputeRootConstantBufferView(1, g_dynamicConstantBuffer.GetGpuVirtualAddress());
+        pRaytracingCommandList->SetComputeRootDescriptorTable(2, g_OutputUAV);
+        pRaytracingCommandList->SetComputeRootDescriptorTable(3, g_SceneSrvs);
+        pRaytracingCommandList->SetComputeRootDescriptorTable(4, g_GpuSceneMaterialSrvs[0]);
+    }
+#endif
 
     // quad shading
     pRaytracingCommandList->SetPipelineState(g_BeamShadePSO.GetPipelineStateObject());
     {
         ScopedTimer _p0(L"Quad Shade", context);
-        pRaytracingCommandList->Dispatch(m_tilesX, m_tilesY, 1);
+        pRaytracingCommandList->Dispatch(m_renderTilesX, m_renderTilesY, 1);
+    }
+}
+
+#if BEAM_VALIDATION || DYNAMIC_RESOLUTION
+# if !BVH_REFIT
+#  error the -validatebeams and -dynamicresolutionpath runs update the beams' acceleration structures, which needs BVH_REFIT
+# endif
+// The camera beams' AABBs are enlarged for the camera at load time, and beams from anywhere else can slip past them.
+// Moves the enlargement of the tile, super-tile, multi-view, lens distortion and dynamic resolution AABBs to camera,
+// refills them, and rebuilds their acceleration structures (every AABB moves, a refit would ruin the trees). It
+// redoes the whole scene's AABBs on the CPU, so it's for the runs that fly through the predefined camera positions,
+// not for the interactive camera.
+void DxrMsaaDemo::RetargetBeamAABBs(const Math::Camera& camera)
+{
+#if EMULATE_CONSERVATIVE_BEAMS_VIA_AABB_ENLARGEMENT
+    GraphicsContext& context = GraphicsContext::Begin(L"Retarget Beam AABBs");
+
+    SetEnlargementCamera(m_ModelAABBs_primaryEnlargement, camera);
+    createAABBs(m_ModelAABBs_primary, nullptr, false, m_ModelAABBs_primaryEnlargement, &context, nullptr, nullptr, true);
+    refitBvh(context, g_bvhAABBs_primary, true);
+#if SUPER_TILE
+    SetEnlargementCamera(m_ModelAABBs_superTileEnlargement, camera);
+    createAABBs(m_ModelAABBs_superTile, nullptr, false, m_ModelAABBs_superTileEnlargement, &context, nullptr, nullptr, true);
+    refitBvh(context, g_bvhAABBs_superTile, true);
+#endif
+#if MULTI_VIEW
+    SetEnlargementCamera(m_ModelAABBs_multiViewEnlargement, camera);
+    createAABBs(m_ModelAABBs_multiView, nullptr, false, m_ModelAABBs_multiViewEnlargement, &context, nullptr, nullptr, true);
+    refitBvh(context, g_bvhAABBs_multiView, true);
+#endif
+#if LENS_DISTORTION
+    SetEnlargementCamera(m_ModelAABBs_lensEnlargement, camera);
+    createAABBs(m_ModelAABBs_lens, nullptr, false, m_ModelAABBs_lensEnlargement, &context, nullptr, nullptr, true);
+    refitBvh(context, g_bvhAABBs_lens, true);
+#endif
+#if DYNAMIC_RESOLUTION
+    SetEnlargementCamera(m_ModelAABBs_dynamicResolutionEnlargement, camera);
+    createAABBs(m_ModelAABBs_dynamicResolution, nullptr, false, m_ModelAABBs_dynamicResolutionEnlargement, &context, nullptr, nullptr, true);
+    refitBvh(context, g_bvhAABBs_dynamicResolution, true);
+#endif
+
+    context.Finish(true);
+#endif
+}
+#endif
+
+#if BEAM_VALIDATION
+// The -validatebeams run: the beams at every predefined camera position, with the current settings, each checked by
+// RayGenValidateBeams and read back on its own, and reported to the debug output. The beams' AABBs are retargeted to
+// each position, and back to the load time camera at the end. The app exits after it.
+void DxrMsaaDemo::ValidateBeams()
+{
+    Math::Camera camera = m_Camera;
+    uint32_t totalFalseNegatives = 0;
+    for (uint32_t c = 0; c < c_NumCameraPositions; c++)
+    {
+        const CameraPosition &position = m_CameraPosArray[c];
+        Matrix3 orientation = Matrix3(m_CameraController->GetWorldEast(), m_CameraController->GetWorldUp(), -m_CameraController->GetWorldNorth())
+            * Matrix3::MakeYRotation(position.heading)
+            * Matrix3::MakeXRotation(position.pitch);
+        camera.SetTransform(AffineTransform(orientation, position.position));
+        camera.Update();
+        RetargetBeamAABBs(camera);
+
+        GraphicsContext& context = GraphicsContext::Begin(L"Validate Beams");
+        context.TransitionResource(m_counters, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, true);
+        context.ClearUAV(m_counters);
+
+        m_validateBeamsPass = true;
+        RaytraceDiffuseBeams(context, camera, g_SceneColorBuffer);
+        m_validateBeamsPass = false;
+
+        context.InsertUAVBarrier(m_counters);
+        context.TransitionResource(m_counters, D3D12_RESOURCE_STATE_COPY_SOURCE);
+        context.TransitionResource(m_beamValidationMisses, D3D12_RESOURCE_STATE_COPY_SOURCE);
+        context.TransitionResource(m_beamValidationCountersReadback, D3D12_RESOURCE_STATE_COPY_DEST);
+        context.TransitionResource(m_beamValidationMissesReadback, D3D12_RESOURCE_STATE_COPY_DEST);
+        context.FlushResourceBarriers();
+        context.CopyBuffer(m_beamValidationCountersReadback, m_counters);
+        context.CopyBuffer(m_beamValidationMissesReadback, m_beamValidationMisses);
+        context.SetDescriptorHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, nullptr);
+        context.Finish(true);
+
+        const Counters *counters = (const Counters*)m_beamValidationCountersReadback.Map();
+        const BeamValidationMiss *misses = (const BeamValidationMiss*)m_beamValidationMissesReadback.Map();
+
+        uint32_t falsePositives = counters->validateListEntries - counters->validateListEntriesHit;
+        Utility::Printf("beam validation, camera position %u: %u tiles (%u overflowed, not checked), %u samples, "
+            "%u false negatives, false positive list entries %.1f%% (%u of %u)\n",
+            c, counters->validateTiles, counters->validateOverflowTiles, counters->validateSamples,
+            counters->validateFalseNegatives,
+            counters->validateListEntries > 0 ? 100.0f * falsePositives / counters->validateListEntries : 0.0f,
+            falsePositives, counters->validateListEntries);
+        totalFalseNegatives += counters->validateFalseNegatives;
+
+        // once per tile and triangle
+        std::set<std::pair<uint32_t, uint32_t>> reported;
+        uint32_t missCount = std::min(counters->validateMisses, uint32_t(BEAM_VALIDATION_MAX_MISSES));
+        for (uint32_t m = 0; m < missCount; m++)
+        {
+            const BeamValidationMiss &miss = misses[m];
+            if (!reported.insert(std::make_pair(miss.tileIndex, miss.id)).second)
+                continue;
+            Utility::Printf("  false negative: tile %u (%u, %u), triangle %u, pixel (%u, %u) sample %u\n",
+                miss.tileIndex, miss.tileIndex % m_renderTilesX, miss.tileIndex / m_renderTilesX, miss.id,
+                miss.pixel & 0xffff, miss.pixel >> 16, miss.sampleIndex);
+        }
+        if (counters->validateMisses > BEAM_VALIDATION_MAX_MISSES)
+            Utility::Printf("  ... %u more not recorded\n", counters->validateMisses - BEAM_VALIDATION_MAX_MISSES);
+
+        m_beamValidationMissesReadback.Unmap();
+        m_beamValidationCountersReadback.Unmap();
+    }
+    RetargetBeamAABBs(m_Camera);
+
+    // the tile lists RaytraceDiffuseBeams used
+    bool useCpuTileBinning, useMultiView, useSuperTiles;
+    BeamsFrontEnd(useCpuTileBinning, useMultiView, useSuperTiles);
+    const char *tileLists =
+        useCpuTileBinning ? "CPU tile binning" :
+        useMultiView ? "multi-view beams, view 0" :
+        useSuperTiles ? "super-tile beams" : "tile beams";
+    Utility::Printf("beam validation: %s, %u camera positions, %u false negatives, %s\n",
+        tileLists, c_NumCameraPositions, totalFalseNegatives, totalFalseNegatives == 0 ? "conservative" : "NOT conservative");
+}
+
+#endif
+
+#if BEAM_VALIDATION || DYNAMIC_RESOLUTION
+bool DxrMsaaDemo::IsDone()
+{
+#if BEAM_VALIDATION
+    if (s_validateBeamsHeadless && m_validateBeamsDone)
+        return true;
+#endif
+#if DYNAMIC_RESOLUTION
+    if (s_dynamicResolutionPathHeadless && m_pathDone)
+        return true;
+#endif
+    return IGameApp::IsDone();
+}
+#endif
+
+#if TILE_STATS
+// Writes a frame's TileStats to the working directory: tilestats_<frame>.bin with the raw records (tilesX, tilesY and
+// TILE_STATS_METRICS as uints, then the records in tile order), and a color mapped PFM per metric, one pixel per
+// tile. Each map is scaled to its metric's largest value in the frame, which goes to the debug output with its tile.
+void DxrMsaaDemo::ExportTileStats(uint64_t frame, uint32_t tilesX, uint32_t tilesY, const TileStats *stats)
+{
+    static_assert(sizeof(TileStats) == TILE_STATS_METRICS * sizeof(uint32_t), "TileStats is TILE_STATS_METRICS uints");
+    static const char *metricNames[TILE_STATS_METRICS] =
+    {
+        "intersects", "anyHits", "triCount", "emittedQuads", "shadedQuads", "shadowLaunches",
+    };
+    uint32_t tileCount = tilesX * tilesY;
+
+    char path[MAX_PATH];
+    sprintf_s(path, "tilestats_%06llu.bin", frame);
+    FILE *file = nullptr;
+    if (fopen_s(&file, path, "wb") != 0)
+    {
+        Utility::Printf("tile stats: failed to write %s\n", path);
+        return;
+    }
+    uint32_t header[3] = { tilesX, tilesY, TILE_STATS_METRICS };
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(stats, sizeof(TileStats), tileCount, file);
+    fclose(file);
+
+    Utility::Printf("tile stats, frame %llu, largest:", frame);
+    std::vector<float> image(tileCount * 3);
+    for (uint32_t m = 0; m < TILE_STATS_METRICS; m++)
+    {
+        auto value = [&](uint32_t tile) { return ((const uint32_t*)&stats[tile])[m]; };
+
+        uint32_t maxValue = 0;
+        uint32_t maxTile = 0;
+        for (uint32_t tile = 0; tile < tileCount; tile++)
+        {
+            if (value(tile) > maxValue)
+            {
+                maxValue = value(tile);
+                maxTile = tile;
+            }
+        }
+
+        // PFM rows go from the bottom up
+        for (uint32_t y = 0; y < tilesY; y++)
+        {
+            for (uint32_t x = 0; x < tilesX; x++)
+            {
+                uint32_t tile = (tilesY - 1 - y) * tilesX + x;
+                HeatmapColor(maxValue > 0 ? float(value(tile)) / maxValue : 0.0f, &image[(y * tilesX + x) * 3]);
+            }
+        }
+
+        sprintf_s(path, "tilestats_%06llu_%s.pfm", frame, metricNames[m]);
+        if (fopen_s(&file, path, "wb") == 0)
+        {
+            // negative scale for little endian
+            fprintf(file, "PF\n%u %u\n-1.0\n", tilesX, tilesY);
+            fwrite(image.data(), sizeof(float), image.size(), file);
+            fclose(file);
+        }
+
+        Utility::Printf(" %s %u (tile %u, %u),", metricNames[m], maxValue, maxTile % tilesX, maxTile / tilesX);
+    }
+    Utility::Printf("\n");
+}
+#endif
+
+#if DYNAMIC_RESOLUTION
+// Picks the frame's tile grid. The oldest beams time in the readback ring gives a cost per tile, taking the beams'
+// cost as proportional to the tiles rendered, and from it the scale that would have fit dynamicResolutionTargetMs.
+// The scale moves dynamicResolutionRate of the way there each frame, to ride out the readback latency and the frame
+// to frame noise.
+void DxrMsaaDemo::UpdateDynamicResolution()
+{
+    int readIndex = (m_frameIndex + 1) % countersReadbackCount;
+    if (m_beamsTimeFrame[readIndex] != ~0ull)
+    {
+        const uint64_t *timestamps = (const uint64_t*)m_beamsTimeReadback[readIndex].Map();
+        bool valid = timestamps[1] > timestamps[0];
+        float ms = valid ? float(double(timestamps[1] - timestamps[0]) * 1000.0 / m_timestampFrequency) : 0.0f;
+        m_beamsTimeReadback[readIndex].Unmap();
+
+        uint64_t frame = m_beamsTimeFrame[readIndex];
+        float tileFraction = float(m_beamsTimeTiles[readIndex]) / (m_tilesX * m_tilesY);
+        m_beamsTimeFrame[readIndex] = ~0ull;
+
+        if (valid)
+        {
+            m_beamsMs = ms;
+
+            if (dynamicResolution)
+            {
+                float fitScale = sqrtf(float(dynamicResolutionTargetMs) / ms * tileFraction);
+                fitScale = std::min(std::max(fitScale, DYNAMIC_RESOLUTION_MIN_SCALE), 1.0f);
+                m_dynamicResolutionScale += (fitScale - m_dynamicResolutionScale) * float(dynamicResolutionRate);
+            }
+
+            // a frame of the -dynamicresolutionpath run, past the warmup
+            if (s_dynamicResolutionPathHeadless && m_pathFrame > 0 &&
+                frame >= m_pathStartFrame + c_pathWarmupFrames &&
+                frame < m_pathStartFrame + c_NumCameraPositions * c_pathSegmentFrames)
+            {
+                float target = dynamicResolutionTargetMs;
+                float scale = sqrtf(tileFraction);
+                m_pathSamples++;
+                if (fabsf(ms - target) <= .1f * target)
+                    m_pathWithinTolerance++;
+                if (ms > target)
+                    m_pathOverTarget++;
+                m_pathMsSum += ms;
+                m_pathSquaredErrorSum += double(ms - target) * (ms - target);
+                m_pathScaleSum += scale;
+                m_pathMsMax = std::max(m_pathMsMax, ms);
+                m_pathScaleMin = std::min(m_pathScaleMin, scale);
+                m_pathScaleMax = std::max(m_pathScaleMax, scale);
+            }
+        }
+    }
+
+    if (!dynamicResolution)
+        m_dynamicResolutionScale = 1.0f;
+
+    m_renderTilesX = std::min(std::max(uint32_t(m_tilesX * m_dynamicResolutionScale + .5f), m_minRenderTilesX), m_tilesX);
+    m_renderTilesY = std::min(std::max(uint32_t(m_tilesY * m_dynamicResolutionScale + .5f), m_minRenderTilesY), m_tilesY);
+}
+
+// Fills colorTarget and m_screenDepth from their top left, where the beams rendered the scaled tile grid.
+void DxrMsaaDemo::UpscaleDynamicResolution(GraphicsContext& context, ColorBuffer& colorTarget)
+{
+    ScopedTimer _p0(L"DynamicResolutionUpscale", context);
+
+    DynamicResolutionCB upscaleConstants = {};
+    upscaleConstants.renderDim = { float(m_renderTilesX * TILE_DIM_X), float(m_renderTilesY * TILE_DIM_Y) };
+    upscaleConstants.outputDim = { float(m_tilesX * TILE_DIM_X), float(m_tilesY * TILE_DIM_Y) };
+    context.WriteBuffer(g_dynamicResolutionConstantBuffer, 0, &upscaleConstants, sizeof(upscaleConstants));
+
+    // the upscale writes them in place, so it reads copies
+    context.TransitionResource(colorTarget, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    context.TransitionResource(m_screenDepth, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    context.TransitionResource(m_upscaleColor, D3D12_RESOURCE_STATE_COPY_DEST);
+    context.TransitionResource(m_upscaleDepth, D3D12_RESOURCE_STATE_COPY_DEST, true);
+    context.CopySubresource(m_upscaleColor, 0, colorTarget, 0);
+    context.CopySubresource(m_upscaleDepth, 0, m_screenDepth, 0);
+
+    context.TransitionResource(g_dynamicResolutionConstantBuffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+    context.TransitionResource(m_upscaleColor, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    context.TransitionResource(m_upscaleDepth, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    context.TransitionResource(colorTarget, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(m_screenDepth, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.FlushResourceBarriers();
+
+    ID3D12GraphicsCommandList* pCommandList = context.GetCommandList();
+    ID3D12DescriptorHeap* pDescriptorHeaps[] = { &g_pRaytracingDescriptorHeap->GetDescriptorHeap() };
+    pCommandList->SetDescriptorHeaps(_countof(pDescriptorHeaps), pDescriptorHeaps);
+
+    pCommandList->SetComputeRootSignature(g_DynamicResolutionUpscaleRootSig.GetSignature());
+    pCommandList->SetComputeRootConstantBufferView(0, g_dynamicResolutionConstantBuffer.GetGpuVirtualAddress());
+    pCommandList->SetComputeRootDescriptorTable(1, m_upscaleSrvs);
+    pCommandList->SetComputeRootDescriptorTable(2, m_upscaleUavs);
+    pCommandList->SetPipelineState(g_DynamicResolutionUpscalePSO.GetPipelineStateObject());
+    pCommandList->Dispatch((m_tilesX * TILE_DIM_X + 7) / 8, (m_tilesY * TILE_DIM_Y + 7) / 8, 1);
+}
+
+// The -dynamicresolutionpath run: the beams with dynamic resolution, along a camera path that loops through the
+// predefined positions, c_pathSegmentFrames frames from each to the next. UpdateDynamicResolution compares each
+// frame's beams time against dynamicResolutionTargetMs as it's read back, leaving out the first c_pathWarmupFrames
+// while the scale settles, and the totals go to the debug output. The beams' AABBs are retargeted to the camera every
+// frame (outside the beams' timings), and back to the load time camera at the end. The app exits after it.
+void DxrMsaaDemo::UpdateDynamicResolutionPath()
+{
+    const uint32_t pathFrames = c_NumCameraPositions * c_pathSegmentFrames;
+    if (m_pathFrame == 0)
+    {
+        renderMode = int(RenderMode::beams);
+        dynamicResolution = true;
+        m_pathStartFrame = m_frameIndex;
+        m_pathLoadCamera = m_Camera;
+    }
+
+    if (m_pathFrame < pathFrames)
+    {
+        uint32_t segment = m_pathFrame / c_pathSegmentFrames;
+        float t = float(m_pathFrame % c_pathSegmentFrames) / c_pathSegmentFrames;
+        t = t * t * (3.0f - 2.0f * t);
+
+        const CameraPosition &from = m_CameraPosArray[segment];
+        const CameraPosition &to = m_CameraPosArray[(segment + 1) % c_NumCameraPositions];
+        // the short way around
+        float headingDelta = to.heading - from.heading;
+        headingDelta -= 2.0f * 3.14159f * floorf((headingDelta + 3.14159f) / (2.0f * 3.14159f));
+
+        Matrix3 orientation = Matrix3(m_CameraController->GetWorldEast(), m_CameraController->GetWorldUp(), -m_CameraController->GetWorldNorth())
+            * Matrix3::MakeYRotation(from.heading + headingDelta * t)
+            * Matrix3::MakeXRotation(from.pitch + (to.pitch - from.pitch) * t);
+        m_Camera.SetTransform(AffineTransform(orientation, from.position + (to.position - from.position) * t));
+        m_Camera.Update();
+        RetargetBeamAABBs(m_Camera);
+    }
+    else if (m_pathFrame >= pathFrames + countersReadbackCount)
+    {
+        // the path's last frames have been read back
+        float target = dynamicResolutionTargetMs;
+        if (m_pathSamples > 0)
+        {
+            float rmsError = float(sqrt(m_pathSquaredErrorSum / m_pathSamples));
+            Utility::Printf("dynamic resolution path: target %.2f ms, %u frames, beams %.2f ms mean, %.2f ms worst, "
+                "RMS error %.2f ms (%.1f%%), %.1f%% of frames within 10%%, %.1f%% over, scale %.2f mean (%.2f to %.2f)\n",
+                target, m_pathSamples, m_pathMsSum / m_pathSamples, m_pathMsMax,
+                rmsError, 100.0f * rmsError / target,
+                100.0f * m_pathWithinTolerance / m_pathSamples, 100.0f * m_pathOverTarget / m_pathSamples,
+                m_pathScaleSum / m_pathSamples, m_pathScaleMin, m_pathScaleMax);
+        }
+        else
+        {
+            Utility::Printf("dynamic resolution path: no beams times were read back\n");
+        }
+        m_Camera = m_pathLoadCamera;
+        RetargetBeamAABBs(m_Camera);
+        m_pathDone = true;
     }
+    m_pathFrame++;
+}
+#endif
+
+#if TEMPORAL_SAMPLES
+// Runs after the frame's ray or beam trace, with its dynamic constants.
+void DxrMsaaDemo::TemporalResolve(
+    GraphicsContext& context,
+    const Math::Camera& camera,
+    ColorBuffer& colorTarget)
+{
+    ScopedTimer _p0(L"TemporalResolve", context);
+
+#if LENS_DISTORTION
+    // the reprojection assumes the rectilinear projection
+    if (lensDistortion)
+        m_temporalHistoryValid = false;
+#endif
+
+    TemporalCB temporalConstants = {};
+    memcpy(&temporalConstants.prevViewProj, &m_temporalPrevViewProj, sizeof(temporalConstants.prevViewProj));
+    temporalConstants.historyValid = m_temporalHistoryValid ? 1 : 0;
+    temporalConstants.maxHistory = float(int(temporalMaxHistory));
+    temporalConstants.clipGamma = temporalClipGamma;
+    context.WriteBuffer(g_temporalConstantBuffer, 0, &temporalConstants, sizeof(temporalConstants));
+
+    m_temporalPrevViewProj = camera.GetViewProjMatrix();
+    m_temporalHistoryValid = true;
+
+    // the resolve writes the scene color, so it reads a copy
+    context.TransitionResource(colorTarget, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    context.TransitionResource(m_temporalColor, D3D12_RESOURCE_STATE_COPY_DEST, true);
+    context.CopySubresource(m_temporalColor, 0, colorTarget, 0);
+
+    uint32_t parity = uint32_t(m_frameIndex & 1);
+    context.TransitionResource(g_temporalConstantBuffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+    context.TransitionResource(m_temporalColor, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    context.TransitionResource(m_screenDepth, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    context.TransitionResource(m_temporalHistory[parity ^ 1], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    context.TransitionResource(m_temporalHistory[parity], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.TransitionResource(colorTarget, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    context.FlushResourceBarriers();
+
+    ID3D12GraphicsCommandList* pCommandList = context.GetCommandList();
+    ID3D12DescriptorHeap* pDescriptorHeaps[] = { &g_pRaytracingDescriptorHeap->GetDescriptorHeap() };
+    pCommandList->SetDescriptorHeaps(_countof(pDescriptorHeaps), pDescriptorHeaps);
+
+    pCommandList->SetComputeRootSignature(g_TemporalResolveRootSig.GetSignature());
+    pCommandList->SetComputeRootConstantBufferView(0, g_temporalConstantBuffer.GetGpuVirtualAddress());
+    pCommandList->SetComputeRootConstantBufferView(1, g_dynamicConstantBuffer.GetGpuVirtualAddress());
+    pCommandList->SetComputeRootDescriptorTable(2, m_temporalSrvs[parity]);
+    pCommandList->SetComputeRootDescriptorTable(3, m_temporalUavs[parity]);
+    pCommandList->SetPipelineState(g_TemporalResolvePSO.GetPipelineStateObject());
+    pCommandList->Dispatch((colorTarget.GetWidth() + 7) / 8, (colorTarget.GetHeight() + 7) / 8, 1);
 }
+#endif
 
 void DxrMsaaDemo::RenderUI(class GraphicsContext& gfxContext)
 {
@@ -1817,6 +5514,24 @@ void DxrMsaaDemo::RenderUI(class GraphicsContext& gfxContext)
     Vector3 camPos = m_Camera.GetPosition();
     text.DrawFormattedString("<%.1f, %.1f, %.1f>\n", float(camPos.GetX()), float(camPos.GetY()), float(camPos.GetZ()));
 
+#if BVH_REFIT
+    if (animateMeshes)
+        text.DrawFormattedString("BVH refits %u, rebuilds %u, SAH %.2fx\n", m_bvhRefitCount, m_bvhRebuildCount, m_bvhSahRatio);
+#endif
+#if DYNAMIC_RESOLUTION
+    if (renderMode == int(RenderMode::beams))
+    {
+        // the primitive ID encoding is per build, this is its GPU time to compare against the other
+        text.DrawFormattedString("beams %.2f ms (target %.2f ms), %ux%u tiles, scale %.2f, %s primitive IDs\n",
+            m_beamsMs, float(dynamicResolutionTargetMs), m_renderTilesX, m_renderTilesY, m_dynamicResolutionScale,
+            PRIM_ID_GLOBAL ? "global" : "packed");
+    }
+#endif
+    // the settings keep their values, the beams just don't use them
+    const char *tileBeamsOnly = TileBeamsOnlyReason();
+    if (renderMode == int(RenderMode::beams) && tileBeamsOnly != nullptr)
+        text.DrawFormattedString("tile beams only with %s: super-tiles, multi-view and CPU tile binning unavailable\n", tileBeamsOnly);
+
 #if COLLECT_COUNTERS
     text.DrawFormattedString("\n");
 
@@ -1837,6 +5552,71 @@ void DxrMsaaDemo::RenderUI(class GraphicsContext& gfxContext)
     PRINT_COUNTER(intersectTrisCulledTileUVW);
     PRINT_COUNTER(intersectTrisFullCoverage);
     PRINT_COUNTER(intersectTrisPartialCoverage);
+    PRINT_COUNTER(intersectTrisCulledOpacity);
+
+    PRINT_COUNTER(superTileLaunchCount);
+    PRINT_COUNTER(superTileIntersectCount);
+    PRINT_COUNTER(superTileTrisIn);
+    PRINT_COUNTER(superTileCandidates);
+    PRINT_COUNTER(superTileOverflow);
+    PRINT_COUNTER(superTileFallbackTiles);
+    // With super-tiles, intersectTrisIn counts the tiles' candidate tests instead of their traversal's leaves.
+    // Compare against superTiles off.
+    if (counters->superTileLaunchCount > 0 && counters->visTiles > 0)
+    {
+        uint32_t tileTrisOut = counters->intersectTrisFullCoverage + counters->intersectTrisPartialCoverage;
+        text.DrawFormattedString("super-tile: candidates %.1f, kept per tile %.1f%%, traversal intersects per tile %.1f\n",
+            float(counters->superTileCandidates) / counters->superTileLaunchCount,
+            counters->intersectTrisIn > 0 ? 100.0f * tileTrisOut / counters->intersectTrisIn : 0.0f,
+            float(counters->superTileIntersectCount + counters->intersectCount) / counters->visTiles);
+    }
+
+#if MULTI_VIEW
+    PRINT_COUNTER(multiViewLaunchCount);
+    PRINT_COUNTER(multiViewIntersectCount);
+    PRINT_COUNTER(multiViewTrisIn);
+    PRINT_COUNTER(multiViewTileTris);
+    // compare the shared traversal against intersectCount with multiView off, times the view count
+    if (counters->multiViewLaunchCount > 0)
+    {
+        text.DrawFormattedString("multi-view: %u views %.1f apart, shared intersects per tile %.1f, list entries per tile and view %.1f\n",
+            MULTI_VIEW_COUNT, float(multiViewSeparation),
+            float(counters->multiViewIntersectCount) / counters->multiViewLaunchCount,
+            float(counters->multiViewTileTris) / (counters->multiViewLaunchCount * MULTI_VIEW_COUNT));
+    }
+#endif
+
+#if LENS_DISTORTION
+    if (lensDistortion)
+    {
+        float extentX, extentY;
+        LensViewExtent(LensParams(lensK1, lensK2, float(g_SceneColorBuffer.GetWidth()) / g_SceneColorBuffer.GetHeight()), extentX, extentY);
+        text.DrawFormattedString("lens distortion: k1 %.2f k2 %.2f, view %.2fx%.2f, render-then-warp would take %.2fx the samples\n",
+            float(lensK1), float(lensK2), extentX, extentY, extentX * extentY);
+    }
+#endif
+
+#if TEMPORAL_SAMPLES
+    if (temporalSamples)
+    {
+        text.DrawFormattedString("temporal samples: %u patterns, history up to %d frames, clip gamma %.2f\n",
+            TEMPORAL_SAMPLE_PATTERNS, int(temporalMaxHistory), float(temporalClipGamma));
+    }
+#endif
+
+#if TILE_BINNING
+    PRINT_COUNTER(binScatterTiles);
+    PRINT_COUNTER(binScatterTris);
+    // compare the per tile visTrisIn below against cpuTileBinning off
+    if (cpuTileBinning && TileBeamsOnlyReason() == nullptr)
+    {
+        const TileBinner::Stats &stats = m_tileBinnerStats;
+        text.DrawFormattedString("tile binning: %.2f ms, entries per tile %.1f, occluded %u, overflow tiles %u\n",
+            stats.milliseconds, float(stats.entries) / (m_tilesX * m_tilesY), stats.entriesOccluded, stats.overflowTiles);
+        text.DrawFormattedString("tile binning: %u threads, %.0f%% utilization, %u steals, %.0f KB live lists\n",
+            stats.threads, stats.utilization * 100.0f, stats.steals, stats.peakListBytes / 1024.0f);
+    }
+#endif
 
     PRINT_COUNTER(visTiles);
     PRINT_COUNTER(visNoTris);
@@ -1844,16 +5624,113 @@ void DxrMsaaDemo::RenderUI(class GraphicsContext& gfxContext)
     PRINT_COUNTER(visFetchIterations);
     PRINT_COUNTER(visTrisIn);
     PRINT_COUNTER(visShadeQuads);
+    PRINT_COUNTER(visSortSkipped);
+    PRINT_COUNTER(visSamples);
+#if FOVEATION
+    PRINT_COUNTER(visFoveatedTiles);
+    // compare visShadeQuads and the profiler's BeamsQuadVis and BeamsShade against foveaMaxLevel 0
+    if (counters->visTiles > 0 && foveaMaxLevel > 0)
+    {
+        text.DrawFormattedString("foveation: samples %.1f%% of full rate, foveated tiles %.1f%%, shade quads per tile %.1f\n",
+            100.0f * counters->visSamples / (float(counters->visTiles) * TILE_SIZE * AA_SAMPLES),
+            100.0f * counters->visFoveatedTiles / counters->visTiles,
+            float(counters->visShadeQuads) / counters->visTiles);
+    }
+#endif
+#if ADAPTIVE_SAMPLES
+    PRINT_COUNTER(visAdaptiveTiles);
+    PRINT_COUNTER(visAdaptiveMismatches);
+    PRINT_COUNTER(visAdaptiveMismatchesOne);
+    // per predefined camera position, compare visSamples, visShadeQuads and the profiler's Quad Vis against adaptiveSamples off
+    if (counters->visTiles > 0 && adaptiveSamples)
+    {
+        text.DrawFormattedString("adaptive samples, camera position %u: samples %.1f%% of full rate, reduced tiles %.1f%%, shade quads per tile %.1f, mismatched samples %u (%u at one sample)%s\n",
+            m_CameraPosArrayCurrentPosition,
+            100.0f * counters->visSamples / (float(counters->visTiles) * TILE_SIZE * AA_SAMPLES),
+            100.0f * counters->visAdaptiveTiles / counters->visTiles,
+            float(counters->visShadeQuads) / counters->visTiles,
+            counters->visAdaptiveMismatches, counters->visAdaptiveMismatchesOne,
+            adaptiveSamplesValidate ? "" : " (needs adaptiveSamplesValidate)");
+    }
+#endif
+#if TILE_DEPTH_RECORD
+    PRINT_COUNTER(visCoveredTiles);
+#endif
+    // per tile cost, for comparing scenes (SCENE_INSTANCES)
+    if (counters->visTiles > 0)
+    {
+        text.DrawFormattedString("per tile: intersectTrisIn %.1f, visTrisIn %.1f\n",
+            float(counters->intersectTrisIn) / counters->visTiles,
+            float(counters->visTrisIn) / counters->visTiles);
+        // position bytes read by the triangle fetches, against fetching through the index buffer
+        float tileTriFetches = float(counters->intersectTrisIn + counters->visTrisIn) / counters->visTiles;
+        text.DrawFormattedString("per tile: triangle fetch bytes %.0f (indexed %.0f)\n",
+            tileTriFetches * (POSITION_STREAM ? TRI_FETCH_BYTES_STREAM : TRI_FETCH_BYTES_INDEXED),
+            tileTriFetches * TRI_FETCH_BYTES_INDEXED);
+    }
 
     PRINT_COUNTER(shadeTiles);
     PRINT_COUNTER(shadeNoQuads);
     PRINT_COUNTER(shadeOverflow);
     PRINT_COUNTER(shadeQuads);
+#if SHADE_CACHE
+    PRINT_COUNTER(shadeCacheLookups);
+    PRINT_COUNTER(shadeCacheHits);
+    PRINT_COUNTER(shadeCacheInserts);
+    // hits skip the albedo sample and the diffuse sun light, compare the profiler's Quad Shade against shadeCache off
+    if (shadeCache && counters->shadeCacheLookups > 0)
+    {
+        m_shadeCacheLookupsTotal += counters->shadeCacheLookups;
+        m_shadeCacheHitsTotal += counters->shadeCacheHits;
+        text.DrawFormattedString("shade cache: hits %.1f%% (%.1f%% over %.1fM lookups since cleared), cache traffic %.1f MB\n",
+            100.0f * counters->shadeCacheHits / counters->shadeCacheLookups,
+            100.0 * m_shadeCacheHitsTotal / m_shadeCacheLookupsTotal, m_shadeCacheLookupsTotal / 1e6,
+            (float(counters->shadeCacheLookups) * SHADE_CACHE_WAYS + counters->shadeCacheInserts) * sizeof(ShadeCacheEntry) / (1024.0f * 1024.0f));
+    }
+#endif
 
     PRINT_COUNTER(shadowLaunchCount);
     PRINT_COUNTER(shadowHitCount);
     PRINT_COUNTER(shadowBeamIntersectCount);
     PRINT_COUNTER(shadowBeamAnyHitCount);
+    PRINT_COUNTER(shadowBeamClusterAnyHitCount);
+    PRINT_COUNTER(sunShadowBeamLaunchCount);
+    PRINT_COUNTER(sunShadowBeamSplitTiles);
+    PRINT_COUNTER(sunShadowBeamOverflow);
+    PRINT_COUNTER(sunShadowBeamOccluders);
+    PRINT_COUNTER(sunShadowBeamOccluderDuplicates);
+    PRINT_COUNTER(sunShadowBeamIntersectCount);
+    PRINT_COUNTER(sunShadowBeamTrisIn);
+    PRINT_COUNTER(sunShadowBeamTrisCulledOpacity);
+    PRINT_COUNTER(aoBeamLaunchCount);
+    PRINT_COUNTER(aoBeamIntersectCount);
+    PRINT_COUNTER(aoBeamAnyHitCount);
+#if BEAM_VALIDATION
+    PRINT_COUNTER(validateTiles);
+    PRINT_COUNTER(validateOverflowTiles);
+    PRINT_COUNTER(validateSamples);
+    PRINT_COUNTER(validateFalseNegatives);
+    PRINT_COUNTER(validateMisses);
+    PRINT_COUNTER(validateListEntries);
+    PRINT_COUNTER(validateListEntriesHit);
+    if (validateBeams && counters->validateListEntries > 0)
+    {
+        text.DrawFormattedString("beam validation: false negative samples %u, false positive list entries %.1f%%\n",
+            counters->validateFalseNegatives,
+            100.0f * (counters->validateListEntries - counters->validateListEntriesHit) / counters->validateListEntries);
+    }
+#endif
+#if SHADOW_MODE == SHADOW_MODE_BEAM
+    for (uint32_t p = 0; p < SHADOW_PARTITIONS; p++)
+    {
+        text.DrawFormattedString("shadowBeamPartitionIntersectCount[%u]: %u (%.2fx)\n",
+            p, counters->shadowBeamPartitionIntersectCount[p], m_shadowPartitionInflation[p]);
+    }
+#endif
+
+    PRINT_COUNTER(opacityMaskOpaque);
+    PRINT_COUNTER(opacityMaskTransparent);
+    PRINT_COUNTER(opacityMaskUnknown);
 
 # undef PRINT_COUNTER
 
@@ -1884,9 +5761,35 @@ void DxrMsaaDemo::Raytrace(class GraphicsContext& gfxContext)
         break;
 
     case RenderMode::beams:
+    {
+#if DYNAMIC_RESOLUTION
+        UpdateDynamicResolution();
+
+        int beamsTimeWriteIndex = m_frameIndex % countersReadbackCount;
+        gfxContext.InsertTimeStamp(m_beamsTimestampHeap, beamsTimeWriteIndex * 2);
+#endif
         RaytraceDiffuseBeams(gfxContext, m_Camera, g_SceneColorBuffer);
+#if DYNAMIC_RESOLUTION
+        gfxContext.InsertTimeStamp(m_beamsTimestampHeap, beamsTimeWriteIndex * 2 + 1);
+        gfxContext.TransitionResource(m_beamsTimeReadback[beamsTimeWriteIndex], D3D12_RESOURCE_STATE_COPY_DEST, true);
+        gfxContext.GetCommandList()->ResolveQueryData(m_beamsTimestampHeap, D3D12_QUERY_TYPE_TIMESTAMP,
+            beamsTimeWriteIndex * 2, 2, m_beamsTimeReadback[beamsTimeWriteIndex].GetResource(), 0);
+        m_beamsTimeFrame[beamsTimeWriteIndex] = m_frameIndex;
+        m_beamsTimeTiles[beamsTimeWriteIndex] = m_renderTilesX * m_renderTilesY;
+
+        if (m_renderTilesX != m_tilesX || m_renderTilesY != m_tilesY)
+            UpscaleDynamicResolution(gfxContext, g_SceneColorBuffer);
+#endif
         break;
     }
+    }
+
+#if TEMPORAL_SAMPLES
+    if (temporalSamples)
+        TemporalResolve(gfxContext, m_Camera, g_SceneColorBuffer);
+    else
+        m_temporalHistoryValid = false;
+#endif
 
 #if COLLECT_COUNTERS
     int countersWriteIndex = m_frameIndex % countersReadbackCount;
@@ -1899,6 +5802,30 @@ void DxrMsaaDemo::Raytrace(class GraphicsContext& gfxContext)
     gfxContext.CopyBuffer(m_countersReadback[countersWriteIndex], m_counters);
 #endif
 
+#if TILE_STATS
+    // the same slots as the counters, RenderUI reads the oldest one
+    int tileStatsReadIndex = (m_frameIndex + 1) % countersReadbackCount;
+    if (m_tileStatsFrame[tileStatsReadIndex] != ~0ull)
+    {
+        ExportTileStats(m_tileStatsFrame[tileStatsReadIndex], m_tileStatsTilesX[tileStatsReadIndex], m_tileStatsTilesY[tileStatsReadIndex],
+            (const TileStats*)m_tileStatsReadback[tileStatsReadIndex].Map());
+        m_tileStatsReadback[tileStatsReadIndex].Unmap();
+        m_tileStatsFrame[tileStatsReadIndex] = ~0ull;
+    }
+
+    if (tileStats && RenderMode(int(renderMode)) == RenderMode::beams)
+    {
+        int tileStatsWriteIndex = m_frameIndex % countersReadbackCount;
+        gfxContext.TransitionResource(m_tileStats, D3D12_RESOURCE_STATE_COPY_SOURCE);
+        gfxContext.TransitionResource(m_tileStatsReadback[tileStatsWriteIndex], D3D12_RESOURCE_STATE_COPY_DEST);
+        gfxContext.FlushResourceBarriers();
+        gfxContext.CopyBuffer(m_tileStatsReadback[tileStatsWriteIndex], m_tileStats);
+        m_tileStatsFrame[tileStatsWriteIndex] = m_frameIndex;
+        m_tileStatsTilesX[tileStatsWriteIndex] = m_renderTilesX;
+        m_tileStatsTilesY[tileStatsWriteIndex] = m_renderTilesY;
+    }
+#endif
+
     // Clear the gfxContext's descriptor heap since ray tracing changes this underneath the sheets
     gfxContext.SetDescriptorHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, nullptr);
 }
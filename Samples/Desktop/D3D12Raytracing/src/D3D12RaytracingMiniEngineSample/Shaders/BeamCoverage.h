@@ -0,0 +1,223 @@
+#pragma once
+
+#ifndef HLSL
+# include "HlslCompat.h"
+#endif
+
+#include "RayCommon.h"
+#include "Shading.h"
+
+// How much of a beam the shadow AABB coverage masks (ShadowAABBPayload) block. Shared by the area light
+// shadow beams (AnyHitShadow), the ambient occlusion beams (AnyHitBeamAO), and their CPU emulation in
+// AnalyzeBeamAO. The beam's cross section is an axis-aligned rect around the ray, of half size
+// beamExtents * t, in the two axes other than the ray's major axis.
+
+// Where a beam reports a hit on the box: its near plane along the ray, so a box is visited before anything
+// further along. Boxes containing the ray origin, or behind it, come out at t <= 0, and are ignored.
+inline float ShadowAABBNearT(ShadowAABBPayload aabbPayload, float3 rayOrigin, float3 rayDir)
+{
+    float3 aabbNPos = float3(
+        rayDir.x >= 0.0f ? aabbPayload.min.x : aabbPayload.max.x,
+        rayDir.y >= 0.0f ? aabbPayload.min.y : aabbPayload.max.y,
+        rayDir.z >= 0.0f ? aabbPayload.min.z : aabbPayload.max.z);
+    return dot(rayDir, aabbNPos - rayOrigin);
+}
+
+// Area of the rect [grid0, grid1] covered by a shadow AABB coverage mask, in units of mask cells.
+// Whole cells inside the rect are counted with popcounts. Cells cut by the rect's edges are weighted
+// by how much of the cell falls inside the rect.
+inline float ShadowCoverageArea(uint2 coverage, float grid0A, float grid0B, float grid1A, float grid1B)
+{
+    grid0A = min(max(grid0A, 0.0f), float(SHADOW_COVERAGE_DIM));
+    grid0B = min(max(grid0B, 0.0f), float(SHADOW_COVERAGE_DIM));
+    grid1A = min(max(grid1A, 0.0f), float(SHADOW_COVERAGE_DIM));
+    grid1B = min(max(grid1B, 0.0f), float(SHADOW_COVERAGE_DIM));
+
+    uint a0 = uint(min(grid0A, SHADOW_COVERAGE_DIM - 1.0f));
+    uint a1 = uint(min(ceil(grid1A), float(SHADOW_COVERAGE_DIM))) - 1;
+    uint b0 = uint(min(grid0B, SHADOW_COVERAGE_DIM - 1.0f));
+    uint b1 = uint(min(ceil(grid1B), float(SHADOW_COVERAGE_DIM))) - 1;
+
+    // partial overlap of the first and last columns
+    float weightA0 = min(a0 + 1.0f, grid1A) - grid0A;
+    float weightA1 = grid1A - max(float(a1), grid0A);
+    // columns a0 + 1 through a1 - 1 are fully inside
+    uint innerMask = ((uint(1) << a1) - 1) & ~((uint(2) << a0) - 1);
+
+    float area = 0.0f;
+    for (uint b = b0; b <= b1; b++)
+    {
+        float weightB = min(b + 1.0f, grid1B) - max(float(b), grid0B);
+
+        uint row = ((b < 4 ? coverage.x : coverage.y) >> ((b % 4) * SHADOW_COVERAGE_DIM)) & ((1 << SHADOW_COVERAGE_DIM) - 1);
+
+        float rowArea;
+        if (a0 == a1)
+        {
+            rowArea = ((row >> a0) & 1) * (grid1A - grid0A);
+        }
+        else
+        {
+            rowArea = float(countbits(row & innerMask));
+            rowArea += ((row >> a0) & 1) * weightA0;
+            rowArea += ((row >> a1) & 1) * weightA1;
+        }
+
+        area += rowArea * weightB;
+    }
+
+    return area;
+}
+
+// The fraction of the beam's cross section at rayT that the box's coverage mask blocks, projected along the
+// ray's major axis. The ray and the payload bounds are in the same (object) space; instances only translate,
+// so the beam extents stay axis-aligned.
+inline float ShadowBeamCoverage(
+    ShadowAABBPayload aabbPayload,
+    float3 rayOrigin, float3 rayDir, float rayT,
+    float3 beamExtents)
+{
+    float absX = max(rayDir.x, -rayDir.x);
+    float absY = max(rayDir.y, -rayDir.y);
+    float absZ = max(rayDir.z, -rayDir.z);
+    float maxMag = max(absX, max(absY, absZ));
+
+    uint2 coverage;
+    float aabbMinA, aabbMinB, aabbMaxA, aabbMaxB;
+    float beamOriginA, beamOriginB;
+    float beamDirA, beamDirB;
+    float beamExtentsA, beamExtentsB;
+    if (absX == maxMag)
+    {
+        coverage = aabbPayload.coverageX;
+
+        aabbMinA = aabbPayload.min.y;
+        aabbMinB = aabbPayload.min.z;
+        aabbMaxA = aabbPayload.max.y;
+        aabbMaxB = aabbPayload.max.z;
+
+        beamOriginA = rayOrigin.y;
+        beamOriginB = rayOrigin.z;
+        beamDirA = rayDir.y;
+        beamDirB = rayDir.z;
+        beamExtentsA = beamExtents.y;
+        beamExtentsB = beamExtents.z;
+    }
+    else if (absY == maxMag)
+    {
+        coverage = aabbPayload.coverageY;
+
+        aabbMinA = aabbPayload.min.x;
+        aabbMinB = aabbPayload.min.z;
+        aabbMaxA = aabbPayload.max.x;
+        aabbMaxB = aabbPayload.max.z;
+
+        beamOriginA = rayOrigin.x;
+        beamOriginB = rayOrigin.z;
+        beamDirA = rayDir.x;
+        beamDirB = rayDir.z;
+        beamExtentsA = beamExtents.x;
+        beamExtentsB = beamExtents.z;
+    }
+    else
+    {
+        coverage = aabbPayload.coverageZ;
+
+        aabbMinA = aabbPayload.min.x;
+        aabbMinB = aabbPayload.min.y;
+        aabbMaxA = aabbPayload.max.x;
+        aabbMaxB = aabbPayload.max.y;
+
+        beamOriginA = rayOrigin.x;
+        beamOriginB = rayOrigin.y;
+        beamDirA = rayDir.x;
+        beamDirB = rayDir.y;
+        beamExtentsA = beamExtents.x;
+        beamExtentsB = beamExtents.y;
+    }
+
+    beamExtentsA *= rayT;
+    beamExtentsB *= rayT;
+
+    float beamMinA = beamOriginA + beamDirA * rayT - beamExtentsA;
+    float beamMinB = beamOriginB + beamDirB * rayT - beamExtentsB;
+    float beamMaxA = beamOriginA + beamDirA * rayT + beamExtentsA;
+    float beamMaxB = beamOriginB + beamDirB * rayT + beamExtentsB;
+
+    // 2D intersection of beam and box
+    float minA = max(aabbMinA, beamMinA);
+    float minB = max(aabbMinB, beamMinB);
+    float maxA = min(aabbMaxA, beamMaxA);
+    float maxB = min(aabbMaxB, beamMaxB);
+    float dA = max(0.0f, maxA - minA);
+    float dB = max(0.0f, maxB - minB);
+    float areaIntersect = dA * dB;
+
+    if (areaIntersect <= 0.0f)
+        return 0.0f;
+
+    // how much of the intersection is covered, in box coverage mask cells
+    float aabbSizeA = aabbMaxA - aabbMinA;
+    float aabbSizeB = aabbMaxB - aabbMinB;
+    float gridScaleA = SHADOW_COVERAGE_DIM / aabbSizeA;
+    float gridScaleB = SHADOW_COVERAGE_DIM / aabbSizeB;
+    float cellArea = aabbSizeA * aabbSizeB / (SHADOW_COVERAGE_DIM * SHADOW_COVERAGE_DIM);
+    float areaCovered = cellArea * ShadowCoverageArea(coverage,
+        (minA - aabbMinA) * gridScaleA, (minB - aabbMinB) * gridScaleB,
+        (maxA - aabbMinA) * gridScaleA, (maxB - aabbMinB) * gridScaleB);
+
+    float areaBeam = 2.0f * beamExtentsA * 2.0f * beamExtentsB;
+    return areaCovered / areaBeam;
+}
+
+// Half size of the area light's shadow beam, per unit of distance along the ray.
+inline float3 ShadowBeamExtents(float3 rayOrigin)
+{
+    float3 toLight = AREA_LIGHT_CENTER - rayOrigin;
+    float areaLightDist = max(.0001f, sqrt(dot(toLight, toLight)));
+    return AREA_LIGHT_EXTENT * (1.0f / areaLightDist);
+}
+
+// Should the beam take the cluster's aggregate opacity, instead of visiting the cluster's leaves?
+// This must give the same answer when asked from the cluster and from each of its leaves, so it only
+// depends on the ray origin and the cluster (and not on the hit distance). The cluster bounds are in
+// object space, like rayOrigin, and beamExtents are those of the world space origin.
+inline bool ShadowBeamTakesCluster(float3 rayOrigin, float3 beamExtents, ShadowAABBPayload cluster)
+{
+    // the intersection shader ignores AABBs containing the ray origin, so fall back to the leaves
+    if (rayOrigin.x >= cluster.min.x && rayOrigin.y >= cluster.min.y && rayOrigin.z >= cluster.min.z &&
+        rayOrigin.x <= cluster.max.x && rayOrigin.y <= cluster.max.y && rayOrigin.z <= cluster.max.z)
+        return false;
+
+    float3 toCenter = (cluster.min + cluster.max) * .5f - rayOrigin;
+    float clusterDist = sqrt(dot(toCenter, toCenter));
+    float beamSize = 2.0f * max(beamExtents.x, max(beamExtents.y, beamExtents.z)) * clusterDist;
+
+    float3 clusterExtents = cluster.max - cluster.min;
+    float clusterSize = max(clusterExtents.x, max(clusterExtents.y, clusterExtents.z));
+
+    return beamSize >= SHADOW_CLUSTER_BEAM_RATIO * clusterSize;
+}
+
+#if BEAM_AO
+// BEAM_AO cone axes in the normal's tangent frame (z along the normal): one around the normal, and a ring of
+// five through the middle of the remaining cosine weighted solid angle (sin^2 of the polar angle is 7/12).
+static const float3 beamAOCones[BEAM_AO_CONES] =
+{
+    float3(0.0f, 0.0f, 1.0f),
+    float3(0.7638f, 0.0f, 0.6455f),
+    float3(0.2360f, 0.7264f, 0.6455f),
+    float3(-0.6179f, 0.4490f, 0.6455f),
+    float3(-0.6179f, -0.4490f, 0.6455f),
+    float3(0.2360f, -0.7264f, 0.6455f),
+};
+
+// world space axis of BEAM_AO cone c, around the unit normal
+inline float3 BeamAOConeDir(float3 normal, uint c)
+{
+    float3 helper = max(normal.y, -normal.y) < .9f ? float3(0, 1, 0) : float3(1, 0, 0);
+    float3 u = normalize(cross(helper, normal));
+    float3 v = cross(normal, u);
+    return u * beamAOCones[c].x + v * beamAOCones[c].y + normal * beamAOCones[c].z;
+}
+#endif
@@ -0,0 +1,36 @@
+#define HLSL
+
+#include "RayCommon.h"
+
+// Copies the tile lists binned on the CPU (see TileBinner.h) into g_tileTriCounts and g_tileTris, in place of
+// the beam trace. One group per tile. The packed lists start with a (offset, count) pair per tile, counts can
+// exceed TILE_MAX_TRIS, just like the beams' InterlockedAdd, so quad visibility sees the same overflow.
+
+ByteAddressBuffer g_binnedTris : register(t7);
+
+[numthreads(WAVE_SIZE, 1, 1)]
+[RootSignature(
+    "CBV(b1),"
+    "DescriptorTable(UAV(u2, numDescriptors = 14)),"
+    "SRV(t7),"
+)]
+void BeamsBinScatter(
+    uint groupIndex : SV_GroupIndex,
+    uint3 groupID : SV_GroupID)
+{
+    uint tileIndex = groupID.y * dynamicConstants.tilesX + groupID.x;
+
+    uint2 header = g_binnedTris.Load2(tileIndex * 8);
+    uint offset = header.x;
+    uint count = header.y;
+
+    if (groupIndex == 0)
+    {
+        g_tileTriCounts[tileIndex] = count;
+        PERF_COUNTER(binScatterTiles, 1);
+        PERF_COUNTER(binScatterTris, count);
+    }
+
+    for (uint i = groupIndex; i < min(count, TILE_MAX_TRIS); i += WAVE_SIZE)
+        g_tileTris[tileIndex].id[i] = g_binnedTris.Load((offset + i) * 4);
+}
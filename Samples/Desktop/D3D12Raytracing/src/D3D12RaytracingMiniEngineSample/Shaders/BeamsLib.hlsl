@@ -1,10 +1,18 @@
 #define HLSL
 
+#include "BeamCoverage.h"
 #include "Intersect.h"
+#include "OpacityMask.h"
 #include "RayCommon.h"
 #include "RayGen.h"
+#include "Shading.h"
 #include "TriFetch.h"
 
+cbuffer b0 : register(b0)
+{
+    ShadeConstants shadeConstants;
+};
+
 // Record the triangle and move on. We'll compute coverage later.
 [shader("anyhit")]
 void AnyHitPrimary(inout BeamPayload payload, in BeamHitAttribs attr)
@@ -14,6 +22,7 @@ void AnyHitPrimary(inout BeamPayload payload, in BeamHitAttribs attr)
     uint tileX = DispatchRaysIndex().x;
     uint tileY = DispatchRaysIndex().y;
     uint tileIndex = tileY * DispatchRaysDimensions().x + tileX;
+    TILE_STAT(tileIndex, anyHits, 1);
 
     uint meshID = rootConstants.meshID;
     uint triID = attr.triID;
@@ -24,11 +33,89 @@ void AnyHitPrimary(inout BeamPayload payload, in BeamHitAttribs attr)
     if (triSlot >= TILE_MAX_TRIS)
         return;
 
-    uint id = (meshID << PRIM_ID_BITS) | triID;
+    uint id = PrimIDEncode(InstanceID(), meshID, triID);
 
     g_tileTris[tileIndex].id[triSlot] = id;
 }
 
+// BeamTriTest results
+#define BEAM_TRI_CULLED_OPACITY         0
+#define BEAM_TRI_CULLED_FRUSTUM         1
+#define BEAM_TRI_CULLED_SETUP           2
+#define BEAM_TRI_CULLED_CONSERVATIVE_T  3
+#define BEAM_TRI_CULLED_UVW             4
+#define BEAM_TRI_PARTIAL_COVERAGE       5 // this and above overlap the beam
+#define BEAM_TRI_FULL_COVERAGE          6
+
+// Tests one triangle against a beam. Shared by the tile beams, the super-tile beams, and the tiles refining
+// their super-tile's candidate list.
+uint BeamTriTest(
+    float3 beamOrigin, float3 beamDirs[4], Frustum beamFrustum,
+    uint instanceID, uint meshID, uint triID,
+    inout float tMax)
+{
+    uint opacityMask = OpacityMaskFetch(meshID, triID);
+    if (opacityMask == OPACITY_MASK_ALL_TRANSPARENT)
+        return BEAM_TRI_CULLED_OPACITY;
+
+    // test the triangle against the beam frustum's planes
+    Triangle tri = triFetchInstance(instanceID, meshID, triID);
+    if (!FrustumTest(beamFrustum, tri))
+        return BEAM_TRI_CULLED_FRUSTUM;
+
+    // test for backfacing and intersection before ray origin
+    TriTile triTile;
+    if (!TriTileSetup(tri, beamOrigin, triTile))
+        return BEAM_TRI_CULLED_SETUP;
+
+    // test UVW interval overlap
+    float triConservativeTMin;
+    float triConservativeTMax;
+    bool partialCoverage;
+    bool fullCoverage;
+    FrustumTest_ConservativeT(
+        beamOrigin, beamDirs, tri,
+        triConservativeTMin, triConservativeTMax,
+        partialCoverage, fullCoverage);
+
+    // test whether the triangle is fully occluded by tMax, within the bounds of the beam
+    if (triConservativeTMin >= tMax)
+        return BEAM_TRI_CULLED_CONSERVATIVE_T;
+
+    // If this triangle fully overlaps the beam, update tMax with the furthest T value of the
+    // triangle within the beam extents.
+    // Otherwise, we leave tMax alone, because we can't guarantee that the triangle occludes
+    // subsequent triangles in the search. Alpha tested triangles can have holes, so they
+    // only occlude if every micro-triangle is opaque.
+    if (fullCoverage && opacityMask == OPACITY_MASK_ALL_OPAQUE)
+        tMax = min(tMax, triConservativeTMax);
+
+    if (fullCoverage)
+        return BEAM_TRI_FULL_COVERAGE;
+    if (partialCoverage)
+        return BEAM_TRI_PARTIAL_COVERAGE;
+    return BEAM_TRI_CULLED_UVW;
+}
+
+// tile beam counters
+void BeamTriTestCount(uint result)
+{
+    if (result == BEAM_TRI_CULLED_OPACITY)
+        PERF_COUNTER(intersectTrisCulledOpacity, 1);
+    else if (result == BEAM_TRI_CULLED_FRUSTUM)
+        PERF_COUNTER(intersectTrisCulledTileFrustum, 1);
+    else if (result == BEAM_TRI_CULLED_SETUP)
+        PERF_COUNTER(intersectTrisCulledTileSetup, 1);
+    else if (result == BEAM_TRI_CULLED_CONSERVATIVE_T)
+        PERF_COUNTER(intersectTrisCulledTileConservativeT, 1);
+    else if (result == BEAM_TRI_CULLED_UVW)
+        PERF_COUNTER(intersectTrisCulledTileUVW, 1);
+    else if (result == BEAM_TRI_PARTIAL_COVERAGE)
+        PERF_COUNTER(intersectTrisPartialCoverage, 1);
+    else
+        PERF_COUNTER(intersectTrisFullCoverage, 1);
+}
+
 [shader("intersection")]
 void IntersectionPrimary()
 {
@@ -38,6 +125,7 @@ void IntersectionPrimary()
 
     uint tileX = DispatchRaysIndex().x;
     uint tileY = DispatchRaysIndex().y;
+    TILE_STAT(tileY * DispatchRaysDimensions().x + tileX, intersects, 1);
 
     uint meshID = rootConstants.meshID;
     uint primID = PrimitiveIndex();
@@ -54,71 +142,21 @@ void IntersectionPrimary()
 
     // TODO: for TRIS_PER_AABB > 1, it might be worth sorting the leaf node triangles here front to back,
     // to enable some extra early rejects from conservative triangle tMin vs tile occluder tMax tracking.
-    bool outputLeaf = false;
     for (uint triID = primID * TRIS_PER_AABB; triID < (primID + 1) * TRIS_PER_AABB; triID++)
     {
-        TriTile triTile;
-
 #if TRIS_PER_AABB > 1
         if (triID < meshTriCount)
 #endif
         {
             PERF_COUNTER(intersectTrisIn, 1);
-            Triangle tri = triFetch(meshID, triID);
+            uint result = BeamTriTest(tileOrigin, tileDirs, tileFrustum, InstanceID(), meshID, triID, tMax);
+            BeamTriTestCount(result);
 
-            // test the triangle against the tile frustum's planes
-            if (FrustumTest(tileFrustum, tri))
+            if (result >= BEAM_TRI_PARTIAL_COVERAGE)
             {
-                // test for backfacing and intersection before ray origin
-                if (TriTileSetup(tri, tileOrigin, triTile))
-                {
-                    // test UVW interval overlap
-                    float triConservativeTMin;
-                    float triConservativeTMax;
-                    bool partialCoverage;
-                    bool fullCoverage;
-                    FrustumTest_ConservativeT(
-                        tileOrigin, tileDirs, tri,
-                        triConservativeTMin, triConservativeTMax,
-                        partialCoverage, fullCoverage);
-
-                    // test whether the triangle is fully occluded by tMax, within the bounds of the beam
-                    if (triConservativeTMin < tMax)
-                    {
-                        // If this triangle fully overlaps the beam, update tMax with the furthest T value of the
-                        // triangle within the beam extents.
-                        // Otherwise, we leave tMax alone, because we can't guarantee that the triangle occludes
-                        // subsequent triangles in the search.
-                        if (fullCoverage)
-                            tMax = min(tMax, triConservativeTMax);
-
-                        if (fullCoverage || partialCoverage)
-                        {
-                            BeamHitAttribs attr;
-                            attr.triID = triID;
-                            ReportHit(tMax, 0, attr);
-                        }
-
-                        if (fullCoverage)
-                            PERF_COUNTER(intersectTrisFullCoverage, 1);
-                        else if (partialCoverage)
-                            PERF_COUNTER(intersectTrisPartialCoverage, 1);
-                        else
-                            PERF_COUNTER(intersectTrisCulledTileUVW, 1);
-                    }
-                    else
-                    {
-                        PERF_COUNTER(intersectTrisCulledTileConservativeT, 1);
-                    }
-                }
-                else
-                {
-                    PERF_COUNTER(intersectTrisCulledTileSetup, 1);
-                }
-            }
-            else
-            {
-                PERF_COUNTER(intersectTrisCulledTileFrustum, 1);
+                BeamHitAttribs attr;
+                attr.triID = triID;
+                ReportHit(tMax, 0, attr);
             }
         }
     }
@@ -130,14 +168,211 @@ void MissPrimary(inout BeamPayload payload)
     PERF_COUNTER(missCount, 1);
 }
 
+// one ray down the middle of the tile, against the AABBs enlarged for the tile size
+void TraceTileBeam()
+{
+    float3 origin, direction;
+    GenerateCameraRay(DispatchRaysDimensions().xy, DispatchRaysIndex().xy, origin, direction);
+
+    RayDesc rayDesc =
+    {
+        origin,
+        0.0f,
+        direction,
+        FLT_MAX
+    };
+
+    BeamPayload payload;
+
+    TraceRay(
+        g_accel,
+        RAY_FLAG_NONE, ~0,
+        HIT_GROUP_PRIMARY, HIT_GROUP_COUNT, HIT_GROUP_PRIMARY,
+        rayDesc, payload);
+}
+
 [shader("raygeneration")]
 void RayGen()
 {
     PERF_COUNTER(rayGenCount, 1);
 
+    TraceTileBeam();
+}
+
+#if SUPER_TILE
+// Super-tile beams run from their own state object, where the primary hit group is IntersectionSuperTile and
+// AnyHitSuperTile, and g_accel holds the AABBs enlarged for the super-tile size.
+// Dispatched over super-tiles, which can hang off the right and bottom edges of the screen.
+
+void SuperTileRays(uint2 superTile, out float3 origin, out float3 dirs[4])
+{
+    uint2 tileDim = uint2(dynamicConstants.tilesX, dynamicConstants.tilesY);
+    uint2 tileMin = superTile * uint2(SUPER_TILE_DIM_X, SUPER_TILE_DIM_Y);
+    uint2 tileMax = min(tileMin + uint2(SUPER_TILE_DIM_X, SUPER_TILE_DIM_Y), tileDim);
+    GenerateTileRectRays(tileDim, tileMin, tileMax, origin, dirs);
+}
+
+[shader("anyhit")]
+void AnyHitSuperTile(inout BeamPayload payload, in BeamHitAttribs attr)
+{
+    PERF_COUNTER(superTileCandidates, 1);
+
+    uint superTileIndex = DispatchRaysIndex().y * DispatchRaysDimensions().x + DispatchRaysIndex().x;
+
+    uint triSlot;
+    InterlockedAdd(g_superTileTriCounts[superTileIndex], 1, triSlot);
+
+    if (triSlot < SUPER_TILE_MAX_TRIS)
+        g_superTileTris[superTileIndex * SUPER_TILE_MAX_TRIS + triSlot] = PrimIDEncode(InstanceID(), rootConstants.meshID, attr.triID);
+    else if (triSlot == SUPER_TILE_MAX_TRIS)
+        PERF_COUNTER(superTileOverflow, 1);
+}
+
+// Same tests as IntersectionPrimary, against the super-tile's beam. A triangle that fully covers the super-tile
+// also fully covers each of its tiles, so the tMax update stays valid for them.
+[shader("intersection")]
+void IntersectionSuperTile()
+{
+    PERF_COUNTER(superTileIntersectCount, 1);
+
+    float tMax = RayTCurrent();
+
+    uint meshID = rootConstants.meshID;
+    uint primID = PrimitiveIndex();
+
+#if TRIS_PER_AABB > 1
+    uint meshTriCount = g_meshInfo[meshID].triCount;
+#endif
+
+    float3 superTileOrigin;
+    float3 superTileDirs[4];
+    SuperTileRays(DispatchRaysIndex().xy, superTileOrigin, superTileDirs);
+    Frustum superTileFrustum = FrustumCreate(superTileOrigin, superTileDirs);
+
+    for (uint triID = primID * TRIS_PER_AABB; triID < (primID + 1) * TRIS_PER_AABB; triID++)
+    {
+#if TRIS_PER_AABB > 1
+        if (triID < meshTriCount)
+#endif
+        {
+            PERF_COUNTER(superTileTrisIn, 1);
+            uint result = BeamTriTest(superTileOrigin, superTileDirs, superTileFrustum, InstanceID(), meshID, triID, tMax);
+
+            if (result >= BEAM_TRI_PARTIAL_COVERAGE)
+            {
+                BeamHitAttribs attr;
+                attr.triID = triID;
+                ReportHit(tMax, 0, attr);
+            }
+        }
+    }
+}
+
+[shader("raygeneration")]
+void RayGenSuperTile()
+{
+    PERF_COUNTER(superTileLaunchCount, 1);
+
+    // Through the middle of the whole super-tile, which is what the AABB enlargement is sized for, even where
+    // the screen edge cuts it off. GenerateCameraRay works in tiles here, and adds half a tile.
+    float2 superTileDim = float2(SUPER_TILE_DIM_X, SUPER_TILE_DIM_Y);
+    float2 tileCenter = DispatchRaysIndex().xy * superTileDim + superTileDim * .5f - .5f;
+
+    float3 origin, direction;
+    GenerateCameraRay(uint2(dynamicConstants.tilesX, dynamicConstants.tilesY), tileCenter, origin, direction);
+
+    RayDesc rayDesc =
+    {
+        origin,
+        0.0f,
+        direction,
+        FLT_MAX
+    };
+
+    BeamPayload payload;
+
+    TraceRay(
+        g_accel,
+        RAY_FLAG_NONE, ~0,
+        HIT_GROUP_PRIMARY, HIT_GROUP_COUNT, HIT_GROUP_PRIMARY,
+        rayDesc, payload);
+}
+
+// Tile beams from the super-tile candidate lists, without traversal. The tile lists come out the same as from
+// RayGen (in a different order), so quad visibility can't tell the difference.
+[shader("raygeneration")]
+void RayGenRefine()
+{
+    PERF_COUNTER(rayGenCount, 1);
+
+    uint2 tile = DispatchRaysIndex().xy;
+    uint tileIndex = tile.y * DispatchRaysDimensions().x + tile.x;
+
+    uint superTilesX = (DispatchRaysDimensions().x + SUPER_TILE_DIM_X - 1) >> SUPER_TILE_DIM_LOG2_X;
+    uint2 superTile = tile >> uint2(SUPER_TILE_DIM_LOG2_X, SUPER_TILE_DIM_LOG2_Y);
+    uint superTileIndex = superTile.y * superTilesX + superTile.x;
+
+    uint candidateCount = g_superTileTriCounts[superTileIndex];
+    if (candidateCount > SUPER_TILE_MAX_TRIS)
+    {
+        // the candidate list is incomplete, g_accel still holds the tile sized AABBs
+        PERF_COUNTER(superTileFallbackTiles, 1);
+        TraceTileBeam();
+        return;
+    }
+    TILE_STAT(tileIndex, intersects, candidateCount);
+
+    float3 tileOrigin;
+    float3 tileDirs[4];
+    GenerateTileRays(DispatchRaysDimensions().xy, tile, tileOrigin, tileDirs);
+    Frustum tileFrustum = FrustumCreate(tileOrigin, tileDirs);
+
+    // this thread owns the tile's list
+    float tMax = FLT_MAX;
+    uint tileTriCount = 0;
+    for (uint c = 0; c < candidateCount; c++)
+    {
+        uint id = g_superTileTris[superTileIndex * SUPER_TILE_MAX_TRIS + c];
+        uint instanceID;
+        uint meshID;
+        uint triID;
+        PrimIDDecode(id, instanceID, meshID, triID);
+
+        PERF_COUNTER(intersectTrisIn, 1);
+        uint result = BeamTriTest(tileOrigin, tileDirs, tileFrustum, instanceID, meshID, triID, tMax);
+        BeamTriTestCount(result);
+
+        if (result >= BEAM_TRI_PARTIAL_COVERAGE)
+        {
+            if (tileTriCount < TILE_MAX_TRIS)
+                g_tileTris[tileIndex].id[tileTriCount] = id;
+            tileTriCount++;
+        }
+    }
+    g_tileTriCounts[tileIndex] = tileTriCount;
+}
+#endif
+
+#if MULTI_VIEW
+// Multi-view beams run from their own state object, where the primary hit group is IntersectionMultiView and
+// AnyHitMultiView, and g_accel holds the AABBs grown for the views' separation.
+
+// same as GenerateCameraRay, from the middle of the views
+[shader("raygeneration")]
+void RayGenMultiView()
+{
+    PERF_COUNTER(multiViewLaunchCount, 1);
+
     float3 origin, direction;
     GenerateCameraRay(DispatchRaysDimensions().xy, DispatchRaysIndex().xy, origin, direction);
 
+    float3 centerOffset = 0.0f;
+    {for (uint v = 0; v < MULTI_VIEW_COUNT; v++)
+    {
+        centerOffset += dynamicConstants.multiViewOffsets[v].xyz;
+    }}
+    origin += centerOffset / MULTI_VIEW_COUNT;
+
     RayDesc rayDesc =
     {
         origin,
@@ -154,3 +389,416 @@ void RayGen()
         HIT_GROUP_PRIMARY, HIT_GROUP_COUNT, HIT_GROUP_PRIMARY,
         rayDesc, payload);
 }
+
+// The tests of IntersectionPrimary, once per view. The views' tile beams only differ in their origin.
+// Each view keeps its own tMax within the AABB, but the shared ray is never shortened, since a triangle
+// that occludes one view's beam doesn't occlude the others.
+[shader("intersection")]
+void IntersectionMultiView()
+{
+    PERF_COUNTER(multiViewIntersectCount, 1);
+    TILE_STAT(DispatchRaysIndex().y * DispatchRaysDimensions().x + DispatchRaysIndex().x, intersects, 1);
+
+    uint meshID = rootConstants.meshID;
+    uint primID = PrimitiveIndex();
+
+#if TRIS_PER_AABB > 1
+    uint meshTriCount = g_meshInfo[meshID].triCount;
+#endif
+
+    float3 tileOrigin;
+    float3 tileDirs[4];
+    GenerateTileRays(DispatchRaysDimensions().xy, DispatchRaysIndex().xy, tileOrigin, tileDirs);
+
+    float3 viewOrigins[MULTI_VIEW_COUNT];
+    Frustum viewFrustums[MULTI_VIEW_COUNT];
+    float viewTMax[MULTI_VIEW_COUNT];
+    {for (uint v = 0; v < MULTI_VIEW_COUNT; v++)
+    {
+        viewOrigins[v] = tileOrigin + dynamicConstants.multiViewOffsets[v].xyz;
+        viewFrustums[v] = FrustumCreate(viewOrigins[v], tileDirs);
+        viewTMax[v] = FLT_MAX;
+    }}
+
+    for (uint triID = primID * TRIS_PER_AABB; triID < (primID + 1) * TRIS_PER_AABB; triID++)
+    {
+#if TRIS_PER_AABB > 1
+        if (triID < meshTriCount)
+#endif
+        {
+            PERF_COUNTER(multiViewTrisIn, 1);
+
+            uint viewMask = 0;
+            {for (uint v = 0; v < MULTI_VIEW_COUNT; v++)
+            {
+                uint result = BeamTriTest(viewOrigins[v], tileDirs, viewFrustums[v], InstanceID(), meshID, triID, viewTMax[v]);
+                // the tile beam counters cover the displayed view
+                if (v == 0)
+                {
+                    PERF_COUNTER(intersectTrisIn, 1);
+                    BeamTriTestCount(result);
+                }
+                if (result >= BEAM_TRI_PARTIAL_COVERAGE)
+                    viewMask |= 1u << v;
+            }}
+
+            if (viewMask != 0)
+            {
+                MultiViewHitAttribs attr;
+                attr.triID = triID;
+                attr.viewMask = viewMask;
+                ReportHit(RayTCurrent(), 0, attr);
+            }
+        }
+    }
+}
+
+[shader("anyhit")]
+void AnyHitMultiView(inout BeamPayload payload, in MultiViewHitAttribs attr)
+{
+    PERF_COUNTER(anyHitCount, 1);
+
+    uint tileCount = DispatchRaysDimensions().x * DispatchRaysDimensions().y;
+    uint tileIndex = DispatchRaysIndex().y * DispatchRaysDimensions().x + DispatchRaysIndex().x;
+    uint id = PrimIDEncode(InstanceID(), rootConstants.meshID, attr.triID);
+    TILE_STAT(tileIndex, anyHits, 1);
+
+    {for (uint v = 0; v < MULTI_VIEW_COUNT; v++)
+    {
+        if (attr.viewMask & (1u << v))
+        {
+            PERF_COUNTER(multiViewTileTris, 1);
+
+            uint listIndex = v * tileCount + tileIndex;
+            uint triSlot;
+            InterlockedAdd(g_tileTriCounts[listIndex], 1, triSlot);
+            if (triSlot < TILE_MAX_TRIS)
+                g_tileTris[listIndex].id[triSlot] = id;
+        }
+    }}
+}
+#endif
+
+#if SHADOW_MODE == SHADOW_MODE_HARD
+// Sun shadow beams are orthographic, along the sun direction. They start at the tile's nearest visible sample
+// (along the sun direction), and cover all of the tile's visible samples.
+// The occluders are gathered into the tile's triangle list, which is free after quad visibility.
+
+struct SunShadowBeam
+{
+    float3 u; // cross section axes
+    float3 v;
+    float2 crossMin;
+    float2 halfSize; // of each split beam
+    float depthMin;
+    uint2 split;
+};
+
+// Shared by the ray gen and intersection shaders, since the intersection shader can't read the payload.
+SunShadowBeam SunShadowBeamSetup(uint tileIndex, float3 sunDir)
+{
+    SunShadowBeam beam;
+    SunShadowBasis(sunDir, beam.u, beam.v);
+
+    // project the tile's sample bounds onto the beam's cross section
+    TileBounds bounds = g_tileBounds[tileIndex];
+    float2 crossMax = -FLT_MAX;
+    beam.crossMin = FLT_MAX;
+    beam.depthMin = FLT_MAX;
+    for (uint c = 0; c < 8; c++)
+    {
+        float3 corner = float3(
+            (c & 1) ? bounds.max.x : bounds.min.x,
+            (c & 2) ? bounds.max.y : bounds.min.y,
+            (c & 4) ? bounds.max.z : bounds.min.z);
+        float2 q = float2(dot(corner, beam.u), dot(corner, beam.v));
+        beam.crossMin = min(beam.crossMin, q);
+        crossMax = max(crossMax, q);
+        beam.depthMin = min(beam.depthMin, dot(corner, sunDir));
+    }
+
+    // A beam fits within the AABB enlargement if its half size is at most SUN_SHADOW_BEAM_RADIUS / sqrt(2)
+    // (the cross section is rotated against the AABB axes).
+    float2 crossSize = crossMax - beam.crossMin;
+    beam.split = max(uint2(1, 1), uint2(ceil(crossSize * .5f * 1.41421356f / SUN_SHADOW_BEAM_RADIUS)));
+    beam.halfSize = crossSize / beam.split * .5f;
+
+    return beam;
+}
+
+[shader("anyhit")]
+void AnyHitSunShadow(inout SunShadowBeamPayload payload, in BeamHitAttribs attr)
+{
+    uint tileIndex = DispatchRaysIndex().y * DispatchRaysDimensions().x + DispatchRaysIndex().x;
+    uint id = PrimIDEncode(InstanceID(), rootConstants.meshID, attr.triID);
+
+    // A split beam only reports each triangle once, but neighbouring split beams of the tile can report
+    // the same one. They run one after another on this thread, so their entries are already written.
+    uint earlierCount = min(payload.firstOccluder, uint(TILE_MAX_TRIS));
+    for (uint i = 0; i < earlierCount; i++)
+    {
+        if (g_tileTris[tileIndex].id[i] == id)
+        {
+            PERF_COUNTER(sunShadowBeamOccluderDuplicates, 1);
+            IgnoreHit();
+        }
+    }
+
+    PERF_COUNTER(sunShadowBeamOccluders, 1);
+
+    uint triSlot;
+    InterlockedAdd(g_tileTriCounts[tileIndex], 1, triSlot);
+
+    if (triSlot < TILE_MAX_TRIS)
+        g_tileTris[tileIndex].id[triSlot] = id;
+
+    // keep going, every occluder along the beam is needed
+    IgnoreHit();
+}
+
+[shader("intersection")]
+void IntersectionSunShadow()
+{
+    PERF_COUNTER(sunShadowBeamIntersectCount, 1);
+
+    // the ray runs down the middle of its split beam
+    float3 rayOrigin = WorldRayOrigin();
+    float3 rayDir = WorldRayDirection();
+
+    uint tileIndex = DispatchRaysIndex().y * DispatchRaysDimensions().x + DispatchRaysIndex().x;
+    SunShadowBeam beam = SunShadowBeamSetup(tileIndex, rayDir);
+
+    uint meshID = rootConstants.meshID;
+    uint primID = PrimitiveIndex();
+
+#if TRIS_PER_AABB > 1
+    uint meshTriCount = g_meshInfo[meshID].triCount;
+#endif
+
+    for (uint triID = primID * TRIS_PER_AABB; triID < (primID + 1) * TRIS_PER_AABB; triID++)
+    {
+#if TRIS_PER_AABB > 1
+        if (triID >= meshTriCount)
+            break;
+#endif
+        PERF_COUNTER(sunShadowBeamTrisIn, 1);
+        if (OpacityMaskFetch(meshID, triID) == OPACITY_MASK_ALL_TRANSPARENT)
+        {
+            PERF_COUNTER(sunShadowBeamTrisCulledOpacity, 1);
+            continue;
+        }
+        Triangle tri = triFetchInstance(InstanceID(), meshID, triID);
+
+        float3 p0 = tri.v0 - rayOrigin;
+        float3 p1 = p0 + tri.e0;
+        float3 p2 = p0 + tri.e1;
+        float3 t = float3(dot(p0, rayDir), dot(p1, rayDir), dot(p2, rayDir));
+
+        // the triangle has to reach past the start of the beam
+        if (max(max(t.x, t.y), t.z) <= 0.0f)
+            continue;
+
+        // 2D bounds test in the beam's cross section
+        float2 q0 = float2(dot(p0, beam.u), dot(p0, beam.v));
+        float2 q1 = float2(dot(p1, beam.u), dot(p1, beam.v));
+        float2 q2 = float2(dot(p2, beam.u), dot(p2, beam.v));
+        float2 qMin = min(min(q0, q1), q2);
+        float2 qMax = max(max(q0, q1), q2);
+        if (any(qMin > beam.halfSize) || any(qMax < -beam.halfSize))
+            continue;
+
+        BeamHitAttribs attr;
+        attr.triID = triID;
+        ReportHit(max(0.0f, min(min(t.x, t.y), t.z)), 0, attr);
+    }
+}
+
+[shader("miss")]
+void MissSunShadow(inout SunShadowBeamPayload payload)
+{
+}
+
+[shader("raygeneration")]
+void RayGenSunShadow()
+{
+    uint tileIndex = DispatchRaysIndex().y * DispatchRaysDimensions().x + DispatchRaysIndex().x;
+
+    g_tileTriCounts[tileIndex] = 0;
+
+    // nothing visible, or quad visibility gave up on this tile
+    uint quadCount = g_tileShadeQuadsCount[tileIndex];
+    if (quadCount == 0 || quadCount > MAX_SHADE_QUADS_PER_TILE)
+        return;
+
+    float3 sunDir = normalize(shadeConstants.sunDirection);
+    SunShadowBeam beam = SunShadowBeamSetup(tileIndex, sunDir);
+
+    if (any(beam.split > SUN_SHADOW_BEAM_MAX_SPLIT))
+    {
+        PERF_COUNTER(sunShadowBeamOverflow, 1);
+        g_tileTriCounts[tileIndex] = ~uint(0);
+        return;
+    }
+    if (beam.split.x * beam.split.y > 1)
+        PERF_COUNTER(sunShadowBeamSplitTiles, 1);
+    TILE_STAT(tileIndex, shadowLaunches, beam.split.x * beam.split.y);
+
+    SunShadowBeamPayload payload;
+
+    for (uint y = 0; y < beam.split.y; y++)
+    {
+        for (uint x = 0; x < beam.split.x; x++)
+        {
+            PERF_COUNTER(sunShadowBeamLaunchCount, 1);
+
+            payload.firstOccluder = g_tileTriCounts[tileIndex];
+
+            float2 beamCenter = beam.crossMin + (float2(x, y) * 2.0f + 1.0f) * beam.halfSize;
+
+            RayDesc rayDesc =
+            {
+                beam.u * beamCenter.x + beam.v * beamCenter.y + sunDir * beam.depthMin,
+                0.0f,
+                sunDir,
+                FLT_MAX
+            };
+
+            // MissSunShadow is the only entry in the miss table of this ray gen's dispatch
+            TraceRay(
+                g_accelShadow,
+                RAY_FLAG_NONE, ~0,
+                HIT_GROUP_SHADOW, HIT_GROUP_COUNT, 0,
+                rayDesc, payload);
+        }
+    }
+}
+#endif
+
+#if BEAM_AO
+# if SHADOW_MODE != SHADOW_MODE_BEAM
+#  error BEAM_AO reads the area light shadow beam coverage masks, and takes the shadow hit group
+# endif
+// Ambient occlusion beams, see BEAM_AO. They trace the AO AABBs (bound as g_accelShadow), which are leaves only,
+// so each box's coverage mask is the leaf's entry in g_aabbShadow_payload.
+
+struct BeamAOHitAttribs
+{
+};
+
+ShadowAABBPayload BeamAOAABBFetch()
+{
+    // PrimitiveIndex() restarts for each geometry (mesh), and the leaves come before the mesh's clusters
+    return g_aabbShadow_payload[g_meshInfo[rootConstants.meshID].shadowAABBOffset + PrimitiveIndex()];
+}
+
+[shader("anyhit")]
+void AnyHitBeamAO(inout BeamAOPayload payload, in BeamAOHitAttribs attr)
+{
+    PERF_COUNTER(aoBeamAnyHitCount, 1);
+
+    // a square cross section, the same for every cone
+    payload.opacity += ShadowBeamCoverage(
+        BeamAOAABBFetch(),
+        ObjectRayOrigin(), ObjectRayDirection(), RayTCurrent(),
+        float3(BEAM_AO_CONE_TAN, BEAM_AO_CONE_TAN, BEAM_AO_CONE_TAN));
+
+    if (payload.opacity >= 1.0f)
+        AcceptHitAndEndSearch();
+    IgnoreHit();
+}
+
+[shader("intersection")]
+void IntersectionBeamAO()
+{
+    PERF_COUNTER(aoBeamIntersectCount, 1);
+
+    float t = ShadowAABBNearT(BeamAOAABBFetch(), ObjectRayOrigin(), ObjectRayDirection());
+
+    // ignore AABBs that contain the ray origin, or come before the origin
+    if (t > 0.0f)
+    {
+        BeamAOHitAttribs hit;
+        ReportHit(t, 0, hit);
+    }
+}
+
+[shader("miss")]
+void MissBeamAO(inout BeamAOPayload payload)
+{
+}
+
+[shader("raygeneration")]
+void RayGenBeamAO()
+{
+    uint tileX = DispatchRaysIndex().x;
+    uint tileY = DispatchRaysIndex().y;
+    uint tileIndex = tileY * DispatchRaysDimensions().x + tileX;
+
+    // quad shading shows the overflow
+    uint quadCount = g_tileShadeQuadsCount[tileIndex];
+    if (quadCount > MAX_SHADE_QUADS_PER_TILE)
+        return;
+    TILE_STAT(tileIndex, shadowLaunches, quadCount * BEAM_AO_CONES);
+
+    uint2 pixelDim = uint2(dynamicConstants.tilesX * TILE_DIM_X, dynamicConstants.tilesY * TILE_DIM_Y);
+
+    for (uint slot = 0; slot < quadCount; slot++)
+    {
+        ShadeQuad shadeQuad = g_tileShadeQuads[tileIndex].quads[slot];
+
+        // from the middle of the quad (localX and localY are its top left pixel), on its triangle's plane
+        uint quadIndex = shadeQuad.bits & (QUADS_PER_TILE - 1);
+        uint localX;
+        uint localY;
+        threadIndexToQuadSwizzle(quadIndex * QUAD_SIZE, localX, localY);
+
+        float3 rayOriginCenter;
+        float3 rayDirCenter;
+        GenerateCameraRay(
+            pixelDim,
+            float2(tileX * TILE_DIM_X + localX + QUAD_DIM_X * .5f, tileY * TILE_DIM_Y + localY + QUAD_DIM_Y * .5f),
+            rayOriginCenter, rayDirCenter);
+
+        uint instanceID;
+        uint meshID;
+        uint triID;
+        PrimIDDecode(shadeQuad.id, instanceID, meshID, triID);
+        Triangle tri = triFetchInstance(instanceID, meshID, triID);
+
+        // facing the camera
+        float3 normal = normalize(cross(tri.e0, tri.e1));
+        if (dot(normal, rayDirCenter) > 0.0f)
+            normal = -normal;
+        float3 position = rayOriginCenter + rayDirCenter * triIntersectNoFail(rayOriginCenter, rayDirCenter, tri).w;
+
+        float occlusion = 0.0f;
+        for (uint c = 0; c < BEAM_AO_CONES; c++)
+        {
+            PERF_COUNTER(aoBeamLaunchCount, 1);
+
+            RayDesc rayDesc =
+            {
+                position + normal * BEAM_AO_BIAS,
+                0.0f,
+                BeamAOConeDir(normal, c),
+                BEAM_AO_RADIUS
+            };
+
+            BeamAOPayload payload;
+            payload.opacity = 0.0f;
+
+            // MissBeamAO is the only entry in the miss table of this ray gen's dispatch
+            TraceRay(
+                g_accelShadow,
+                RAY_FLAG_NONE, ~0,
+                HIT_GROUP_SHADOW, HIT_GROUP_COUNT, 0,
+                rayDesc, payload);
+
+            occlusion += min(payload.opacity, 1.0f);
+        }
+
+        uint occlusionBits = uint(occlusion / BEAM_AO_CONES * ((1 << BEAM_AO_BITS) - 1) + .5f);
+        g_tileShadeQuads[tileIndex].quads[slot].bits = shadeQuad.bits | (occlusionBits << BEAM_AO_SHIFT);
+    }
+}
+#endif
@@ -1,6 +1,7 @@
 #define HLSL
 
 #include "Intersect.h"
+#include "OpacityMask.h"
 #include "RayCommon.h"
 #include "RayGen.h"
 #include "Shading.h"
@@ -17,7 +18,7 @@ Texture2D<float4> g_materialTextures[] : register(t100);
 
 struct ShadePixel
 {
-    uint id; // mesh + primitive IDs
+    uint id; // encoded primitive ID, see PRIM_ID_GLOBAL
     uint sampleMask;
 };
 
@@ -63,13 +64,197 @@ groupshared float3 tileFramebuffer[TILE_SIZE];
 groupshared float2 qr_float2[TILE_SIZE];
 #endif
 
+#if SHADOW_MODE == SHADOW_MODE_HARD
+// Resolves one pixel's samples against the occluders gathered by the tile's sun shadow beams.
+// The samples are placed on the shaded triangle's plane, giving supersampled hard shadows.
+float SunShadowResolve(
+    uint tileIndex,
+    uint2 pixelDim, uint2 pixelPos,
+    uint receiverID, Triangle receiver)
+{
+    uint occluderCount = g_tileTriCounts[tileIndex];
+    // no occluders, or the tile's samples were too spread out for its beams
+    if (occluderCount == 0 || occluderCount > TILE_MAX_TRIS)
+        return 1.0f;
+
+    // same as RayGenSunShadow
+    float3 sunDir = normalize(shadeConstants.sunDirection);
+
+    float3 rayOriginCenter;
+    float3 rayDirCenter;
+    GenerateCameraRay(pixelDim, float2(pixelPos), rayOriginCenter, rayDirCenter);
+
+    // facing away from the sun, lighting already takes care of it
+    float3 normal = cross(receiver.e0, receiver.e1);
+    if (dot(normal, rayDirCenter) > 0.0f)
+        normal = -normal;
+    if (dot(normal, sunDir) <= 0.0f)
+        return 1.0f;
+
+    // same sample positions as quad visibility
+    float3 majorDirDiff;
+    float3 minorDirDiff;
+    GenerateCameraRayFootprint(pixelDim, float2(pixelPos), majorDirDiff, minorDirDiff);
+
+    float3 samplePos[AA_SAMPLES];
+    {for (uint s = 0; s < AA_SAMPLES; s++)
+    {
+        float2 alpha = AA_SAMPLE_OFFSET_TABLE[s];
+        float3 rayDir = rayDirCenter + majorDirDiff * alpha.x + minorDirDiff * alpha.y;
+        samplePos[s] = rayOriginCenter + rayDir * triIntersectNoFail(rayOriginCenter, rayDir, receiver).w;
+    }}
+
+    uint occludedMask = 0;
+    for (uint i = 0; i < occluderCount && occludedMask != AA_SAMPLE_MASK; i++)
+    {
+        uint id = g_tileTris[tileIndex].id[i];
+        if (id == receiverID)
+            continue;
+
+        uint instanceID;
+        uint meshID;
+        uint triID;
+        PrimIDDecode(id, instanceID, meshID, triID);
+        Triangle occluder = triFetchInstance(instanceID, meshID, triID);
+        uint opacityMask = OpacityMaskFetch(meshID, triID);
+        if (opacityMask == OPACITY_MASK_ALL_OPAQUE)
+        {
+            for (uint s = 0; s < AA_SAMPLES; s++)
+            {
+                if (triOccludes(samplePos[s], sunDir, occluder, ShadowRayTMin(samplePos[s])))
+                    occludedMask |= 1 << s;
+            }
+        }
+        else
+        {
+            Texture2D<float4> diffuse = g_materialTextures[g_meshInfo[meshID].materialID * 2 + 0];
+            for (uint s = 0; s < AA_SAMPLES; s++)
+            {
+                float3 uvw;
+                if (triOccludesUVW(samplePos[s], sunDir, occluder, ShadowRayTMin(samplePos[s]), uvw) &&
+                    OpacityTest(opacityMask, meshID, triID, uvw, diffuse))
+                    occludedMask |= 1 << s;
+            }
+        }
+    }
+
+    return 1.0f - countbits(occludedMask) / float(AA_SAMPLES);
+}
+#endif
+
+#if SHADE_CACHE
+uint ShadeCacheHash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// Identifies the diffuse texel the lane samples on its triangle, at the mip level of its footprint. Returns the
+// key (never 0), and the first entry of the key's set.
+uint ShadeCacheKey(
+    uint instanceID, uint meshID, uint primID,
+    float2 uv, float2 uvDx, float2 uvDy, Texture2D<float4> diffuse,
+    out uint setBase)
+{
+    uint width;
+    uint height;
+    uint levels;
+    diffuse.GetDimensions(0, width, height, levels);
+    float2 dim = float2(width, height);
+    float footprint = max(length(uvDx * dim), length(uvDy * dim));
+    uint mip = min(uint(max(log2(footprint), 0.0f)), levels - 1);
+    int2 texel = int2(floor(uv * dim / float(1 << mip)));
+
+    uint h = ShadeCacheHash(instanceID);
+    h = ShadeCacheHash(h ^ meshID);
+    h = ShadeCacheHash(h ^ primID);
+    h = ShadeCacheHash(h ^ uint(texel.x));
+    h = ShadeCacheHash(h ^ uint(texel.y));
+    h = ShadeCacheHash(h ^ mip);
+
+    setBase = (ShadeCacheHash(h ^ 0x9e3779b9) & ((1 << SHADE_CACHE_SETS_LOG2) - 1)) << SHADE_CACHE_WAYS_LOG2;
+    return h | 1;
+}
+
+bool ShadeCacheLookup(uint key, uint setBase, out float3 albedo, out float3 diffuseSun)
+{
+    uint frame = dynamicConstants.shadeCacheFrame;
+    for (uint way = 0; way < SHADE_CACHE_WAYS; way++)
+    {
+        uint index = setBase + way;
+        if (g_shadeCache[index].key != key)
+            continue;
+
+        // Seqlock with ShadeCacheInsert, which clears the key, stamps the frame, then writes the payload and the key
+        // last: the key and shadedFrame reading the same after the payload means the payload is the key's.
+        // Entries shaded this frame may still be being written.
+        DeviceMemoryBarrier();
+        ShadeCacheEntry entry = g_shadeCache[index];
+        DeviceMemoryBarrier();
+        if (g_shadeCache[index].key == key && g_shadeCache[index].shadedFrame == entry.shadedFrame &&
+            entry.shadedFrame != frame && frame - entry.shadedFrame <= dynamicConstants.shadeCacheMaxAge)
+        {
+            g_shadeCache[index].usedFrame = frame;
+            albedo = float3(
+                f16tof32(entry.albedoRG),
+                f16tof32(entry.albedoRG >> 16),
+                f16tof32(entry.albedoBSunR));
+            diffuseSun = float3(
+                f16tof32(entry.albedoBSunR >> 16),
+                f16tof32(entry.sunGB),
+                f16tof32(entry.sunGB >> 16));
+            return true;
+        }
+    }
+
+    albedo = float3(0, 0, 0);
+    diffuseSun = float3(0, 0, 0);
+    return false;
+}
+
+// Replaces the entry with an expired copy of the key, or else the set's least recently used entry. Lanes missing on
+// the same texel in a frame pick the same entry, and write the same key. See ShadeCacheLookup for the write order.
+void ShadeCacheInsert(uint key, uint setBase, float3 albedo, float3 diffuseSun)
+{
+    uint frame = dynamicConstants.shadeCacheFrame;
+    uint victim = 0;
+    uint victimAge = 0;
+    for (uint way = 0; way < SHADE_CACHE_WAYS; way++)
+    {
+        uint age = g_shadeCache[setBase + way].key == key ? 0xffffffff : frame - g_shadeCache[setBase + way].usedFrame;
+        if (age >= victimAge)
+        {
+            victim = way;
+            victimAge = age;
+        }
+    }
+
+    uint index = setBase + victim;
+    g_shadeCache[index].key = 0;
+    DeviceMemoryBarrier();
+    g_shadeCache[index].shadedFrame = frame;
+    g_shadeCache[index].usedFrame = frame;
+    DeviceMemoryBarrier();
+    g_shadeCache[index].albedoRG = f32tof16(albedo.r) | (f32tof16(albedo.g) << 16);
+    g_shadeCache[index].albedoBSunR = f32tof16(albedo.b) | (f32tof16(diffuseSun.r) << 16);
+    g_shadeCache[index].sunGB = f32tof16(diffuseSun.g) | (f32tof16(diffuseSun.b) << 16);
+    DeviceMemoryBarrier();
+    g_shadeCache[index].key = key;
+}
+#endif
+
 float3 ShadeQuadThread(
     uint threadID, // for groupshared fallback
-    float3 rayDir, uint meshID, uint primID, float3 uvw
+    float3 rayDir, uint instanceID, uint meshID, uint primID, float3 uvw,
+    float shadow, float ambientOcclusion
 )
 {
     uint materialID = g_meshInfo[meshID].materialID;
-    TriInterpolated tri = triFetchAndInterpolate(meshID, primID, uvw);
+    TriInterpolated tri = triFetchAndInterpolateInstance(instanceID, meshID, primID, uvw);
 
 #if QUAD_READ_GROUPSHARED_FALLBACK
     qr_float2[threadID] = tri.uv;
@@ -93,7 +278,34 @@ float3 ShadeQuadThread(
     float2 uvDx = uv10 - uv00;
     float2 uvDy = uv01 - uv00;
 
+    float3 ambientColor = shadeConstants.ambientColor * ambientOcclusion;
+
+#if SHADE_CACHE
+    // after the quad's uv exchange, so the lanes of a quad can hit and miss independently
+    // The animated meshes' texels move under the cached shading, so they skip the cache while they sway
+    uint cacheKey = 0;
+    uint cacheSetBase = 0;
+    bool cacheHit = false;
+    float3 diffuseColor;
+    float3 diffuseSun;
+    if (dynamicConstants.shadeCacheMaxAge > 0 &&
+        !(dynamicConstants.animateMeshes && g_meshInfo[meshID].animated))
+    {
+        PERF_COUNTER(shadeCacheLookups, 1);
+        cacheKey = ShadeCacheKey(
+            instanceID, meshID, primID,
+            tri.uv, uvDx, uvDy, g_materialTextures[materialID * 2 + 0],
+            cacheSetBase);
+
+        cacheHit = ShadeCacheLookup(cacheKey, cacheSetBase, diffuseColor, diffuseSun);
+        if (cacheHit)
+        {
+            PERF_COUNTER(shadeCacheHits, 1);
+        }
+    }
+#else
     float3 diffuseColor = g_materialTextures[materialID * 2 + 0].SampleGrad(g_s0, tri.uv, uvDx, uvDy).rgb;
+#endif
 
     float3 normal = g_materialTextures[materialID * 2 + 1].SampleGrad(g_s0, tri.uv, uvDx, uvDy).rgb * 2 - 1;
     float gloss = 128;
@@ -108,11 +320,35 @@ float3 ShadeQuadThread(
     float3 viewDir = normalize(rayDir);
     float specularMask = .1; // TODO: read the texture
 
-    float shadow = 1.0f;
+#if SHADE_CACHE
+    // The cache holds the view independent albedo and diffuse sun light, the specular is shaded per lane
+    if (!cacheHit)
+    {
+        diffuseColor = g_materialTextures[materialID * 2 + 0].SampleGrad(g_s0, tri.uv, uvDx, uvDy).rgb;
+        diffuseSun = saturate(dot(normal, shadeConstants.sunDirection)) * shadeConstants.sunColor * diffuseColor;
+        if (cacheKey != 0)
+        {
+            PERF_COUNTER(shadeCacheInserts, 1);
+            ShadeCacheInsert(cacheKey, cacheSetBase, diffuseColor, diffuseSun);
+        }
+    }
+
+    float diffuseWeight;
+    float3 specularSun = ApplyLightSpecular(
+        float3(.56f, .56f, .56f),
+        specularMask,
+        gloss,
+        normal,
+        viewDir,
+        shadeConstants.sunDirection,
+        shadeConstants.sunColor,
+        diffuseWeight);
 
+    float3 outputColor = ambientColor * diffuseColor + shadow * (diffuseSun * diffuseWeight + specularSun);
+#else
     float3 outputColor = Shade(
         diffuseColor,
-        shadeConstants.ambientColor,
+        ambientColor,
         float3(.56f, .56f, .56f),
         specularMask,
         gloss,
@@ -121,6 +357,7 @@ float3 ShadeQuadThread(
         shadeConstants.sunDirection,
         shadeConstants.sunColor,
         shadow);
+#endif
 
     return outputColor;
 }
@@ -129,8 +366,8 @@ float3 ShadeQuadThread(
 [RootSignature(
     "CBV(b0),"
     "CBV(b1),"
-    "DescriptorTable(UAV(u2, numDescriptors = 6)),"
-    "DescriptorTable(SRV(t1, numDescriptors = 3)),"
+    "DescriptorTable(UAV(u2, numDescriptors = 14)),"
+    "DescriptorTable(SRV(t1, numDescriptors = 6)),"
     "DescriptorTable(SRV(t100, numDescriptors = unbounded)),"
     "StaticSampler(s0, maxAnisotropy = 8),"
 )]
@@ -169,6 +406,7 @@ void BeamsQuadShade(
         g_screenOutput[outputPos] = float4(1, 0, 0, 1);
         return;
     }
+    if (threadID == 0) TILE_STAT(tileIndex, shadedQuads, quadCount);
 
 #if PACKED_TILE_FB
     tileFramebufferPacked[threadID] = tileFbPack(float3(0, 0, 0));
@@ -207,16 +445,33 @@ void BeamsQuadShade(
             rayOriginShade, rayDirShade);
 
         uint id = shadeQuad.id;
-        uint meshID = id >> PRIM_ID_BITS;
-        uint primID = id & PRIM_ID_MASK;
-        Triangle tri = triFetch(meshID, primID);
+        uint instanceID;
+        uint meshID;
+        uint primID;
+        PrimIDDecode(id, instanceID, meshID, primID);
+        Triangle tri = triFetchInstance(instanceID, meshID, primID);
 
         float3 uvw = triIntersectNoFail(rayOriginShade, rayDirShade, tri).xyz;
 
+#if SHADOW_MODE == SHADOW_MODE_HARD
+        float shadow = SunShadowResolve(
+            tileIndex,
+            uint2(pixelDimX, pixelDimY), uint2(pixelX, pixelY),
+            id, tri);
+#else
+        float shadow = 1.0f;
+#endif
+#if BEAM_AO
+        float ambientOcclusion = 1.0f - (shadeQuad.bits >> BEAM_AO_SHIFT) / float((1 << BEAM_AO_BITS) - 1);
+#else
+        float ambientOcclusion = 1.0f;
+#endif
+
 #if PACKED_TILE_FB
         float3 shadeColor = ShadeQuadThread(
             threadID,
-            rayDirShade, meshID, primID, uvw);
+            rayDirShade, instanceID, meshID, primID, uvw,
+            shadow, ambientOcclusion);
 
         shadeColor = clamp(shadeColor, 0.0f, 1.0f);
 
@@ -229,7 +484,8 @@ void BeamsQuadShade(
 #else
         tileFramebuffer[tileFbIndex] += sampleCount * ShadeQuadThread(
             threadID,
-            rayDirShade, meshID, primID, uvw);
+            rayDirShade, instanceID, meshID, primID, uvw,
+            shadow, ambientOcclusion);
 #endif
     }
     GroupMemoryBarrierWithGroupSync();
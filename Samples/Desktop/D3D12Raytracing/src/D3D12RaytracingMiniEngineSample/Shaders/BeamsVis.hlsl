@@ -1,6 +1,7 @@
 #define HLSL
 
 #include "Intersect.h"
+#include "OpacityMask.h"
 #include "RayCommon.h"
 #include "RayGen.h"
 #include "Shading.h"
@@ -8,9 +9,11 @@
 
 #pragma warning (disable: 3078) // this doesn't seem to work with the new HLSL compiler...
 
+Texture2D<float4> g_materialTextures[] : register(t100);
+
 struct ShadePixel
 {
-    uint id; // mesh + primitive IDs
+    uint id; // encoded primitive ID, see PRIM_ID_GLOBAL
     uint sampleMask;
 };
 
@@ -25,6 +28,7 @@ struct TriCacheEntry
 {
     TriTile triTile;
     uint id;
+    uint opacityMask;
 };
 groupshared TriCacheEntry triCache[TRI_CACHE_SIZE];
 
@@ -80,12 +84,60 @@ void EmitQuad(
     }
 }
 
+#if ADAPTIVE_SAMPLES
+// see ADAPTIVE_SAMPLES, for the (at most ADAPTIVE_SAMPLES_MAX_TRIS) triangles in triCache
+uint AdaptiveSampleCount(uint triCount, float3 rayDirCenter, float3 majorDirDiff, float3 minorDirDiff)
+{
+    uint coveringCount = 0;
+    for (uint cacheIndex = 0; cacheIndex < triCount; cacheIndex++)
+    {
+        if (triCache[cacheIndex].opacityMask != OPACITY_MASK_ALL_OPAQUE)
+            return AA_SAMPLES;
+
+        TriThread triThread = TriThreadSetup(triCache[cacheIndex].triTile, rayDirCenter, majorDirDiff, minorDirDiff);
+
+        // ranges of the denominator and the scaled barycentrics over the pixel footprint, alpha in [-.5, .5]
+        float2 dUdAlpha = triThread.dDenomDAlpha - triThread.dVdAlpha - triThread.dWdAlpha;
+        float4 center = float4(
+            triThread.denomCenter,
+            triThread.denomCenter - triThread.vCenter - triThread.wCenter,
+            triThread.vCenter,
+            triThread.wCenter);
+        float4 radius = .5f * float4(
+            abs(triThread.dDenomDAlpha.x) + abs(triThread.dDenomDAlpha.y),
+            abs(dUdAlpha.x) + abs(dUdAlpha.y),
+            abs(triThread.dVdAlpha.x) + abs(triThread.dVdAlpha.y),
+            abs(triThread.dWdAlpha.x) + abs(triThread.dWdAlpha.y));
+        bool inside = all(center - radius > 0.0f);
+        bool outside = any(center + radius < 0.0f) || center.x + radius.x <= 0.0f;
+
+        if (WaveActiveAllTrue(inside))
+            coveringCount++;
+        else if (!WaveActiveAllTrue(outside))
+            return AA_SAMPLES; // an edge crosses the tile
+    }
+    return max(coveringCount, 1);
+}
+#endif
+
+#if TILE_DEPTH_RECORD
+TileDepthRecord MakeTileDepthRecord(float minDepth, float maxDepth, uint coveredSamples, uint triCount)
+{
+    TileDepthRecord record;
+    record.minDepth = minDepth;
+    record.maxDepth = maxDepth;
+    record.coveredSamples = coveredSamples;
+    record.triCount = triCount;
+    return record;
+}
+#endif
+
 [numthreads(TILE_SIZE, 1, 1)]
 [RootSignature(
     "CBV(b0),"
     "CBV(b1),"
-    "DescriptorTable(UAV(u2, numDescriptors = 6)),"
-    "DescriptorTable(SRV(t1, numDescriptors = 3)),"
+    "DescriptorTable(UAV(u2, numDescriptors = 14)),"
+    "DescriptorTable(SRV(t1, numDescriptors = 6)),"
     "DescriptorTable(SRV(t100, numDescriptors = unbounded)),"
     "StaticSampler(s0, maxAnisotropy = 8),"
 )]
@@ -115,11 +167,16 @@ void BeamsQuadVis(
     if (threadID == 0) PERF_COUNTER(visTiles, 1);
 
     uint tileTriCount = g_tileTriCounts[tileIndex];
+    if (threadID == 0) TILE_STAT(tileIndex, triCount, tileTriCount);
     if (tileTriCount <= 0)
     {
         // no leaves overlap this tile
         if (threadID == 0) PERF_COUNTER(visNoTris, 1);
         g_tileShadeQuadsCount[tileIndex] = 0;
+        g_screenDepth[uint2(pixelX, pixelY)] = FLT_MAX;
+#if TILE_DEPTH_RECORD
+        if (threadID == 0) g_tileDepthRecords[tileIndex] = MakeTileDepthRecord(FLT_MAX, FLT_MAX, 0, 0);
+#endif
         return;
     }
     else if (tileTriCount > TILE_MAX_TRIS)
@@ -127,6 +184,11 @@ void BeamsQuadVis(
         // tile tri list overflowed
         if (threadID == 0) PERF_COUNTER(visOverflow, 1);
         g_tileShadeQuadsCount[tileIndex] = ~uint(0);
+        g_screenDepth[uint2(pixelX, pixelY)] = FLT_MAX;
+#if TILE_DEPTH_RECORD
+        // nothing is known about the tile's depths
+        if (threadID == 0) g_tileDepthRecords[tileIndex] = MakeTileDepthRecord(0.0f, FLT_MAX, 0, tileTriCount);
+#endif
         return;
     }
 
@@ -134,6 +196,21 @@ void BeamsQuadVis(
         tileQuadCount = 0;
     GroupMemoryBarrierWithGroupSync();
 
+#if FOVEATION
+    // uniform across the tile, so the sample loops below don't diverge
+    uint foveationLevel = FoveationLevel(
+        tileX, tileY, dynamicConstants.tilesX, dynamicConstants.tilesY,
+        dynamicConstants.fovea, dynamicConstants.foveaMaxLevel);
+    uint sampleCount = FoveationSampleCount(foveationLevel);
+    if (threadID == 0 && foveationLevel > 0) PERF_COUNTER(visFoveatedTiles, 1);
+#else
+    uint sampleCount = AA_SAMPLES;
+#endif
+#if ADAPTIVE_SAMPLES || FOVEATION
+    // the samples the results are repeated from, sampleCount unless validating
+    uint repeatCount = sampleCount;
+#endif
+
     float nearestT[AA_SAMPLES];
 // TODO: nearestID can be moved to groupshared to reduce register pressure at higher sample counts
 // (but should be moved back to registers for the sort)
@@ -157,11 +234,13 @@ void BeamsQuadVis(
         if (tileTriIndex < tileTriCount)
         {
             uint id = g_tileTris[tileIndex].id[tileTriIndex];
-            uint meshID = id >> PRIM_ID_BITS;
-            uint triID = id & PRIM_ID_MASK;
+            uint instanceID;
+            uint meshID;
+            uint triID;
+            PrimIDDecode(id, instanceID, meshID, triID);
 
             PERF_COUNTER(visTrisIn, 1);
-            Triangle tri = triFetch(meshID, triID);
+            Triangle tri = triFetchInstance(instanceID, meshID, triID);
 
             // We've already performed conservative (coarse) beam tile vs triangle rejects
             // in the intersection shader, so we don't need to repeat them here. Just precompute
@@ -175,17 +254,48 @@ void BeamsQuadVis(
             uint appendSlot = threadID;
 
             triCache[appendSlot].triTile = triTile;
-            triCache[appendSlot].id = (meshID << PRIM_ID_BITS) | triID;
+            triCache[appendSlot].id = id;
+            triCache[appendSlot].opacityMask = OpacityMaskFetch(meshID, triID);
         }
 
         uint triCacheCount = min(TRI_CACHE_SIZE, tileTriCount - tileTriIndexBase);
         GroupMemoryBarrierWithGroupSync();
 
+#if ADAPTIVE_SAMPLES
+        // only one fetch iteration for these
+        if (dynamicConstants.adaptiveSamples != ADAPTIVE_SAMPLES_OFF && tileTriCount <= ADAPTIVE_SAMPLES_MAX_TRIS)
+        {
+            float3 rayOriginCenter;
+            float3 rayDirCenter;
+            GenerateCameraRay(
+                uint2(pixelDimX, pixelDimY),
+                float2(pixelX, pixelY),
+                rayOriginCenter, rayDirCenter);
+
+            float3 majorDirDiff;
+            float3 minorDirDiff;
+            GenerateCameraRayFootprint(
+                uint2(pixelDimX, pixelDimY),
+                float2(pixelX, pixelY),
+                majorDirDiff, minorDirDiff);
+
+            uint adaptiveCount = AdaptiveSampleCount(triCacheCount, rayDirCenter, majorDirDiff, minorDirDiff);
+            if (adaptiveCount < repeatCount)
+            {
+                if (threadID == 0) PERF_COUNTER(visAdaptiveTiles, 1);
+                repeatCount = adaptiveCount;
+                if (dynamicConstants.adaptiveSamples != ADAPTIVE_SAMPLES_VALIDATE)
+                    sampleCount = adaptiveCount;
+            }
+        }
+#endif
+
         // process the surviving triangles in the cache
         for (uint cacheIndex = 0; cacheIndex < triCacheCount; cacheIndex++)
         {
             TriTile triTile = triCache[cacheIndex].triTile;
             uint id = triCache[cacheIndex].id;
+            uint opacityMask = triCache[cacheIndex].opacityMask;
 
             float3 rayOriginCenter;
             float3 rayDirCenter;
@@ -198,24 +308,179 @@ void BeamsQuadVis(
             float3 minorDirDiff;
             GenerateCameraRayFootprint(
                 uint2(pixelDimX, pixelDimY),
+                float2(pixelX, pixelY),
                 majorDirDiff, minorDirDiff);
 
             TriThread triThread = TriThreadSetup(triTile, rayDirCenter, majorDirDiff, minorDirDiff);
 
-            for (uint s = 0; s < AA_SAMPLES; s++)
+            if (opacityMask == OPACITY_MASK_ALL_OPAQUE)
             {
-                if (TriThreadTest(triTile, triThread, AA_SAMPLE_OFFSET_TABLE[s], nearestT[s]))
+                for (uint s = 0; s < sampleCount; s++)
                 {
-                    nearestID[s] = id;
+                    if (TriThreadTest(triTile, triThread, AA_SAMPLE_OFFSET_TABLE[s], nearestT[s]))
+                    {
+                        nearestID[s] = id;
+                    }
+                }
+            }
+            else
+            {
+                // alpha tested, samples that land on transparent micro-triangles (or texels) miss
+                uint instanceID;
+                uint meshID;
+                uint triID;
+                PrimIDDecode(id, instanceID, meshID, triID);
+                Texture2D<float4> diffuse = g_materialTextures[g_meshInfo[meshID].materialID * 2 + 0];
+
+                for (uint s = 0; s < sampleCount; s++)
+                {
+                    float4 uvwt;
+                    if (TriThreadTestUVW(triTile, triThread, AA_SAMPLE_OFFSET_TABLE[s], nearestT[s], uvwt) &&
+                        OpacityTest(opacityMask, meshID, triID, uvwt.xyz, diffuse))
+                    {
+                        nearestT[s] = uvwt.w;
+                        nearestID[s] = id;
+                    }
                 }
             }
         }
         GroupMemoryBarrierWithGroupSync();
     }
 
+#if SHADOW_MODE == SHADOW_MODE_HARD
+    // world space bounds of the visible samples, for the tile's sun shadow beams
+    {
+        float3 rayOriginCenter;
+        float3 rayDirCenter;
+        GenerateCameraRay(
+            uint2(pixelDimX, pixelDimY),
+            float2(pixelX, pixelY),
+            rayOriginCenter, rayDirCenter);
+
+        float3 majorDirDiff;
+        float3 minorDirDiff;
+        GenerateCameraRayFootprint(
+            uint2(pixelDimX, pixelDimY),
+            float2(pixelX, pixelY),
+            majorDirDiff, minorDirDiff);
+
+        float3 boundsMin = FLT_MAX;
+        float3 boundsMax = -FLT_MAX;
+        for (uint s = 0; s < AA_SAMPLES; s++)
+        {
+            if (s < sampleCount && nearestID[s] != BAD_TRI_ID)
+            {
+                float2 alpha = AA_SAMPLE_OFFSET_TABLE[s];
+                float3 rayDir = rayDirCenter + majorDirDiff * alpha.x + minorDirDiff * alpha.y;
+                float3 pos = rayOriginCenter + rayDir * nearestT[s];
+                boundsMin = min(boundsMin, pos);
+                boundsMax = max(boundsMax, pos);
+            }
+        }
+
+        // Note: this assumes TILE_SIZE == WAVE_SIZE
+        boundsMin = WaveActiveMin(boundsMin);
+        boundsMax = WaveActiveMax(boundsMax);
+        if (threadID == 0)
+        {
+            g_tileBounds[tileIndex].min = boundsMin;
+            g_tileBounds[tileIndex].max = boundsMax;
+        }
+    }
+#endif
+
+    if (threadID == 0) PERF_COUNTER(visSamples, TILE_SIZE * sampleCount);
+
+    // nearest tested sample, for the reprojection in TemporalResolve
+    {
+        float depth = FLT_MAX;
+        for (uint s = 0; s < sampleCount; s++)
+        {
+            depth = min(depth, nearestT[s]);
+        }
+        g_screenDepth[uint2(pixelX, pixelY)] = depth;
+    }
+
+#if TILE_DEPTH_RECORD
+    {
+        float minDepth = FLT_MAX;
+        float maxDepth = 0.0f;
+        uint coveredSamples = 0;
+        for (uint s = 0; s < sampleCount; s++)
+        {
+            if (nearestID[s] != BAD_TRI_ID)
+            {
+                minDepth = min(minDepth, nearestT[s]);
+                maxDepth = max(maxDepth, nearestT[s]);
+                coveredSamples++;
+            }
+        }
+
+        // Note: this assumes TILE_SIZE == WAVE_SIZE
+        minDepth = WaveActiveMin(minDepth);
+        maxDepth = WaveActiveMax(maxDepth);
+        // sampleCount is uniform across the tile
+        coveredSamples = WaveActiveSum(coveredSamples) * AA_SAMPLES / sampleCount;
+        if (threadID == 0)
+        {
+            if (coveredSamples == TILE_SIZE * AA_SAMPLES) PERF_COUNTER(visCoveredTiles, 1);
+            g_tileDepthRecords[tileIndex] = MakeTileDepthRecord(
+                minDepth, coveredSamples > 0 ? maxDepth : FLT_MAX, coveredSamples, tileTriCount);
+        }
+    }
+#endif
+
+#if ADAPTIVE_SAMPLES || FOVEATION
+    // The untested samples (FOVEATION and ADAPTIVE_SAMPLES alike) repeat the tested ones, after the tile bounds,
+    // which only cover the positions that were actually tested.
+    if (repeatCount < AA_SAMPLES)
+    {
+#if ADAPTIVE_SAMPLES
+        // With adaptiveSamplesValidate every sample was tested, count the ones the repeat would change, and the
+        // ones a fixed single sample would, for the same tiles
+        uint mismatches = 0;
+        uint mismatchesOne = 0;
+        {for (uint s = 1; s < sampleCount; s++)
+        {
+            mismatchesOne += nearestID[s] != nearestID[0] ? 1 : 0;
+        }}
+#endif
+        {for (uint s = repeatCount; s < AA_SAMPLES; s++)
+        {
+            uint repeatID = nearestID[s % repeatCount];
+#if ADAPTIVE_SAMPLES
+            mismatches += (s < sampleCount && nearestID[s] != repeatID) ? 1 : 0;
+#endif
+            nearestID[s] = repeatID;
+        }}
+#if ADAPTIVE_SAMPLES
+        if (dynamicConstants.adaptiveSamples == ADAPTIVE_SAMPLES_VALIDATE && repeatCount < sampleCount)
+        {
+            mismatches = WaveActiveSum(mismatches);
+            mismatchesOne = WaveActiveSum(mismatchesOne);
+            if (threadID == 0 && mismatches > 0) PERF_COUNTER(visAdaptiveMismatches, mismatches);
+            if (threadID == 0 && mismatchesOne > 0) PERF_COUNTER(visAdaptiveMismatchesOne, mismatchesOne);
+        }
+#endif
+    }
+#endif
+
     // Beware packing bits into the sort key and/or sign-extending it on unpack like HVVR does...
     // HLSL likes to silently convert uint to int (for example, the min intrinsic).
-    sortBitonic(nearestID);
+    // Most pixels are covered by a single triangle, so skip the sort when that holds across the wave.
+    bool pixelUniform = true;
+    {for (uint s = 1; s < AA_SAMPLES; s++)
+    {
+        pixelUniform = pixelUniform && (nearestID[s] == nearestID[0]);
+    }}
+    if (WaveActiveAllTrue(pixelUniform))
+    {
+        if (threadID == 0) PERF_COUNTER(visSortSkipped, 1);
+    }
+    else
+    {
+        sortList(nearestID);
+    }
 
     uint matchID = BAD_TRI_ID;
     uint localS = 0;
@@ -280,4 +545,5 @@ void BeamsQuadVis(
     GroupMemoryBarrierWithGroupSync();
 
     g_tileShadeQuadsCount[tileIndex] = tileQuadCount;
+    if (threadID == 0) TILE_STAT(tileIndex, emittedQuads, tileQuadCount);
 }
@@ -0,0 +1,42 @@
+#define HLSL
+
+#include "RayCommon.h"
+
+// Fills the frame from the top left renderDim pixels, where the beams rendered at the DYNAMIC_RESOLUTION scale. Color
+// is filtered bilinearly, clamped to the rendered pixels. Depth takes the nearest rendered pixel, so TemporalResolve
+// reprojects from depths that were actually sampled.
+
+cbuffer b0 : register(b0)
+{
+    DynamicResolutionCB upscaleConstants;
+};
+
+Texture2D<float3> g_renderColor : register(t30); // copy of this frame's g_screenOutput
+Texture2D<float> g_renderDepth : register(t31); // copy of g_screenDepth
+
+RWTexture2D<float4> g_upscaleOutput : register(u20);
+RWTexture2D<float> g_upscaleDepth : register(u21);
+
+[numthreads(8, 8, 1)]
+[RootSignature(
+    "CBV(b0),"
+    "DescriptorTable(SRV(t30, numDescriptors = 2)),"
+    "DescriptorTable(UAV(u20, numDescriptors = 2)),"
+    "StaticSampler(s0, filter = FILTER_MIN_MAG_MIP_LINEAR, addressU = TEXTURE_ADDRESS_CLAMP, addressV = TEXTURE_ADDRESS_CLAMP),"
+)]
+void DynamicResolutionUpscale(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint2 pixelPos = dispatchThreadID.xy;
+    if (pixelPos.x >= uint(upscaleConstants.outputDim.x) || pixelPos.y >= uint(upscaleConstants.outputDim.y))
+        return;
+
+    uint2 textureDim;
+    g_renderColor.GetDimensions(textureDim.x, textureDim.y);
+
+    // the pixel's center, in rendered pixels
+    float2 renderPos = (float2(pixelPos) + .5f) * upscaleConstants.renderDim / upscaleConstants.outputDim;
+
+    float2 uv = clamp(renderPos, .5f, upscaleConstants.renderDim - .5f) / float2(textureDim);
+    g_upscaleOutput[pixelPos] = float4(g_renderColor.SampleLevel(g_s0, uv, 0), 1);
+    g_upscaleDepth[pixelPos] = g_renderDepth[min(uint2(renderPos), uint2(upscaleConstants.renderDim) - 1)];
+}
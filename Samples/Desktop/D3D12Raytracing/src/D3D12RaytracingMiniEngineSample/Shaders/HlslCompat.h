@@ -29,6 +29,14 @@ struct float4
 
 typedef uint32_t uint;
 
+struct uint2
+{
+    uint32_t x, y;
+
+    uint2() {}
+    uint2(uint32_t x, uint32_t y) : x(x), y(y) {}
+};
+
 struct uint4
 {
     uint32_t x, y, z, w;
@@ -123,3 +131,24 @@ inline float3 cross(const float3 &a, const float3 &b)
         a.x * b.y - a.y * b.x
     );
 }
+
+inline uint countbits(uint v)
+{
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+}
+
+inline float3 operator*(const float3 &a, float b)
+{
+    return float3(
+        a.x * b,
+        a.y * b,
+        a.z * b
+    );
+}
+
+inline float3 normalize(const float3 &a)
+{
+    return a * (1.0f / std::sqrt(dot(a, a)));
+}
@@ -55,6 +55,41 @@ float4 triIntersectNoFail(float3 rayOrigin, float3 rayDir, Triangle tri)
     return float4(u, v, w, t);
 }
 
+// Two-sided occlusion test for shadow rays, also returns the barycentrics (for alpha testing).
+bool triOccludesUVW(float3 rayOrigin, float3 rayDir, Triangle tri, float tMin, out float3 uvw)
+{
+    uvw = float3(0.0f, 0.0f, 0.0f);
+
+    float3 n = cross(tri.e0, tri.e1);
+
+    float denom = dot(-rayDir, n);
+    // ray is parallel to triangle?
+    if (denom == 0.0f)
+        return false;
+
+    float3 v0ToRayOrigin = rayOrigin - tri.v0;
+    float t = dot(v0ToRayOrigin, n);
+
+    float3 e = cross(-rayDir, v0ToRayOrigin);
+    float v = dot(tri.e1, e);
+    float w = -dot(tri.e0, e);
+
+    float ood = 1.0f / denom;
+    t *= ood;
+    v *= ood;
+    w *= ood;
+
+    uvw = float3(1.0f - v - w, v, w);
+    return t >= tMin && v >= 0.0f && w >= 0.0f && v + w <= 1.0f;
+}
+
+// Two-sided occlusion test for shadow rays, doesn't need the barycentrics.
+bool triOccludes(float3 rayOrigin, float3 rayDir, Triangle tri, float tMin)
+{
+    float3 uvw;
+    return triOccludesUVW(rayOrigin, rayDir, tri, tMin, uvw);
+}
+
 struct Frustum
 {
     enum { planeCount = 4 };
@@ -315,3 +350,24 @@ bool TriThreadTest(TriTile triTile, TriThread triThread, float2 alpha, inout flo
     depth = triTile.t * (1.0f / denom);
     return true;
 }
+
+// Same as TriThreadTest, but also returns the barycentrics of the hit (for alpha testing).
+// depth is left alone, the caller decides whether the hit counts.
+bool TriThreadTestUVW(TriTile triTile, TriThread triThread, float2 alpha, float depth, out float4 uvwt)
+{
+    uvwt = float4(0.0f, 0.0f, 0.0f, depth);
+
+    float denom = triThread.denomCenter + triThread.dDenomDAlpha.x * alpha.x + triThread.dDenomDAlpha.y * alpha.y;
+    float depthDelta = depth * denom - triTile.t;
+
+    float v = triThread.vCenter + triThread.dVdAlpha.x * alpha.x + triThread.dVdAlpha.y * alpha.y;
+    float w = triThread.wCenter + triThread.dWdAlpha.x * alpha.x + triThread.dWdAlpha.y * alpha.y;
+    float u = denom - v - w;
+
+    if (depthDelta < 0.0f || u < 0.0f || v < 0.0f || w < 0.0f)
+        return false;
+
+    float ood = 1.0f / denom;
+    uvwt = float4(u * ood, v * ood, w * ood, triTile.t * ood);
+    return true;
+}
@@ -0,0 +1,91 @@
+#define HLSL
+
+#include "OpacityMask.h"
+#include "RayCommon.h"
+#include "TriFetch.h"
+
+// Bakes the opacity micro-masks of one alpha tested mesh, one thread per triangle.
+// Runs once at load time.
+
+Texture2D<float4> g_materialTextures[] : register(t100);
+
+RWStructuredBuffer<uint> g_opacityMasksOut : register(u0);
+
+[numthreads(64, 1, 1)]
+[RootSignature(
+    "RootConstants(num32BitConstants = 1, b3),"
+    "DescriptorTable(SRV(t1, numDescriptors = 3)),"
+    "DescriptorTable(SRV(t100, numDescriptors = unbounded)),"
+    "UAV(u0),"
+    "StaticSampler(s0, maxAnisotropy = 8),"
+)]
+void BakeOpacityMasks(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint meshID = rootConstants.meshID;
+    uint triID = dispatchThreadID.x;
+
+    RayTraceMeshInfo mesh = g_meshInfo[meshID];
+    if (triID >= mesh.triCount)
+        return;
+
+    uint3 indices = triFetchIndices(mesh.indexOffset + triID * 3 * 2);
+    float2 uv0 = asfloat(g_attributes.Load2(mesh.attrOffsetTexcoord0 + indices.x * mesh.attrStride));
+    float2 uv1 = asfloat(g_attributes.Load2(mesh.attrOffsetTexcoord0 + indices.y * mesh.attrStride));
+    float2 uv2 = asfloat(g_attributes.Load2(mesh.attrOffsetTexcoord0 + indices.z * mesh.attrStride));
+
+    Texture2D<float4> diffuse = g_materialTextures[mesh.materialID * 2 + 0];
+    float2 texSize;
+    diffuse.GetDimensions(texSize.x, texSize.y);
+
+    uint mask = 0;
+    for (uint m = 0; m < OPACITY_MICRO_TRIS; m++)
+    {
+        float2 c0, c1, c2;
+        OpacityMicroTriCorners(m, c0, c1, c2);
+
+        // micro-triangle corners in UV space
+        float2 t0 = (uv0 * (1.0f - c0.x - c0.y) + uv1 * c0.x + uv2 * c0.y);
+        float2 t1 = (uv0 * (1.0f - c1.x - c1.y) + uv1 * c1.x + uv2 * c1.y);
+        float2 t2 = (uv0 * (1.0f - c2.x - c2.y) + uv1 * c2.x + uv2 * c2.y);
+        float2 e0 = (t1 - t0) * texSize;
+        float2 e1 = (t2 - t0) * texSize;
+        float2 e2 = (t2 - t1) * texSize;
+        float edgeTexels = sqrt(max(dot(e0, e0), max(dot(e1, e1), dot(e2, e2))));
+
+        // enough samples to land on every texel, or drop down the mip chain until they do
+        uint sampleDim = clamp(uint(ceil(edgeTexels)) + 1, 2, OPACITY_BAKE_SAMPLES);
+        float lod = max(0.0f, log2(edgeTexels / (OPACITY_BAKE_SAMPLES - 1)));
+
+        // Coarser mips average the alpha, so only trust them when every texel underneath agrees.
+        float opaqueCutoff = lod > 0.0f ? .99f : OPACITY_ALPHA_CUTOFF;
+        float transparentCutoff = lod > 0.0f ? .01f : OPACITY_ALPHA_CUTOFF;
+
+        uint opaqueCount = 0;
+        uint transparentCount = 0;
+        uint sampleCount = 0;
+        for (uint b = 0; b < sampleDim; b++)
+        {
+            for (uint a = 0; a + b < sampleDim; a++)
+            {
+                float2 st = float2(a, b) / (sampleDim - 1);
+                float2 uv = t0 + (t1 - t0) * st.x + (t2 - t0) * st.y;
+                float alpha = diffuse.SampleLevel(g_s0, uv, lod).a;
+                if (alpha >= opaqueCutoff)
+                    opaqueCount++;
+                if (alpha < transparentCutoff)
+                    transparentCount++;
+                sampleCount++;
+            }
+        }
+
+        uint state = OPACITY_STATE_UNKNOWN;
+        if (opaqueCount == sampleCount)
+            state = OPACITY_STATE_OPAQUE;
+        else if (transparentCount == sampleCount)
+            state = OPACITY_STATE_TRANSPARENT;
+
+        mask |= state << (m * 2);
+    }
+
+    g_opacityMasksOut[mesh.opacityMaskOffset + triID] = mask;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#ifndef HLSL
+# include "HlslCompat.h"
+#endif
+
+#include "RayCommon.h"
+
+// Alpha tested triangles carry an opacity micro-mask, baked from the diffuse texture's alpha at load time.
+// Each triangle is split into OPACITY_MICRO_TRIS micro-triangles (OPACITY_SUBDIV segments along each edge),
+// with 2 bits of state per micro-triangle, so a triangle's mask fits in a uint.
+// Only micro-triangles the bake couldn't classify need to touch the texture during traversal.
+#define OPACITY_SUBDIV 4
+#define OPACITY_MICRO_TRIS (OPACITY_SUBDIV * OPACITY_SUBDIV)
+
+#define OPACITY_STATE_TRANSPARENT   0
+#define OPACITY_STATE_OPAQUE        1
+#define OPACITY_STATE_UNKNOWN       2 // mixed alpha, sample the texture
+
+#define OPACITY_MASK_ALL_TRANSPARENT    (uint(0x00000000))
+#define OPACITY_MASK_ALL_OPAQUE         (uint(0x55555555))
+
+// RayTraceMeshInfo::opacityMaskOffset for meshes that aren't alpha tested
+#define OPACITY_MASK_NONE (uint(0xffffffff))
+
+// same cutoff as MiniEngine's cutout pixel shader
+#define OPACITY_ALPHA_CUTOFF .5f
+
+// The bake samples each micro-triangle on a grid with up to this many samples per edge,
+// at the mip level where neighboring samples are about a texel apart.
+#define OPACITY_BAKE_SAMPLES 8
+
+// v and w are the barycentrics of the triangle's second and third vertices.
+// Row j (along w) holds 2 * (OPACITY_SUBDIV - j) - 1 micro-triangles, alternating upright and flipped.
+inline uint OpacityMicroTriIndex(float v, float w)
+{
+    float fv = v * OPACITY_SUBDIV;
+    float fw = w * OPACITY_SUBDIV;
+    int i = int(fv);
+    int j = int(fw);
+    i = i < 0 ? 0 : (i > OPACITY_SUBDIV - 1 ? OPACITY_SUBDIV - 1 : i);
+    j = j < 0 ? 0 : (j > OPACITY_SUBDIV - 1 ? OPACITY_SUBDIV - 1 : j);
+    // points on (or slightly past) the outer edge
+    if (i + j > OPACITY_SUBDIV - 1)
+        i = OPACITY_SUBDIV - 1 - j;
+
+    bool flipped = (i + j < OPACITY_SUBDIV - 1) && ((fv - i) + (fw - j) > 1.0f);
+    return uint(j * (2 * OPACITY_SUBDIV - j) + 2 * i + (flipped ? 1 : 0));
+}
+
+inline uint OpacityMaskState(uint mask, uint microTri)
+{
+    return (mask >> (microTri * 2)) & 3;
+}
+
+#ifdef HLSL
+
+#include "TriFetch.h"
+
+StructuredBuffer<uint> g_opacityMasks : register(t4);
+
+// Inverse of OpacityMicroTriIndex, returns the (v, w) barycentrics of the micro-triangle's corners.
+void OpacityMicroTriCorners(uint microTri, out float2 c0, out float2 c1, out float2 c2)
+{
+    uint j = 0;
+    while (microTri >= uint(2 * (OPACITY_SUBDIV - j) - 1))
+    {
+        microTri -= 2 * (OPACITY_SUBDIV - j) - 1;
+        j++;
+    }
+    uint i = microTri / 2;
+
+    float s = 1.0f / OPACITY_SUBDIV;
+    if (microTri & 1)
+    {
+        c0 = float2(float(i + 1) * s, float(j) * s);
+        c1 = float2(float(i + 1) * s, float(j + 1) * s);
+        c2 = float2(float(i) * s, float(j + 1) * s);
+    }
+    else
+    {
+        c0 = float2(float(i) * s, float(j) * s);
+        c1 = float2(float(i + 1) * s, float(j) * s);
+        c2 = float2(float(i) * s, float(j + 1) * s);
+    }
+}
+
+uint OpacityMaskFetch(uint meshID, uint triID)
+{
+    uint offset = g_meshInfo[meshID].opacityMaskOffset;
+    if (offset == OPACITY_MASK_NONE)
+        return OPACITY_MASK_ALL_OPAQUE;
+    return g_opacityMasks[offset + triID];
+}
+
+// Alpha test for a hit at barycentrics uvw. The mask resolves most hits without touching the texture.
+// counted is false for the tests that aren't part of the frame's rendering (BEAM_VALIDATION).
+bool OpacityTest(uint mask, uint meshID, uint triID, float3 uvw, Texture2D<float4> diffuse, bool counted = true)
+{
+    if (mask == OPACITY_MASK_ALL_OPAQUE)
+        return true;
+
+    uint state = OpacityMaskState(mask, OpacityMicroTriIndex(uvw.y, uvw.z));
+    if (state == OPACITY_STATE_OPAQUE)
+    {
+        if (counted) PERF_COUNTER(opacityMaskOpaque, 1);
+        return true;
+    }
+    if (state == OPACITY_STATE_TRANSPARENT)
+    {
+        if (counted) PERF_COUNTER(opacityMaskTransparent, 1);
+        return false;
+    }
+
+    if (counted) PERF_COUNTER(opacityMaskUnknown, 1);
+    float2 uv = triFetchUV(meshID, triID, uvw);
+    return diffuse.SampleLevel(g_s0, uv, 0).a >= OPACITY_ALPHA_CUTOFF;
+}
+
+#endif
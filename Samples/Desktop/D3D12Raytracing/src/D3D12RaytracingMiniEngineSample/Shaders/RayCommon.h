@@ -4,6 +4,8 @@
 # include "HlslCompat.h"
 #endif
 
+#include "Shading.h"
+
 #define QUAD_READ_GROUPSHARED_FALLBACK 1
 // Note that the AABBs are enlarged to be conservative from the original camera viewpoint,
 // and this isn't updated as you move the camera around.
@@ -26,9 +28,46 @@
 #define AA_SAMPLES_RASTER (AA_SAMPLES > 8 ? 8 : AA_SAMPLES)
 
 #define TRIS_PER_AABB 1
+
+// The model is placed SCENE_INSTANCES_X x SCENE_INSTANCES_Z times on a grid in XZ. Every instance shares the
+// same bottom-level BVHs, and the top-level BVHs hold one instance per copy (and per bottom-level BVH).
+// Triangles are fetched in object space and transformed by g_instanceTransforms, and the instance is part of
+// the encoded primitive ID, so PRIM_ID_GLOBAL is selected.
+// The AABB enlargement and shadow beam coverage masks work in object space, so instances are only translated.
+#define SCENE_INSTANCES_X 1
+#define SCENE_INSTANCES_Z 1
+#define SCENE_INSTANCES (SCENE_INSTANCES_X * SCENE_INSTANCES_Z)
+
+// How triangles are identified in the tile triangle lists and shade quads (always 32 bits).
+// 0 = meshID << PRIM_ID_BITS | triID, limited to 2^PRIM_ID_BITS triangles per mesh, decoded with a shift and a mask
+// 1 = global triangle index, for instanced scenes and meshes over 2^PRIM_ID_BITS triangles. Every decode does a
+//     binary search over the per-mesh prefix sum of triangle counts (RayTraceMeshInfo::triOffset), and with
+//     instances a divide. Instanced scenes select it, larger meshes need it set by hand (the load time log says so).
+#define PRIM_ID_GLOBAL (SCENE_INSTANCES > 1)
 #define PRIM_ID_BITS 16
 #define PRIM_ID_MASK ((1 << PRIM_ID_BITS) - 1)
 
+// Triangle fetches in the visibility passes (beam intersection, quad visibility, shadow occluders) read
+// positions from a de-indexed stream built at load time, instead of going through the index buffer to the
+// interleaved vertex records (see triFetch). Triangles are stored in blocks of POSITION_STREAM_BLOCK, with
+// one array per component within a block, so lanes fetching nearby triangles read the same cache lines.
+// POSITION_STREAM_BLOCK 1 gives a plain array of per-triangle records.
+// With POSITION_STREAM_QUANTIZED, components are 16 bits relative to the mesh's bounding box
+// (RayTraceMeshInfo::posQuantMin/posQuantScale), and the AABBs are grown by half a quantization step.
+#define POSITION_STREAM 1
+#define POSITION_STREAM_QUANTIZED 0
+#define POSITION_STREAM_BLOCK 32
+#if POSITION_STREAM_QUANTIZED
+# define POSITION_STREAM_DWORDS 5 // 9 16-bit components
+#else
+# define POSITION_STREAM_DWORDS 9
+#endif
+
+// Bytes read per triangle fetch, for the per tile estimate in the UI. The indexed path reads the 16-bit
+// indices as 8 aligned bytes, then 3 positions from 3 separate vertex records.
+#define TRI_FETCH_BYTES_INDEXED (8 + 3 * 12)
+#define TRI_FETCH_BYTES_STREAM (POSITION_STREAM_DWORDS * 4)
+
 // 8x4 tiles
 #define TILE_DIM_LOG2_X 3
 #define TILE_DIM_LOG2_Y 2
@@ -37,6 +76,114 @@
 #define TILE_SIZE (TILE_DIM_X * TILE_DIM_Y)
 #define TILE_MAX_TRIS 512 // adjust this according to max estimated tri density
 
+// Two level primary beams: a coarse beam per super-tile of SUPER_TILE_DIM_X x SUPER_TILE_DIM_Y tiles
+// (default 4x8 tiles, 32x32 pixels) traverses its own set of AABBs, enlarged for the super-tile size, and gathers
+// a candidate list. The tiles within it then test only that list, without traversing the BVH again.
+// Super-tiles whose list overflows SUPER_TILE_MAX_TRIS fall back to tracing the tile beams.
+// SUPER_TILE_NODE_COST is the cost of visiting a BVH node relative to testing a triangle against a beam, for the
+// load time estimate of where super-tiles pay off.
+#define SUPER_TILE 1
+#define SUPER_TILE_DIM_LOG2_X 2
+#define SUPER_TILE_DIM_LOG2_Y 3
+#define SUPER_TILE_DIM_X (1 << SUPER_TILE_DIM_LOG2_X)
+#define SUPER_TILE_DIM_Y (1 << SUPER_TILE_DIM_LOG2_Y)
+#define SUPER_TILE_MAX_TRIS 4096
+#define SUPER_TILE_NODE_COST .25f
+
+// Multi-view (stereo) primary beams with shared traversal. The views share the camera's orientation and
+// projection, and sit side by side along its right axis, Application/Raytracing/multiViewSeparation apart
+// (at most MULTI_VIEW_MAX_SEPARATION). One beam per tile, from the middle of the views, traverses its own set of
+// AABBs, grown by half of MULTI_VIEW_MAX_SEPARATION so it finds every triangle any of the views' tile beams
+// would. The intersection shader then runs the beam tests once per view, from each view's origin, and the tile
+// lists of view v start at v * tile count. View 0 is the camera, which is the one displayed.
+#define MULTI_VIEW 1
+#define MULTI_VIEW_COUNT 2
+#define MULTI_VIEW_MAX_SEPARATION 13.0f
+
+// Foveated quad visibility: tiles test AA_SAMPLES >> L samples per pixel at foveation level L, from their distance to
+// the fovea (see FoveationLevel), and repeat them, so shade quads still carry AA_SAMPLES worth of coverage.
+#define FOVEATION 1
+#define FOVEATION_MAX_LEVEL AA_SAMPLES_LOG2
+
+// Adaptive per-tile sample count in quad visibility: tiles with no triangle edges inside them (at most
+// ADAPTIVE_SAMPLES_MAX_TRIS opaque candidates) test one sample per covering triangle, see Application/Raytracing/adaptiveSamples.
+#define ADAPTIVE_SAMPLES 1
+#define ADAPTIVE_SAMPLES_MAX_TRIS 2
+#define ADAPTIVE_SAMPLES_OFF 0
+#define ADAPTIVE_SAMPLES_ON 1
+#define ADAPTIVE_SAMPLES_VALIDATE 2
+
+// Radial lens distortion of the output projection (see LensScale), for head-mounted and fisheye displays that would
+// otherwise render a rectilinear image and warp it. Camera rays go straight through the distorted pixels, and the
+// tile beams cover conservative bounds of the distorted tile footprints (LensRectBounds). The primary AABBs are
+// enlarged for a tile's footprint, so Application/Raytracing/lensDistortion traces a separate set, enlarged for the
+// largest stretch the coefficient ranges allow (LENS_DISTORTION_K1_MIN..LENS_DISTORTION_K2_MAX).
+#define LENS_DISTORTION 1
+#define LENS_DISTORTION_K1_MIN -0.2f
+#define LENS_DISTORTION_K1_MAX 0.3f
+#define LENS_DISTORTION_K2_MIN -0.05f
+#define LENS_DISTORTION_K2_MAX 0.25f
+// in pixels, covers the per pixel linearization of the distortion in quad visibility
+#define LENS_DISTORTION_BEAM_PAD .25f
+
+// Temporal sample patterns: frame f uses a rotation or mirror image of AA_SAMPLE_OFFSET_TABLE, and with
+// Application/Raytracing/temporalSamples TemporalResolve accumulates the frames into a reprojected history.
+#define TEMPORAL_SAMPLES 1
+#define TEMPORAL_SAMPLE_PATTERNS 8
+#define TEMPORAL_SAMPLES_MAX_HISTORY 32
+
+// Beam traced ambient occlusion, for the beams renderer (which has no depth buffer for SSAO, and SSAO can't see
+// off-screen occluders in any case). Between quad visibility and shading, RayGenBeamAO casts BEAM_AO_CONES wide
+// beams from the middle of each shade quad, over the hemisphere around its triangle's normal, and accumulates
+// their opacity from the shadow AABB coverage masks the way the area light shadow beams do (ShadowBeamCoverage).
+// The cones are evenly spaced in cosine weighted solid angle, so the occlusion is their plain average. The AO
+// AABBs are grown by the beams' half width at BEAM_AO_RADIUS, so the ray down each beam reaches every box the beam
+// overlaps within that radius. The result goes into the top BEAM_AO_BITS bits of ShadeQuad::bits, as occlusion,
+// so quads the pass doesn't touch (with Application/Raytracing/beamAO off) come out unoccluded.
+#define BEAM_AO 1
+#define BEAM_AO_CONES 6
+#define BEAM_AO_CONE_TAN .6f // beam half width per unit distance, about 31 degrees
+#define BEAM_AO_RADIUS 64.0f
+#define BEAM_AO_BIAS .5f // along the normal, for the beam origins
+#define BEAM_AO_BITS 8
+#define BEAM_AO_SHIFT (32 - BEAM_AO_BITS)
+
+// Texel space cache of the view independent shading (albedo and unshadowed diffuse sun light) for quad shading, set
+// associative, entries live for Application/Raytracing/shadeCacheMaxAge frames. Specular is shaded per lane.
+#define SHADE_CACHE 1
+#define SHADE_CACHE_SETS_LOG2 16
+#define SHADE_CACHE_WAYS_LOG2 2
+#define SHADE_CACHE_WAYS (1 << SHADE_CACHE_WAYS_LOG2)
+#define SHADE_CACHE_ENTRIES (1 << (SHADE_CACHE_SETS_LOG2 + SHADE_CACHE_WAYS_LOG2))
+#define SHADE_CACHE_MAX_AGE 32
+
+// Per tile summary of quad visibility (TileDepthRecord), for the passes of the next frame (culling, light binning,
+// post effects) to read instead of reducing a depth buffer. It comes from the depths quad visibility tested anyway.
+// Depths are view space, like g_screenDepth: the camera rays have a view space z of -1, so their t is the depth.
+#define TILE_DEPTH_RECORD 1
+
+// Conservativeness check for the beams: RayGenValidateBeams traces every sample of each tile as an exact ray and
+// counts the hits missing from the tile's list (Application/Raytracing/validateBeams, or the -validatebeams run).
+#define BEAM_VALIDATION 1
+#define BEAM_VALIDATION_MAX_MISSES 1024
+// RayPayload::sampleIndex of the validation rays, HitPrimary only records the triangle for them
+#define BEAM_VALIDATION_SAMPLE (uint(0xffffffff))
+#if BEAM_VALIDATION && !COLLECT_COUNTERS
+# error BEAM_VALIDATION reports through the counters, and needs COLLECT_COUNTERS
+#endif
+
+// Per tile costs of the beams renderer (TileStats), to find the screen regions that drive the frame totals. With
+// Application/Raytracing/tileStats, each stage adds its work to the tile it runs for, and the app writes every
+// frame's records out as heatmaps (see ExportTileStats). The super-tile beams' traversal is per super-tile and isn't
+// included, RayGenRefine's candidate tests count as the tile's intersection calls instead.
+#define TILE_STATS 1
+#define TILE_STATS_METRICS 6 // uints in TileStats
+
+// Dynamic resolution for the beams renderer: the tile grid is scaled each frame to hold the beams' GPU time at
+// Application/Raytracing/dynamicResolutionTargetMs (see UpdateDynamicResolution), within the full grid's buffers.
+#define DYNAMIC_RESOLUTION 1
+#define DYNAMIC_RESOLUTION_MIN_SCALE .5f // per axis
+
 // There are a couple places where TILE_SIZE is assumed to be equal to WAVE_SIZE,
 // and WAVE_SIZE is assumed to be <= 32.
 #define WAVE_SIZE 32
@@ -79,22 +226,75 @@ struct Counters
     uint intersectTrisFullCoverage;
     uint intersectTrisPartialCoverage;
 
+    uint superTileLaunchCount;
+    uint superTileIntersectCount;
+    uint superTileTrisIn;
+    uint superTileCandidates;
+    uint superTileOverflow;
+    uint superTileFallbackTiles; // tiles that traced their own beam, because their super-tile overflowed
+
+    uint multiViewLaunchCount;
+    uint multiViewIntersectCount;
+    uint multiViewTrisIn;
+    uint multiViewTileTris; // tile list entries, summed over the views
+
+    uint binScatterTiles;
+    uint binScatterTris; // tile list entries from the CPU tile binning, including any beyond TILE_MAX_TRIS
+
     uint visTiles;
     uint visNoTris;
     uint visOverflow;
     uint visFetchIterations;
     uint visTrisIn;
     uint visShadeQuads;
+    uint visSortSkipped; // tiles where every pixel's samples hit the same triangle
+    uint visSamples; // samples tested, TILE_SIZE * AA_SAMPLES per tile without foveation
+    uint visFoveatedTiles; // tiles above foveation level 0
+    uint visAdaptiveTiles; // tiles ADAPTIVE_SAMPLES reduced below AA_SAMPLES
+    uint visAdaptiveMismatches; // with adaptiveSamplesValidate, repeated samples that differ from the tested ones
+    uint visAdaptiveMismatchesOne; // same, for the same tiles at a fixed single sample per pixel
+    uint visCoveredTiles; // every sample covered, see TILE_DEPTH_RECORD
 
     uint shadeTiles;
     uint shadeNoQuads;
     uint shadeOverflow;
     uint shadeQuads;
+    uint shadeCacheLookups; // one per shaded lane
+    uint shadeCacheHits;
+    uint shadeCacheInserts;
 
     uint shadowLaunchCount;
     uint shadowHitCount;
     uint shadowBeamIntersectCount;
     uint shadowBeamAnyHitCount;
+    uint shadowBeamClusterAnyHitCount;
+    uint shadowBeamPartitionIntersectCount[SHADOW_PARTITIONS]; // per shadow partition (instance mask bit)
+
+    uint sunShadowBeamLaunchCount;
+    uint sunShadowBeamSplitTiles;
+    uint sunShadowBeamOverflow;
+    uint sunShadowBeamOccluders;
+    uint sunShadowBeamOccluderDuplicates; // already gathered by an earlier split beam of the tile
+    uint sunShadowBeamIntersectCount;
+    uint sunShadowBeamTrisIn;
+    uint sunShadowBeamTrisCulledOpacity;
+
+    uint aoBeamLaunchCount;
+    uint aoBeamIntersectCount;
+    uint aoBeamAnyHitCount;
+
+    uint validateTiles;
+    uint validateOverflowTiles; // lists beyond TILE_MAX_TRIS, not checked
+    uint validateSamples;
+    uint validateFalseNegatives; // samples whose triangle is missing from their tile's list
+    uint validateMisses; // g_beamValidationMisses entries, one per run of a tile's samples on the same missing triangle
+    uint validateListEntries;
+    uint validateListEntriesHit; // hit by at least one sample, the rest are false positives
+
+    uint opacityMaskOpaque;
+    uint opacityMaskTransparent;
+    uint opacityMaskUnknown; // fell back to sampling the diffuse texture
+    uint intersectTrisCulledOpacity;
 };
 #if COLLECT_COUNTERS
 # define PERF_COUNTER(counter, value) InterlockedAdd(g_counters[0]. counter, value)
@@ -104,23 +304,74 @@ struct Counters
 
 struct TileTri
 {
-    uint id[TILE_MAX_TRIS]; // mesh + primitive IDs
+    uint id[TILE_MAX_TRIS]; // encoded primitive ID, see PRIM_ID_GLOBAL
 };
 
 struct ShadeQuad
 {
-    uint id; // mesh + primitive IDs
+    uint id; // encoded primitive ID, see PRIM_ID_GLOBAL
     // QUADS_PER_TILE_LOG2_X bits: X quad pos within tile
     // QUADS_PER_TILE_LOG2_Y bits: Y quad pos within tile
     // (AA_SAMPLES_LOG2 + 1) bits * QUAD_SIZE: sample count - 1
+    // BEAM_AO_BITS top bits: ambient occlusion, see BEAM_AO
     uint bits;
 };
+#if BEAM_AO && QUADS_PER_TILE_LOG2 + (AA_SAMPLES_LOG2 + 1) * QUAD_SIZE > BEAM_AO_SHIFT
+# error the shade quad bits leave no room for BEAM_AO
+#endif
+
+// see TILE_DEPTH_RECORD, written by BeamsQuadVis for every tile
+struct TileDepthRecord
+{
+    float minDepth; // FLT_MAX when nothing is covered, 0 when the tile list overflowed
+    float maxDepth; // of the covered samples, FLT_MAX when nothing is covered or the tile list overflowed
+    uint coveredSamples; // of TILE_SIZE * AA_SAMPLES, the untested samples (FOVEATION, ADAPTIVE_SAMPLES) count like the ones they repeat
+    uint triCount; // candidates in the tile list, above TILE_MAX_TRIS when it overflowed
+};
+
+// see BEAM_VALIDATION, a sample whose triangle is missing from its tile's list
+struct BeamValidationMiss
+{
+    uint tileIndex;
+    uint id; // encoded primitive ID, see PRIM_ID_GLOBAL
+    uint pixel; // x | y << 16
+    uint sampleIndex;
+};
+
+// see TILE_STATS, per tile
+struct TileStats
+{
+    uint intersects; // intersection shader calls of the tile beam
+    uint anyHits; // any hit calls of the tile beam, the triangles it appended
+    uint triCount; // tile list length, above TILE_MAX_TRIS when it overflowed
+    uint emittedQuads; // shade quads from quad visibility
+    uint shadedQuads; // shade quads quad shading went through
+    uint shadowLaunches; // sun shadow beams (SHADOW_MODE_HARD) and ambient occlusion beams (BEAM_AO)
+};
+
+// see SHADE_CACHE, 24 bytes
+struct ShadeCacheEntry
+{
+    uint key; // 0 for none
+    uint shadedFrame;
+    uint usedFrame; // for the LRU eviction
+    uint albedoRG; // halves, the diffuse texture sample
+    uint albedoBSunR; // halves, then the unshadowed diffuse sun light
+    uint sunGB;
+};
 
 struct TileShadeQuads
 {
     ShadeQuad quads[MAX_SHADE_QUADS_PER_TILE];
 };
 
+// world space bounds of the tile's visible samples
+struct TileBounds
+{
+    float3 min;
+    float3 max;
+};
+
 struct RayTraceMeshInfo
 {
     uint triCount;
@@ -132,6 +383,20 @@ struct RayTraceMeshInfo
     uint attrOffsetPos;
     uint attrStride;
     uint materialID;
+    uint shadowAABBOffset; // first entry in g_aabbShadow_payload for this mesh
+    uint opacityMaskOffset; // first entry in g_opacityMasks for this mesh, or OPACITY_MASK_NONE
+    uint triOffset; // sum of the triangle counts of the preceding meshes, also the first triangle in g_positions
+    uint animated; // deformed by UpdateAnimatedMeshes, see BVH_REFIT
+    float3 posQuantMin; // POSITION_STREAM_QUANTIZED
+    float3 posQuantScale;
+};
+
+// object to world, 3x4 row major like D3D12_RAYTRACING_INSTANCE_DESC::Transform
+struct InstanceTransform
+{
+    float4 row0;
+    float4 row1;
+    float4 row2;
 };
 
 // Volatile part (can be split into its own CBV). 
@@ -145,8 +410,122 @@ struct DynamicCB
 
     uint tilesX;
     uint tilesY;
+
+    // see FOVEATION, 0 disables foveation
+    uint foveaMaxLevel;
+    float4 fovea; // xy: center (0..1, y down), z: radius, w: falloff (screen heights)
+    float4 lens; // see LENS_DISTORTION, xy: k1, k2 (0 when off), z: aspect ratio, w: 1 / (1 + aspect ratio^2)
+
+#if MULTI_VIEW
+    float4 multiViewOffsets[MULTI_VIEW_COUNT]; // xyz: world space offset of the view from worldCameraPosition
+#endif
+
+    uint adaptiveSamples; // ADAPTIVE_SAMPLES_OFF, _ON or _VALIDATE
+    uint samplePattern; // see TEMPORAL_SAMPLES, 0 is AA_SAMPLE_OFFSET_TABLE as is
+    uint shadeCacheFrame; // see SHADE_CACHE
+    uint shadeCacheMaxAge; // frames, 0 disables the cache
+    uint animateMeshes; // the animated meshes are moving, and skip the shade cache
+    uint tileStats; // see TILE_STATS, 0 when not recording
+};
+
+// see TemporalResolve.hlsl
+struct TemporalCB
+{
+    float4x4 prevViewProj; // world to the previous frame's clip space
+    uint historyValid;
+    float maxHistory; // frames
+    float clipGamma; // variance clipping box, in standard deviations
+    uint pad;
+};
+
+// see DynamicResolutionUpscale.hlsl
+struct DynamicResolutionCB
+{
+    float2 renderDim; // pixels the beams rendered, at the top left
+    float2 outputDim; // pixels of the full tile grid
 };
 
+#if FOVEATION
+inline uint FoveationLevel(uint tileX, uint tileY, uint tilesX, uint tilesY, float4 fovea, uint maxLevel)
+{
+    if (maxLevel == 0)
+        return 0;
+
+    // from the middle of the tile, in screen heights
+    float aspect = float(tilesX * TILE_DIM_X) / float(tilesY * TILE_DIM_Y);
+    float dx = ((tileX + .5f) / tilesX - fovea.x) * aspect;
+    float dy = (tileY + .5f) / tilesY - fovea.y;
+    float dist = sqrt(dx * dx + dy * dy);
+    if (dist <= fovea.z)
+        return 0;
+    if (fovea.w <= 0.0f)
+        return maxLevel;
+
+    uint level = uint((dist - fovea.z) / fovea.w) + 1;
+    return level < maxLevel ? level : maxLevel;
+}
+
+inline uint FoveationSampleCount(uint level)
+{
+    return level < AA_SAMPLES_LOG2 ? AA_SAMPLES >> level : 1;
+}
+#endif
+
+#if LENS_DISTORTION
+// An output screen position p (-1..1, y up) looks through p * LensScale(LensRadius2(p)) on the rectilinear view
+// plane, with LensScale(r2) = 1 + k1 r2 + k2 r2^2, and r2 = 1 at the screen corners.
+inline float LensRadius2(float x, float y, float4 lens)
+{
+    return (x * x * lens.z * lens.z + y * y) * lens.w;
+}
+
+inline float LensScale(float r2, float4 lens)
+{
+    return 1.0f + r2 * (lens.x + r2 * lens.y);
+}
+
+// d(LensScale) / d(r2)
+inline float LensScaleDerivative(float r2, float4 lens)
+{
+    return lens.x + 2.0f * r2 * lens.y;
+}
+
+// Conservative view plane bounds (xy: min, zw: max) of the screen rect [x0, x1] x [y0, y1], by interval arithmetic:
+// the range of r2 over the rect, the range of LensScale over that, and their products with the rect's extents.
+inline float4 LensRectBounds(float x0, float x1, float y0, float y1, float4 lens)
+{
+    float xx0 = x0 * x0, xx1 = x1 * x1;
+    float yy0 = y0 * y0, yy1 = y1 * y1;
+    float xxMin = (x0 <= 0.0f && x1 >= 0.0f) ? 0.0f : min(xx0, xx1);
+    float yyMin = (y0 <= 0.0f && y1 >= 0.0f) ? 0.0f : min(yy0, yy1);
+    float t0 = (xxMin * lens.z * lens.z + yyMin) * lens.w;
+    float t1 = (max(xx0, xx1) * lens.z * lens.z + max(yy0, yy1)) * lens.w;
+
+    float g0 = LensScale(t0, lens);
+    float g1 = LensScale(t1, lens);
+    float gMin = min(g0, g1);
+    float gMax = max(g0, g1);
+    // LensScale is a parabola in r2, its vertex may fall inside the range
+    if (lens.y != 0.0f)
+    {
+        float tv = -lens.x / (2.0f * lens.y);
+        if (tv > t0 && tv < t1)
+        {
+            float gv = LensScale(tv, lens);
+            gMin = min(gMin, gv);
+            gMax = max(gMax, gv);
+        }
+    }
+
+    float4 bounds;
+    bounds.x = min(min(x0 * gMin, x0 * gMax), min(x1 * gMin, x1 * gMax));
+    bounds.y = min(min(y0 * gMin, y0 * gMax), min(y1 * gMin, y1 * gMax));
+    bounds.z = max(max(x0 * gMin, x0 * gMax), max(x1 * gMin, x1 * gMax));
+    bounds.w = max(max(y0 * gMin, y0 * gMax), max(y1 * gMin, y1 * gMax));
+    return bounds;
+}
+#endif
+
 struct RootConstants
 {
     uint meshID;
@@ -156,22 +535,50 @@ struct RayPayload
 {
     float3 color;
     uint sampleIndex;
+    float depth; // nearest hit over the samples, for the reprojection in TemporalResolve
+    uint hitID; // encoded primitive ID of the hit, for BEAM_VALIDATION rays
 };
 
 struct BeamPayload
 {
     uint pad;
 };
+struct SunShadowBeamPayload
+{
+    uint firstOccluder; // tile list entries before this one came from the tile's earlier split beams
+};
+struct BeamAOPayload
+{
+    float opacity; // see BEAM_AO
+};
 struct BeamHitAttribs
 {
     uint triID;
 };
+struct MultiViewHitAttribs
+{
+    uint triID;
+    uint viewMask; // the views whose tile beam overlaps the triangle
+};
+
+#define SHADOW_CLUSTER_NONE (uint(0xffffffff))
+
+// Shadow AABB coverage masks are SHADOW_COVERAGE_DIM x SHADOW_COVERAGE_DIM bits, packed into a uint2.
+// Bit (b * SHADOW_COVERAGE_DIM + a) is cell (a, b), where a and b are the two axes orthogonal to the
+// projection axis, in xyz order.
+#define SHADOW_COVERAGE_DIM 8
 
 struct ShadowAABBPayload
 {
     float3 min;
     float3 max;
-    float3 opacity; // projection along major axes
+    // rasterized coverage of the box's triangles, projected along each major axis
+    uint2 coverageX; // cells over YZ
+    uint2 coverageY; // cells over XZ
+    uint2 coverageZ; // cells over XY
+    // leaf: index of the parent cluster within g_aabbShadow_payload, or SHADOW_CLUSTER_NONE
+    // cluster: SHADOW_CLUSTER_NONE
+    uint cluster;
 };
 
 #ifdef HLSL
@@ -188,6 +595,8 @@ StructuredBuffer<ShadowAABBPayload> g_aabbShadow_payload : register(t21);
 StructuredBuffer<RayTraceMeshInfo> g_meshInfo : register(t1);
 ByteAddressBuffer g_indices : register(t2);
 ByteAddressBuffer g_attributes : register(t3);
+StructuredBuffer<InstanceTransform> g_instanceTransforms : register(t5);
+ByteAddressBuffer g_positions : register(t6); // see POSITION_STREAM
 
 Texture2D<float4> g_localTexture : register(t10);
 Texture2D<float4> g_localNormal : register(t11);
@@ -200,12 +609,85 @@ RWStructuredBuffer<TileTri> g_tileTris : register(u4);
 RWStructuredBuffer<TileShadeQuads> g_tileShadeQuads : register(u5);
 RWStructuredBuffer<uint> g_tileShadeQuadsCount : register(u6);
 RWStructuredBuffer<Counters> g_counters : register(u7);
+RWStructuredBuffer<TileBounds> g_tileBounds : register(u8);
+RWStructuredBuffer<uint> g_superTileTriCounts : register(u9);
+RWStructuredBuffer<uint> g_superTileTris : register(u10); // SUPER_TILE_MAX_TRIS per super-tile
+RWTexture2D<float> g_screenDepth : register(u11); // ray t of the nearest sample, FLT_MAX for none
+globallycoherent RWStructuredBuffer<ShadeCacheEntry> g_shadeCache : register(u12); // see SHADE_CACHE, shared across groups
+RWStructuredBuffer<TileDepthRecord> g_tileDepthRecords : register(u13); // see TILE_DEPTH_RECORD
+RWStructuredBuffer<BeamValidationMiss> g_beamValidationMisses : register(u14); // see BEAM_VALIDATION
+RWStructuredBuffer<TileStats> g_tileStats : register(u15); // see TILE_STATS
 
 cbuffer b1 : register(b1)
 {
     DynamicCB dynamicConstants;
 };
 
+#if TILE_STATS
+# define TILE_STAT(tileIndex, stat, value) { if (dynamicConstants.tileStats) InterlockedAdd(g_tileStats[tileIndex]. stat, value); }
+#else
+# define TILE_STAT(tileIndex, stat, value)
+#endif
+
+uint SceneTriCount()
+{
+    uint meshCount;
+    uint meshInfoStride;
+    g_meshInfo.GetDimensions(meshCount, meshInfoStride);
+
+    RayTraceMeshInfo lastMesh = g_meshInfo[meshCount - 1];
+    return lastMesh.triOffset + lastMesh.triCount;
+}
+
+uint PrimIDEncode(uint instanceID, uint meshID, uint triID)
+{
+#if PRIM_ID_GLOBAL
+# if SCENE_INSTANCES > 1
+    return instanceID * SceneTriCount() + g_meshInfo[meshID].triOffset + triID;
+# else
+    return g_meshInfo[meshID].triOffset + triID;
+# endif
+#else
+    return (meshID << PRIM_ID_BITS) | triID;
+#endif
+}
+
+void PrimIDDecode(uint id, out uint instanceID, out uint meshID, out uint triID)
+{
+#if PRIM_ID_GLOBAL
+# if SCENE_INSTANCES > 1
+    uint sceneTriCount = SceneTriCount();
+    instanceID = id / sceneTriCount;
+    id -= instanceID * sceneTriCount;
+# else
+    instanceID = 0;
+# endif
+
+    uint meshCount;
+    uint meshInfoStride;
+    g_meshInfo.GetDimensions(meshCount, meshInfoStride);
+
+    // last mesh starting at or before id (this also skips over empty meshes)
+    uint lo = 0;
+    uint hi = meshCount - 1;
+    while (lo < hi)
+    {
+        uint mid = (lo + hi + 1) / 2;
+        if (g_meshInfo[mid].triOffset <= id)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    meshID = lo;
+    triID = id - g_meshInfo[lo].triOffset;
+#else
+    instanceID = 0;
+    meshID = id >> PRIM_ID_BITS;
+    triID = id & PRIM_ID_MASK;
+#endif
+}
+
 cbuffer b3 : register(b3)
 {
     RootConstants rootConstants;
@@ -1,52 +1,17 @@
 #pragma once
 
 #include "RayCommon.h"
+#include "SamplePatterns.h"
 
-// go ahead and build in the Y flip here so we're not doing it per-sample in the beam vis shader
-#define SAMPLE_Y_SCALE (-1)
-
-// https://msdn.microsoft.com/en-us/library/windows/desktop/Ff476218(v=VS.85).aspx
-static const float2 sampleOffset1x[1] = {
-	{(1.0 / 16.0 * 0),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 0)},
-};
-static const float2 sampleOffset2x[2] = {
-	{(1.0 / 16.0 * 4),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 4)},
-	{(1.0 / 16.0 * -4), SAMPLE_Y_SCALE * (1.0 / 16.0 * -4)},
-};
-static const float2 sampleOffset4x[4] = {
-	{(1.0 / 16.0 * -2), SAMPLE_Y_SCALE * (1.0 / 16.0 * -6)},
-	{(1.0 / 16.0 * 6),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -2)},
-	{(1.0 / 16.0 * -6), SAMPLE_Y_SCALE * (1.0 / 16.0 * 2)},
-	{(1.0 / 16.0 * 2),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 6)},
-};
-static const float2 sampleOffset8x[8] = {
-	{(1.0 / 16.0 * 1),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -3)},
-	{(1.0 / 16.0 * -1), SAMPLE_Y_SCALE * (1.0 / 16.0 * 3)},
-	{(1.0 / 16.0 * 5),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 1)},
-	{(1.0 / 16.0 * -3), SAMPLE_Y_SCALE * (1.0 / 16.0 * -5)},
-	{(1.0 / 16.0 * -5), SAMPLE_Y_SCALE * (1.0 / 16.0 * 5)},
-	{(1.0 / 16.0 * -7), SAMPLE_Y_SCALE * (1.0 / 16.0 * -1)},
-	{(1.0 / 16.0 * 3),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 7)},
-	{(1.0 / 16.0 * 7),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -7)},
-};
-static const float2 sampleOffset16x[16] = {
-	{(1.0 / 16.0 * 1),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 1)},
-	{(1.0 / 16.0 * -1), SAMPLE_Y_SCALE * (1.0 / 16.0 * -3)},
-	{(1.0 / 16.0 * -3), SAMPLE_Y_SCALE * (1.0 / 16.0 * 2)},
-	{(1.0 / 16.0 * 4),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -1)},
-	{(1.0 / 16.0 * -5), SAMPLE_Y_SCALE * (1.0 / 16.0 * -2)},
-	{(1.0 / 16.0 * 2),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 5)},
-	{(1.0 / 16.0 * 5),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 3)},
-	{(1.0 / 16.0 * 3),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -5)},
-	{(1.0 / 16.0 * -2), SAMPLE_Y_SCALE * (1.0 / 16.0 * 6)},
-	{(1.0 / 16.0 * 0),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -7)},
-	{(1.0 / 16.0 * -4), SAMPLE_Y_SCALE * (1.0 / 16.0 * -6)},
-	{(1.0 / 16.0 * -6), SAMPLE_Y_SCALE * (1.0 / 16.0 * 4)},
-	{(1.0 / 16.0 * -8), SAMPLE_Y_SCALE * (1.0 / 16.0 * 0)},
-	{(1.0 / 16.0 * 7),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -4)},
-	{(1.0 / 16.0 * 6),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 7)},
-	{(1.0 / 16.0 * -7), SAMPLE_Y_SCALE * (1.0 / 16.0 * -8)},
-};
+// pixel offset of sample s in the current frame's pattern, see TEMPORAL_SAMPLES
+float2 SampleOffset(uint s)
+{
+#if TEMPORAL_SAMPLES
+    return SamplePatternTransform(AA_SAMPLE_OFFSET_TABLE[s], dynamicConstants.samplePattern);
+#else
+    return AA_SAMPLE_OFFSET_TABLE[s];
+#endif
+}
 
 void GenerateCameraRay(
     uint2 pixelDim,
@@ -63,19 +28,50 @@ void GenerateCameraRay(
     // Invert Y for DirectX-style coordinates
     screenPos.y = -screenPos.y;
 
+#if LENS_DISTORTION
+    screenPos *= LensScale(LensRadius2(screenPos.x, screenPos.y, dynamicConstants.lens), dynamicConstants.lens);
+#endif
+
     float3x3 rotation = (float3x3)dynamicConstants.cameraToWorld;
     dir = mul(rotation, float3(screenPos, -1));
 }
 
 // for a simple 2D grid projection with square pixels, there's not much to this
+// (with LENS_DISTORTION, it's the distortion's Jacobian at the pixel center)
 void GenerateCameraRayFootprint(
     uint2 pixelDim,
+    float2 pixelPos,
     out float3 majorDirDiff,
     out float3 minorDirDiff)
 {
     float3 major = float3(-2.0f / pixelDim.x, 0, 0);
     float3 minor = float3(0, -2.0f / pixelDim.y, 0); // flip Y for DX Y convention
 
+#if LENS_DISTORTION
+    float4 lens = dynamicConstants.lens;
+    float2 scale = 2.0f / float2(pixelDim);
+    float2 bias = -float2(dynamicConstants.jitterNormalizedX, dynamicConstants.jitterNormalizedY) - 1.0f;
+    float2 p = (pixelPos + .5f) * scale + bias;
+    p.y = -p.y;
+
+    // d(p * g(r2)) / dp = g I + g' (dr2 / dp) p^T
+    float r2 = LensRadius2(p.x, p.y, lens);
+    float g = LensScale(r2, lens);
+    float2 dr2 = 2.0f * lens.w * float2(p.x * lens.z * lens.z, p.y);
+    float2x2 jacobian = float2x2(g, 0, 0, g) + LensScaleDerivative(r2, lens) * float2x2(p.x * dr2, p.y * dr2);
+    major.xy = mul(jacobian, major.xy);
+    minor.xy = mul(jacobian, minor.xy);
+#endif
+
+#if TEMPORAL_SAMPLES
+    // the frame's sample pattern, as a change of basis instead of per sample offset (see SampleOffset)
+    float2 patternX = SamplePatternTransform(float2(1, 0), dynamicConstants.samplePattern);
+    float2 patternY = SamplePatternTransform(float2(0, 1), dynamicConstants.samplePattern);
+    float3 unpatternedMajor = major;
+    major = unpatternedMajor * patternX.x + minor * patternX.y;
+    minor = unpatternedMajor * patternY.x + minor * patternY.y;
+#endif
+
     float3x3 rotation = (float3x3)dynamicConstants.cameraToWorld;
     majorDirDiff = mul(rotation, major);
     minorDirDiff = mul(rotation, minor);
@@ -86,9 +82,11 @@ void GenerateCameraRayFootprint(
 // inset to the pixel centers of the outer corner pixels of the beam tile. This will give a tighter
 // fit and allow fewer triangles through.
 // Note: outputs in the correct winding order for creating a Frustum
-void GenerateTileRays(
+// Corner rays of the beam covering tiles [tileMin, tileMax).
+void GenerateTileRectRays(
     uint2 tileDim,
-    uint2 tilePos,
+    uint2 tileMin,
+    uint2 tileMax,
     out float3 origin,
     out float3 dir[4])
 {
@@ -97,10 +95,10 @@ void GenerateTileRays(
     float2 scale = 2.0f / float2(tileDim);
     float2 bias = -float2(dynamicConstants.jitterNormalizedX, dynamicConstants.jitterNormalizedY) - 1.0f;
     // Y delta is flipped due to DX Y convention, see below
-    float2 screenPos00 = (tilePos + uint2(0, 1)) * scale + bias;
-    float2 screenPos10 = (tilePos + uint2(1, 1)) * scale + bias;
-    float2 screenPos11 = (tilePos + uint2(1, 0)) * scale + bias;
-    float2 screenPos01 = (tilePos + uint2(0, 0)) * scale + bias;
+    float2 screenPos00 = uint2(tileMin.x, tileMax.y) * scale + bias;
+    float2 screenPos10 = uint2(tileMax.x, tileMax.y) * scale + bias;
+    float2 screenPos11 = uint2(tileMax.x, tileMin.y) * scale + bias;
+    float2 screenPos01 = uint2(tileMin.x, tileMin.y) * scale + bias;
 
     // Invert Y for DirectX-style coordinates
     screenPos00.y = -screenPos00.y;
@@ -108,9 +106,34 @@ void GenerateTileRays(
     screenPos11.y = -screenPos11.y;
     screenPos01.y = -screenPos01.y;
 
+#if LENS_DISTORTION
+    // the rect bounding the distorted tiles, padded for quad visibility's linearized pixel footprints
+    if (dynamicConstants.lens.x != 0.0f || dynamicConstants.lens.y != 0.0f)
+    {
+        float2 pad = LENS_DISTORTION_BEAM_PAD * scale / float2(TILE_DIM_X, TILE_DIM_Y);
+        float4 bounds = LensRectBounds(
+            screenPos00.x - pad.x, screenPos10.x + pad.x,
+            screenPos00.y - pad.y, screenPos01.y + pad.y,
+            dynamicConstants.lens);
+        screenPos00 = bounds.xy;
+        screenPos10 = bounds.zy;
+        screenPos11 = bounds.zw;
+        screenPos01 = bounds.xw;
+    }
+#endif
+
     float3x3 rotation = (float3x3)dynamicConstants.cameraToWorld;
     dir[0] = mul(rotation, float3(screenPos00, -1));
     dir[1] = mul(rotation, float3(screenPos10, -1));
     dir[2] = mul(rotation, float3(screenPos11, -1));
     dir[3] = mul(rotation, float3(screenPos01, -1));
 }
+
+void GenerateTileRays(
+    uint2 tileDim,
+    uint2 tilePos,
+    out float3 origin,
+    out float3 dir[4])
+{
+    GenerateTileRectRays(tileDim, tilePos, tilePos + 1, origin, dir);
+}
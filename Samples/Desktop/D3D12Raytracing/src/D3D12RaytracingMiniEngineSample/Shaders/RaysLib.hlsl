@@ -13,7 +13,9 @@
 
 #define HLSL
 
+#include "BeamCoverage.h"
 #include "Intersect.h"
+#include "OpacityMask.h"
 #include "RayCommon.h"
 #include "RayGen.h"
 #include "Shading.h"
@@ -24,6 +26,19 @@ cbuffer b0 : register(b0)
     ShadeConstants shadeConstants;
 };
 
+// Any hit shaders only run for the alpha tested meshes, the rest of the geometry is flagged opaque.
+bool AlphaTestHit(BuiltInTriangleIntersectionAttributes attr, bool counted = true)
+{
+    uint meshID = rootConstants.meshID;
+    uint primID = PrimitiveIndex();
+
+    float3 uvw = float3(
+        1.0f - attr.barycentrics.x - attr.barycentrics.y,
+        attr.barycentrics.x,
+        attr.barycentrics.y);
+    return OpacityTest(OpacityMaskFetch(meshID, primID), meshID, primID, uvw, g_localTexture, counted);
+}
+
 struct ShadowPayload
 {
     float opacity;
@@ -37,95 +52,37 @@ struct ShadowHitAttribs
 {
 };
 
+// which receiver region's shadow AABBs to trace
+uint ShadowPartition(float3 receiverPos)
+{
+    int2 cell = int2((receiverPos.xz - shadeConstants.shadowPartitionOrigin) * shadeConstants.shadowPartitionScale);
+    cell = clamp(cell, int2(0, 0), int2(SHADOW_PARTITIONS_X - 1, SHADOW_PARTITIONS_Z - 1));
+    return cell.y * SHADOW_PARTITIONS_X + cell.x;
+}
+
+ShadowAABBPayload ShadowAABBFetch()
+{
+    // PrimitiveIndex() restarts for each geometry (mesh)
+    uint meshID = rootConstants.meshID;
+    return g_aabbShadow_payload[g_meshInfo[meshID].shadowAABBOffset + PrimitiveIndex()];
+}
+
 [shader("anyhit")]
 void AnyHitShadow(inout ShadowPayload payload, in ShadowHitAttribs attr)
 {
     PERF_COUNTER(shadowBeamAnyHitCount, 1);
 
-    uint primID = PrimitiveIndex();
-    ShadowAABBPayload aabbPayload = g_aabbShadow_payload[primID];
-
-    float3 rayOrigin = WorldRayOrigin();
-    float3 rayDir = WorldRayDirection();
-    float rayT = RayTCurrent();
-
-    float maxMag = max(abs(rayDir.x), max(abs(rayDir.y), abs(rayDir.z)));
-
-    float opacity;
-    float aabbMinA, aabbMinB, aabbMaxA, aabbMaxB;
-    float beamOriginA, beamOriginB;
-    float beamDirA, beamDirB;
-    float beamExtentsA, beamExtentsB;
-    if (abs(rayDir.x) == maxMag)
-    {
-        opacity = aabbPayload.opacity.x;
-
-        aabbMinA = aabbPayload.min.y;
-        aabbMinB = aabbPayload.min.z;
-        aabbMaxA = aabbPayload.max.y;
-        aabbMaxB = aabbPayload.max.z;
-
-        beamOriginA = rayOrigin.y;
-        beamOriginB = rayOrigin.z;
-        beamDirA = rayDir.y;
-        beamDirB = rayDir.z;
-        beamExtentsA = payload.beamExtents.y;
-        beamExtentsB = payload.beamExtents.z;
-    }
-    else if (abs(rayDir.y) == maxMag)
-    {
-        opacity = aabbPayload.opacity.y;
-
-        aabbMinA = aabbPayload.min.x;
-        aabbMinB = aabbPayload.min.z;
-        aabbMaxA = aabbPayload.max.x;
-        aabbMaxB = aabbPayload.max.z;
-
-        beamOriginA = rayOrigin.x;
-        beamOriginB = rayOrigin.z;
-        beamDirA = rayDir.x;
-        beamDirB = rayDir.z;
-        beamExtentsA = payload.beamExtents.x;
-        beamExtentsB = payload.beamExtents.z;
-    }
-    else
-    {
-        opacity = aabbPayload.opacity.z;
-
-        aabbMinA = aabbPayload.min.x;
-        aabbMinB = aabbPayload.min.y;
-        aabbMaxA = aabbPayload.max.x;
-        aabbMaxB = aabbPayload.max.y;
-
-        beamOriginA = rayOrigin.x;
-        beamOriginB = rayOrigin.y;
-        beamDirA = rayDir.x;
-        beamDirB = rayDir.y;
-        beamExtentsA = payload.beamExtents.x;
-        beamExtentsB = payload.beamExtents.y;
-    }
-
-    beamExtentsA *= rayT;
-    beamExtentsB *= rayT;
-    
-    float beamMinA = beamOriginA + beamDirA * rayT - beamExtentsA;
-    float beamMinB = beamOriginB + beamDirB * rayT - beamExtentsB;
-    float beamMaxA = beamOriginA + beamDirA * rayT + beamExtentsA;
-    float beamMaxB = beamOriginB + beamDirB * rayT + beamExtentsB;
-
-    // scale opacity by 2D intersection of beam and box
-    float minA = max(aabbMinA, beamMinA);
-    float minB = max(aabbMinB, beamMinB);
-    float maxA = min(aabbMaxA, beamMaxA);
-    float maxB = min(aabbMaxB, beamMaxB);
-    float dA = max(0.0f, maxA - minA);
-    float dB = max(0.0f, maxB - minB);
-    float areaIntersect = dA * dB;
-
-    float areaBeam = 2.0f * beamExtentsA * 2.0f * beamExtentsB;
-    float areaPercent = areaIntersect / areaBeam;
+    ShadowAABBPayload aabbPayload = ShadowAABBFetch();
+#if SHADOW_CLUSTER_SIZE > 1
+    if (aabbPayload.cluster == SHADOW_CLUSTER_NONE)
+        PERF_COUNTER(shadowBeamClusterAnyHitCount, 1);
+#endif
 
-    payload.opacity += opacity * areaPercent;
+    // instances only translate, so the beam extents stay axis-aligned in object space
+    payload.opacity += ShadowBeamCoverage(
+        aabbPayload,
+        ObjectRayOrigin(), ObjectRayDirection(), RayTCurrent(),
+        payload.beamExtents);
 
     if (payload.opacity >= 1.0f)
         AcceptHitAndEndSearch();
@@ -136,18 +93,30 @@ void AnyHitShadow(inout ShadowPayload payload, in ShadowHitAttribs attr)
 void IntersectionShadow()
 {
     PERF_COUNTER(shadowBeamIntersectCount, 1);
+    // the shadow BVH's instances are grouped by partition, SCENE_INSTANCES each
+    PERF_COUNTER(shadowBeamPartitionIntersectCount[InstanceIndex() / SCENE_INSTANCES], 1);
 
-    float3 rayOrigin = WorldRayOrigin();
-    float3 rayDir = WorldRayDirection();
+    float3 rayOrigin = ObjectRayOrigin();
+    float3 rayDir = ObjectRayDirection();
 
-    uint primID = PrimitiveIndex();
-    ShadowAABBPayload aabbPayload = g_aabbShadow_payload[primID];
+    ShadowAABBPayload aabbPayload = ShadowAABBFetch();
+
+#if SHADOW_CLUSTER_SIZE > 1
+    // Exactly one of a cluster and its leaves contributes to any given beam. Intersection shaders can't
+    // read the payload, so the beam extents are rebuilt from the ray origin.
+    float3 beamExtents = ShadowBeamExtents(WorldRayOrigin());
+    if (aabbPayload.cluster == SHADOW_CLUSTER_NONE)
+    {
+        if (!ShadowBeamTakesCluster(rayOrigin, beamExtents, aabbPayload))
+            return;
+    }
+    else if (ShadowBeamTakesCluster(rayOrigin, beamExtents, g_aabbShadow_payload[aabbPayload.cluster]))
+    {
+        return;
+    }
+#endif
 
-    float3 aabbNPos = float3(
-        rayDir.x >= 0.0f ? aabbPayload.min.x : aabbPayload.max.x,
-        rayDir.y >= 0.0f ? aabbPayload.min.y : aabbPayload.max.y,
-        rayDir.z >= 0.0f ? aabbPayload.min.z : aabbPayload.max.z);
-    float t = dot(rayDir, aabbNPos - rayOrigin);
+    float t = ShadowAABBNearT(aabbPayload, rayOrigin, rayDir);
 
     if (t <= 0.0f)
     {
@@ -160,6 +129,13 @@ void IntersectionShadow()
     }
 }
 #else
+[shader("anyhit")]
+void AnyHitShadow(inout ShadowPayload payload, in BuiltInTriangleIntersectionAttributes attr)
+{
+    if (!AlphaTestHit(attr))
+        IgnoreHit();
+}
+
 [shader("closesthit")]
 void HitShadow(inout ShadowPayload payload, in BuiltInTriangleIntersectionAttributes attr)
 {
@@ -169,9 +145,30 @@ void HitShadow(inout ShadowPayload payload, in BuiltInTriangleIntersectionAttrib
 }
 #endif
 
+[shader("anyhit")]
+void AnyHitPrimary(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes attr)
+{
+#if BEAM_VALIDATION
+    // the validation rays stay out of the frame's opacity mask counters
+    bool counted = payload.sampleIndex != BEAM_VALIDATION_SAMPLE;
+#else
+    bool counted = true;
+#endif
+    if (!AlphaTestHit(attr, counted))
+        IgnoreHit();
+}
+
 [shader("closesthit")]
 void HitPrimary(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes attr)
 {
+#if BEAM_VALIDATION
+    if (payload.sampleIndex == BEAM_VALIDATION_SAMPLE)
+    {
+        payload.hitID = PrimIDEncode(InstanceID(), rootConstants.meshID, PrimitiveIndex());
+        return;
+    }
+#endif
+
     PERF_COUNTER(closestHitCount, 1);
 
     uint sampleIndex = payload.sampleIndex;
@@ -184,23 +181,23 @@ void HitPrimary(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
         1.0f - attr.barycentrics.x - attr.barycentrics.y,
         attr.barycentrics.x,
         attr.barycentrics.y);
-    TriInterpolated tri = triFetchAndInterpolate(meshID, primID, uvw);
+    TriInterpolated tri = triFetchAndInterpolateInstance(InstanceID(), meshID, primID, uvw);
 
     // find the UVWs of +1 X and +1 Y pixels, then calculate texcoord derivatives with finite differencing
     float3 rayOriginDX, rayDirDX;
     float3 rayOriginDY, rayDirDY;
     GenerateCameraRay(
         DispatchRaysDimensions().xy,
-        DispatchRaysIndex().xy + uint2(1, 0) + AA_SAMPLE_OFFSET_TABLE[sampleIndex] * float2(1, -1), // Y direction is flipped vs beam vis shader
+        DispatchRaysIndex().xy + uint2(1, 0) + SampleOffset(sampleIndex) * float2(1, -1), // Y direction is flipped vs beam vis shader
         rayOriginDX,
         rayDirDX);
     GenerateCameraRay(
         DispatchRaysDimensions().xy,
-        DispatchRaysIndex().xy + uint2(0, 1) + AA_SAMPLE_OFFSET_TABLE[sampleIndex] * float2(1, -1), // Y direction is flipped vs beam vis shader
+        DispatchRaysIndex().xy + uint2(0, 1) + SampleOffset(sampleIndex) * float2(1, -1), // Y direction is flipped vs beam vis shader
         rayOriginDY,
         rayDirDY);
 
-    Triangle triPos = triFetch(meshID, primID);
+    Triangle triPos = triFetchInstance(InstanceID(), meshID, primID);
     float4 uvwtDX = triIntersectNoFail(rayOriginDX, rayDirDX, triPos);
     float4 uvwtDY = triIntersectNoFail(rayOriginDY, rayDirDY, triPos);
 
@@ -259,8 +256,7 @@ void HitPrimary(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
         // soft beam shadows
         // use the area light center
         float3 shadowRayDir = normalize(shadowTarget - tri.worldPos);
-        float areaLightDist = max(.0001f, length(shadowTarget - tri.worldPos));
-        shadowPayload.beamExtents = AREA_LIGHT_EXTENT / areaLightDist;
+        shadowPayload.beamExtents = ShadowBeamExtents(tri.worldPos);
 #else
         // hard shadows
         // use the directional light
@@ -272,7 +268,7 @@ void HitPrimary(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
         if (dot(shadowRayDir, normal) <= 0.0f)
             continue;
 
-        float tMin = .01f;
+        float tMin = ShadowRayTMin(tri.worldPos);
         RayDesc shadowRayDesc =
         {
             tri.worldPos,
@@ -287,9 +283,13 @@ void HitPrimary(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
 #if SHADOW_MODE == SHADOW_MODE_BEAM
             RAY_FLAG_NONE,
 #else
-            RAY_FLAG_FORCE_OPAQUE | RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH,
+            RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH,
 #endif
+#if SHADOW_MODE == SHADOW_MODE_BEAM
+            1 << ShadowPartition(tri.worldPos),
+#else
             ~0,
+#endif
             HIT_GROUP_SHADOW, HIT_GROUP_COUNT, HIT_GROUP_SHADOW,
             shadowRayDesc, shadowPayload);
 
@@ -314,11 +314,17 @@ void HitPrimary(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
 outputColor = float3(shadow, shadow, shadow);
 
     payload.color += outputColor;
+    payload.depth = min(payload.depth, RayTCurrent());
 }
 
 [shader("miss")]
 void MissPrimary(inout RayPayload payload)
 {
+#if BEAM_VALIDATION
+    if (payload.sampleIndex == BEAM_VALIDATION_SAMPLE)
+        return;
+#endif
+
     PERF_COUNTER(missCount, 1);
 
     g_screenOutput[DispatchRaysIndex().xy] = float4(0, 0, 0, 1);
@@ -331,6 +337,7 @@ void RayGen()
 
     RayPayload payload;
     payload.color = float3(0, 0, 0);
+    payload.depth = FLT_MAX;
 
     for (uint s = 0; s < AA_SAMPLES; s++)
     {
@@ -339,7 +346,7 @@ void RayGen()
         float3 origin, direction;
         GenerateCameraRay(
             DispatchRaysDimensions().xy,
-            DispatchRaysIndex().xy + AA_SAMPLE_OFFSET_TABLE[s] * float2(1, -1), // Y direction is flipped vs beam vis shader
+            DispatchRaysIndex().xy + SampleOffset(s) * float2(1, -1), // Y direction is flipped vs beam vis shader
             origin,
             direction);
 
@@ -359,4 +366,114 @@ void RayGen()
     }
 
     g_screenOutput[DispatchRaysIndex().xy] = float4(payload.color / AA_SAMPLES, 1);
+    g_screenDepth[DispatchRaysIndex().xy] = payload.depth;
+}
+
+#if BEAM_VALIDATION
+// One thread per tile, see BEAM_VALIDATION. The samples are the ones quad visibility tests (without FOVEATION and
+// ADAPTIVE_SAMPLES), on the tile grid's pixel dimensions. Neighboring samples mostly hit the same triangle, so the
+// list is only searched again when the hit changes.
+[shader("raygeneration")]
+void RayGenValidateBeams()
+{
+    uint2 tilePos = DispatchRaysIndex().xy;
+    uint tileIndex = tilePos.y * dynamicConstants.tilesX + tilePos.x;
+    uint2 pixelDim = uint2(dynamicConstants.tilesX * TILE_DIM_X, dynamicConstants.tilesY * TILE_DIM_Y);
+
+    PERF_COUNTER(validateTiles, 1);
+
+    uint tileTriCount = g_tileTriCounts[tileIndex];
+    if (tileTriCount > TILE_MAX_TRIS)
+    {
+        PERF_COUNTER(validateOverflowTiles, 1);
+        return;
+    }
+
+    // the list entries some sample hit
+    uint entriesHit[(TILE_MAX_TRIS + 31) / 32];
+    {for (uint i = 0; i < (TILE_MAX_TRIS + 31) / 32; i++)
+        entriesHit[i] = 0;}
+
+    RayPayload payload;
+    payload.color = float3(0, 0, 0);
+    payload.sampleIndex = BEAM_VALIDATION_SAMPLE;
+    payload.depth = FLT_MAX;
+
+    uint lastID = BAD_TRI_ID;
+    bool lastFound = true;
+    uint falseNegatives = 0;
+    for (uint p = 0; p < TILE_SIZE; p++)
+    {
+        uint2 pixelPos = tilePos * uint2(TILE_DIM_X, TILE_DIM_Y) + uint2(p % TILE_DIM_X, p / TILE_DIM_X);
+        for (uint s = 0; s < AA_SAMPLES; s++)
+        {
+            float3 origin, direction;
+            GenerateCameraRay(
+                pixelDim,
+                pixelPos + SampleOffset(s) * float2(1, -1), // Y direction is flipped vs beam vis shader
+                origin,
+                direction);
+
+            RayDesc rayDesc =
+            {
+                origin,
+                0.0f,
+                direction,
+                FLT_MAX,
+            };
+
+            payload.hitID = BAD_TRI_ID;
+            TraceRay(
+                g_accel,
+                RAY_FLAG_CULL_BACK_FACING_TRIANGLES, ~0,
+                HIT_GROUP_PRIMARY, HIT_GROUP_COUNT, HIT_GROUP_PRIMARY,
+                rayDesc, payload);
+
+            uint id = payload.hitID;
+            if (id == BAD_TRI_ID)
+                continue;
+
+            if (id != lastID)
+            {
+                lastID = id;
+
+                uint i = 0;
+                while (i < tileTriCount && g_tileTris[tileIndex].id[i] != id)
+                    i++;
+                lastFound = i < tileTriCount;
+
+                if (lastFound)
+                {
+                    entriesHit[i / 32] |= 1u << (i % 32);
+                }
+                else
+                {
+                    uint missIndex;
+                    InterlockedAdd(g_counters[0].validateMisses, 1, missIndex);
+                    if (missIndex < BEAM_VALIDATION_MAX_MISSES)
+                    {
+                        BeamValidationMiss miss;
+                        miss.tileIndex = tileIndex;
+                        miss.id = id;
+                        miss.pixel = pixelPos.x | (pixelPos.y << 16);
+                        miss.sampleIndex = s;
+                        g_beamValidationMisses[missIndex] = miss;
+                    }
+                }
+            }
+
+            if (!lastFound)
+                falseNegatives++;
+        }
+    }
+
+    uint entriesHitCount = 0;
+    {for (uint i = 0; i < (TILE_MAX_TRIS + 31) / 32; i++)
+        entriesHitCount += countbits(entriesHit[i]);}
+
+    PERF_COUNTER(validateSamples, TILE_SIZE * AA_SAMPLES);
+    PERF_COUNTER(validateFalseNegatives, falseNegatives);
+    PERF_COUNTER(validateListEntries, tileTriCount);
+    PERF_COUNTER(validateListEntriesHit, entriesHitCount);
 }
+#endif
@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef HLSL
+# include "HlslCompat.h"
+#endif
+
+// go ahead and build in the Y flip here so we're not doing it per-sample in the beam vis shader
+#define SAMPLE_Y_SCALE (-1)
+
+// https://msdn.microsoft.com/en-us/library/windows/desktop/Ff476218(v=VS.85).aspx
+static const float2 sampleOffset1x[1] = {
+	{(1.0 / 16.0 * 0),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 0)},
+};
+static const float2 sampleOffset2x[2] = {
+	{(1.0 / 16.0 * 4),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 4)},
+	{(1.0 / 16.0 * -4), SAMPLE_Y_SCALE * (1.0 / 16.0 * -4)},
+};
+static const float2 sampleOffset4x[4] = {
+	{(1.0 / 16.0 * -2), SAMPLE_Y_SCALE * (1.0 / 16.0 * -6)},
+	{(1.0 / 16.0 * 6),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -2)},
+	{(1.0 / 16.0 * -6), SAMPLE_Y_SCALE * (1.0 / 16.0 * 2)},
+	{(1.0 / 16.0 * 2),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 6)},
+};
+static const float2 sampleOffset8x[8] = {
+	{(1.0 / 16.0 * 1),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -3)},
+	{(1.0 / 16.0 * -1), SAMPLE_Y_SCALE * (1.0 / 16.0 * 3)},
+	{(1.0 / 16.0 * 5),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 1)},
+	{(1.0 / 16.0 * -3), SAMPLE_Y_SCALE * (1.0 / 16.0 * -5)},
+	{(1.0 / 16.0 * -5), SAMPLE_Y_SCALE * (1.0 / 16.0 * 5)},
+	{(1.0 / 16.0 * -7), SAMPLE_Y_SCALE * (1.0 / 16.0 * -1)},
+	{(1.0 / 16.0 * 3),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 7)},
+	{(1.0 / 16.0 * 7),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -7)},
+};
+static const float2 sampleOffset16x[16] = {
+	{(1.0 / 16.0 * 1),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 1)},
+	{(1.0 / 16.0 * -1), SAMPLE_Y_SCALE * (1.0 / 16.0 * -3)},
+	{(1.0 / 16.0 * -3), SAMPLE_Y_SCALE * (1.0 / 16.0 * 2)},
+	{(1.0 / 16.0 * 4),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -1)},
+	{(1.0 / 16.0 * -5), SAMPLE_Y_SCALE * (1.0 / 16.0 * -2)},
+	{(1.0 / 16.0 * 2),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 5)},
+	{(1.0 / 16.0 * 5),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 3)},
+	{(1.0 / 16.0 * 3),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -5)},
+	{(1.0 / 16.0 * -2), SAMPLE_Y_SCALE * (1.0 / 16.0 * 6)},
+	{(1.0 / 16.0 * 0),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -7)},
+	{(1.0 / 16.0 * -4), SAMPLE_Y_SCALE * (1.0 / 16.0 * -6)},
+	{(1.0 / 16.0 * -6), SAMPLE_Y_SCALE * (1.0 / 16.0 * 4)},
+	{(1.0 / 16.0 * -8), SAMPLE_Y_SCALE * (1.0 / 16.0 * 0)},
+	{(1.0 / 16.0 * 7),  SAMPLE_Y_SCALE * (1.0 / 16.0 * -4)},
+	{(1.0 / 16.0 * 6),  SAMPLE_Y_SCALE * (1.0 / 16.0 * 7)},
+	{(1.0 / 16.0 * -7), SAMPLE_Y_SCALE * (1.0 / 16.0 * -8)},
+};
+
+// One of the 8 rotations and mirror images of the square, by index: bit 2 mirrors x, bit 0 rotates by 90 degrees
+// and bit 1 by 180. They keep a pattern inside the pixel, and keep the 8x pattern's one sample per row and column.
+inline float2 SamplePatternTransform(float2 offset, uint pattern)
+{
+    float2 o = offset;
+    if (pattern & 4)
+    {
+        o.x = -o.x;
+    }
+    if (pattern & 1)
+    {
+        float x = o.x;
+        o.x = -o.y;
+        o.y = x;
+    }
+    if (pattern & 2)
+    {
+        o.x = -o.x;
+        o.y = -o.y;
+    }
+    return o;
+}
+
+// Frame order of the transforms, which brings the 8x pattern to 32 distinct positions in 4 frames
+// (a plain 0..7 order gets 22), and all 48 in 8.
+static const uint samplePatternOrder[8] = { 0, 1, 5, 6, 2, 3, 4, 7 };
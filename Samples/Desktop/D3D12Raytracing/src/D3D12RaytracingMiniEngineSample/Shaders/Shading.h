@@ -30,6 +30,36 @@
 // smaller numbers to scale the area light extents down, to create harder shadows
 #define SHADOW_AREA_LIGHT_SCALE .01f
 
+// For beam shadow mode, how many consecutive leaf AABBs are grouped into a cluster AABB?
+// Clusters carry the union of their leaves' coverage masks, and a beam that is wide relative to a cluster
+// accepts the whole cluster in a single anyhit instead of visiting each of its leaves.
+// 1 = leaf-only (no clusters)
+#define SHADOW_CLUSTER_SIZE 16
+// A beam takes the cluster opacity once its footprint at the cluster is at least this
+// fraction of the cluster's largest extent.
+#define SHADOW_CLUSTER_BEAM_RATIO 1.0f
+
+// For beam shadow mode, the model's XZ footprint is split into a grid of receiver regions, each with its own
+// shadow AABBs enlarged from the middle of the region. Beams trace the region they start in, selected with
+// the instance mask, so there can be at most 8.
+#define SHADOW_PARTITIONS_X 4
+#define SHADOW_PARTITIONS_Z 2
+#define SHADOW_PARTITIONS (SHADOW_PARTITIONS_X * SHADOW_PARTITIONS_Z)
+#if SHADOW_PARTITIONS > 8
+# error SHADOW_PARTITIONS must fit in the 8 instance mask bits
+#endif
+
+// For hard shadow mode, the beams renderer gathers each tile's occluders with orthographic beams along the
+// sun direction, and resolves every sample against that list while shading.
+// The sun shadow AABBs are enlarged by SUN_SHADOW_BEAM_RADIUS, which bounds the width of a single beam.
+// Tiles with their samples spread wider are split into up to SUN_SHADOW_BEAM_MAX_SPLIT^2 beams,
+// past that the tile is left unshadowed.
+#define SUN_SHADOW_BEAM_RADIUS 16.0f
+#define SUN_SHADOW_BEAM_MAX_SPLIT 4
+
+#define SHADOW_RAY_T_MIN .01f
+#define SHADOW_RAY_T_MIN_RELATIVE 1e-5f
+
 #define AREA_LIGHT_CENTER float3(-61, 1296, -38)
 #define AREA_LIGHT_EXTENT (float3(907 * SHADOW_AREA_LIGHT_SCALE, 0 * SHADOW_AREA_LIGHT_SCALE, 189 * SHADOW_AREA_LIGHT_SCALE))
 
@@ -38,6 +68,8 @@ STRUCT_ALIGN(16) struct ShadeConstants
     float3 sunDirection; uint pad0;
     float3 sunColor; uint pad1;
     float3 ambientColor; uint pad2;
+    float2 shadowPartitionOrigin; // XZ corner of the shadow partition grid
+    float2 shadowPartitionScale; // shadow partitions per unit, XZ
 };
 
 #ifdef HLSL
@@ -55,6 +87,24 @@ float2 shadowRandom(uint2 p, uint sampleIndex)
 }
 # endif
 
+// Shadow rays start this far along, to step off the receiver. The receiver position's float error grows with its
+// magnitude, so the offset does too, with SHADOW_RAY_T_MIN as the floor.
+float ShadowRayTMin(float3 receiverPos)
+{
+    float3 a = abs(receiverPos);
+    return max(SHADOW_RAY_T_MIN, max(a.x, max(a.y, a.z)) * SHADOW_RAY_T_MIN_RELATIVE);
+}
+
+# if SHADOW_MODE == SHADOW_MODE_HARD
+// axes perpendicular to the sun direction, for orthographic sun shadow beams
+void SunShadowBasis(float3 sunDir, out float3 u, out float3 v)
+{
+    float3 helper = abs(sunDir.y) < .9f ? float3(0, 1, 0) : float3(1, 0, 0);
+    u = normalize(cross(helper, sunDir));
+    v = cross(sunDir, u);
+}
+# endif
+
 void AntiAliasSpecular(inout float3 texNormal, inout float gloss)
 {
     float normalLenSq = dot(texNormal, texNormal);
@@ -94,6 +144,33 @@ float3 ApplyLightCommon(
     return nDotL * lightColor * (diffuseColor + specularFactor * specularColor);
 }
 
+// The view dependent part of ApplyLightCommon, for a diffuse term nDotL * lightColor * diffuseColor shaded apart from
+// it: the specular term, and the fresnel weight to scale the diffuse term by.
+float3 ApplyLightSpecular(
+    float3    specularColor,
+    float     specularMask,
+    float     gloss,
+    float3    normal,
+    float3    viewDir,
+    float3    lightDir,
+    float3    lightColor,
+    out float diffuseWeight
+)
+{
+    float3 halfVec = normalize(lightDir - viewDir);
+    float nDotH = saturate(dot(halfVec, normal));
+
+    float3 diffuseFresnel = 1;
+    FSchlick(specularColor, diffuseFresnel, lightDir, halfVec);
+    diffuseWeight = diffuseFresnel.x;
+
+    float specularFactor = specularMask * pow(nDotH, gloss) * (gloss + 2) / 8;
+
+    float nDotL = saturate(dot(normal, lightDir));
+
+    return nDotL * lightColor * specularFactor * specularColor;
+}
+
 float3 Shade(
     float3 diffuseColor,
     float3 ambientColor,
@@ -1,3 +1,5 @@
+#include "SortNetworks.h"
+
 // bitonic sort within a single thread, see:
 // https://github.com/facebookresearch/HVVR/blob/master/libraries/hvvr/raycaster/sort.h
 // http://developer.download.nvidia.com/compute/cuda/1.1-Beta/x86_website/Data-Parallel_Algorithms.html ("Bitonic Sort" sample, bitonic_kernel.cu)
@@ -42,3 +44,36 @@ void sortBitonic(inout SORT_T sortKeys[SORT_SIZE])
         }
     }
 }
+
+// Sorts with the network for SORT_SIZE keys, see SortNetworks.h. SORT_SIZE is known at compile time,
+// so this unrolls to a straight series of compare-exchanges, skipping the pruned comparators.
+void sortNetwork(inout SORT_T sortKeys[SORT_SIZE])
+{
+    const uint first = sortNetworkFirst[SORT_SIZE];
+    const uint length = sortNetworkLength[SORT_SIZE];
+
+    [unroll]
+    for (uint c = 0; c < length; c++) {
+        uint ce = sortNetworkComparators[first + c];
+        uint s0 = SORT_CE_A(ce);
+        uint s1 = SORT_CE_B(ce);
+        if (s1 < SORT_SIZE) {
+            SORT_T a = sortKeys[s0];
+            SORT_T b = sortKeys[s1];
+
+            if (SORT_CMP_LESS(b, a)) {
+                sortKeys[s0] = b;
+                sortKeys[s1] = a;
+            }
+        }
+    }
+}
+
+void sortList(inout SORT_T sortKeys[SORT_SIZE])
+{
+#if SORT_NETWORK && SORT_SIZE <= SORT_NETWORK_MAX
+    sortNetwork(sortKeys);
+#else
+    sortBitonic(sortKeys);
+#endif
+}
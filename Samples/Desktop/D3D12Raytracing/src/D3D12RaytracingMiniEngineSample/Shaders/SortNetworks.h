@@ -0,0 +1,109 @@
+#pragma once
+
+#ifndef HLSL
+# include "HlslCompat.h"
+#endif
+
+// Sorting networks for up to SORT_NETWORK_MAX keys, used by sortNetwork in Sort.h. These are the
+// smallest known networks (Knuth, TAOCP vol. 3, 5.3.4), optimal for every count but 13, which has one
+// comparator more than the best known 45. Unlike the bitonic sort, which pads the count up to a power of
+// two, each count gets its own network: 60 comparators instead of 80 for 16 keys, 19 instead of 24 for 8.
+// The networks are checked at load time (ValidateSortNetworks in ModelViewer.cpp).
+#define SORT_NETWORK 1 // 0 = sortBitonic
+#define SORT_NETWORK_MAX 16
+
+// orders the keys at index a < b
+#define SORT_CE(a, b) ((a) | ((b) << 8))
+#define SORT_CE_A(ce) ((ce) & 0xff)
+#define SORT_CE_B(ce) ((ce) >> 8)
+
+static const uint sortNetworkComparators[] =
+{
+    // 2 inputs, 1 comparator, 1 layer
+    SORT_CE(0, 1),
+    // 3 inputs, 3 comparators, 3 layers
+    SORT_CE(0, 2),
+    SORT_CE(0, 1),
+    SORT_CE(1, 2),
+    // 4 inputs, 5 comparators, 3 layers
+    SORT_CE(0, 2), SORT_CE(1, 3),
+    SORT_CE(0, 1), SORT_CE(2, 3),
+    SORT_CE(1, 2),
+    // 5 inputs, 9 comparators, 5 layers
+    SORT_CE(0, 3), SORT_CE(1, 4),
+    SORT_CE(0, 2), SORT_CE(1, 3),
+    SORT_CE(0, 1), SORT_CE(2, 4),
+    SORT_CE(1, 2), SORT_CE(3, 4),
+    SORT_CE(2, 3),
+    // 6 inputs, 12 comparators, 5 layers
+    SORT_CE(0, 5), SORT_CE(1, 3), SORT_CE(2, 4),
+    SORT_CE(1, 2), SORT_CE(3, 4),
+    SORT_CE(0, 3), SORT_CE(2, 5),
+    SORT_CE(0, 1), SORT_CE(2, 3), SORT_CE(4, 5),
+    SORT_CE(1, 2), SORT_CE(3, 4),
+    // 7 inputs, 16 comparators, 6 layers
+    SORT_CE(0, 6), SORT_CE(2, 3), SORT_CE(4, 5),
+    SORT_CE(0, 2), SORT_CE(1, 4), SORT_CE(3, 6),
+    SORT_CE(0, 1), SORT_CE(2, 5), SORT_CE(3, 4),
+    SORT_CE(1, 2), SORT_CE(4, 6),
+    SORT_CE(2, 3), SORT_CE(4, 5),
+    SORT_CE(1, 2), SORT_CE(3, 4), SORT_CE(5, 6),
+    // 8 inputs, 19 comparators, 6 layers
+    SORT_CE(0, 2), SORT_CE(1, 3), SORT_CE(4, 6), SORT_CE(5, 7),
+    SORT_CE(0, 4), SORT_CE(1, 5), SORT_CE(2, 6), SORT_CE(3, 7),
+    SORT_CE(0, 1), SORT_CE(2, 3), SORT_CE(4, 5), SORT_CE(6, 7),
+    SORT_CE(2, 4), SORT_CE(3, 5),
+    SORT_CE(1, 4), SORT_CE(3, 6),
+    SORT_CE(1, 2), SORT_CE(3, 4), SORT_CE(5, 6),
+    // 9 inputs, 25 comparators, 7 layers
+    SORT_CE(0, 3), SORT_CE(1, 7), SORT_CE(2, 5), SORT_CE(4, 8),
+    SORT_CE(0, 7), SORT_CE(2, 4), SORT_CE(3, 8), SORT_CE(5, 6),
+    SORT_CE(0, 2), SORT_CE(1, 3), SORT_CE(4, 5), SORT_CE(7, 8),
+    SORT_CE(1, 4), SORT_CE(3, 6), SORT_CE(5, 7),
+    SORT_CE(0, 1), SORT_CE(2, 4), SORT_CE(3, 5), SORT_CE(6, 8),
+    SORT_CE(2, 3), SORT_CE(4, 5), SORT_CE(6, 7),
+    SORT_CE(1, 2), SORT_CE(3, 4), SORT_CE(5, 6),
+    // 10 inputs, 29 comparators, 9 layers
+    SORT_CE(0, 5), SORT_CE(1, 6), SORT_CE(2, 7), SORT_CE(3, 8), SORT_CE(4, 9),
+    SORT_CE(0, 3), SORT_CE(1, 4), SORT_CE(5, 8), SORT_CE(6, 9),
+    SORT_CE(0, 2), SORT_CE(3, 6), SORT_CE(7, 9),
+    SORT_CE(0, 1), SORT_CE(2, 4), SORT_CE(5, 7), SORT_CE(8, 9),
+    SORT_CE(1, 2), SORT_CE(3, 5), SORT_CE(4, 6), SORT_CE(7, 8),
+    SORT_CE(1, 3), SORT_CE(2, 5), SORT_CE(4, 7), SORT_CE(6, 8),
+    SORT_CE(2, 3), SORT_CE(6, 7),
+    SORT_CE(3, 4), SORT_CE(5, 6),
+    SORT_CE(4, 5),
+    // 12 inputs, 39 comparators, 9 layers
+    SORT_CE(0, 8), SORT_CE(1, 7), SORT_CE(2, 6), SORT_CE(3, 11), SORT_CE(4, 10), SORT_CE(5, 9),
+    SORT_CE(0, 1), SORT_CE(2, 5), SORT_CE(3, 4), SORT_CE(6, 9), SORT_CE(7, 8), SORT_CE(10, 11),
+    SORT_CE(0, 2), SORT_CE(1, 6), SORT_CE(5, 10), SORT_CE(9, 11),
+    SORT_CE(0, 3), SORT_CE(1, 2), SORT_CE(4, 6), SORT_CE(5, 7), SORT_CE(8, 11), SORT_CE(9, 10),
+    SORT_CE(1, 4), SORT_CE(3, 5), SORT_CE(6, 8), SORT_CE(7, 10),
+    SORT_CE(1, 3), SORT_CE(2, 5), SORT_CE(6, 9), SORT_CE(8, 10),
+    SORT_CE(2, 3), SORT_CE(4, 5), SORT_CE(6, 7), SORT_CE(8, 9),
+    SORT_CE(4, 6), SORT_CE(5, 7),
+    SORT_CE(3, 4), SORT_CE(5, 6), SORT_CE(7, 8),
+    // 16 inputs, 60 comparators, 10 layers
+    SORT_CE(0, 13), SORT_CE(1, 12), SORT_CE(2, 15), SORT_CE(3, 14), SORT_CE(4, 8), SORT_CE(5, 6), SORT_CE(7, 11), SORT_CE(9, 10),
+    SORT_CE(0, 5), SORT_CE(1, 7), SORT_CE(2, 9), SORT_CE(3, 4), SORT_CE(6, 13), SORT_CE(8, 14), SORT_CE(10, 15), SORT_CE(11, 12),
+    SORT_CE(0, 1), SORT_CE(2, 3), SORT_CE(4, 5), SORT_CE(6, 8), SORT_CE(7, 9), SORT_CE(10, 11), SORT_CE(12, 13), SORT_CE(14, 15),
+    SORT_CE(0, 2), SORT_CE(1, 3), SORT_CE(4, 10), SORT_CE(5, 11), SORT_CE(6, 7), SORT_CE(8, 9), SORT_CE(12, 14), SORT_CE(13, 15),
+    SORT_CE(1, 2), SORT_CE(3, 12), SORT_CE(4, 6), SORT_CE(5, 7), SORT_CE(8, 10), SORT_CE(9, 11), SORT_CE(13, 14),
+    SORT_CE(1, 4), SORT_CE(2, 6), SORT_CE(5, 8), SORT_CE(7, 10), SORT_CE(9, 13), SORT_CE(11, 14),
+    SORT_CE(2, 4), SORT_CE(3, 6), SORT_CE(9, 12), SORT_CE(11, 13),
+    SORT_CE(3, 5), SORT_CE(6, 8), SORT_CE(7, 9), SORT_CE(10, 12),
+    SORT_CE(3, 4), SORT_CE(5, 6), SORT_CE(7, 8), SORT_CE(9, 10), SORT_CE(11, 12),
+    SORT_CE(6, 7), SORT_CE(8, 9),
+};
+
+// Range of sortNetworkComparators to run, per key count. Counts without a network of their own (11, 13-15)
+// run the next larger one, skipping the comparators that reach past the last key. Treating the missing keys
+// as +infinity, those comparators would never swap, so what's left still sorts.
+static const uint sortNetworkFirst[SORT_NETWORK_MAX + 1] =
+{
+    0, 0, 0, 1, 4, 9, 18, 30, 46, 65, 90, 119, 119, 158, 158, 158, 158,
+};
+static const uint sortNetworkLength[SORT_NETWORK_MAX + 1] =
+{
+    0, 0, 1, 3, 5, 9, 12, 16, 19, 25, 29, 39, 39, 60, 60, 60, 60,
+};
@@ -0,0 +1,86 @@
+#define HLSL
+
+#include "RayCommon.h"
+#include "RayGen.h"
+
+// Accumulates the rotating sample patterns of TEMPORAL_SAMPLES. Each pixel's history is fetched from where the pixel's
+// nearest sample was in the previous frame, clipped to the colors of the current frame's 3x3 neighborhood (to reject
+// disocclusions and shading changes), and blended in as a running average over up to maxHistory frames, so a static
+// view converges to the average over every pattern. The history keeps its frame count in alpha.
+
+cbuffer b0 : register(b0)
+{
+    TemporalCB temporalConstants;
+};
+
+Texture2D<float3> g_currentColor : register(t30); // copy of this frame's g_screenOutput
+Texture2D<float> g_currentDepth : register(t31); // g_screenDepth
+Texture2D<float4> g_historyIn : register(t32);
+
+RWTexture2D<float4> g_resolveOutput : register(u20);
+RWTexture2D<float4> g_historyOut : register(u21);
+
+[numthreads(8, 8, 1)]
+[RootSignature(
+    "CBV(b0),"
+    "CBV(b1),"
+    "DescriptorTable(SRV(t30, numDescriptors = 3)),"
+    "DescriptorTable(UAV(u20, numDescriptors = 2)),"
+    "StaticSampler(s0, filter = FILTER_MIN_MAG_MIP_LINEAR, addressU = TEXTURE_ADDRESS_CLAMP, addressV = TEXTURE_ADDRESS_CLAMP),"
+)]
+void TemporalResolve(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint2 pixelDim;
+    g_currentColor.GetDimensions(pixelDim.x, pixelDim.y);
+    uint2 pixelPos = dispatchThreadID.xy;
+    if (pixelPos.x >= pixelDim.x || pixelPos.y >= pixelDim.y)
+        return;
+
+    float3 color = g_currentColor[pixelPos];
+
+    // mean and standard deviation of the neighborhood
+    float3 m1 = float3(0, 0, 0);
+    float3 m2 = float3(0, 0, 0);
+    {for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            int2 p = clamp(int2(pixelPos) + int2(x, y), int2(0, 0), int2(pixelDim) - 1);
+            float3 c = g_currentColor[p];
+            m1 += c;
+            m2 += c * c;
+        }
+    }}
+    m1 /= 9.0f;
+    float3 sigma = sqrt(max(m2 / 9.0f - m1 * m1, 0.0f));
+
+    float3 history = color;
+    float historyCount = 0.0f;
+    if (temporalConstants.historyValid)
+    {
+        // the nearest sample's position, or just the pixel's direction when nothing was hit
+        float3 origin;
+        float3 dir;
+        GenerateCameraRay(pixelDim, float2(pixelPos), origin, dir);
+        float depth = g_currentDepth[pixelPos];
+        float4 prevClip = depth < FLT_MAX ?
+            mul(temporalConstants.prevViewProj, float4(origin + dir * depth, 1)) :
+            mul(temporalConstants.prevViewProj, float4(dir, 0));
+
+        float2 prevUV = prevClip.xy / prevClip.w * float2(.5f, -.5f) + .5f;
+        if (prevClip.w > 0.0f && all(prevUV >= 0.0f) && all(prevUV <= 1.0f))
+        {
+            float4 prev = g_historyIn.SampleLevel(g_s0, prevUV, 0);
+            float3 boxMin = m1 - temporalConstants.clipGamma * sigma;
+            float3 boxMax = m1 + temporalConstants.clipGamma * sigma;
+            history = clamp(prev.rgb, boxMin, boxMax);
+            historyCount = prev.a;
+        }
+    }
+
+    float count = min(historyCount + 1.0f, temporalConstants.maxHistory);
+    float3 result = lerp(history, color, 1.0f / count);
+
+    g_resolveOutput[pixelPos] = float4(result, 1);
+    g_historyOut[pixelPos] = float4(result, count);
+}
@@ -42,16 +42,42 @@ uint3 triFetchIndices(uint offsetBytes)
     return indices;
 }
 
+// dword of a triangle in the position stream, see POSITION_STREAM
+uint positionStreamLoad(uint triIndex, uint dword)
+{
+    uint block = triIndex / POSITION_STREAM_BLOCK;
+    uint lane = triIndex % POSITION_STREAM_BLOCK;
+    return g_positions.Load(((block * POSITION_STREAM_DWORDS + dword) * POSITION_STREAM_BLOCK + lane) * 4);
+}
+
 Triangle triFetch(uint meshID, uint primID)
 {
     RayTraceMeshInfo mesh = g_meshInfo[meshID];
 
+    Triangle tri;
+#if POSITION_STREAM
+    uint triIndex = mesh.triOffset + primID;
+# if POSITION_STREAM_QUANTIZED
+    uint q0 = positionStreamLoad(triIndex, 0);
+    uint q1 = positionStreamLoad(triIndex, 1);
+    uint q2 = positionStreamLoad(triIndex, 2);
+    uint q3 = positionStreamLoad(triIndex, 3);
+    uint q4 = positionStreamLoad(triIndex, 4);
+    tri.v0 = mesh.posQuantMin + mesh.posQuantScale * float3(q0 & 0xffff, q0 >> 16, q1 & 0xffff);
+    float3 v1 = mesh.posQuantMin + mesh.posQuantScale * float3(q1 >> 16, q2 & 0xffff, q2 >> 16);
+    float3 v2 = mesh.posQuantMin + mesh.posQuantScale * float3(q3 & 0xffff, q3 >> 16, q4 & 0xffff);
+# else
+    tri.v0 = asfloat(uint3(positionStreamLoad(triIndex, 0), positionStreamLoad(triIndex, 1), positionStreamLoad(triIndex, 2)));
+    float3 v1 = asfloat(uint3(positionStreamLoad(triIndex, 3), positionStreamLoad(triIndex, 4), positionStreamLoad(triIndex, 5)));
+    float3 v2 = asfloat(uint3(positionStreamLoad(triIndex, 6), positionStreamLoad(triIndex, 7), positionStreamLoad(triIndex, 8)));
+# endif
+#else
     uint3 indices = triFetchIndices(mesh.indexOffset + primID * 3 * 2);
 
-    Triangle tri;
     tri.v0 = asfloat(g_attributes.Load3(mesh.attrOffsetPos + indices.x * mesh.attrStride));
     float3 v1 = asfloat(g_attributes.Load3(mesh.attrOffsetPos + indices.y * mesh.attrStride));
     float3 v2 = asfloat(g_attributes.Load3(mesh.attrOffsetPos + indices.z * mesh.attrStride));
+#endif
 
     tri.e0 = v1 - tri.v0;
     tri.e1 = v2 - tri.v0;
@@ -93,3 +119,68 @@ TriInterpolated triFetchAndInterpolate(uint meshID, uint primID, float3 uvw)
 
     return tri;
 }
+
+// just the texture coordinates, for alpha testing
+float2 triFetchUV(uint meshID, uint primID, float3 uvw)
+{
+    RayTraceMeshInfo mesh = g_meshInfo[meshID];
+
+    uint3 indices = triFetchIndices(mesh.indexOffset + primID * 3 * 2);
+
+    return
+        uvw.x * asfloat(g_attributes.Load2(mesh.attrOffsetTexcoord0 + indices.x * mesh.attrStride)) +
+        uvw.y * asfloat(g_attributes.Load2(mesh.attrOffsetTexcoord0 + indices.y * mesh.attrStride)) +
+        uvw.z * asfloat(g_attributes.Load2(mesh.attrOffsetTexcoord0 + indices.z * mesh.attrStride));
+}
+
+// Instances place the object space vertex data in the world, see SCENE_INSTANCES.
+float3 instanceTransformPoint(uint instanceID, float3 p)
+{
+#if SCENE_INSTANCES > 1
+    InstanceTransform xf = g_instanceTransforms[instanceID];
+    return float3(
+        dot(xf.row0.xyz, p) + xf.row0.w,
+        dot(xf.row1.xyz, p) + xf.row1.w,
+        dot(xf.row2.xyz, p) + xf.row2.w);
+#else
+    return p;
+#endif
+}
+
+// Also used for normals and tangents, which is fine as long as the transforms are rigid.
+float3 instanceTransformVector(uint instanceID, float3 v)
+{
+#if SCENE_INSTANCES > 1
+    InstanceTransform xf = g_instanceTransforms[instanceID];
+    return float3(
+        dot(xf.row0.xyz, v),
+        dot(xf.row1.xyz, v),
+        dot(xf.row2.xyz, v));
+#else
+    return v;
+#endif
+}
+
+// world space triangle
+Triangle triFetchInstance(uint instanceID, uint meshID, uint primID)
+{
+    Triangle tri = triFetch(meshID, primID);
+
+    tri.v0 = instanceTransformPoint(instanceID, tri.v0);
+    tri.e0 = instanceTransformVector(instanceID, tri.e0);
+    tri.e1 = instanceTransformVector(instanceID, tri.e1);
+
+    return tri;
+}
+
+TriInterpolated triFetchAndInterpolateInstance(uint instanceID, uint meshID, uint primID, float3 uvw)
+{
+    TriInterpolated tri = triFetchAndInterpolate(meshID, primID, uvw);
+
+    tri.worldPos = instanceTransformPoint(instanceID, tri.worldPos);
+    tri.normal = instanceTransformVector(instanceID, tri.normal);
+    tri.tangent = instanceTransformVector(instanceID, tri.tangent);
+    tri.bitangent = instanceTransformVector(instanceID, tri.bitangent);
+
+    return tri;
+}
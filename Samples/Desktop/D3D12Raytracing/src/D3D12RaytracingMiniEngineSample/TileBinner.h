@@ -0,0 +1,553 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "TileScheduler.h"
+
+// A CPU front-end for primary beams. Instead of tracing a beam per tile, the triangles are projected and
+// binned into the tiles they overlap, and the lists are uploaded and scattered into the tile triangle lists
+// (Shaders/BeamsBinScatter.hlsl). The lists hold the same encoded primitive IDs and the same overflow
+// convention, so quad visibility and shading can't tell which front-end produced them.
+// Application/Raytracing/cpuTileBinning switches between the two at runtime.
+#define TILE_BINNING 1
+
+// triangles are clipped against this view depth, anything closer can't be in front of the beams' origin
+#define TILE_BINNING_NEAR_W 1e-4f
+
+// The binning runs on the TileScheduler's threads (Application/Raytracing/cpuTileBinningThreads), in chunks of
+// the triangles, then in square regions of tiles.
+#define TILE_BINNING_CHUNKS 64
+#define TILE_BINNING_REGION_DIM 8
+
+// Conservative tile binning. Culls the same things as the beam tests, where it can do so exactly: backfacing
+// triangles (the camera behind the triangle's plane), fully transparent opacity masks, and triangles behind
+// an opaque triangle that covers the whole tile. A triangle overlaps a tile if it overlaps the tile's
+// rectangle, so every sample within the tile is covered.
+class TileBinner
+{
+public:
+    struct Camera
+    {
+        float position[3];
+        float right[3];
+        float up[3];
+        float forward[3];
+        float projScaleX; // view space to NDC, at a view depth of 1
+        float projScaleY;
+        float jitterNormalizedX; // same as DynamicCB
+        float jitterNormalizedY;
+    };
+
+    struct Stats
+    {
+        uint32_t trisIn;
+        uint32_t culledTransparent;
+        uint32_t culledBackface;
+        uint32_t culledOffscreen; // behind the camera or outside the screen
+        uint32_t clipped; // crossing the near plane, binned by their bounds only
+        uint32_t occluderTiles; // tiles fully covered by an opaque triangle
+        uint32_t entriesOccluded;
+        uint32_t entries; // tile list entries, including any beyond TILE_MAX_TRIS
+        uint32_t overflowTiles;
+        float milliseconds;
+        uint32_t threads;
+        uint32_t steals;
+        float utilization; // of the threads, over the scheduled work
+        uint32_t peakListBytes; // tile lists and occluder depths live at once, before packing
+    };
+
+    TileBinner() : m_pipelined(false), m_mode(TileScheduler::Mode::workStealing), m_packCost(0.0f)
+    {
+        std::fill(m_chunkCost, m_chunkCost + TILE_BINNING_CHUNKS, 0.0f);
+    }
+
+    void Resize(uint32_t triCount)
+    {
+        m_tris.resize(triCount);
+        m_projected.resize(triCount);
+    }
+
+    // id is the encoded primitive ID written into the lists
+    void SetTriangle(uint32_t index, const float v0[3], const float v1[3], const float v2[3], uint32_t id, uint32_t opacityMask)
+    {
+        Tri &tri = m_tris[index];
+        for (int c = 0; c < 3; c++)
+        {
+            tri.v[0][c] = v0[c];
+            tri.v[1][c] = v1[c];
+            tri.v[2][c] = v2[c];
+        }
+        tri.id = id;
+        tri.opacityMask = opacityMask;
+    }
+
+    uint32_t TriCount() const { return uint32_t(m_tris.size()); }
+
+    void SetThreading(uint32_t threadCount, TileScheduler::Mode mode)
+    {
+        m_scheduler.SetThreadCount(threadCount);
+        m_mode = mode;
+    }
+
+    // Off: the whole screen is binned, then packed. On: bands of TILE_BINNING_REGION_DIM tile rows stream through
+    // binning and packing, each band packing while the next one bins, so only two bands' tile lists are live.
+    void SetPipelined(bool pipelined) { m_pipelined = pipelined; }
+
+    // Bins every triangle into tilesX x tilesY tiles of maxTris entries. The packed output is tileCount
+    // (offset, count) pairs, followed by the entries, with offsets in dwords from the start.
+    // Counts are the full counts, but at most maxTris entries are stored per tile.
+    //
+    // Runs on the scheduler's threads in two phases. The first projects and culls TILE_BINNING_CHUNKS chunks of
+    // the triangles, and sorts the survivors of each chunk into regions of TILE_BINNING_REGION_DIM^2 tiles. The
+    // second finds the occluders and fills the tile lists of each region, walking the chunks in order, so the
+    // lists come out the same as in triangle order on one thread, and packs them (see SetPipelined). Each phase's
+    // tasks are ordered by the time they took last frame.
+    void Bin(const Camera &camera, uint32_t tilesX, uint32_t tilesY, uint32_t maxTris, std::vector<uint32_t> &packed, Stats &stats)
+    {
+        int64_t start = SystemTime::GetCurrentTick();
+
+        stats = {};
+        uint32_t tileCount = tilesX * tilesY;
+        uint32_t regionsX = (tilesX + TILE_BINNING_REGION_DIM - 1) / TILE_BINNING_REGION_DIM;
+        uint32_t regionsY = (tilesY + TILE_BINNING_REGION_DIM - 1) / TILE_BINNING_REGION_DIM;
+        uint32_t regionCount = regionsX * regionsY;
+        if (m_regionCost.size() != regionCount)
+            m_regionCost.assign(regionCount, 0.0f);
+        m_chunkRegionTris.resize(TILE_BINNING_CHUNKS * regionCount);
+        for (std::vector<uint32_t> &list : m_chunkRegionTris)
+            list.clear();
+
+        uint32_t bandRegionRows = m_pipelined ? 1 : regionsY;
+        uint32_t bandCount = (regionsY + bandRegionRows - 1) / bandRegionRows;
+        uint32_t bandTiles = bandRegionRows * TILE_BINNING_REGION_DIM * tilesX;
+        m_bands.resize(m_pipelined ? 2 : 1);
+        for (Band &band : m_bands)
+        {
+            band.tileLists.resize(bandTiles);
+            band.tileOccluderW.resize(bandTiles);
+        }
+
+        uint32_t threadCount = m_scheduler.ThreadCount();
+        m_threadStats.assign(threadCount, ThreadStats());
+
+        // project, cull, and sort into regions
+        uint32_t triCount = uint32_t(m_tris.size());
+        TileScheduler::Stats projectStats;
+        m_scheduler.Run(TILE_BINNING_CHUNKS, m_chunkCost, m_mode, [&](uint32_t chunk, uint32_t thread)
+        {
+            int64_t chunkStart = SystemTime::GetCurrentTick();
+            Stats &threadStats = m_threadStats[thread].stats;
+            std::vector<uint32_t> *regionTris = &m_chunkRegionTris[chunk * regionCount];
+
+            uint32_t first = uint32_t(uint64_t(triCount) * chunk / TILE_BINNING_CHUNKS);
+            uint32_t last = uint32_t(uint64_t(triCount) * (chunk + 1) / TILE_BINNING_CHUNKS);
+            for (uint32_t t = first; t < last; t++)
+            {
+                const Tri &tri = m_tris[t];
+                Projected &proj = m_projected[t];
+                proj.vertexCount = 0;
+                threadStats.trisIn++;
+
+                if (tri.opacityMask == OPACITY_MASK_ALL_TRANSPARENT)
+                {
+                    threadStats.culledTransparent++;
+                    continue;
+                }
+
+                // same test as TriTileSetup
+                float e0[3], e1[3], toCamera[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    e0[c] = tri.v[1][c] - tri.v[0][c];
+                    e1[c] = tri.v[2][c] - tri.v[0][c];
+                    toCamera[c] = camera.position[c] - tri.v[0][c];
+                }
+                float normal[3] =
+                {
+                    e0[1] * e1[2] - e0[2] * e1[1],
+                    e0[2] * e1[0] - e0[0] * e1[2],
+                    e0[0] * e1[1] - e0[1] * e1[0],
+                };
+                if (Dot(toCamera, normal) < 0.0f)
+                {
+                    threadStats.culledBackface++;
+                    continue;
+                }
+
+                if (!Project(camera, tilesX, tilesY, tri, proj))
+                {
+                    threadStats.culledOffscreen++;
+                    continue;
+                }
+                if (proj.clipped)
+                    threadStats.clipped++;
+
+                for (uint32_t ry = proj.tileMinY / TILE_BINNING_REGION_DIM; ry <= proj.tileMaxY / TILE_BINNING_REGION_DIM; ry++)
+                {
+                    for (uint32_t rx = proj.tileMinX / TILE_BINNING_REGION_DIM; rx <= proj.tileMaxX / TILE_BINNING_REGION_DIM; rx++)
+                        regionTris[ry * regionsX + rx].push_back(t);
+                }
+            }
+
+            m_chunkCost[chunk] = float(SystemTime::GetCurrentTick() - chunkStart);
+        }, projectStats);
+
+        // Step s bins band s into its slot in the ring, and packs band s - 1 from the other, as one batch.
+        TileScheduler::Stats binStats = {};
+        float binUtilizationMs = 0.0f;
+        uint32_t bandRegions = bandRegionRows * regionsX;
+        uint32_t bandEntries[2] = {};
+        packed.resize(tileCount * 2);
+        for (uint32_t step = 0; step <= bandCount; step++)
+        {
+            uint32_t firstRegion = step * bandRegions;
+            uint32_t regions = step < bandCount ? std::min(bandRegions, regionCount - firstRegion) : 0;
+            uint32_t packBand = step - 1;
+            bool packing = step > 0;
+
+            // the pack task is last
+            m_stepCost.resize(regions + 1);
+            for (uint32_t task = 0; task < regions; task++)
+                m_stepCost[task] = m_regionCost[firstRegion + task];
+            m_stepCost[regions] = m_packCost;
+
+            TileScheduler::Stats stepStats;
+            m_scheduler.Run(regions + (packing ? 1 : 0), m_stepCost.data(), m_mode, [&](uint32_t task, uint32_t thread)
+            {
+                int64_t taskStart = SystemTime::GetCurrentTick();
+                if (task < regions)
+                {
+                    uint32_t region = firstRegion + task;
+                    BinRegion(region, regionsX, regionCount, tilesX, tilesY, m_bands[step % m_bands.size()],
+                        step * bandRegionRows * TILE_BINNING_REGION_DIM, m_threadStats[thread].stats);
+                    m_regionCost[region] = float(SystemTime::GetCurrentTick() - taskStart);
+                }
+                else
+                {
+                    uint32_t bandMinY = packBand * bandRegionRows * TILE_BINNING_REGION_DIM;
+                    uint32_t bandMaxY = std::min(bandMinY + bandRegionRows * TILE_BINNING_REGION_DIM, tilesY);
+                    PackBand(m_bands[packBand % m_bands.size()], bandMinY, bandMaxY, tilesX, maxTris, packed, stats.overflowTiles);
+                    m_packCost = float(SystemTime::GetCurrentTick() - taskStart);
+                }
+            }, stepStats);
+
+            binStats.milliseconds += stepStats.milliseconds;
+            binStats.steals += stepStats.steals;
+            binUtilizationMs += stepStats.utilization * stepStats.milliseconds;
+
+            // the bands in flight: the one just binned, and the one just packed
+            if (regions > 0)
+            {
+                uint32_t &entries = bandEntries[step % m_bands.size()];
+                entries = 0;
+                for (const std::vector<uint32_t> &list : m_bands[step % m_bands.size()].tileLists)
+                    entries += uint32_t(list.size());
+            }
+            uint32_t liveEntries = bandEntries[0] + (m_bands.size() > 1 ? bandEntries[1] : 0);
+            size_t bandTileBytes = sizeof(std::vector<uint32_t>) + sizeof(float);
+            stats.peakListBytes = std::max(stats.peakListBytes,
+                uint32_t(liveEntries * sizeof(uint32_t) + m_bands.size() * bandTiles * bandTileBytes));
+        }
+        binStats.utilization = binStats.milliseconds > 0.0f ? binUtilizationMs / binStats.milliseconds : 1.0f;
+
+        for (const ThreadStats &threadStats : m_threadStats)
+        {
+            const Stats &s = threadStats.stats;
+            stats.trisIn += s.trisIn;
+            stats.culledTransparent += s.culledTransparent;
+            stats.culledBackface += s.culledBackface;
+            stats.culledOffscreen += s.culledOffscreen;
+            stats.clipped += s.clipped;
+            stats.occluderTiles += s.occluderTiles;
+            stats.entriesOccluded += s.entriesOccluded;
+            stats.entries += s.entries;
+        }
+
+        int64_t end = SystemTime::GetCurrentTick();
+        stats.milliseconds = float(SystemTime::TicksToMillisecs(end - start));
+
+        stats.threads = threadCount;
+        stats.steals = projectStats.steals + binStats.steals;
+        float parallelMs = projectStats.milliseconds + binStats.milliseconds;
+        stats.utilization = parallelMs > 0.0f ?
+            (projectStats.utilization * projectStats.milliseconds + binStats.utilization * binStats.milliseconds) / parallelMs : 1.0f;
+    }
+
+private:
+    struct Tri
+    {
+        float v[3][3];
+        uint32_t id;
+        uint32_t opacityMask;
+    };
+
+    // in tile units, see Project
+    struct Projected
+    {
+        float x[4];
+        float y[4];
+        uint32_t vertexCount; // 0 = culled, 4 after clipping a corner off
+        bool clipped;
+        bool edgeTest; // a non-degenerate, unclipped triangle, wound so that the inside is positive
+        float wMin;
+        float wMax;
+        uint32_t tileMinX, tileMinY;
+        uint32_t tileMaxX, tileMaxY; // inclusive
+    };
+
+    // tile lists and occluder depths, of TILE_BINNING_REGION_DIM tile rows per region row in the band
+    struct Band
+    {
+        std::vector<std::vector<uint32_t>> tileLists;
+        std::vector<float> tileOccluderW;
+    };
+
+    // Finds the occluders, and fills the tile lists of a region, into the band starting at tile row bandMinY.
+    void BinRegion(uint32_t region, uint32_t regionsX, uint32_t regionCount, uint32_t tilesX, uint32_t tilesY,
+        Band &band, uint32_t bandMinY, Stats &stats)
+    {
+        uint32_t regionMinX = (region % regionsX) * TILE_BINNING_REGION_DIM;
+        uint32_t regionMinY = (region / regionsX) * TILE_BINNING_REGION_DIM;
+        uint32_t regionMaxX = std::min(regionMinX + TILE_BINNING_REGION_DIM, tilesX) - 1;
+        uint32_t regionMaxY = std::min(regionMinY + TILE_BINNING_REGION_DIM, tilesY) - 1;
+
+        for (uint32_t ty = regionMinY; ty <= regionMaxY; ty++)
+        {
+            for (uint32_t tx = regionMinX; tx <= regionMaxX; tx++)
+            {
+                band.tileLists[(ty - bandMinY) * tilesX + tx].clear();
+                band.tileOccluderW[(ty - bandMinY) * tilesX + tx] = FLT_MAX;
+            }
+        }
+
+        for (uint32_t chunk = 0; chunk < TILE_BINNING_CHUNKS; chunk++)
+        {
+            for (uint32_t t : m_chunkRegionTris[chunk * regionCount + region])
+            {
+                const Projected &proj = m_projected[t];
+                if (m_tris[t].opacityMask != OPACITY_MASK_ALL_OPAQUE || !proj.edgeTest)
+                    continue;
+
+                for (uint32_t ty = std::max(proj.tileMinY, regionMinY); ty <= std::min(proj.tileMaxY, regionMaxY); ty++)
+                {
+                    for (uint32_t tx = std::max(proj.tileMinX, regionMinX); tx <= std::min(proj.tileMaxX, regionMaxX); tx++)
+                    {
+                        if (CoversTile(proj, float(tx), float(ty)))
+                        {
+                            float &occluderW = band.tileOccluderW[(ty - bandMinY) * tilesX + tx];
+                            occluderW = std::min(occluderW, proj.wMax);
+                        }
+                    }
+                }
+            }
+        }
+
+        for (uint32_t ty = regionMinY; ty <= regionMaxY; ty++)
+        {
+            for (uint32_t tx = regionMinX; tx <= regionMaxX; tx++)
+            {
+                if (band.tileOccluderW[(ty - bandMinY) * tilesX + tx] < FLT_MAX)
+                    stats.occluderTiles++;
+            }
+        }
+
+        for (uint32_t chunk = 0; chunk < TILE_BINNING_CHUNKS; chunk++)
+        {
+            for (uint32_t t : m_chunkRegionTris[chunk * regionCount + region])
+            {
+                const Projected &proj = m_projected[t];
+                for (uint32_t ty = std::max(proj.tileMinY, regionMinY); ty <= std::min(proj.tileMaxY, regionMaxY); ty++)
+                {
+                    for (uint32_t tx = std::max(proj.tileMinX, regionMinX); tx <= std::min(proj.tileMaxX, regionMaxX); tx++)
+                    {
+                        if (proj.edgeTest && !OverlapsTile(proj, float(tx), float(ty)))
+                            continue;
+
+                        uint32_t bandTileIndex = (ty - bandMinY) * tilesX + tx;
+                        // strictly behind, so an occluder doesn't cull itself
+                        if (proj.wMin > band.tileOccluderW[bandTileIndex])
+                        {
+                            stats.entriesOccluded++;
+                            continue;
+                        }
+
+                        band.tileLists[bandTileIndex].push_back(m_tris[t].id);
+                        stats.entries++;
+                    }
+                }
+            }
+        }
+    }
+
+    // Appends tile rows [bandMinY, bandMaxY) of the band, in tile order, so bands have to pack in order.
+    static void PackBand(const Band &band, uint32_t bandMinY, uint32_t bandMaxY, uint32_t tilesX, uint32_t maxTris,
+        std::vector<uint32_t> &packed, uint32_t &overflowTiles)
+    {
+        for (uint32_t tileIndex = bandMinY * tilesX; tileIndex < bandMaxY * tilesX; tileIndex++)
+        {
+            const std::vector<uint32_t> &list = band.tileLists[tileIndex - bandMinY * tilesX];
+            uint32_t count = uint32_t(list.size());
+            if (count > maxTris)
+                overflowTiles++;
+
+            packed[tileIndex * 2 + 0] = uint32_t(packed.size());
+            packed[tileIndex * 2 + 1] = count;
+            packed.insert(packed.end(), list.begin(), list.begin() + std::min(count, maxTris));
+        }
+    }
+
+    static float Dot(const float a[3], const float b[3])
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    // Projects to tile units, where tile (x, y) covers [x, x + 1] x [y, y + 1], matching GenerateTileRays
+    // (including the jitter and the Y flip). Returns false if the triangle doesn't reach any tile.
+    static bool Project(const Camera &camera, uint32_t tilesX, uint32_t tilesY, const Tri &tri, Projected &proj)
+    {
+        // view space x, y and depth
+        float view[3][3];
+        for (int v = 0; v < 3; v++)
+        {
+            float d[3] = { tri.v[v][0] - camera.position[0], tri.v[v][1] - camera.position[1], tri.v[v][2] - camera.position[2] };
+            view[v][0] = Dot(d, camera.right);
+            view[v][1] = Dot(d, camera.up);
+            view[v][2] = Dot(d, camera.forward);
+        }
+
+        // clip against the near plane (one plane, so at most 4 vertices come out)
+        float clippedView[4][3];
+        uint32_t count = 0;
+        for (int v = 0; v < 3; v++)
+        {
+            const float *a = view[v];
+            const float *b = view[(v + 1) % 3];
+            bool aInside = a[2] >= TILE_BINNING_NEAR_W;
+            bool bInside = b[2] >= TILE_BINNING_NEAR_W;
+            if (aInside)
+            {
+                std::copy(a, a + 3, clippedView[count]);
+                count++;
+            }
+            if (aInside != bInside)
+            {
+                float s = (TILE_BINNING_NEAR_W - a[2]) / (b[2] - a[2]);
+                for (int c = 0; c < 3; c++)
+                    clippedView[count][c] = a[c] + (b[c] - a[c]) * s;
+                clippedView[count][2] = TILE_BINNING_NEAR_W;
+                count++;
+            }
+        }
+        if (count == 0)
+            return false;
+
+        proj.clipped = count != 3 || view[0][2] < TILE_BINNING_NEAR_W || view[1][2] < TILE_BINNING_NEAR_W || view[2][2] < TILE_BINNING_NEAR_W;
+        proj.vertexCount = count;
+        proj.wMin = FLT_MAX;
+        proj.wMax = -FLT_MAX;
+        float xMin = FLT_MAX, yMin = FLT_MAX;
+        float xMax = -FLT_MAX, yMax = -FLT_MAX;
+        for (uint32_t v = 0; v < count; v++)
+        {
+            float w = clippedView[v][2];
+            float ndcX = camera.projScaleX * clippedView[v][0] / w;
+            float ndcY = camera.projScaleY * clippedView[v][1] / w;
+            proj.x[v] = (ndcX + 1.0f + camera.jitterNormalizedX) * tilesX * .5f;
+            proj.y[v] = (1.0f + camera.jitterNormalizedY - ndcY) * tilesY * .5f;
+            proj.wMin = std::min(proj.wMin, w);
+            proj.wMax = std::max(proj.wMax, w);
+            xMin = std::min(xMin, proj.x[v]);
+            yMin = std::min(yMin, proj.y[v]);
+            xMax = std::max(xMax, proj.x[v]);
+            yMax = std::max(yMax, proj.y[v]);
+        }
+
+        if (xMax < 0.0f || yMax < 0.0f || xMin > float(tilesX) || yMin > float(tilesY))
+        {
+            proj.vertexCount = 0;
+            return false;
+        }
+
+        // a triangle touching a tile's edge is kept on both sides
+        proj.tileMinX = uint32_t(std::max(0.0f, std::floor(xMin) - (std::floor(xMin) == xMin ? 1.0f : 0.0f)));
+        proj.tileMinY = uint32_t(std::max(0.0f, std::floor(yMin) - (std::floor(yMin) == yMin ? 1.0f : 0.0f)));
+        proj.tileMaxX = uint32_t(std::min(float(tilesX - 1), std::floor(xMax)));
+        proj.tileMaxY = uint32_t(std::min(float(tilesY - 1), std::floor(yMax)));
+
+        proj.edgeTest = false;
+        if (!proj.clipped)
+        {
+            float area2 = (proj.x[1] - proj.x[0]) * (proj.y[2] - proj.y[0]) - (proj.y[1] - proj.y[0]) * (proj.x[2] - proj.x[0]);
+            if (area2 != 0.0f)
+            {
+                if (area2 < 0.0f)
+                {
+                    std::swap(proj.x[1], proj.x[2]);
+                    std::swap(proj.y[1], proj.y[2]);
+                }
+                proj.edgeTest = true;
+            }
+        }
+        return true;
+    }
+
+    // Edge function of edge e at the corner of the tile most inside (outside), which decides whether any
+    // (every) point of the tile is inside the edge.
+    static float EdgeAtTileCorner(const Projected &proj, int e, float tileX, float tileY, bool mostInside)
+    {
+        float ax = proj.x[e], ay = proj.y[e];
+        float bx = proj.x[(e + 1) % 3], by = proj.y[(e + 1) % 3];
+        // inside is to the left of a -> b: (b - a) x (p - a) >= 0
+        float nx = -(by - ay);
+        float ny = bx - ax;
+        float px = (nx > 0.0f) == mostInside ? tileX + 1.0f : tileX;
+        float py = (ny > 0.0f) == mostInside ? tileY + 1.0f : tileY;
+        return nx * (px - ax) + ny * (py - ay);
+    }
+
+    static bool OverlapsTile(const Projected &proj, float tileX, float tileY)
+    {
+        for (int e = 0; e < 3; e++)
+        {
+            if (EdgeAtTileCorner(proj, e, tileX, tileY, true) < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    static bool CoversTile(const Projected &proj, float tileX, float tileY)
+    {
+        for (int e = 0; e < 3; e++)
+        {
+            if (EdgeAtTileCorner(proj, e, tileX, tileY, false) < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    struct ThreadStats
+    {
+        Stats stats;
+        char pad[64]; // keeps the threads' counters off each other's cache lines
+    };
+
+    std::vector<Tri> m_tris;
+    std::vector<Projected> m_projected;
+    // one band over the whole screen, or a ring of two (see SetPipelined)
+    std::vector<Band> m_bands;
+    bool m_pipelined;
+
+    TileScheduler m_scheduler;
+    TileScheduler::Mode m_mode;
+    std::vector<ThreadStats> m_threadStats;
+    // surviving triangles of each chunk, per region, in triangle order
+    std::vector<std::vector<uint32_t>> m_chunkRegionTris;
+    // ticks each task took last frame, for the scheduling order
+    float m_chunkCost[TILE_BINNING_CHUNKS];
+    std::vector<float> m_regionCost;
+    float m_packCost;
+    std::vector<float> m_stepCost;
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SystemTime.h"
+
+// Runs a batch of independent tasks on a pool of threads, for the CPU tile binning (TileBinner). Their costs vary by
+// orders of magnitude between the sky and the dense geometry, so a static split leaves threads idle while one is
+// still on its heavy share. Instead every thread owns a deque, dealt the tasks round robin in order of the caller's
+// cost estimates (the previous frame's measured times), heaviest first. Threads take work from the front of their
+// own deque, and once it's empty, steal from the back of the others'.
+#define TILE_SCHEDULER_MAX_THREADS 64
+
+class TileScheduler
+{
+public:
+    enum class Mode
+    {
+        staticSplit, // contiguous ranges of equal task counts in task order, no stealing (a plain parallel for)
+        workStealing,
+    };
+
+    struct Stats
+    {
+        uint32_t threads;
+        uint32_t tasks;
+        uint32_t steals;
+        float milliseconds; // of the batch
+        float utilization; // time spent in tasks, over threads * milliseconds
+    };
+
+    TileScheduler() : m_threadCount(1), m_threads(new Thread[1]), m_generation(0), m_running(0), m_exit(false) {}
+    ~TileScheduler() { StopWorkers(); }
+
+    uint32_t ThreadCount() const { return m_threadCount; }
+
+    // The calling thread is thread 0, the pool has the rest.
+    void SetThreadCount(uint32_t threadCount)
+    {
+        threadCount = std::min(std::max(threadCount, 1u), uint32_t(TILE_SCHEDULER_MAX_THREADS));
+        if (threadCount == m_threadCount)
+            return;
+
+        StopWorkers();
+        m_threadCount = threadCount;
+        m_threads.reset(new Thread[threadCount]);
+        m_exit = false;
+        for (uint32_t t = 1; t < threadCount; t++)
+            m_workers.emplace_back(&TileScheduler::WorkerLoop, this, t, m_generation);
+    }
+
+    // Runs task(taskIndex, threadIndex) for every task, and returns once they're all done. costs, if given, has an
+    // estimate per task for the work stealing order.
+    void Run(uint32_t taskCount, const float *costs, Mode mode, const std::function<void(uint32_t, uint32_t)> &task, Stats &stats)
+    {
+        int64_t start = SystemTime::GetCurrentTick();
+
+        for (uint32_t t = 0; t < m_threadCount; t++)
+        {
+            m_threads[t].tasks.clear();
+            m_threads[t].busyTicks = 0;
+            m_threads[t].steals = 0;
+        }
+
+        if (mode == Mode::staticSplit)
+        {
+            for (uint32_t t = 0; t < m_threadCount; t++)
+            {
+                uint32_t first = uint32_t(uint64_t(taskCount) * t / m_threadCount);
+                uint32_t last = uint32_t(uint64_t(taskCount) * (t + 1) / m_threadCount);
+                for (uint32_t i = first; i < last; i++)
+                    m_threads[t].tasks.push_back(i);
+            }
+        }
+        else
+        {
+            m_order.resize(taskCount);
+            for (uint32_t i = 0; i < taskCount; i++)
+                m_order[i] = i;
+            if (costs)
+                std::stable_sort(m_order.begin(), m_order.end(), [costs](uint32_t a, uint32_t b) { return costs[a] > costs[b]; });
+            for (uint32_t i = 0; i < taskCount; i++)
+                m_threads[i % m_threadCount].tasks.push_back(m_order[i]);
+        }
+
+        m_task = &task;
+        m_stealing = mode == Mode::workStealing;
+        {
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            m_running = m_threadCount - 1;
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        Work(0);
+
+        {
+            std::unique_lock<std::mutex> lock(m_poolMutex);
+            m_done.wait(lock, [this] { return m_running == 0; });
+        }
+
+        int64_t end = SystemTime::GetCurrentTick();
+
+        int64_t busyTicks = 0;
+        stats = {};
+        for (uint32_t t = 0; t < m_threadCount; t++)
+        {
+            busyTicks += m_threads[t].busyTicks;
+            stats.steals += m_threads[t].steals;
+        }
+        stats.threads = m_threadCount;
+        stats.tasks = taskCount;
+        stats.milliseconds = float(SystemTime::TicksToMillisecs(end - start));
+        stats.utilization = end > start ? float(double(busyTicks) / (double(end - start) * m_threadCount)) : 1.0f;
+    }
+
+private:
+    struct Thread
+    {
+        std::mutex mutex;
+        std::deque<uint32_t> tasks;
+        int64_t busyTicks;
+        uint32_t steals;
+        char pad[64]; // keeps the threads' counters off each other's cache lines
+    };
+
+    bool Pop(uint32_t t, bool front, uint32_t &task)
+    {
+        Thread &thread = m_threads[t];
+        std::lock_guard<std::mutex> lock(thread.mutex);
+        if (thread.tasks.empty())
+            return false;
+
+        if (front)
+        {
+            task = thread.tasks.front();
+            thread.tasks.pop_front();
+        }
+        else
+        {
+            task = thread.tasks.back();
+            thread.tasks.pop_back();
+        }
+        return true;
+    }
+
+    void Work(uint32_t t)
+    {
+        Thread &thread = m_threads[t];
+        for (;;)
+        {
+            uint32_t task;
+            bool found = Pop(t, true, task);
+            // the cheapest of what's left, which the owner would get to last
+            for (uint32_t v = 1; !found && m_stealing && v < m_threadCount; v++)
+            {
+                found = Pop((t + v) % m_threadCount, false, task);
+                if (found)
+                    thread.steals++;
+            }
+            // nothing adds tasks during a batch, so there's nothing more to do
+            if (!found)
+                return;
+
+            int64_t taskStart = SystemTime::GetCurrentTick();
+            (*m_task)(task, t);
+            thread.busyTicks += SystemTime::GetCurrentTick() - taskStart;
+        }
+    }
+
+    void WorkerLoop(uint32_t t, uint64_t generation)
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_poolMutex);
+                m_wake.wait(lock, [&] { return m_exit || m_generation != generation; });
+                if (m_exit)
+                    return;
+                generation = m_generation;
+            }
+
+            Work(t);
+
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            if (--m_running == 0)
+                m_done.notify_one();
+        }
+    }
+
+    void StopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            m_exit = true;
+        }
+        m_wake.notify_all();
+        for (std::thread &worker : m_workers)
+            worker.join();
+        m_workers.clear();
+    }
+
+    uint32_t m_threadCount;
+    std::unique_ptr<Thread[]> m_threads;
+    std::vector<std::thread> m_workers;
+    std::vector<uint32_t> m_order;
+
+    // the batch in progress
+    const std::function<void(uint32_t, uint32_t)> *m_task;
+    bool m_stealing;
+
+    std::mutex m_poolMutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    uint64_t m_generation; // one per batch
+    uint32_t m_running; // pool threads still working on the batch
+    bool m_exit;
+};